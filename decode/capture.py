@@ -0,0 +1,174 @@
+#!/usr/bin/python
+# -*- Mode: python; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details:
+#
+# Copyright (C) 2012 Google, Inc.
+#
+# ---- Decodes the serial traffic captures written by ModemManager on SIGUSR1
+#      or through the DumpSerialCapture() D-Bus method (see
+#      src/mm-serial-capture.h for the format).
+#
+# Usage: capture.py [--port=NAME] [--hex] [--extract=DIR] <capture file>
+#
+#   --port=NAME     only show the traffic of the given port
+#   --hex           show payloads as hex dumps instead of escaped text
+#   --extract=DIR   write the raw TX and RX streams of each port to
+#                   DIR/<port>.tx and DIR/<port>.rx, so that they can be
+#                   replayed against a real or simulated device
+
+import os
+import struct
+import sys
+
+import defs
+
+MAGIC = b"MMSC"
+VERSION = 1
+HEADER_SIZE = 8
+RECORD_SIZE = 12
+
+RECORD_PORT = 1
+RECORD_RX = 2
+RECORD_TX = 3
+
+FLAG_TRUNCATED = 0x01
+FLAG_REDACTED = 0x02
+
+class Record:
+    def __init__(self, port, rtype, flags, timestamp, data):
+        self.port = port
+        self.type = rtype
+        self.flags = flags
+        self.timestamp = timestamp
+        self.data = data
+        if rtype == RECORD_TX:
+            self.direction = defs.TO_MODEM
+        else:
+            self.direction = defs.TO_HOST
+
+    def escaped(self):
+        # Same escaping as the AT port debug logs
+        s = ""
+        for b in bytearray(self.data):
+            if b == 0x0D:
+                s += "<CR>"
+            elif b == 0x0A:
+                s += "<LF>"
+            elif b >= 0x20 and b < 0x7F:
+                s += chr(b)
+            else:
+                s += "\\%d" % b
+        return s
+
+    def hexdump(self):
+        return " ".join(["%02x" % b for b in bytearray(self.data)])
+
+    def show(self, start, hexdump):
+        if self.direction == defs.TO_MODEM:
+            prefix = "-->"
+        else:
+            prefix = "<--"
+        if hexdump:
+            payload = self.hexdump()
+        else:
+            payload = "'%s'" % self.escaped()
+        trunc = ""
+        if self.flags & FLAG_TRUNCATED:
+            trunc = " (truncated)"
+        if self.flags & FLAG_REDACTED:
+            trunc += " (redacted)"
+        print("[%12.6f] (%s): %s %s%s" % ((self.timestamp - start) / 1000000.0,
+                                          self.port, prefix, payload, trunc))
+
+def parse(data):
+    if len(data) < HEADER_SIZE or data[:4] != MAGIC:
+        raise Exception("Not a ModemManager serial capture")
+    version = bytearray(data)[4]
+    if version != VERSION:
+        raise Exception("Unsupported capture version %d" % version)
+
+    records = []
+    port = None
+    pos = HEADER_SIZE
+    while pos < len(data):
+        if len(data) - pos < RECORD_SIZE:
+            raise Exception("Truncated record header at offset %d" % pos)
+        (rtype, flags, length, timestamp) = struct.unpack("<BBHQ", data[pos:pos + RECORD_SIZE])
+        pos += RECORD_SIZE
+        payload = data[pos:pos + length]
+        if len(payload) != length:
+            raise Exception("Truncated record at offset %d" % pos)
+        pos += length
+
+        if rtype == RECORD_PORT:
+            port = payload.decode("ascii", "replace")
+        elif rtype == RECORD_RX or rtype == RECORD_TX:
+            if port is None:
+                raise Exception("Traffic record before any port record")
+            records.append(Record(port, rtype, flags, timestamp, payload))
+        # Unknown record types are skipped
+    return records
+
+def extract(records, directory):
+    files = {}
+    for r in records:
+        if r.direction == defs.TO_MODEM:
+            suffix = "tx"
+        else:
+            suffix = "rx"
+        key = (r.port, suffix)
+        if key not in files:
+            files[key] = open(os.path.join(directory, "%s.%s" % key), "wb")
+        files[key].write(r.data)
+    for f in files.values():
+        f.close()
+
+if __name__ == "__main__":
+    port = None
+    hexdump = False
+    directory = None
+
+    args = sys.argv[1:]
+    while len(args) > 1:
+        if args[0].startswith("--port="):
+            port = args[0][len("--port="):]
+        elif args[0] == "--hex":
+            hexdump = True
+        elif args[0].startswith("--extract="):
+            directory = args[0][len("--extract="):]
+        else:
+            break
+        args = args[1:]
+
+    if len(args) != 1:
+        print("Usage: %s [--port=NAME] [--hex] [--extract=DIR] <capture file>" % sys.argv[0])
+        sys.exit(1)
+
+    f = open(args[0], "rb")
+    data = f.read()
+    f.close()
+
+    records = parse(data)
+    if port:
+        records = [r for r in records if r.port == port]
+
+    # Records are grouped by port; merge them back in time order
+    records.sort(key=lambda r: r.timestamp)
+
+    if directory:
+        extract(records, directory)
+    else:
+        start = 0
+        if len(records):
+            start = records[0].timestamp
+        for r in records:
+            r.show(start, hexdump)
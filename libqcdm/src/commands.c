@@ -23,6 +23,7 @@
 #include "errors.h"
 #include "dm-commands.h"
 #include "nv-items.h"
+#include "log-items.h"
 #include "result-private.h"
 #include "utils.h"
 
@@ -1410,7 +1411,9 @@ qcdm_cmd_log_config_new (char *buf,
             items_len++;
         }
     }
-    cmdsize = sizeof (DMCmdLogConfig) + ((highest + 7) / 8);
+    cmdsize = sizeof (DMCmdLogConfig);
+    if (items_len)
+        cmdsize += (highest / 8) + 1;  /* Including the highest item's bit */
     cmdbufsize = cmdsize + DIAG_TRAILER_LEN;
 
     qcdm_return_val_if_fail (len >= cmdsize, 0);
@@ -1429,7 +1432,9 @@ qcdm_cmd_log_config_new (char *buf,
         cmd->num_items = htole32 (highest);
     }
 
-    return dm_encapsulate_buffer ((char *) cmd, cmdsize, cmdbufsize, buf, len);
+    len = dm_encapsulate_buffer ((char *) cmd, cmdsize, cmdbufsize, buf, len);
+    free (cmd);
+    return len;
 }
 
 size_t
@@ -1614,6 +1619,126 @@ qcmd_cmd_log_config_mask_result_code_set (QcdmResult *result,
     return FALSE;
 }
 
+
+qcdmbool
+qcdm_cmd_log_get_header (const char *buf,
+                         size_t len,
+                         u_int16_t *out_log_code,
+                         u_int64_t *out_timestamp)
+{
+    DMCmdLog *rsp = (DMCmdLog *) buf;
+
+    qcdm_return_val_if_fail (buf != NULL, FALSE);
+
+    if (len < sizeof (DMCmdLog) || rsp->code != DIAG_CMD_LOG)
+        return FALSE;
+
+    if (out_log_code)
+        *out_log_code = le16toh (rsp->log_code);
+    if (out_timestamp)
+        *out_timestamp = le64toh (rsp->timestamp);
+    return TRUE;
+}
+
+static void
+log_wcdma_agc_info (QcdmResult *result, const u_int8_t *data, size_t len)
+{
+    DMLogItemWcdmaAgcInfo *item = (DMLogItemWcdmaAgcInfo *) data;
+
+    if (len < sizeof (*item))
+        return;
+
+    qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_WCDMA_RX_AGC, le16toh (item->rx_agc));
+    if (item->agc_info & 0x10)
+        qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_WCDMA_TX_AGC, le16toh (item->tx_agc));
+}
+
+static void
+log_gsm_bcch_message (QcdmResult *result, const u_int8_t *data, size_t len)
+{
+    DMLogItemGsmBcchMessage *item = (DMLogItemGsmBcchMessage *) data;
+    u_int16_t arfcn;
+
+    if (len < sizeof (*item))
+        return;
+
+    arfcn = le16toh (item->bcch_arfcn);
+    qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_GSM_ARFCN, arfcn & 0x0FFF);
+    qcdm_result_add_u8 (result, QCDM_CMD_LOG_ITEM_GSM_BAND, (arfcn >> 12) & 0x0F);
+    qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_GSM_BSIC, le16toh (item->bsic));
+    qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_GSM_CELL_ID, le16toh (item->cell_id));
+}
+
+QcdmResult *
+qcdm_cmd_log_result (const char *buf, size_t len, int *out_error)
+{
+    QcdmResult *result;
+    DMCmdLog *rsp = (DMCmdLog *) buf;
+    const u_int8_t *data;
+    size_t data_len;
+    u_int16_t log_code;
+
+    qcdm_return_val_if_fail (buf != NULL, NULL);
+
+    if (!check_command (buf, len, DIAG_CMD_LOG, sizeof (DMCmdLog), out_error))
+        return NULL;
+
+    log_code = le16toh (rsp->log_code);
+    data = rsp->data;
+    data_len = len - sizeof (DMCmdLog);
+
+    result = qcdm_result_new ();
+    qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_LOG_CODE, log_code);
+
+    /* Items too short for their log code are reported without values */
+    switch (log_code) {
+    case DM_LOG_ITEM_WCDMA_RRC_STATE:
+        if (data_len >= sizeof (DMLogItemWcdmaRrcState))
+            qcdm_result_add_u8 (result, QCDM_CMD_LOG_ITEM_WCDMA_RRC_STATE,
+                                ((DMLogItemWcdmaRrcState *) data)->rrc_state);
+        break;
+    case DM_LOG_ITEM_WCDMA_CELL_ID:
+        if (data_len >= sizeof (DMLogItemWcdmaCellId))
+            qcdm_result_add_u32 (result, QCDM_CMD_LOG_ITEM_WCDMA_CELL_ID,
+                                 le32toh (((DMLogItemWcdmaCellId *) data)->cellid));
+        break;
+    case DM_LOG_ITEM_WCDMA_AGC_INFO:
+        log_wcdma_agc_info (result, data, data_len);
+        break;
+    case DM_LOG_ITEM_GSM_BCCH_MESSAGE:
+        log_gsm_bcch_message (result, data, data_len);
+        break;
+    case DM_LOG_ITEM_CDMA_REVERSE_POWER_CONTROL:
+        if (data_len >= sizeof (DMLogItemCdmaReversePowerControl)) {
+            DMLogItemCdmaReversePowerControl *item = (DMLogItemCdmaReversePowerControl *) data;
+
+            qcdm_result_add_u8 (result, QCDM_CMD_LOG_ITEM_CDMA_BAND_CLASS, item->band_class);
+            qcdm_result_add_u8 (result, QCDM_CMD_LOG_ITEM_CDMA_RPC_RECORDS, item->num_records);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+qcdmbool
+qcdm_cmd_event_get_id (const char *buf, size_t len, u_int16_t *out_event_id)
+{
+    DMCmdEventReportRsp *rsp = (DMCmdEventReportRsp *) buf;
+
+    qcdm_return_val_if_fail (buf != NULL, FALSE);
+
+    if (len < sizeof (DMCmdEventReportRsp) || rsp->code != DIAG_CMD_EVENT_REPORT)
+        return FALSE;
+
+    /* Top bits of the ID are flags about the event's payload and timestamp */
+    if (out_event_id)
+        *out_event_id = le16toh (rsp->event_id) & 0x0FFF;
+    return TRUE;
+}
+
 /**********************************************************************/
 
 static char bcd_chars[] = "0123456789\0\0\0\0\0\0";
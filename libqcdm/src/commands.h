@@ -536,6 +536,53 @@ qcdmbool    qcmd_cmd_log_config_mask_result_code_set (QcdmResult *result,
 
 /**********************************************************************/
 
+/* Unsolicited log packets, sent for the log codes enabled with the log
+ * config command.  Only a few log items are decoded; the log code is always
+ * available.
+ */
+
+/* Log code, including the equipment ID in the top 4 bits */
+#define QCDM_CMD_LOG_ITEM_LOG_CODE         "log-code"
+
+/* DM_LOG_ITEM_WCDMA_RRC_STATE, one of DM_LOG_ITEM_WCDMA_RRC_STATE_* */
+#define QCDM_CMD_LOG_ITEM_WCDMA_RRC_STATE  "wcdma-rrc-state"
+
+/* DM_LOG_ITEM_WCDMA_CELL_ID */
+#define QCDM_CMD_LOG_ITEM_WCDMA_CELL_ID    "wcdma-cell-id"
+
+/* DM_LOG_ITEM_WCDMA_AGC_INFO; raw values, TX AGC only when valid */
+#define QCDM_CMD_LOG_ITEM_WCDMA_RX_AGC     "wcdma-rx-agc"
+#define QCDM_CMD_LOG_ITEM_WCDMA_TX_AGC     "wcdma-tx-agc"
+
+/* DM_LOG_ITEM_GSM_BCCH_MESSAGE; band is one of DM_LOG_ITEM_GSM_BCCH_BAND_* */
+#define QCDM_CMD_LOG_ITEM_GSM_ARFCN        "gsm-arfcn"
+#define QCDM_CMD_LOG_ITEM_GSM_BAND         "gsm-band"
+#define QCDM_CMD_LOG_ITEM_GSM_BSIC         "gsm-bsic"
+#define QCDM_CMD_LOG_ITEM_GSM_CELL_ID      "gsm-cell-id"
+
+/* DM_LOG_ITEM_CDMA_REVERSE_POWER_CONTROL */
+#define QCDM_CMD_LOG_ITEM_CDMA_BAND_CLASS  "cdma-band-class"
+#define QCDM_CMD_LOG_ITEM_CDMA_RPC_RECORDS "cdma-rpc-records"
+
+/* Cheap check of a log packet, to demultiplex it without decoding it */
+qcdmbool    qcdm_cmd_log_get_header (const char *buf,
+                                     size_t len,
+                                     u_int16_t *out_log_code,
+                                     u_int64_t *out_timestamp);
+
+QcdmResult *qcdm_cmd_log_result     (const char *buf,
+                                     size_t len,
+                                     int *out_error);
+
+/* Unsolicited event reports, sent once enabled with the event report
+ * command (whose own reply is shorter than any event report).
+ */
+qcdmbool    qcdm_cmd_event_get_id   (const char *buf,
+                                     size_t len,
+                                     u_int16_t *out_event_id);
+
+/**********************************************************************/
+
 #define QCDM_CMD_ZTE_SUBSYS_STATUS_ITEM_SIGNAL_INDICATOR    "signal-indicator"
 
 size_t      qcdm_cmd_zte_subsys_status_new    (char *buf, size_t len);
@@ -0,0 +1,92 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2012 Google, Inc.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBQCDM_HDLC_H
+#define LIBQCDM_HDLC_H
+
+#include <sys/types.h>
+
+/* Async HDLC framing primitives, shared by libqcdm and libwmc.
+ *
+ * The CRC is the 16-bit CCITT CRC (reflected, polynomial 0x8408) computed
+ * 8 bytes at a time with slicing tables.  Escaping and unescaping copy the
+ * runs of bytes which don't need any change in bulk; the bytes to escape are
+ * found with SSE2 or AVX2 when the CPU has them.
+ */
+
+/* libwmc builds its own copy of this module; HDLC_PREFIX gives each copy
+ * private symbol names (_qcdm_hdlc_*, _wmc_hdlc_*) so that both libraries can
+ * be linked into the same program.  Users just call the hdlc_* names below. */
+#ifndef HDLC_PREFIX
+#define HDLC_PREFIX qcdm
+#endif
+
+#define HDLC_SYMBOL_2(prefix, name) _##prefix##_hdlc_##name
+#define HDLC_SYMBOL_1(prefix, name) HDLC_SYMBOL_2 (prefix, name)
+#define HDLC_SYMBOL(name)           HDLC_SYMBOL_1 (HDLC_PREFIX, name)
+
+#define hdlc_set_impl      HDLC_SYMBOL (set_impl)
+#define hdlc_get_impl_name HDLC_SYMBOL (get_impl_name)
+#define hdlc_crc16_update  HDLC_SYMBOL (crc16_update)
+#define hdlc_find_special  HDLC_SYMBOL (find_special)
+#define hdlc_escape_data   HDLC_SYMBOL (escape_data)
+#define hdlc_unescape_data HDLC_SYMBOL (unescape_data)
+
+#define HDLC_FLAG        0x7E  /* End of frame */
+#define HDLC_ESCAPE      0x7D  /* Escape sequence 1st character value */
+#define HDLC_ESCAPE_MASK 0x20  /* Escape sequence complement value */
+
+typedef enum {
+    HDLC_IMPL_AUTO = 0,
+    HDLC_IMPL_SCALAR,
+    HDLC_IMPL_SSE2,
+    HDLC_IMPL_AVX2
+} HdlcImpl;
+
+/* Selects the implementation used to look for bytes to escape; by default the
+ * best one the CPU supports.  Returns 0 if the CPU doesn't support it. */
+int         hdlc_set_impl      (HdlcImpl impl);
+const char *hdlc_get_impl_name (void);
+
+/* Runs the CRC register over the buffer; no seed nor final inversion */
+u_int16_t   hdlc_crc16_update  (u_int16_t crc, const char *buf, size_t len);
+
+/* Returns the offset of the first byte needing escaping (0x7D, 0x7E, and all
+ * control characters up to 0x20 if 'escape_ctrl' is set), or 'len' */
+size_t      hdlc_find_special  (const char *buf, size_t len, int escape_ctrl);
+
+/* Escapes 'inbuf' into 'outbuf' in a single pass; returns the escaped length,
+ * or 0 if it doesn't fit in 'outbuf_len' */
+size_t      hdlc_escape_data   (const char *inbuf,
+                                size_t inbuf_len,
+                                int escape_ctrl,
+                                char *outbuf,
+                                size_t outbuf_len);
+
+/* Unescapes 'inbuf' into 'outbuf', which may be 'inbuf' itself.  'escaping'
+ * carries a trailing escape character over to the next call.  If 'crc' is
+ * given, the CRC register is run over the unescaped data.  Returns 0 if the
+ * unescaped data doesn't fit in 'outbuf_len'. */
+int         hdlc_unescape_data (const char *inbuf,
+                                size_t inbuf_len,
+                                char *outbuf,
+                                size_t outbuf_len,
+                                size_t *out_len,
+                                int *escaping,
+                                u_int16_t *crc);
+
+#endif  /* LIBQCDM_HDLC_H */
@@ -24,7 +24,12 @@
 
 /*********************************************************/
 
-typedef struct Val Val;
+/* A result is built once by a decoder and then only read, so everything it
+ * holds (values, their keys and payloads, and the key index) is carved from
+ * an arena which starts inside the QcdmResult itself.  Typical results fit
+ * in it, so building and querying one costs a single allocation; bigger ones
+ * get extra chunks, which are only freed along with the result.
+ */
 
 typedef enum {
     VAL_TYPE_NONE = 0,
@@ -35,164 +40,218 @@ typedef enum {
     VAL_TYPE_U16_ARRAY = 5,
 } ValType;
 
-struct Val {
-    char *key;
+typedef struct {
+    const char *key;
+    u_int32_t hash;
     u_int8_t type;
+    u_int32_t array_len;
     union {
-        char *s;
+        const char *s;
         u_int8_t u8;
         u_int32_t u32;
-        u_int8_t *u8_array;
-        u_int16_t *u16_array;
+        const u_int8_t *u8_array;
+        const u_int16_t *u16_array;
     } u;
-    u_int32_t array_len;
-    Val *next;
+} Val;
+
+typedef struct Chunk Chunk;
+struct Chunk {
+    Chunk *next;
+    /* Followed by the chunk's data */
 };
 
-static void
-val_free (Val *v)
-{
-    if (v->type == VAL_TYPE_STRING) {
-        if (v->u.s)
-            free (v->u.s);
-    } else if (v->type == VAL_TYPE_U8_ARRAY) {
-        if (v->u.u8_array);
-            free (v->u.u8_array);
-    } else if (v->type == VAL_TYPE_U16_ARRAY) {
-        if (v->u.u16_array);
-            free (v->u.u16_array);
-    }
-    free (v->key);
-    memset (v, 0, sizeof (*v));
-    free (v);
-}
+#define ARENA_ALIGN       8
+#define ARENA_ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
 
-static Val *
-val_new_string (const char *key, const char *value)
-{
-    Val *v;
+#define INLINE_VALS       16
+#define INLINE_ARENA_SIZE 512
+#define MIN_CHUNK_SIZE    1024
 
-    qcdm_return_val_if_fail (key != NULL, NULL);
-    qcdm_return_val_if_fail (key[0] != '\0', NULL);
-    qcdm_return_val_if_fail (value != NULL, NULL);
+struct QcdmResult {
+    u_int32_t refcount;
 
-    v = calloc (sizeof (Val), 1);
-    if (v == NULL)
-        return NULL;
+    /* Values in the order they were added; a key added again gets a new
+     * value and the index is pointed at it */
+    Val *vals;
+    u_int32_t n_vals;
+    u_int32_t vals_size;
 
-    v->key = strdup (key);
-    v->type = VAL_TYPE_STRING;
-    v->u.s = strdup (value);
-    return v;
-}
+    /* Open-addressed (linear probing) index of 'vals', holding value
+     * positions plus one; 0 is an empty slot.  Size is a power of two at
+     * least twice 'vals_size'. */
+    u_int16_t *index;
+    u_int32_t index_size;
 
-static Val *
-val_new_u8 (const char *key, u_int8_t u)
-{
-    Val *v;
+    char *arena;
+    size_t arena_used;
+    size_t arena_size;
+    Chunk *chunks;
 
-    qcdm_return_val_if_fail (key != NULL, NULL);
-    qcdm_return_val_if_fail (key[0] != '\0', NULL);
+    union {
+        char data[INLINE_ARENA_SIZE];
+        double align;
+    } inline_arena;
+    Val inline_vals[INLINE_VALS];
+    u_int16_t inline_index[INLINE_VALS * 2];
+};
 
-    v = calloc (sizeof (Val), 1);
-    if (v == NULL)
-        return NULL;
+static void *
+arena_alloc (QcdmResult *r, size_t size)
+{
+    void *p;
+
+    size = ARENA_ALIGN_UP (size);
+    if (r->arena_size - r->arena_used < size) {
+        size_t chunk_size;
+        Chunk *c;
+
+        chunk_size = r->arena_size * 2;
+        if (chunk_size < MIN_CHUNK_SIZE)
+            chunk_size = MIN_CHUNK_SIZE;
+        if (chunk_size < size)
+            chunk_size = size;
+
+        c = malloc (ARENA_ALIGN_UP (sizeof (Chunk)) + chunk_size);
+        if (c == NULL)
+            return NULL;
+        c->next = r->chunks;
+        r->chunks = c;
+
+        r->arena = (char *) c + ARENA_ALIGN_UP (sizeof (Chunk));
+        r->arena_used = 0;
+        r->arena_size = chunk_size;
+    }
 
-    v->key = strdup (key);
-    v->type = VAL_TYPE_U8;
-    v->u.u8 = u;
-    return v;
+    p = r->arena + r->arena_used;
+    r->arena_used += size;
+    return p;
 }
 
-static Val *
-val_new_u8_array (const char *key, const u_int8_t *array, size_t array_len)
+static void *
+arena_dup (QcdmResult *r, const void *data, size_t len)
 {
-    Val *v;
+    void *p;
 
-    qcdm_return_val_if_fail (key != NULL, NULL);
-    qcdm_return_val_if_fail (key[0] != '\0', NULL);
-    qcdm_return_val_if_fail (array != NULL, NULL);
-    qcdm_return_val_if_fail (array_len > 0, NULL);
+    p = arena_alloc (r, len);
+    if (p)
+        memcpy (p, data, len);
+    return p;
+}
 
-    v = calloc (sizeof (Val), 1);
-    if (v == NULL)
-        return NULL;
+/* FNV-1a */
+static u_int32_t
+key_hash (const char *key)
+{
+    u_int32_t h = 2166136261U;
 
-    v->key = strdup (key);
-    v->type = VAL_TYPE_U8_ARRAY;
-    v->u.u8_array = malloc (array_len);
-    if (v->u.u8_array == NULL) {
-        val_free (v);
-        return NULL;
+    while (*key) {
+        h ^= (u_int8_t) *key++;
+        h *= 16777619U;
     }
-    memcpy (v->u.u8_array, array, array_len);
-    v->array_len = array_len;
-
-    return v;
+    return h;
 }
 
-static Val *
-val_new_u32 (const char *key, u_int32_t u)
+static void
+index_insert (u_int16_t *index, u_int32_t index_size, const Val *vals, u_int32_t pos)
 {
-    Val *v;
-
-    qcdm_return_val_if_fail (key != NULL, NULL);
-    qcdm_return_val_if_fail (key[0] != '\0', NULL);
-
-    v = calloc (sizeof (Val), 1);
-    if (v == NULL)
-        return NULL;
+    u_int32_t mask = index_size - 1;
+    u_int32_t i = vals[pos].hash & mask;
+
+    for (;;) {
+        const Val *v;
+
+        if (index[i] == 0)
+            break;
+        /* Replace an earlier value with the same key */
+        v = &vals[index[i] - 1];
+        if (v->hash == vals[pos].hash && strcmp (v->key, vals[pos].key) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    index[i] = pos + 1;
+}
 
-    v->key = strdup (key);
-    v->type = VAL_TYPE_U32;
-    v->u.u32 = u;
-    return v;
+static int
+grow_vals (QcdmResult *r)
+{
+    Val *vals;
+    u_int16_t *index;
+    u_int32_t vals_size, index_size, i;
+
+    vals_size = r->vals_size * 2;
+    index_size = r->index_size * 2;
+    /* Positions plus one must fit in the index */
+    qcdm_return_val_if_fail (vals_size < 0xFFFF, 0);
+
+    vals = arena_alloc (r, vals_size * sizeof (Val));
+    index = arena_alloc (r, index_size * sizeof (u_int16_t));
+    if (!vals || !index)
+        return 0;
+
+    memcpy (vals, r->vals, r->n_vals * sizeof (Val));
+    memset (index, 0, index_size * sizeof (u_int16_t));
+    for (i = 0; i < r->n_vals; i++)
+        index_insert (index, index_size, vals, i);
+
+    r->vals = vals;
+    r->vals_size = vals_size;
+    r->index = index;
+    r->index_size = index_size;
+    return 1;
 }
 
+/* Returns a new value for 'key', whose payload the caller fills in before
+ * calling val_commit() */
 static Val *
-val_new_u16_array (const char *key, const u_int16_t *array, size_t array_len)
+val_new (QcdmResult *r, const char *key, ValType type)
 {
     Val *v;
-    size_t sz;
 
     qcdm_return_val_if_fail (key != NULL, NULL);
     qcdm_return_val_if_fail (key[0] != '\0', NULL);
-    qcdm_return_val_if_fail (array != NULL, NULL);
-    qcdm_return_val_if_fail (array_len > 0, NULL);
 
-    v = calloc (sizeof (Val), 1);
-    if (v == NULL)
+    if (r->n_vals == r->vals_size && !grow_vals (r))
         return NULL;
 
-    v->key = strdup (key);
-    v->type = VAL_TYPE_U16_ARRAY;
-    sz = sizeof (u_int16_t) * array_len;
-    v->u.u16_array = malloc (sz);
-    if (v->u.u16_array == NULL) {
-        val_free (v);
+    v = &r->vals[r->n_vals];
+    memset (v, 0, sizeof (*v));
+    v->key = arena_dup (r, key, strlen (key) + 1);
+    if (v->key == NULL)
         return NULL;
-    }
-    memcpy (v->u.u16_array, array, sz);
-    v->array_len = array_len;
-
+    v->hash = key_hash (key);
+    v->type = type;
     return v;
 }
 
-/*********************************************************/
+static void
+val_commit (QcdmResult *r)
+{
+    index_insert (r->index, r->index_size, r->vals, r->n_vals);
+    r->n_vals++;
+}
 
-struct QcdmResult {
-    u_int32_t refcount;
-    Val *first;
-};
+/*********************************************************/
 
 QcdmResult *
 qcdm_result_new (void)
 {
     QcdmResult *r;
 
-    r = calloc (sizeof (QcdmResult), 1);
-    if (r)
-        r->refcount = 1;
+    r = malloc (sizeof (QcdmResult));
+    if (r == NULL)
+        return NULL;
+
+    r->refcount = 1;
+    r->vals = r->inline_vals;
+    r->n_vals = 0;
+    r->vals_size = INLINE_VALS;
+    r->index = r->inline_index;
+    r->index_size = INLINE_VALS * 2;
+    memset (r->inline_index, 0, sizeof (r->inline_index));
+    r->arena = r->inline_arena.data;
+    r->arena_used = 0;
+    r->arena_size = sizeof (r->inline_arena.data);
+    r->chunks = NULL;
     return r;
 }
 
@@ -209,15 +268,15 @@ qcdm_result_ref (QcdmResult *r)
 static void
 qcdm_result_free (QcdmResult *r)
 {
-    Val *v, *n;
+    Chunk *c, *n;
 
-    v = r->first;
-    while (v) {
-        n = v->next;
-        val_free (v);
-        v = n;
+    c = r->chunks;
+    while (c) {
+        n = c->next;
+        free (c);
+        c = n;
     }
-    memset (r, 0, sizeof (*r));
+    r->refcount = 0;
     free (r);
 }
 
@@ -235,17 +294,18 @@ qcdm_result_unref (QcdmResult *r)
 static Val *
 find_val (QcdmResult *r, const char *key, ValType expected_type)
 {
-    Val *v, *n;
+    u_int32_t hash, mask, i;
+
+    hash = key_hash (key);
+    mask = r->index_size - 1;
+    for (i = hash & mask; r->index[i]; i = (i + 1) & mask) {
+        Val *v = &r->vals[r->index[i] - 1];
 
-    v = r->first;
-    while (v) {
-        n = v->next;
-        if (strcmp (v->key, key) == 0) {
+        if (v->hash == hash && strcmp (v->key, key) == 0) {
             /* Check type */
             qcdm_return_val_if_fail (v->type == expected_type, NULL);
             return v;
         }
-        v = n;
     }
     return NULL;
 }
@@ -262,10 +322,11 @@ qcdm_result_add_string (QcdmResult *r,
     qcdm_return_if_fail (key != NULL);
     qcdm_return_if_fail (str != NULL);
 
-    v = val_new_string (key, str);
+    v = val_new (r, key, VAL_TYPE_STRING);
     qcdm_return_if_fail (v != NULL);
-    v->next = r->first;
-    r->first = v;
+    v->u.s = arena_dup (r, str, strlen (str) + 1);
+    qcdm_return_if_fail (v->u.s != NULL);
+    val_commit (r);
 }
 
 int
@@ -300,10 +361,10 @@ qcdm_result_add_u8 (QcdmResult *r,
     qcdm_return_if_fail (r->refcount > 0);
     qcdm_return_if_fail (key != NULL);
 
-    v = val_new_u8 (key, num);
+    v = val_new (r, key, VAL_TYPE_U8);
     qcdm_return_if_fail (v != NULL);
-    v->next = r->first;
-    r->first = v;
+    v->u.u8 = num;
+    val_commit (r);
 }
 
 int
@@ -338,12 +399,14 @@ qcdm_result_add_u8_array (QcdmResult *r,
     qcdm_return_if_fail (r->refcount > 0);
     qcdm_return_if_fail (key != NULL);
     qcdm_return_if_fail (array != NULL);
-    qcdm_return_if_fail (array_len >= 0);
+    qcdm_return_if_fail (array_len > 0);
 
-    v = val_new_u8_array (key, array, array_len);
+    v = val_new (r, key, VAL_TYPE_U8_ARRAY);
     qcdm_return_if_fail (v != NULL);
-    v->next = r->first;
-    r->first = v;
+    v->u.u8_array = arena_dup (r, array, array_len);
+    qcdm_return_if_fail (v->u.u8_array != NULL);
+    v->array_len = array_len;
+    val_commit (r);
 }
 
 int
@@ -380,10 +443,10 @@ qcdm_result_add_u32 (QcdmResult *r,
     qcdm_return_if_fail (r->refcount > 0);
     qcdm_return_if_fail (key != NULL);
 
-    v = val_new_u32 (key, num);
+    v = val_new (r, key, VAL_TYPE_U32);
     qcdm_return_if_fail (v != NULL);
-    v->next = r->first;
-    r->first = v;
+    v->u.u32 = num;
+    val_commit (r);
 }
 
 int
@@ -418,12 +481,14 @@ qcdm_result_add_u16_array (QcdmResult *r,
     qcdm_return_if_fail (r->refcount > 0);
     qcdm_return_if_fail (key != NULL);
     qcdm_return_if_fail (array != NULL);
-    qcdm_return_if_fail (array_len >= 0);
+    qcdm_return_if_fail (array_len > 0);
 
-    v = val_new_u16_array (key, array, array_len);
+    v = val_new (r, key, VAL_TYPE_U16_ARRAY);
     qcdm_return_if_fail (v != NULL);
-    v->next = r->first;
-    r->first = v;
+    v->u.u16_array = arena_dup (r, array, array_len * sizeof (u_int16_t));
+    qcdm_return_if_fail (v->u.u16_array != NULL);
+    v->array_len = array_len;
+    val_commit (r);
 }
 
 int
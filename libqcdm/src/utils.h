@@ -30,6 +30,8 @@ typedef u_int8_t qcdmbool;
 #endif
 
 #define DIAG_CONTROL_CHAR 0x7E
+#define DIAG_ESC_CHAR     0x7D  /* Escape sequence 1st character value */
+#define DIAG_ESC_MASK     0x20  /* Escape sequence complement value */
 #define DIAG_TRAILER_LEN  3
 
 u_int16_t crc16 (const char *buffer, size_t len);
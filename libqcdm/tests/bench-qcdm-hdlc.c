@@ -0,0 +1,172 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2012 Google, Inc.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput of the CRC and HDLC escaping code, with each implementation the
+ * CPU supports, over frames of the given size (4096 bytes by default):
+ *
+ *   bench-qcdm-hdlc [frame size] [MiB per run]
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "hdlc.h"
+
+static guint16 crc_table[256];
+
+/* The original one byte at a time CRC, as baseline */
+static guint16
+crc16_bytewise (const char *buf, gsize len)
+{
+    guint16 crc = 0xffff;
+
+    while (len--)
+        crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* The original byte by byte escaping, as baseline */
+static gsize
+escape_bytewise (const char *inbuf, gsize len, char *outbuf)
+{
+    gsize i, o = 0;
+
+    for (i = 0; i < len; i++) {
+        if (inbuf[i] == DIAG_CONTROL_CHAR || inbuf[i] == DIAG_ESC_CHAR) {
+            outbuf[o++] = DIAG_ESC_CHAR;
+            outbuf[o++] = inbuf[i] ^ DIAG_ESC_MASK;
+        } else
+            outbuf[o++] = inbuf[i];
+    }
+    return o;
+}
+
+static void
+report (const char *what, const char *impl, gsize bytes, GTimer *timer)
+{
+    gdouble secs = g_timer_elapsed (timer, NULL);
+
+    g_print ("%-24s %-8s %8.1f MiB/s\n",
+             what, impl, secs > 0 ? (bytes / (1024.0 * 1024.0)) / secs : 0.0);
+}
+
+int
+main (int argc, char **argv)
+{
+    static const HdlcImpl impls[] = { HDLC_IMPL_SCALAR, HDLC_IMPL_SSE2, HDLC_IMPL_AVX2 };
+    static const guint densities[] = { 0, 1, 10 };
+    gsize frame_size = 4096;
+    gsize total = 64 * 1024 * 1024;
+    gsize n_frames, i, j, d;
+    char *frame;
+    char *escaped;
+    char *work;
+    GTimer *timer;
+    volatile guint32 sink = 0;
+
+    if (argc > 1)
+        frame_size = MAX (16, strtoul (argv[1], NULL, 10));
+    if (argc > 2)
+        total = MAX (1, strtoul (argv[2], NULL, 10)) * 1024 * 1024;
+    n_frames = MAX (1, total / frame_size);
+
+    for (i = 0; i < 256; i++) {
+        guint16 c = i;
+
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ 0x8408 : c >> 1;
+        crc_table[i] = c;
+    }
+
+    frame = g_malloc (frame_size + 2);
+    escaped = g_malloc (frame_size * 2 + 3);
+    work = g_malloc (frame_size * 2 + 3);
+    timer = g_timer_new ();
+
+    g_print ("%" G_GSIZE_FORMAT " frames of %" G_GSIZE_FORMAT " bytes\n\n", n_frames, frame_size);
+
+    for (i = 0; i < frame_size; i++)
+        frame[i] = (char) g_random_int ();
+
+    g_timer_start (timer);
+    for (i = 0; i < n_frames; i++)
+        sink += crc16_bytewise (frame, frame_size);
+    report ("crc16", "bytewise", n_frames * frame_size, timer);
+
+    g_timer_start (timer);
+    for (i = 0; i < n_frames; i++)
+        sink += crc16 (frame, frame_size);
+    report ("crc16", "slice-8", n_frames * frame_size, timer);
+
+    /* Percentage of bytes needing escaping; log packets are mostly clean */
+    for (d = 0; d < G_N_ELEMENTS (densities); d++) {
+        gchar *what;
+        gsize escaped_len;
+
+        for (i = 0; i < frame_size; i++) {
+            frame[i] = (char) g_random_int_range (0, 0x7D);
+            if (g_random_int_range (0, 100) < (gint) densities[d])
+                frame[i] = g_random_boolean () ? DIAG_CONTROL_CHAR : DIAG_ESC_CHAR;
+        }
+
+        what = g_strdup_printf ("escape (%u%% special)", densities[d]);
+        g_timer_start (timer);
+        for (i = 0; i < n_frames; i++)
+            sink += escape_bytewise (frame, frame_size, escaped);
+        report (what, "bytewise", n_frames * frame_size, timer);
+
+        for (j = 0; j < G_N_ELEMENTS (impls); j++) {
+            if (!hdlc_set_impl (impls[j]))
+                continue;
+            g_timer_start (timer);
+            for (i = 0; i < n_frames; i++)
+                sink += dm_escape (frame, frame_size, escaped, frame_size * 2 + 3);
+            report (what, hdlc_get_impl_name (), n_frames * frame_size, timer);
+        }
+        g_free (what);
+
+        /* Full frames: unescape, CRC check, in place */
+        escaped_len = dm_encapsulate_buffer (frame, frame_size, frame_size + 2,
+                                             escaped, frame_size * 2 + 3);
+        g_assert (escaped_len > 0);
+        what = g_strdup_printf ("decapsulate (%u%%)", densities[d]);
+        g_timer_start (timer);
+        for (i = 0; i < n_frames; i++) {
+            gsize decap_len = 0, used = 0;
+            qcdmbool more = FALSE;
+
+            memcpy (work, escaped, escaped_len);
+            if (!dm_decapsulate_buffer (work, escaped_len, work, escaped_len,
+                                        &decap_len, &used, &more))
+                g_error ("Failed to decapsulate frame");
+            sink += decap_len;
+        }
+        report (what, "in-place", n_frames * frame_size, timer);
+        g_free (what);
+    }
+
+    hdlc_set_impl (HDLC_IMPL_AUTO);
+
+    g_timer_destroy (timer);
+    g_free (frame);
+    g_free (escaped);
+    g_free (work);
+    return sink == 0x12345678 ? 1 : 0;
+}
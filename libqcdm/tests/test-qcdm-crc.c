@@ -20,6 +20,7 @@
 
 #include "test-qcdm-crc.h"
 #include "utils.h"
+#include "hdlc.h"
 
 void
 test_crc16_2 (void *f, void *data)
@@ -63,3 +64,33 @@ test_crc16_1 (void *f, void *data)
     g_assert (crc == expected);
 }
 
+
+void
+test_crc16_slicing (void *f, void *data)
+{
+    char buf[300];
+    guint16 table[256];
+    guint i, j, offset, len;
+
+    for (i = 0; i < 256; i++) {
+        guint16 c = i;
+
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ 0x8408 : c >> 1;
+        table[i] = c;
+    }
+
+    for (i = 0; i < sizeof (buf); i++)
+        buf[i] = (char) g_test_rand_int ();
+
+    /* Same as one byte at a time, for any length and alignment */
+    for (offset = 0; offset < 8; offset++) {
+        for (len = 0; len + offset <= sizeof (buf); len++) {
+            guint16 expected = 0xffff;
+
+            for (i = 0; i < len; i++)
+                expected = table[(expected ^ buf[offset + i]) & 0xff] ^ (expected >> 8);
+            g_assert_cmpuint (hdlc_crc16_update (0xffff, &buf[offset], len), ==, expected);
+        }
+    }
+}
@@ -20,6 +20,7 @@
 
 #include "test-qcdm-escaping.h"
 #include "utils.h"
+#include "hdlc.h"
 
 static const char data1[] = {
     0x70, 0x68, 0x6f, 0x6e, 0x65, 0x66, 0x61, 0x69, 0x6c, 0x75, 0x72, 0x65, 
@@ -122,3 +123,75 @@ test_escape_unescape (void *f, void *data)
     g_assert (memcmp (unescaped, data1, unlen) == 0);
 }
 
+
+static gsize
+escape_reference (const char *inbuf, gsize len, gboolean escape_ctrl, char *outbuf)
+{
+    gsize i, o = 0;
+
+    for (i = 0; i < len; i++) {
+        guint8 c = (guint8) inbuf[i];
+
+        if (c == 0x7E || c == 0x7D || (escape_ctrl && c <= 0x20)) {
+            outbuf[o++] = 0x7D;
+            outbuf[o++] = c ^ 0x20;
+        } else
+            outbuf[o++] = c;
+    }
+    return o;
+}
+
+void
+test_escape_impls (void *f, void *data)
+{
+    static const HdlcImpl impls[] = { HDLC_IMPL_SCALAR, HDLC_IMPL_SSE2, HDLC_IMPL_AVX2 };
+    char src[200];
+    char expected[sizeof (src) * 2];
+    char escaped[sizeof (src) * 2];
+    char unescaped[sizeof (src) * 2];
+    guint i, j, n, density;
+    gsize expected_len, len, unlen;
+    int escaping;
+
+    for (i = 0; i < G_N_ELEMENTS (impls); i++) {
+        /* Not all CPUs have everything */
+        if (!hdlc_set_impl (impls[i]))
+            continue;
+
+        for (density = 0; density <= 100; density += 25) {
+            for (n = 1; n <= sizeof (src); n += 7) {
+                for (j = 0; j < n; j++) {
+                    if (g_test_rand_int_range (0, 100) < (gint) density)
+                        src[j] = g_test_rand_bit () ? 0x7E : 0x7D;
+                    else
+                        src[j] = (char) g_test_rand_int_range (0, 256);
+                }
+
+                /* Special bytes anywhere in the vector-sized blocks */
+                expected_len = escape_reference (src, n, FALSE, expected);
+                len = hdlc_escape_data (src, n, FALSE, escaped, sizeof (escaped));
+                g_assert_cmpuint (len, ==, expected_len);
+                g_assert (memcmp (escaped, expected, len) == 0);
+
+                expected_len = escape_reference (src, n, TRUE, expected);
+                len = hdlc_escape_data (src, n, TRUE, escaped, sizeof (escaped));
+                g_assert_cmpuint (len, ==, expected_len);
+                g_assert (memcmp (escaped, expected, len) == 0);
+
+                /* Not enough room */
+                g_assert_cmpuint (hdlc_escape_data (src, n, TRUE, escaped, expected_len - 1), ==, 0);
+
+                /* And back, in place */
+                memcpy (unescaped, escaped, len);
+                escaping = 0;
+                g_assert (hdlc_unescape_data (unescaped, len, unescaped, sizeof (unescaped),
+                                              &unlen, &escaping, NULL));
+                g_assert (escaping == 0);
+                g_assert_cmpuint (unlen, ==, n);
+                g_assert (memcmp (unescaped, src, n) == 0);
+            }
+        }
+    }
+
+    hdlc_set_impl (HDLC_IMPL_AUTO);
+}
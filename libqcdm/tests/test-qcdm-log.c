@@ -0,0 +1,122 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2012 Google, Inc.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "test-qcdm-log.h"
+#include "commands.h"
+#include "errors.h"
+#include "result.h"
+
+/* Log packet header: code, more, len, len, log code, timestamp */
+#define LOG_HEADER(len, code) \
+    0x10, 0x00, (len) & 0xFF, 0x00, (len) & 0xFF, 0x00, (code) & 0xFF, ((code) >> 8) & 0xFF, \
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08
+
+void
+test_log_wcdma_cell_id (void *f, void *data)
+{
+    static const char buf[] = {
+        LOG_HEADER (28, 0x4127),
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x78, 0x56, 0x34, 0x12,
+        0x00, 0x00, 0x00, 0x00
+    };
+    QcdmResult *result;
+    u_int16_t log_code = 0;
+    u_int64_t timestamp = 0;
+    u_int32_t val = 0;
+    int err = QCDM_SUCCESS;
+
+    g_assert (qcdm_cmd_log_get_header (buf, sizeof (buf), &log_code, &timestamp));
+    g_assert_cmpuint (log_code, ==, 0x4127);
+    g_assert (timestamp == 0x0807060504030201ULL);
+
+    result = qcdm_cmd_log_result (buf, sizeof (buf), &err);
+    g_assert (result);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_LOG_CODE, &val), ==, 0);
+    g_assert_cmpuint (val, ==, 0x4127);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_WCDMA_CELL_ID, &val), ==, 0);
+    g_assert_cmpuint (val, ==, 0x12345678);
+    qcdm_result_unref (result);
+}
+
+void
+test_log_gsm_bcch (void *f, void *data)
+{
+    static const char buf[] = {
+        LOG_HEADER (25, 0x5134),
+        0x3e, 0xb0,             /* band 11 (GSM 850), ARFCN 62 */
+        0x21, 0x00,             /* BSIC */
+        0x39, 0x30,             /* cell ID */
+        0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00,
+        0x00
+    };
+    QcdmResult *result;
+    u_int32_t val = 0;
+    u_int8_t band = 0;
+    int err = QCDM_SUCCESS;
+
+    result = qcdm_cmd_log_result (buf, sizeof (buf), &err);
+    g_assert (result);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_GSM_ARFCN, &val), ==, 0);
+    g_assert_cmpuint (val, ==, 62);
+    g_assert_cmpint (qcdm_result_get_u8 (result, QCDM_CMD_LOG_ITEM_GSM_BAND, &band), ==, 0);
+    g_assert_cmpuint (band, ==, 11);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_GSM_BSIC, &val), ==, 0);
+    g_assert_cmpuint (val, ==, 0x21);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_GSM_CELL_ID, &val), ==, 0);
+    g_assert_cmpuint (val, ==, 12345);
+    qcdm_result_unref (result);
+}
+
+void
+test_log_short_item (void *f, void *data)
+{
+    /* Cell ID item cut short; only the log code is reported */
+    static const char buf[] = {
+        LOG_HEADER (16, 0x4127),
+        0x00, 0x00, 0x00, 0x00
+    };
+    QcdmResult *result;
+    u_int32_t val = 0;
+    int err = QCDM_SUCCESS;
+
+    result = qcdm_cmd_log_result (buf, sizeof (buf), &err);
+    g_assert (result);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_LOG_CODE, &val), ==, 0);
+    g_assert_cmpint (qcdm_result_get_u32 (result, QCDM_CMD_LOG_ITEM_WCDMA_CELL_ID, &val), !=, 0);
+    qcdm_result_unref (result);
+
+    /* Not even a full header */
+    g_assert (qcdm_cmd_log_get_header (buf, 10, NULL, NULL) == FALSE);
+    g_assert (qcdm_cmd_log_result (buf, 10, &err) == NULL);
+}
+
+void
+test_event_id (void *f, void *data)
+{
+    static const char ack[] = { 0x60, 0x01 };
+    static const char event[] = { 0x60, 0x06, 0x00, 0x01, 0x81, 0x00, 0x00, 0x00 };
+    u_int16_t id = 0;
+
+    g_assert (qcdm_cmd_event_get_id (ack, sizeof (ack), &id) == FALSE);
+    g_assert (qcdm_cmd_event_get_id (event, sizeof (event), &id));
+    g_assert_cmpuint (id, ==, 0x101);
+}
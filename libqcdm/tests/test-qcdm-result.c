@@ -85,3 +85,45 @@ test_result_uint8_array (void *f, void *data)
     g_assert_cmpint (memcmp (tmp, array, tmp_len), ==, 0);
 }
 
+void
+test_result_many (void *f, void *data)
+{
+    QcdmResult *result;
+    char key[32];
+    u_int16_t array[300];
+    const u_int16_t *tmp16 = NULL;
+    size_t tmp_len = 0;
+    guint32 tmp = 0;
+    guint i;
+
+    result = qcdm_result_new ();
+
+    /* Enough values and payload to outgrow the initial storage */
+    for (i = 0; i < G_N_ELEMENTS (array); i++)
+        array[i] = i * 7;
+    qcdm_result_add_u16_array (result, "array", array, G_N_ELEMENTS (array));
+    for (i = 0; i < 500; i++) {
+        g_snprintf (key, sizeof (key), "key-%u", i);
+        qcdm_result_add_u32 (result, key, i);
+    }
+
+    for (i = 0; i < 500; i++) {
+        g_snprintf (key, sizeof (key), "key-%u", i);
+        tmp = 0;
+        g_assert_cmpint (qcdm_result_get_u32 (result, key, &tmp), ==, 0);
+        g_assert_cmpint (tmp, ==, i);
+    }
+    g_assert_cmpint (qcdm_result_get_u32 (result, "key-500", &tmp), !=, 0);
+
+    g_assert_cmpint (qcdm_result_get_u16_array (result, "array", &tmp16, &tmp_len), ==, 0);
+    g_assert_cmpint (tmp_len, ==, G_N_ELEMENTS (array));
+    g_assert_cmpint (memcmp (tmp16, array, sizeof (array)), ==, 0);
+
+    /* The last value added for a key is the one returned */
+    qcdm_result_add_u32 (result, "key-42", 4242);
+    g_assert_cmpint (qcdm_result_get_u32 (result, "key-42", &tmp), ==, 0);
+    g_assert_cmpint (tmp, ==, 4242);
+
+    qcdm_result_unref (result);
+}
+
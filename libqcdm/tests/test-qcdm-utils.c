@@ -62,6 +62,114 @@ test_utils_decapsulate_buffer (void *f, void *data)
 }
 
 
+void
+test_utils_decapsulate_in_place (void *f, void *data)
+{
+    gboolean success;
+    char buf[sizeof (decap_inbuf)];
+    char outbuf[512];
+    gsize decap_len = 0;
+    gsize used = 0;
+    qcdmbool more = FALSE;
+
+    /* Same result as with a separate output buffer */
+    success = dm_decapsulate_buffer (decap_inbuf, sizeof (decap_inbuf),
+                                     outbuf, sizeof (outbuf),
+                                     &decap_len, &used, &more);
+    g_assert (success);
+
+    memcpy (buf, decap_inbuf, sizeof (decap_inbuf));
+    success = dm_decapsulate_buffer (buf, sizeof (buf),
+                                     buf, sizeof (buf),
+                                     &decap_len, &used, &more);
+    g_assert (success);
+    g_assert (more == FALSE);
+    g_assert (decap_len == 214);
+    g_assert (used == 221);
+    g_assert (memcmp (buf, outbuf, decap_len) == 0);
+}
+
+void
+test_utils_decapsulate_large (void *f, void *data)
+{
+    char frame[5000];
+    char encap[sizeof (frame) * 2 + 3];
+    gsize encap_len;
+    gsize decap_len = 0;
+    gsize used = 0;
+    qcdmbool more = FALSE;
+    gboolean success;
+    guint i;
+
+    /* Much larger than the old 1024 byte limit, with lots of escaping */
+    for (i = 0; i < sizeof (frame) - 2; i++)
+        frame[i] = (i % 3) ? (char) i : 0x7E;
+    encap_len = dm_encapsulate_buffer (frame, sizeof (frame) - 2, sizeof (frame),
+                                       encap, sizeof (encap));
+    g_assert (encap_len > sizeof (frame));
+
+    /* Not complete until the control char */
+    success = dm_decapsulate_buffer (encap, encap_len - 1,
+                                     encap, encap_len - 1,
+                                     &decap_len, &used, &more);
+    g_assert (success);
+    g_assert (more == TRUE);
+    g_assert (used == 0);
+
+    success = dm_decapsulate_buffer (encap, encap_len,
+                                     encap, encap_len,
+                                     &decap_len, &used, &more);
+    g_assert (success);
+    g_assert (more == FALSE);
+    g_assert (used == encap_len);
+    g_assert (decap_len == sizeof (frame) - 2);
+    g_assert (memcmp (encap, frame, decap_len) == 0);
+}
+
+void
+test_utils_decapsulate_multiple (void *f, void *data)
+{
+    char cmd1[10] = { 0x4B, 0x05, 0x08, 0x00 };
+    char cmd2[10] = { 0x00 };
+    char buf[64];
+    gsize len1, len2, pos;
+    gsize decap_len = 0;
+    gsize used = 0;
+    qcdmbool more = FALSE;
+    gboolean success;
+
+    /* Two frames read at once, plus the start of a third one */
+    len1 = dm_encapsulate_buffer (cmd1, 4, sizeof (cmd1), buf, sizeof (buf));
+    len2 = dm_encapsulate_buffer (cmd2, 1, sizeof (cmd2), &buf[len1], sizeof (buf) - len1);
+    g_assert (len1 > 0 && len2 > 0);
+    memcpy (&buf[len1 + len2], "\x4b\x05", 2);
+
+    success = dm_decapsulate_buffer (buf, len1 + len2 + 2,
+                                     buf, len1 + len2 + 2,
+                                     &decap_len, &used, &more);
+    g_assert (success);
+    g_assert (used == len1);
+    g_assert (decap_len == 4);
+    g_assert (memcmp (buf, "\x4b\x05\x08\x00", 4) == 0);
+
+    pos = used;
+    success = dm_decapsulate_buffer (&buf[pos], len2 + 2,
+                                     &buf[pos], len2 + 2,
+                                     &decap_len, &used, &more);
+    g_assert (success);
+    g_assert (used == len2);
+    g_assert (decap_len == 1);
+    g_assert (buf[pos] == 0x00);
+
+    pos += used;
+    success = dm_decapsulate_buffer (&buf[pos], 2,
+                                     &buf[pos], 2,
+                                     &decap_len, &used, &more);
+    g_assert (success);
+    g_assert (more == TRUE);
+}
+
+
 static const char encap_outbuf[] = {
     0x4b, 0x05, 0x08, 0x00, 0x01, 0xdd, 0x7e
 };
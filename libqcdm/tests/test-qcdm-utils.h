@@ -20,6 +20,12 @@
 
 void test_utils_decapsulate_buffer (void *f, void *data);
 
+void test_utils_decapsulate_in_place (void *f, void *data);
+
+void test_utils_decapsulate_large (void *f, void *data);
+
+void test_utils_decapsulate_multiple (void *f, void *data);
+
 void test_utils_encapsulate_buffer (void *f, void *data);
 
 void test_utils_decapsulate_sierra_cns (void *f, void *data);
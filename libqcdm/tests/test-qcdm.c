@@ -23,6 +23,7 @@
 #include "test-qcdm-com.h"
 #include "test-qcdm-result.h"
 #include "test-qcdm-utils.h"
+#include "test-qcdm-log.h"
 
 typedef struct {
     gpointer com_data;
@@ -84,16 +85,26 @@ int main (int argc, char **argv)
 
     g_test_suite_add (suite, TESTCASE (test_crc16_1, NULL));
     g_test_suite_add (suite, TESTCASE (test_crc16_2, NULL));
+    g_test_suite_add (suite, TESTCASE (test_crc16_slicing, NULL));
     g_test_suite_add (suite, TESTCASE (test_escape1, NULL));
     g_test_suite_add (suite, TESTCASE (test_escape2, NULL));
     g_test_suite_add (suite, TESTCASE (test_escape_unescape, NULL));
+    g_test_suite_add (suite, TESTCASE (test_escape_impls, NULL));
     g_test_suite_add (suite, TESTCASE (test_utils_decapsulate_buffer, NULL));
+    g_test_suite_add (suite, TESTCASE (test_utils_decapsulate_in_place, NULL));
+    g_test_suite_add (suite, TESTCASE (test_utils_decapsulate_large, NULL));
+    g_test_suite_add (suite, TESTCASE (test_utils_decapsulate_multiple, NULL));
     g_test_suite_add (suite, TESTCASE (test_utils_encapsulate_buffer, NULL));
     g_test_suite_add (suite, TESTCASE (test_utils_decapsulate_sierra_cns, NULL));
     g_test_suite_add (suite, TESTCASE (test_result_string, NULL));
     g_test_suite_add (suite, TESTCASE (test_result_uint32, NULL));
     g_test_suite_add (suite, TESTCASE (test_result_uint8, NULL));
     g_test_suite_add (suite, TESTCASE (test_result_uint8_array, NULL));
+    g_test_suite_add (suite, TESTCASE (test_result_many, NULL));
+    g_test_suite_add (suite, TESTCASE (test_log_wcdma_cell_id, NULL));
+    g_test_suite_add (suite, TESTCASE (test_log_gsm_bcch, NULL));
+    g_test_suite_add (suite, TESTCASE (test_log_short_item, NULL));
+    g_test_suite_add (suite, TESTCASE (test_event_id, NULL));
 
     /* Live tests */
     if (port) {
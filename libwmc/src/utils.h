@@ -33,7 +33,7 @@ typedef u_int8_t wmcbool;
 
 /* Utility and testcase functions */
 
-u_int16_t crc16 (const char *buffer, size_t len, u_int16_t seed);
+u_int16_t wmc_crc16 (const char *buffer, size_t len, u_int16_t seed);
 
 size_t hdlc_escape (const char *inbuf,
                     size_t inbuf_len,
@@ -116,6 +116,7 @@ mm_plugin_create (void)
                       MM_PLUGIN_BASE_ALLOWED_VENDOR_IDS, vendor_ids,
                       MM_PLUGIN_BASE_ALLOWED_PRODUCT_IDS, product_ids,
                       MM_PLUGIN_BASE_ALLOWED_AT, TRUE,
+                      MM_PLUGIN_BASE_AT_PIPELINE, TRUE,
                       NULL));
 }
 
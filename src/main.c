@@ -20,6 +20,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include <gio/gio.h>
 
@@ -28,6 +30,7 @@
 #include "mm-manager.h"
 #include "mm-log.h"
 #include "mm-context.h"
+#include "mm-serial-capture.h"
 
 #if !defined(MM_DIST_VERSION)
 # define MM_DIST_VERSION VERSION
@@ -36,11 +39,23 @@
 static GMainLoop *loop;
 static MMManager *manager;
 
+/* Written from the signal handler, to dump serial captures from the main loop */
+static int usr1_pipe[2] = { -1, -1 };
+
 static void
 mm_signal_handler (int signo)
 {
-    if (signo == SIGUSR1)
+    if (signo == SIGUSR1) {
         mm_log_usr1 ();
+        if (usr1_pipe[1] >= 0) {
+            int errsv = errno;
+
+            if (write (usr1_pipe[1], "", 1) < 0) {
+                /* Pipe full, a dump is already pending */
+            }
+            errno = errsv;
+        }
+    }
 	else if (signo == SIGINT || signo == SIGTERM) {
 		mm_info ("Caught signal %d, shutting down...", signo);
         if (loop)
@@ -50,12 +65,58 @@ mm_signal_handler (int signo)
     }
 }
 
+static gboolean
+usr1_pipe_cb (GIOChannel *source,
+              GIOCondition condition,
+              gpointer user_data)
+{
+    GError *error = NULL;
+    gchar buf[16];
+    gchar *path;
+
+    /* Several signals may have been coalesced, dump once */
+    while (read (usr1_pipe[0], buf, sizeof (buf)) > 0);
+
+    mm_log_usr1_report ();
+
+    path = mm_serial_capture_dump_all (mm_context_get_capture_dir (), &error);
+    if (!path) {
+        mm_warn ("Couldn't dump serial traffic: %s", error->message);
+        g_error_free (error);
+    }
+    g_free (path);
+
+    return TRUE;
+}
+
+static void
+setup_usr1_pipe (void)
+{
+    GIOChannel *channel;
+
+    if (pipe (usr1_pipe) < 0) {
+        mm_warn ("Couldn't create signal pipe: %s", strerror (errno));
+        return;
+    }
+
+    fcntl (usr1_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl (usr1_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl (usr1_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (usr1_pipe[1], F_SETFL, O_NONBLOCK);
+
+    channel = g_io_channel_unix_new (usr1_pipe[0]);
+    g_io_add_watch (channel, G_IO_IN, usr1_pipe_cb, NULL);
+    g_io_channel_unref (channel);
+}
+
 static void
 setup_signals (void)
 {
     struct sigaction action;
     sigset_t mask;
 
+    setup_usr1_pipe ();
+
     sigemptyset (&mask);
     action.sa_handler = mm_signal_handler;
     action.sa_mask = mask;
@@ -113,6 +174,7 @@ main (int argc, char *argv[])
 
     if (!mm_log_setup (mm_context_get_log_level (),
                        mm_context_get_log_file (),
+                       mm_context_get_log_flush (),
                        mm_context_get_timestamps (),
                        mm_context_get_relative_timestamps (),
                        mm_context_get_debug (),
@@ -122,6 +184,8 @@ main (int argc, char *argv[])
         exit (1);
     }
 
+    mm_serial_capture_set_default_size (mm_context_get_capture_size ());
+
     setup_signals ();
 
     mm_info ("ModemManager (version " MM_DIST_VERSION ") starting...");
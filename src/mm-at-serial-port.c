@@ -21,6 +21,9 @@
 #include <unistd.h>
 #include <string.h>
 
+#include <ModemManager.h>
+#include <mm-errors-types.h>
+
 #include "mm-at-serial-port.h"
 #include "mm-log.h"
 
@@ -31,20 +34,38 @@ G_DEFINE_TYPE (MMAtSerialPort, mm_at_serial_port, MM_TYPE_SERIAL_PORT)
 enum {
     PROP_0,
     PROP_REMOVE_ECHO,
+    PROP_PIPELINE,
     LAST_PROP
 };
 
+typedef struct _UnsolicitedTrieNode UnsolicitedTrieNode;
+
 typedef struct {
     /* Response parser data */
     MMAtSerialResponseParserFn response_parser_fn;
     gpointer response_parser_user_data;
     GDestroyNotify response_parser_notify;
+    /* Offset in the response from which the response parser may resume
+     * scanning, so that each read only costs parsing the new data */
+    gsize response_parser_resume;
 
     GSList *unsolicited_msg_handlers;
+    UnsolicitedTrieNode *unsolicited_trie;
+    /* Offset in the response from which unsolicited messages need to be
+     * looked for again */
+    gsize unsolicited_resume;
 
     MMAtPortFlag flags;
 
     gboolean remove_echo;
+
+    /* Queries waiting to be sent in a single command line */
+    gboolean pipeline;
+    GQueue *pipelined;
+    guint pipelined_id;
+
+    /* Streamed commands waiting for their reply */
+    GList *streamed;
 } MMAtSerialPortPrivate;
 
 /*****************************************************************************/
@@ -65,6 +86,7 @@ mm_at_serial_port_set_response_parser (MMAtSerialPort *self,
     priv->response_parser_fn = fn;
     priv->response_parser_user_data = user_data;
     priv->response_parser_notify = notify;
+    priv->response_parser_resume = 0;
 }
 
 void
@@ -87,37 +109,274 @@ mm_at_serial_port_remove_echo (GByteArray *response)
     }
 }
 
+static void
+remove_echo (MMAtSerialPort *self, GByteArray *response)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    guint len = response->len;
+
+    mm_at_serial_port_remove_echo (response);
+
+    /* Removing data invalidates the resume offsets */
+    if (response->len != len) {
+        priv->response_parser_resume = 0;
+        priv->unsolicited_resume = 0;
+    }
+}
+
+/*****************************************************************************/
+/* Streamed commands
+ *
+ * Commands which may get very long replies, like listing all stored SMS, can
+ * be queued so that each record of the reply (a line starting with a given
+ * prefix, and any other line up to the next one with the prefix) is given to
+ * the caller as soon as it is received. Records are removed from the response
+ * right away, so that it doesn't grow with the number of records.
+ *
+ * Records are given to the caller from an idle, never while the response is
+ * being parsed, as the caller may well queue commands or emit signals; the
+ * final reply is then delayed until all the records have been delivered.
+ */
+
+typedef struct {
+    MMAtSerialPort *self;
+    gchar *prefix;
+    MMAtSerialRecordFn record_callback;
+    MMAtSerialResponseFn callback;
+    gpointer user_data;
+
+    /* Records not delivered yet */
+    GPtrArray *records;
+    guint records_id;
+    gboolean delivering;
+
+    /* The final reply, kept while records are still pending */
+    gboolean done;
+    GString *response;
+    GError *error;
+} StreamedCommand;
+
+static void
+streamed_command_free (StreamedCommand *sc)
+{
+    if (sc->records_id) {
+        g_source_remove (sc->records_id);
+        g_object_unref (sc->self);
+    }
+    g_ptr_array_unref (sc->records);
+    if (sc->response)
+        g_string_free (sc->response, TRUE);
+    if (sc->error)
+        g_error_free (sc->error);
+    g_free (sc->prefix);
+    g_slice_free (StreamedCommand, sc);
+}
+
+static void
+streamed_command_complete (StreamedCommand *sc,
+                           GString *response,
+                           GError *error)
+{
+    sc->callback (sc->self, response, error, sc->user_data);
+    streamed_command_free (sc);
+}
+
+static void streamed_records_schedule (StreamedCommand *sc);
+
+static gboolean
+streamed_records_deliver_cb (StreamedCommand *sc)
+{
+    MMAtSerialPort *self = sc->self;
+    GPtrArray *records;
+    guint i;
+
+    sc->records_id = 0;
+
+    /* Callbacks may queue more records, or even get the final reply if they
+     * cancel the command; either one is left for later */
+    records = sc->records;
+    sc->records = g_ptr_array_new_with_free_func (g_free);
+    sc->delivering = TRUE;
+    for (i = 0; i < records->len; i++)
+        sc->record_callback (self, g_ptr_array_index (records, i), sc->user_data);
+    g_ptr_array_unref (records);
+    sc->delivering = FALSE;
+
+    if (sc->records->len > 0)
+        streamed_records_schedule (sc);
+    else if (sc->done)
+        streamed_command_complete (sc, sc->response, sc->error);
+
+    g_object_unref (self);
+    return FALSE;
+}
+
+static void
+streamed_records_schedule (StreamedCommand *sc)
+{
+    if (sc->records_id || sc->delivering || sc->records->len == 0)
+        return;
+
+    /* Keep the port around until the records are delivered */
+    g_object_ref (sc->self);
+    sc->records_id = g_idle_add ((GSourceFunc) streamed_records_deliver_cb, sc);
+}
+
+/* Looks for the first record in 'data'. Unless 'last' is set, records are
+ * only complete once the next line starting with the prefix is found, as
+ * they may span several lines. On success, 'start' and 'end' delimit the
+ * record, without line breaks, and 'next' is where the line break before
+ * the next record starts. */
+static gboolean
+find_record (const gchar *data,
+             gsize len,
+             const gchar *prefix,
+             gboolean last,
+             gsize *start,
+             gsize *end,
+             gsize *next)
+{
+    gsize prefix_len = strlen (prefix);
+    const gchar *p = data;
+    const gchar *q;
+    gsize e;
+
+    /* The record starts with the prefix at the beginning of a line */
+    while ((p = g_strstr_len (p, len - (p - data), prefix)) != NULL) {
+        if (p == data || p[-1] == '\n')
+            break;
+        p++;
+    }
+    if (!p)
+        return FALSE;
+
+    q = p + prefix_len;
+    while ((q = g_strstr_len (q, len - (q - data), prefix)) != NULL) {
+        if (q[-1] == '\n')
+            break;
+        q++;
+    }
+
+    if (q) {
+        /* Keep the line break, so that the next record is still seen
+         * as starting a line, and not as echo */
+        e = q - data - 1;
+        if (e > 0 && data[e - 1] == '\r')
+            e--;
+    } else if (last)
+        e = len;
+    else
+        return FALSE;
+
+    *start = p - data;
+    *next = e;
+    while (e > *start && (data[e - 1] == '\r' || data[e - 1] == '\n'))
+        e--;
+    *end = e;
+    return TRUE;
+}
+
+gchar *
+mm_at_serial_port_take_record (GByteArray *response,
+                               const gchar *prefix,
+                               gboolean last)
+{
+    gsize start, end, next;
+    gchar *record;
+
+    if (!find_record ((const gchar *) response->data, response->len, prefix, last,
+                      &start, &end, &next))
+        return NULL;
+
+    record = g_strndup ((const gchar *) response->data + start, end - start);
+    g_byte_array_remove_range (response, 0, next);
+    return record;
+}
+
+static StreamedCommand *
+streamed_command_peek_current (MMAtSerialPort *self)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    gpointer data;
+
+    if (!priv->streamed)
+        return NULL;
+
+    /* Streamed commands are queued with their own context as user data */
+    data = mm_serial_port_get_current_command_data (MM_SERIAL_PORT (self));
+    return g_list_find (priv->streamed, data) ? data : NULL;
+}
+
+static void
+stream_records (MMAtSerialPort *self, GByteArray *response)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    StreamedCommand *sc;
+    gsize start, end, next;
+    gsize consumed = 0;
+
+    sc = streamed_command_peek_current (self);
+    if (!sc)
+        return;
+
+    while (find_record ((const gchar *) response->data + consumed,
+                        response->len - consumed,
+                        sc->prefix,
+                        FALSE,
+                        &start, &end, &next)) {
+        g_ptr_array_add (sc->records,
+                         g_strndup ((const gchar *) response->data + consumed + start,
+                                    end - start));
+        consumed += next;
+    }
+
+    if (consumed) {
+        g_byte_array_remove_range (response, 0, consumed);
+        priv->response_parser_resume = 0;
+        priv->unsolicited_resume = 0;
+    }
+
+    streamed_records_schedule (sc);
+}
+
 static gboolean
 parse_response (MMSerialPort *port, GByteArray *response, GError **error)
 {
     MMAtSerialPort *self = MM_AT_SERIAL_PORT (port);
     MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
     gboolean found;
-    GString *string;
+    guint len;
 
     g_return_val_if_fail (priv->response_parser_fn != NULL, FALSE);
 
     /* Remove echo */
     if (priv->remove_echo)
-        mm_at_serial_port_remove_echo (response);
+        remove_echo (self, response);
 
-    /* Construct the string that AT-parsing functions expect */
-    string = g_string_sized_new (response->len + 1);
-    g_string_append_len (string, (const char *) response->data, response->len);
+    /* Hand over the complete records of a streamed reply */
+    stream_records (self, response);
 
-    /* Parse it */
-    found = priv->response_parser_fn (priv->response_parser_user_data, string, error);
+    /* Parse it; the parser will remove matches and clean it up */
+    len = response->len;
+    found = priv->response_parser_fn (priv->response_parser_user_data,
+                                      response,
+                                      &priv->response_parser_resume,
+                                      error);
+    if (response->len != len)
+        priv->unsolicited_resume = 0;
 
-    /* And copy it back into the response array after the parser has removed
-     * matches and cleaned it up.
-     */
-    if (response->len)
-        g_byte_array_remove_range (response, 0, response->len);
-    g_byte_array_append (response, (const guint8 *) string->str, string->len);
-    g_string_free (string, TRUE);
     return found;
 }
 
+static void
+response_trimmed (MMSerialPort *port)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (port);
+
+    priv->response_parser_resume = 0;
+    priv->unsolicited_resume = 0;
+}
+
 static gsize
 handle_response (MMSerialPort *port,
                  GByteArray *response,
@@ -142,11 +401,210 @@ handle_response (MMSerialPort *port,
 
 typedef struct {
     GRegex *regex;
+    /* Literal texts all matches start with, right after a leading <CR><LF>;
+     * NULL if the handler needs to be run over the whole response */
+    gchar **prefixes;
     MMAtSerialUnsolicitedMsgFn callback;
     gpointer user_data;
     GDestroyNotify notify;
 } MMAtUnsolicitedMsgHandler;
 
+/* Trie of unsolicited message prefixes, so that each received line is
+ * only matched against the handlers which may actually match it */
+struct _UnsolicitedTrieNode {
+    guint8 c;
+    /* Handlers with a prefix ending in this node */
+    GSList *handlers;
+    UnsolicitedTrieNode *child;
+    UnsolicitedTrieNode *sibling;
+};
+
+static void
+unsolicited_trie_insert (UnsolicitedTrieNode *node,
+                         const gchar *prefix,
+                         MMAtUnsolicitedMsgHandler *handler)
+{
+    for (; *prefix; prefix++) {
+        UnsolicitedTrieNode *child;
+
+        for (child = node->child; child; child = child->sibling) {
+            if (child->c == (guint8) *prefix)
+                break;
+        }
+
+        if (!child) {
+            child = g_slice_new0 (UnsolicitedTrieNode);
+            child->c = (guint8) *prefix;
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+
+    node->handlers = g_slist_append (node->handlers, handler);
+}
+
+static void
+unsolicited_trie_free (UnsolicitedTrieNode *node)
+{
+    while (node) {
+        UnsolicitedTrieNode *sibling = node->sibling;
+
+        unsolicited_trie_free (node->child);
+        g_slist_free (node->handlers);
+        g_slice_free (UnsolicitedTrieNode, node);
+        node = sibling;
+    }
+}
+
+/* Reads literal characters from the regex pattern into 'str', and returns
+ * a pointer to the first non-literal one */
+static const gchar *
+pattern_read_literal (const gchar *p, GString *str)
+{
+    for (;;) {
+        gchar c;
+        const gchar *next;
+
+        if (p[0] == '\\') {
+            /* Escaped alphanumerics are character classes, back references,
+             * assertions... */
+            if (p[1] == '\0' || g_ascii_isalnum (p[1]))
+                return p;
+            c = p[1];
+            next = p + 2;
+        } else if (p[0] == '\0' || strchr ("^$.[|()?*+{", p[0]))
+            return p;
+        else {
+            c = p[0];
+            next = p + 1;
+        }
+
+        /* A quantified character is not part of the literal text */
+        if (*next != '\0' && strchr ("?*+{", *next))
+            return p;
+
+        g_string_append_c (str, c);
+        p = next;
+    }
+}
+
+static gboolean
+pattern_has_toplevel_alternation (const gchar *p)
+{
+    guint depth = 0;
+    gboolean in_class = FALSE;
+
+    for (; *p; p++) {
+        if (*p == '\\') {
+            if (*(++p) == '\0')
+                break;
+        } else if (in_class) {
+            if (*p == ']')
+                in_class = FALSE;
+        } else if (*p == '[')
+            in_class = TRUE;
+        else if (*p == '(')
+            depth++;
+        else if (*p == ')' && depth > 0)
+            depth--;
+        else if (*p == '|' && depth == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Computes the literal texts that any match of the handler's regex starts
+ * with, right after a leading <CR><LF>. A group of literal alternatives
+ * after the first literal text, as in "\r\n\+(CREG|CGREG):", gives one
+ * prefix per alternative. Returns NULL if the pattern doesn't start with a
+ * <CR><LF> or if no prefix can be safely computed. */
+static gchar **
+unsolicited_msg_prefixes_from_regex (GRegex *regex)
+{
+    const gchar *p;
+    GString *base;
+    GPtrArray *prefixes;
+
+    if (g_regex_get_compile_flags (regex) & (G_REGEX_CASELESS | G_REGEX_EXTENDED))
+        return NULL;
+
+    p = g_regex_get_pattern (regex);
+    if (pattern_has_toplevel_alternation (p))
+        return NULL;
+
+    if (g_str_has_prefix (p, "\\r\\n"))
+        p += 4;
+    else if (g_str_has_prefix (p, "\r\n"))
+        p += 2;
+    else
+        return NULL;
+
+    base = g_string_new (NULL);
+    p = pattern_read_literal (p, base);
+
+    prefixes = g_ptr_array_new ();
+    if (p[0] == '(') {
+        GPtrArray *alternatives;
+        gboolean valid = TRUE;
+
+        alternatives = g_ptr_array_new ();
+        p++;
+        if (p[0] == '?' && p[1] == ':')
+            p += 2;
+
+        while (valid) {
+            GString *alternative;
+
+            alternative = g_string_new (base->str);
+            p = pattern_read_literal (p, alternative);
+            if (alternative->len == base->len || (*p != '|' && *p != ')')) {
+                g_string_free (alternative, TRUE);
+                valid = FALSE;
+                break;
+            }
+
+            g_ptr_array_add (alternatives, g_string_free (alternative, FALSE));
+            if (*(p++) == ')')
+                break;
+        }
+
+        /* The group must not be optional */
+        if (valid && (*p == '?' || *p == '*' || *p == '{'))
+            valid = FALSE;
+
+        if (valid) {
+            guint i;
+            GString *tail;
+
+            tail = g_string_new (NULL);
+            pattern_read_literal (p, tail);
+            for (i = 0; i < alternatives->len; i++) {
+                gchar *alternative = g_ptr_array_index (alternatives, i);
+
+                g_ptr_array_add (prefixes, g_strconcat (alternative, tail->str, NULL));
+            }
+            g_string_free (tail, TRUE);
+        }
+
+        g_ptr_array_foreach (alternatives, (GFunc) g_free, NULL);
+        g_ptr_array_free (alternatives, TRUE);
+    }
+
+    if (prefixes->len == 0 && base->len > 0)
+        g_ptr_array_add (prefixes, g_strdup (base->str));
+    g_string_free (base, TRUE);
+
+    if (prefixes->len == 0) {
+        g_ptr_array_free (prefixes, TRUE);
+        return NULL;
+    }
+
+    g_ptr_array_add (prefixes, NULL);
+    return (gchar **) g_ptr_array_free (prefixes, FALSE);
+}
+
 static gint
 unsolicited_msg_handler_cmp (MMAtUnsolicitedMsgHandler *handler,
                              GRegex *regex)
@@ -183,6 +641,15 @@ mm_at_serial_port_add_unsolicited_msg_handler (MMAtSerialPort *self,
         handler = g_slice_new (MMAtUnsolicitedMsgHandler);
         priv->unsolicited_msg_handlers = g_slist_append (priv->unsolicited_msg_handlers, handler);
         handler->regex = g_regex_ref (regex);
+
+        /* Index the handler by its prefixes, if any */
+        handler->prefixes = unsolicited_msg_prefixes_from_regex (regex);
+        if (handler->prefixes) {
+            guint i;
+
+            for (i = 0; handler->prefixes[i]; i++)
+                unsolicited_trie_insert (priv->unsolicited_trie, handler->prefixes[i], handler);
+        }
     }
 
     handler->callback = callback;
@@ -205,51 +672,209 @@ remove_eval_cb (const GMatchInfo *match_info,
     return FALSE;
 }
 
+static void
+run_unsolicited_msg_handler (MMAtSerialPort *self,
+                             MMAtUnsolicitedMsgHandler *handler,
+                             GByteArray *response)
+{
+    GMatchInfo *match_info;
+    gboolean matches;
+
+    matches = g_regex_match_full (handler->regex,
+                                  (const char *) response->data,
+                                  response->len,
+                                  0, 0, &match_info, NULL);
+    if (handler->callback) {
+        while (g_match_info_matches (match_info)) {
+            handler->callback (self, match_info, handler->user_data);
+            g_match_info_next (match_info, NULL);
+        }
+    }
+
+    g_match_info_free (match_info);
+
+    if (matches) {
+        /* Remove matches */
+        char *str;
+        int result_len = response->len;
+
+        str = g_regex_replace_eval (handler->regex,
+                                    (const char *) response->data,
+                                    response->len,
+                                    0, 0,
+                                    remove_eval_cb, &result_len, NULL);
+
+        g_byte_array_remove_range (response, 0, response->len);
+        g_byte_array_append (response, (const guint8 *) str, result_len);
+        g_free (str);
+    }
+}
+
+/* Runs the handler anchored at the <CR><LF> found at 'start'; if it matches,
+ * the match is removed from the response */
+static gboolean
+run_unsolicited_msg_handler_at (MMAtSerialPort *self,
+                                MMAtUnsolicitedMsgHandler *handler,
+                                GByteArray *response,
+                                gsize start,
+                                gboolean *partial)
+{
+    GMatchInfo *match_info = NULL;
+    gint match_start;
+    gint match_end;
+
+    if (!g_regex_match_full (handler->regex,
+                             (const char *) response->data,
+                             response->len,
+                             start,
+                             G_REGEX_MATCH_ANCHORED | G_REGEX_MATCH_PARTIAL,
+                             &match_info, NULL)) {
+        /* The message may just not be complete yet */
+        if (match_info && g_match_info_is_partial_match (match_info))
+            *partial = TRUE;
+        g_match_info_free (match_info);
+        return FALSE;
+    }
+
+    if (handler->callback)
+        handler->callback (self, match_info, handler->user_data);
+
+    g_match_info_fetch_pos (match_info, 0, &match_start, &match_end);
+    g_match_info_free (match_info);
+
+    g_byte_array_remove_range (response, match_start, match_end - match_start);
+    return TRUE;
+}
+
+static gboolean
+dispatch_unsolicited_line (MMAtSerialPort *self,
+                           GByteArray *response,
+                           gsize line_start,
+                           gsize line_end,
+                           gboolean *partial)
+{
+    UnsolicitedTrieNode *node;
+    gsize i;
+
+    /* Walk the trie with the line contents, trying the handlers of every
+     * prefix of the line found on the way */
+    node = MM_AT_SERIAL_PORT_GET_PRIVATE (self)->unsolicited_trie;
+    for (i = line_start + 2; i < line_end; i++) {
+        GSList *l;
+
+        for (node = node->child; node; node = node->sibling) {
+            if (node->c == response->data[i])
+                break;
+        }
+        if (!node)
+            break;
+
+        for (l = node->handlers; l; l = g_slist_next (l)) {
+            if (run_unsolicited_msg_handler_at (self,
+                                                (MMAtUnsolicitedMsgHandler *) l->data,
+                                                response,
+                                                line_start,
+                                                partial))
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+dispatch_unsolicited (MMAtSerialPort *self, GByteArray *response)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    gsize pos;
+    gsize pending = G_MAXSIZE;
+
+    if (!priv->unsolicited_trie->child)
+        return;
+
+    /* Only lines completed since the last run need to be looked at, plus
+     * the ones which may still become a multi-line message */
+    pos = (priv->unsolicited_resume <= response->len ? priv->unsolicited_resume : 0);
+
+    while (pos + 1 < response->len) {
+        const guint8 *p;
+        gsize line_end;
+        gboolean partial = FALSE;
+
+        /* Look for the next line start, i.e. a <CR><LF> */
+        p = memchr (response->data + pos, '\r', response->len - pos - 1);
+        if (!p) {
+            /* The last byte may still be the <CR> of a line start */
+            pos = response->len - 1;
+            break;
+        }
+        pos = p - response->data;
+        if (response->data[pos + 1] != '\n') {
+            pos++;
+            continue;
+        }
+
+        /* Only complete lines are dispatched */
+        line_end = pos + 2;
+        for (;;) {
+            p = (line_end + 1 < response->len ?
+                 memchr (response->data + line_end, '\r', response->len - line_end - 1) :
+                 NULL);
+            if (!p) {
+                line_end = 0;
+                break;
+            }
+            line_end = p - response->data;
+            if (response->data[line_end + 1] == '\n')
+                break;
+            line_end++;
+        }
+        if (!line_end)
+            break;
+
+        /* If the message was removed, look again at whatever followed it */
+        if (dispatch_unsolicited_line (self, response, pos, line_end, &partial))
+            continue;
+
+        if (partial && pending == G_MAXSIZE)
+            pending = pos;
+        pos = line_end;
+    }
+
+    priv->unsolicited_resume = MIN (pos, pending);
+}
+
 static void
 parse_unsolicited (MMSerialPort *port, GByteArray *response)
 {
     MMAtSerialPort *self = MM_AT_SERIAL_PORT (port);
     MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
     GSList *iter;
+    guint len;
 
     /* Remove echo */
     if (priv->remove_echo)
-        mm_at_serial_port_remove_echo (response);
+        remove_echo (self, response);
 
+    len = response->len;
+
+    /* Handlers without prefix are run over the whole response */
     for (iter = priv->unsolicited_msg_handlers; iter; iter = iter->next) {
         MMAtUnsolicitedMsgHandler *handler = (MMAtUnsolicitedMsgHandler *) iter->data;
-        GMatchInfo *match_info;
-        gboolean matches;
-
-        matches = g_regex_match_full (handler->regex,
-                                      (const char *) response->data,
-                                      response->len,
-                                      0, 0, &match_info, NULL);
-        if (handler->callback) {
-            while (g_match_info_matches (match_info)) {
-                handler->callback (self, match_info, handler->user_data);
-                g_match_info_next (match_info, NULL);
-            }
-        }
 
-        g_match_info_free (match_info);
+        if (!handler->prefixes)
+            run_unsolicited_msg_handler (self, handler, response);
+    }
 
-        if (matches) {
-            /* Remove matches */
-            char *str;
-            int result_len = response->len;
+    if (response->len != len)
+        priv->unsolicited_resume = 0;
 
-            str = g_regex_replace_eval (handler->regex,
-                                        (const char *) response->data,
-                                        response->len,
-                                        0, 0,
-                                        remove_eval_cb, &result_len, NULL);
+    /* And the rest are dispatched line by line */
+    dispatch_unsolicited (self, response);
 
-            g_byte_array_remove_range (response, 0, response->len);
-            g_byte_array_append (response, (const guint8 *) str, result_len);
-            g_free (str);
-        }
-    }
+    /* Removing data invalidates the resume offset of the parser */
+    if (response->len != len)
+        priv->response_parser_resume = 0;
 }
 
 /*****************************************************************************/
@@ -277,30 +902,489 @@ at_command_to_byte_array (const char *command)
     return buf;
 }
 
+/*****************************************************************************/
+/* Command pipelining
+ *
+ * When enabled, queries which are queued during the same main loop iteration
+ * are sent to the modem in a single command line, e.g. "AT+CPIN?;+CREG?", and
+ * the combined reply is split back for each caller. Only extended syntax read
+ * commands ("+NAME?") are pipelined, as their information responses are
+ * prefixed with the command name ("+NAME: ..."), which is what allows to tell
+ * which lines belong to each query.
+ *
+ * If the modem reports an error, the whole command line is aborted, so each
+ * query is then sent again on its own to get its individual result. Errors
+ * not coming from the modem (timeouts, cancellations...) are reported to all
+ * callers.
+ */
+
+/* Keep command lines short enough for all modems */
+#define PIPELINE_MAX_COMMANDS    8
+#define PIPELINE_MAX_LINE_LENGTH 128
+
+typedef struct {
+    gchar *command;
+    guint32 timeout_ms;
+    GCancellable *cancellable;
+    MMAtSerialResponseFn callback;
+    gpointer user_data;
+} PipelinedCommand;
+
+static void
+pipelined_command_free (PipelinedCommand *pc)
+{
+    if (pc->cancellable)
+        g_object_unref (pc->cancellable);
+    g_free (pc->command);
+    g_slice_free (PipelinedCommand, pc);
+}
+
+/* Returns the "+NAME" part of a "+NAME?" query, or NULL if the command
+ * cannot be pipelined */
+static gchar *
+pipelined_command_get_name (const gchar *command)
+{
+    const gchar *p;
+
+    if (g_ascii_strncasecmp (command, "AT", 2) == 0)
+        command += 2;
+
+    if (command[0] != '+')
+        return NULL;
+
+    for (p = command + 1; g_ascii_isalnum (*p); p++);
+    if (p == command + 1 || p[0] != '?' || (p[1] != '\0' && p[1] != '\r'))
+        return NULL;
+
+    return g_strndup (command, p - command);
+}
+
+gchar **
+mm_at_serial_port_split_pipelined_response (const gchar *response,
+                                            const gchar **commands)
+{
+    guint n_commands;
+    gchar **names;
+    gint *starts;
+    gint *ends;
+    gchar **replies = NULL;
+    const gchar *line;
+    gint current = -1;
+    guint i;
+
+    g_return_val_if_fail (response != NULL, NULL);
+    g_return_val_if_fail (commands != NULL, NULL);
+
+    n_commands = g_strv_length ((gchar **) commands);
+    names = g_new0 (gchar *, n_commands + 1);
+    for (i = 0; i < n_commands; i++) {
+        names[i] = pipelined_command_get_name (commands[i]);
+        if (!names[i])
+            goto out;
+    }
+
+    starts = g_new (gint, n_commands);
+    ends = g_new (gint, n_commands);
+    for (i = 0; i < n_commands; i++)
+        starts[i] = ends[i] = -1;
+
+    /* Information responses come in the same order as the commands, so each
+     * line either starts the reply of one of the next commands, or continues
+     * the reply of the current one. */
+    line = response;
+    while (*line) {
+        const gchar *eol;
+        gsize len;
+
+        eol = strchr (line, '\r');
+        if (!eol)
+            eol = line + strlen (line);
+        len = eol - line;
+
+        if (len > 0) {
+            gint j;
+
+            for (j = MAX (current, 0); j < (gint) n_commands; j++) {
+                gsize name_len = strlen (names[j]);
+
+                if (len > name_len &&
+                    line[name_len] == ':' &&
+                    g_ascii_strncasecmp (line, names[j], name_len) == 0)
+                    break;
+            }
+
+            if (j < (gint) n_commands && j != current) {
+                current = j;
+                starts[current] = line - response;
+            } else if (current < 0)
+                /* Can't tell whose reply this is */
+                break;
+
+            ends[current] = eol - response;
+        }
+
+        line = eol;
+        while (*line == '\r' || *line == '\n')
+            line++;
+    }
+
+    /* Every query must have got its own information response */
+    for (i = 0; *line == '\0' && i < n_commands; i++) {
+        if (starts[i] < 0)
+            break;
+    }
+
+    if (i == n_commands) {
+        replies = g_new0 (gchar *, n_commands + 1);
+        for (i = 0; i < n_commands; i++)
+            replies[i] = g_strndup (response + starts[i], ends[i] - starts[i]);
+    }
+
+    g_free (starts);
+    g_free (ends);
+
+out:
+    g_strfreev (names);
+    return replies;
+}
+
+static void
+pipelined_command_queue (MMAtSerialPort *self,
+                         PipelinedCommand *pc)
+{
+    mm_serial_port_queue_command_ms (MM_SERIAL_PORT (self),
+                                     at_command_to_byte_array (pc->command),
+                                     TRUE,
+                                     pc->timeout_ms,
+                                     pc->cancellable,
+                                     (MMSerialResponseFn) pc->callback,
+                                     pc->user_data);
+}
+
+static void
+pipelined_response_ready (MMAtSerialPort *self,
+                          GString *response,
+                          GError *error,
+                          GList *commands)
+{
+    gchar **replies = NULL;
+    gboolean retry = FALSE;
+    GList *l;
+    guint i;
+
+    if (!error) {
+        const gchar **strv;
+
+        strv = g_new0 (const gchar *, g_list_length (commands) + 1);
+        for (l = commands, i = 0; l; l = g_list_next (l), i++)
+            strv[i] = ((PipelinedCommand *) l->data)->command;
+        replies = mm_at_serial_port_split_pipelined_response (response->str, strv);
+        g_free (strv);
+
+        if (!replies) {
+            mm_dbg ("(%s): couldn't split pipelined reply, sending queries one by one",
+                    mm_port_get_device (MM_PORT (self)));
+            retry = TRUE;
+        }
+    } else if (error->domain != MM_SERIAL_ERROR &&
+               error->domain != MM_CORE_ERROR) {
+        /* The modem replied with an error (+CME ERROR, +CMS ERROR...), which
+         * may belong to any of the queries */
+        mm_dbg ("(%s): pipelined queries failed, sending them one by one",
+                mm_port_get_device (MM_PORT (self)));
+        retry = TRUE;
+    }
+
+    for (l = commands, i = 0; l; l = g_list_next (l), i++) {
+        PipelinedCommand *pc = l->data;
+
+        if (retry)
+            pipelined_command_queue (self, pc);
+        else if (!replies)
+            pc->callback (self, response, error, pc->user_data);
+        else {
+            GString *reply;
+
+            reply = g_string_new (replies[i]);
+            if (pc->cancellable && g_cancellable_is_cancelled (pc->cancellable)) {
+                GError *cancelled;
+
+                cancelled = g_error_new_literal (MM_CORE_ERROR,
+                                                 MM_CORE_ERROR_CANCELLED,
+                                                 "Waiting for the reply cancelled");
+                pc->callback (self, reply, cancelled, pc->user_data);
+                g_error_free (cancelled);
+            } else
+                pc->callback (self, reply, NULL, pc->user_data);
+            g_string_free (reply, TRUE);
+        }
+
+        pipelined_command_free (pc);
+    }
+
+    g_strfreev (replies);
+    g_list_free (commands);
+    g_object_unref (self);
+}
+
+static void
+pipelined_flush (MMAtSerialPort *self)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    GList *commands;
+    GList *l;
+    GString *line;
+    guint32 timeout_ms = 0;
+
+    if (priv->pipelined_id) {
+        g_source_remove (priv->pipelined_id);
+        priv->pipelined_id = 0;
+    }
+
+    if (g_queue_is_empty (priv->pipelined))
+        return;
+
+    /* A single query is just sent as usual */
+    if (g_queue_get_length (priv->pipelined) == 1) {
+        PipelinedCommand *pc;
+
+        pc = g_queue_pop_head (priv->pipelined);
+        pipelined_command_queue (self, pc);
+        pipelined_command_free (pc);
+        return;
+    }
+
+    commands = g_queue_peek_head_link (priv->pipelined);
+    g_queue_init (priv->pipelined);
+
+    line = g_string_new ("AT");
+    for (l = commands; l; l = g_list_next (l)) {
+        PipelinedCommand *pc = l->data;
+        const gchar *command = pc->command;
+
+        if (g_ascii_strncasecmp (command, "AT", 2) == 0)
+            command += 2;
+        if (l != commands)
+            g_string_append_c (line, ';');
+        g_string_append (line, command);
+        if (line->str[line->len - 1] == '\r')
+            g_string_truncate (line, line->len - 1);
+
+        /* The modem answers the queries one after the other, so the whole
+         * line may take as long as all of them together */
+        timeout_ms += pc->timeout_ms;
+    }
+
+    mm_dbg ("(%s): pipelining %u queries",
+            mm_port_get_device (MM_PORT (self)),
+            g_list_length (commands));
+
+    /* Cancellations are handled per query when the reply arrives. The
+     * response callback may be called right away (e.g. if the port is
+     * closed), so take the reference it releases before queueing. */
+    g_object_ref (self);
+    mm_serial_port_queue_command_ms (MM_SERIAL_PORT (self),
+                                     at_command_to_byte_array (line->str),
+                                     TRUE,
+                                     timeout_ms,
+                                     NULL,
+                                     (MMSerialResponseFn) pipelined_response_ready,
+                                     commands);
+    g_string_free (line, TRUE);
+}
+
+static gboolean
+pipelined_flush_cb (MMAtSerialPort *self)
+{
+    MM_AT_SERIAL_PORT_GET_PRIVATE (self)->pipelined_id = 0;
+    pipelined_flush (self);
+    return FALSE;
+}
+
+/* Returns TRUE if the command was taken to be sent along with others */
+static gboolean
+pipelined_add (MMAtSerialPort *self,
+               const char *command,
+               guint32 timeout_ms,
+               GCancellable *cancellable,
+               MMAtSerialResponseFn callback,
+               gpointer user_data)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    PipelinedCommand *pc;
+    gchar *name;
+    GList *l;
+    gsize line_len;
+
+    if (!priv->pipeline)
+        return FALSE;
+
+    name = pipelined_command_get_name (command);
+    if (!name) {
+        /* Keep the order in which commands were queued */
+        pipelined_flush (self);
+        return FALSE;
+    }
+
+    /* Flush the current line if there's no room for this query */
+    line_len = 2 + strlen (name) + 1;
+    for (l = priv->pipelined->head; l; l = g_list_next (l))
+        line_len += strlen (((PipelinedCommand *) l->data)->command) + 1;
+    if (line_len > PIPELINE_MAX_LINE_LENGTH)
+        pipelined_flush (self);
+    g_free (name);
+
+    pc = g_slice_new0 (PipelinedCommand);
+    pc->command = g_strdup (command);
+    pc->timeout_ms = timeout_ms;
+    pc->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+    pc->callback = callback;
+    pc->user_data = user_data;
+    g_queue_push_tail (priv->pipelined, pc);
+
+    if (g_queue_get_length (priv->pipelined) >= PIPELINE_MAX_COMMANDS)
+        pipelined_flush (self);
+    else if (!priv->pipelined_id)
+        priv->pipelined_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                                              (GSourceFunc) pipelined_flush_cb,
+                                              g_object_ref (self),
+                                              g_object_unref);
+    return TRUE;
+}
+
+/*****************************************************************************/
+
+static void
+streamed_response_ready (MMAtSerialPort *self,
+                         GString *response,
+                         GError *error,
+                         StreamedCommand *sc)
+{
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+
+    priv->streamed = g_list_remove (priv->streamed, sc);
+
+    /* Whatever was left in the reply once the final result was found */
+    if (!error) {
+        gsize start, end, next;
+        gsize offset = 0;
+        gsize first = response->len;
+
+        while (find_record (response->str + offset,
+                            response->len - offset,
+                            sc->prefix,
+                            TRUE,
+                            &start, &end, &next)) {
+            first = MIN (first, offset + start);
+            g_ptr_array_add (sc->records,
+                             g_strndup (response->str + offset + start, end - start));
+            offset += next;
+        }
+        g_string_truncate (response, first);
+    }
+
+    /* Complete right away only if all records were already delivered */
+    if (sc->records->len == 0 && !sc->delivering) {
+        streamed_command_complete (sc, response, error);
+        return;
+    }
+
+    sc->done = TRUE;
+    sc->response = g_string_new_len (response->str, response->len);
+    sc->error = error ? g_error_copy (error) : NULL;
+    streamed_records_schedule (sc);
+}
+
 void
-mm_at_serial_port_queue_command (MMAtSerialPort *self,
-                                 const char *command,
-                                 guint32 timeout_seconds,
-                                 GCancellable *cancellable,
-                                 MMAtSerialResponseFn callback,
-                                 gpointer user_data)
+mm_at_serial_port_queue_command_streamed (MMAtSerialPort *self,
+                                          const char *command,
+                                          const char *record_prefix,
+                                          guint32 timeout_seconds,
+                                          GCancellable *cancellable,
+                                          MMAtSerialRecordFn record_callback,
+                                          MMAtSerialResponseFn callback,
+                                          gpointer user_data)
 {
+    MMAtSerialPortPrivate *priv = MM_AT_SERIAL_PORT_GET_PRIVATE (self);
+    StreamedCommand *sc;
     GByteArray *buf;
 
     g_return_if_fail (self != NULL);
     g_return_if_fail (MM_IS_AT_SERIAL_PORT (self));
     g_return_if_fail (command != NULL);
+    g_return_if_fail (record_prefix != NULL && record_prefix[0] != '\0');
+    g_return_if_fail (record_callback != NULL);
+    g_return_if_fail (callback != NULL);
+
+    /* Keep the order in which commands were queued */
+    pipelined_flush (self);
 
     buf = at_command_to_byte_array (command);
     g_return_if_fail (buf != NULL);
 
+    sc = g_slice_new0 (StreamedCommand);
+    sc->self = self;
+    sc->records = g_ptr_array_new_with_free_func (g_free);
+    sc->prefix = g_strdup (record_prefix);
+    sc->record_callback = record_callback;
+    sc->callback = callback;
+    sc->user_data = user_data;
+    priv->streamed = g_list_prepend (priv->streamed, sc);
+
     mm_serial_port_queue_command (MM_SERIAL_PORT (self),
                                   buf,
                                   TRUE,
                                   timeout_seconds,
                                   cancellable,
-                                  (MMSerialResponseFn) callback,
-                                  user_data);
+                                  (MMSerialResponseFn) streamed_response_ready,
+                                  sc);
+}
+
+/*****************************************************************************/
+
+void
+mm_at_serial_port_queue_command_ms (MMAtSerialPort *self,
+                                    const char *command,
+                                    guint32 timeout_ms,
+                                    GCancellable *cancellable,
+                                    MMAtSerialResponseFn callback,
+                                    gpointer user_data)
+{
+    GByteArray *buf;
+
+    g_return_if_fail (self != NULL);
+    g_return_if_fail (MM_IS_AT_SERIAL_PORT (self));
+    g_return_if_fail (command != NULL);
+
+    if (pipelined_add (self, command, timeout_ms, cancellable, callback, user_data))
+        return;
+
+    buf = at_command_to_byte_array (command);
+    g_return_if_fail (buf != NULL);
+
+    mm_serial_port_queue_command_ms (MM_SERIAL_PORT (self),
+                                     buf,
+                                     TRUE,
+                                     timeout_ms,
+                                     cancellable,
+                                     (MMSerialResponseFn) callback,
+                                     user_data);
+}
+
+void
+mm_at_serial_port_queue_command (MMAtSerialPort *self,
+                                 const char *command,
+                                 guint32 timeout_seconds,
+                                 GCancellable *cancellable,
+                                 MMAtSerialResponseFn callback,
+                                 gpointer user_data)
+{
+    mm_at_serial_port_queue_command_ms (self,
+                                        command,
+                                        timeout_seconds * 1000,
+                                        cancellable,
+                                        callback,
+                                        user_data);
 }
 
 void
@@ -317,6 +1401,9 @@ mm_at_serial_port_queue_command_cached (MMAtSerialPort *self,
     g_return_if_fail (MM_IS_AT_SERIAL_PORT (self));
     g_return_if_fail (command != NULL);
 
+    /* Keep the order in which commands were queued */
+    pipelined_flush (self);
+
     buf = at_command_to_byte_array (command);
     g_return_if_fail (buf != NULL);
 
@@ -329,6 +1416,29 @@ mm_at_serial_port_queue_command_cached (MMAtSerialPort *self,
                                          user_data);
 }
 
+static gchar *
+command_key (MMSerialPort *port, const GByteArray *command)
+{
+    const gchar *str = (const gchar *) command->data;
+    gsize len = command->len;
+
+    if (len >= 2 && g_ascii_strncasecmp (str, "AT", 2) == 0) {
+        str += 2;
+        len -= 2;
+    }
+    while (len > 0 && (str[len - 1] == '\r' || str[len - 1] == '\n'))
+        len--;
+
+    /* Commands are tracked by the whole command line, as the same command
+     * may take very different times depending on its arguments (e.g. +COPS?
+     * vs. a +COPS=? network scan). Dialing depends on the network and not
+     * on the modem, so it always gets the full timeout. */
+    if (len == 0 || g_ascii_toupper (str[0]) == 'D')
+        return NULL;
+
+    return g_ascii_strup (str, len);
+}
+
 static void
 debug_log (MMSerialPort *port, const char *prefix, const char *buf, gsize len)
 {
@@ -401,6 +1511,10 @@ mm_at_serial_port_init (MMAtSerialPort *self)
 
     /* By default, remove echo */
     priv->remove_echo = TRUE;
+
+    priv->unsolicited_trie = g_slice_new0 (UnsolicitedTrieNode);
+
+    priv->pipelined = g_queue_new ();
 }
 
 static void
@@ -413,6 +1527,11 @@ set_property (GObject *object, guint prop_id,
     case PROP_REMOVE_ECHO:
         priv->remove_echo = g_value_get_boolean (value);
         break;
+    case PROP_PIPELINE:
+        priv->pipeline = g_value_get_boolean (value);
+        if (!priv->pipeline)
+            pipelined_flush (MM_AT_SERIAL_PORT (object));
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -429,6 +1548,9 @@ get_property (GObject *object, guint prop_id,
     case PROP_REMOVE_ECHO:
         g_value_set_boolean (value, priv->remove_echo);
         break;
+    case PROP_PIPELINE:
+        g_value_set_boolean (value, priv->pipeline);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -448,10 +1570,20 @@ finalize (GObject *object)
             handler->notify (handler->user_data);
 
         g_regex_unref (handler->regex);
+        g_strfreev (handler->prefixes);
         g_slice_free (MMAtUnsolicitedMsgHandler, handler);
         priv->unsolicited_msg_handlers = g_slist_delete_link (priv->unsolicited_msg_handlers,
                                                               priv->unsolicited_msg_handlers);
     }
+    unsolicited_trie_free (priv->unsolicited_trie);
+
+    /* The pending flush keeps a reference, so nothing may be left here */
+    g_warn_if_fail (g_queue_is_empty (priv->pipelined));
+    g_queue_free (priv->pipelined);
+
+    /* Closing the port completes all queued commands */
+    g_warn_if_fail (priv->streamed == NULL);
+    g_list_free_full (priv->streamed, (GDestroyNotify) streamed_command_free);
 
     if (priv->response_parser_notify)
         priv->response_parser_notify (priv->response_parser_user_data);
@@ -474,7 +1606,9 @@ mm_at_serial_port_class_init (MMAtSerialPortClass *klass)
 
     port_class->parse_unsolicited = parse_unsolicited;
     port_class->parse_response = parse_response;
+    port_class->response_trimmed = response_trimmed;
     port_class->handle_response = handle_response;
+    port_class->command_key = command_key;
     port_class->debug_log = debug_log;
 
     g_object_class_install_property
@@ -484,4 +1618,13 @@ mm_at_serial_port_class_init (MMAtSerialPortClass *klass)
                                "Built-in echo removal should be applied",
                                TRUE,
                                G_PARAM_READWRITE));
+
+    g_object_class_install_property
+        (object_class, PROP_PIPELINE,
+         g_param_spec_boolean (MM_AT_SERIAL_PORT_PIPELINE,
+                               "Pipeline",
+                               "Queries may be sent to the modem in a single "
+                               "command line",
+                               FALSE,
+                               G_PARAM_READWRITE));
 }
@@ -52,8 +52,15 @@ typedef enum { /*< underscore_name=mm_at_port_flag >*/
     MM_AT_PORT_FLAG_GPS_CONTROL = 1 << 3,
 } MMAtPortFlag;
 
+/* Response parsers may be run several times over the same response as more
+ * data arrives. 'resume' is an offset within 'response', opaque to the port,
+ * which the parser may set when no complete reply is found, so that the next
+ * run only needs to scan the newly received data. The port resets it to 0
+ * whenever data is removed from the response.
+ */
 typedef gboolean (*MMAtSerialResponseParserFn) (gpointer user_data,
-                                                GString *response,
+                                                GByteArray *response,
+                                                gsize *resume,
                                                 GError **error);
 
 typedef void (*MMAtSerialUnsolicitedMsgFn) (MMAtSerialPort *port,
@@ -65,7 +72,12 @@ typedef void (*MMAtSerialResponseFn)     (MMAtSerialPort *port,
                                           GError *error,
                                           gpointer user_data);
 
+typedef void (*MMAtSerialRecordFn)       (MMAtSerialPort *port,
+                                          const gchar *record,
+                                          gpointer user_data);
+
 #define MM_AT_SERIAL_PORT_REMOVE_ECHO "remove-echo"
+#define MM_AT_SERIAL_PORT_PIPELINE    "pipeline"
 
 struct _MMAtSerialPort {
     MMSerialPort parent;
@@ -97,6 +109,14 @@ void     mm_at_serial_port_queue_command     (MMAtSerialPort *self,
                                               MMAtSerialResponseFn callback,
                                               gpointer user_data);
 
+/* Same as mm_at_serial_port_queue_command(), with the timeout in milliseconds */
+void     mm_at_serial_port_queue_command_ms  (MMAtSerialPort *self,
+                                              const char *command,
+                                              guint32 timeout_ms,
+                                              GCancellable *cancellable,
+                                              MMAtSerialResponseFn callback,
+                                              gpointer user_data);
+
 void     mm_at_serial_port_queue_command_cached (MMAtSerialPort *self,
                                                  const char *command,
                                                  guint32 timeout_seconds,
@@ -104,8 +124,27 @@ void     mm_at_serial_port_queue_command_cached (MMAtSerialPort *self,
                                                  MMAtSerialResponseFn callback,
                                                  gpointer user_data);
 
+/* Like mm_at_serial_port_queue_command(), but each record of the reply, i.e.
+ * each line starting with 'record_prefix' together with any other line
+ * following it, is given to 'record_callback' as soon as it is received,
+ * instead of being accumulated in the response. The final 'callback' only
+ * gets what's left out of the records, usually nothing. */
+void     mm_at_serial_port_queue_command_streamed (MMAtSerialPort *self,
+                                                   const char *command,
+                                                   const char *record_prefix,
+                                                   guint32 timeout_seconds,
+                                                   GCancellable *cancellable,
+                                                   MMAtSerialRecordFn record_callback,
+                                                   MMAtSerialResponseFn callback,
+                                                   gpointer user_data);
+
 /* Just for unit tests */
 void mm_at_serial_port_remove_echo (GByteArray *response);
+gchar *mm_at_serial_port_take_record (GByteArray *response,
+                                      const gchar *prefix,
+                                      gboolean last);
+gchar **mm_at_serial_port_split_pipelined_response (const gchar *response,
+                                                    const gchar **commands);
 
 void     mm_at_serial_port_set_flags (MMAtSerialPort *self,
                                       MMAtPortFlag flags);
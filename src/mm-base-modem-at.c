@@ -77,6 +77,104 @@ modem_cancellable_cancelled (GCancellable *modem_cancellable,
     g_cancellable_cancel (user_cancellable);
 }
 
+/*****************************************************************************/
+/* AT port scheduling
+ *
+ * Commands not explicitly sent through a given port go to the best AT port,
+ * usually the primary one. The signal quality, indicator and vendor specific
+ * access technology queries listed below don't change the modem state and
+ * their replies don't depend on any per-port setting, so they may instead be
+ * sent through whichever of the primary and secondary ports is less busy, and
+ * periodic polling doesn't need to wait for other commands. Registration
+ * queries are not in the list, as their reply format depends on the reporting
+ * mode set with +CREG=n in each port. Everything else keeps on going through
+ * the best port, in the order it was queued.
+ */
+
+static const gchar *read_only_queries[] = {
+    /* Signal quality */
+    "+CSQ",
+    "+CSQF",
+    "+CIND?",
+    /* Vendor specific access technology and state queries */
+    "*HSTATE?",
+    "*STATE?",
+    "^SMONG",
+    "_OCTI?",
+    "_OWCTI?",
+    "_OSSYS?",
+    "+CNSMOD?",
+    NULL
+};
+
+static gboolean
+command_is_read_only_query (const gchar *command)
+{
+    guint i;
+
+    if (g_ascii_strncasecmp (command, "AT", 2) == 0)
+        command += 2;
+
+    for (i = 0; read_only_queries[i]; i++) {
+        if (g_ascii_strcasecmp (command, read_only_queries[i]) == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+sequence_is_read_only (const MMBaseModemAtCommand *sequence)
+{
+    for (; sequence->command; sequence++) {
+        if (!command_is_read_only_query (sequence->command))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static MMAtSerialPort *
+peek_least_busy_at_port (MMBaseModem *self,
+                         GError **error)
+{
+    MMAtSerialPort *best;
+    MMAtSerialPort *secondary;
+
+    best = mm_base_modem_peek_best_at_port (self, error);
+    if (!best)
+        return NULL;
+
+    /* Only the primary port may get a secondary alternative. Also, don't open
+     * the secondary port just for this, it will be open anyway while the modem
+     * is enabled. */
+    secondary = mm_base_modem_peek_port_secondary (self);
+    if (best != mm_base_modem_peek_port_primary (self) ||
+        !secondary ||
+        mm_port_get_connected (MM_PORT (secondary)) ||
+        !mm_serial_port_is_open (MM_SERIAL_PORT (secondary)))
+        return best;
+
+    if (mm_serial_port_get_queue_length (MM_SERIAL_PORT (secondary)) <
+        mm_serial_port_get_queue_length (MM_SERIAL_PORT (best)))
+        return secondary;
+
+    return best;
+}
+
+MMAtSerialPort *
+mm_base_modem_at_peek_port_for_command (MMBaseModem *self,
+                                        const gchar *command,
+                                        GError **error)
+{
+    g_return_val_if_fail (MM_IS_BASE_MODEM (self), NULL);
+    g_return_val_if_fail (command != NULL, NULL);
+
+    if (command_is_read_only_query (command))
+        return peek_least_busy_at_port (self, error);
+
+    return mm_base_modem_peek_best_at_port (self, error);
+}
+
 /*****************************************************************************/
 /* AT sequence handling */
 
@@ -318,7 +416,10 @@ mm_base_modem_at_sequence (MMBaseModem *self,
     GError *error = NULL;
 
     /* No port given, so we'll try to guess which is best */
-    port = mm_base_modem_peek_best_at_port (self, &error);
+    if (sequence_is_read_only (sequence))
+        port = peek_least_busy_at_port (self, &error);
+    else
+        port = mm_base_modem_peek_best_at_port (self, &error);
     if (!port) {
         g_assert (error != NULL);
         g_simple_async_report_take_gerror_in_idle (G_OBJECT (self),
@@ -408,6 +509,9 @@ typedef struct {
     GCancellable *modem_cancellable;
     GCancellable *user_cancellable;
     GSimpleAsyncResult *result;
+    /* Only for streamed commands */
+    MMBaseModemAtRecordFn record_fn;
+    gpointer record_user_data;
 } AtCommandContext;
 
 static void
@@ -471,22 +575,15 @@ at_command_parse_response (MMAtSerialPort *port,
     at_command_context_free (ctx);
 }
 
-void
-mm_base_modem_at_command_full (MMBaseModem *self,
-                               MMAtSerialPort *port,
-                               const gchar *command,
-                               guint timeout,
-                               gboolean allow_cached,
-                               GCancellable *cancellable,
-                               GAsyncReadyCallback callback,
-                               gpointer user_data)
+static AtCommandContext *
+at_command_context_new (MMBaseModem *self,
+                        MMAtSerialPort *port,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data)
 {
     AtCommandContext *ctx;
 
-    /* Ensure that we have an open port */
-    if (!abort_async_if_port_unusable (self, port, callback, user_data))
-        return;
-
     ctx = g_new0 (AtCommandContext, 1);
     ctx->self = g_object_ref (self);
     ctx->port = g_object_ref (port);
@@ -511,6 +608,26 @@ mm_base_modem_at_command_full (MMBaseModem *self,
                                                    NULL);
     }
 
+    return ctx;
+}
+
+void
+mm_base_modem_at_command_full (MMBaseModem *self,
+                               MMAtSerialPort *port,
+                               const gchar *command,
+                               guint timeout,
+                               gboolean allow_cached,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data)
+{
+    AtCommandContext *ctx;
+
+    /* Ensure that we have an open port */
+    if (!abort_async_if_port_unusable (self, port, callback, user_data))
+        return;
+
+    ctx = at_command_context_new (self, port, cancellable, callback, user_data);
 
     /* Go on with the command */
     if (allow_cached)
@@ -551,7 +668,7 @@ mm_base_modem_at_command (MMBaseModem *self,
     GError *error = NULL;
 
     /* No port given, so we'll try to guess which is best */
-    port = mm_base_modem_peek_best_at_port (self, &error);
+    port = mm_base_modem_at_peek_port_for_command (self, command, &error);
     if (!port) {
         g_assert (error != NULL);
         g_simple_async_report_take_gerror_in_idle (G_OBJECT (self),
@@ -570,3 +687,58 @@ mm_base_modem_at_command (MMBaseModem *self,
                                    callback,
                                    user_data);
 }
+
+static void
+at_command_record_received (MMAtSerialPort *port,
+                            const gchar *record,
+                            AtCommandContext *ctx)
+{
+    /* Once cancelled, the records are of no use to anyone */
+    if (g_cancellable_is_cancelled (ctx->cancellable))
+        return;
+
+    ctx->record_fn (ctx->self, record, ctx->record_user_data);
+}
+
+void
+mm_base_modem_at_command_streamed (MMBaseModem *self,
+                                   const gchar *command,
+                                   const gchar *record_prefix,
+                                   guint timeout,
+                                   MMBaseModemAtRecordFn record_fn,
+                                   gpointer record_user_data,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+    AtCommandContext *ctx;
+    MMAtSerialPort *port;
+    GError *error = NULL;
+
+    port = mm_base_modem_at_peek_port_for_command (self, command, &error);
+    if (!port) {
+        g_assert (error != NULL);
+        g_simple_async_report_take_gerror_in_idle (G_OBJECT (self),
+                                                   callback,
+                                                   user_data,
+                                                   error);
+        return;
+    }
+
+    /* Ensure that we have an open port */
+    if (!abort_async_if_port_unusable (self, port, callback, user_data))
+        return;
+
+    ctx = at_command_context_new (self, port, NULL, callback, user_data);
+    ctx->record_fn = record_fn;
+    ctx->record_user_data = record_user_data;
+
+    mm_at_serial_port_queue_command_streamed (
+        port,
+        command,
+        record_prefix,
+        timeout,
+        ctx->cancellable,
+        (MMAtSerialRecordFn)at_command_record_received,
+        (MMAtSerialResponseFn)at_command_parse_response,
+        ctx);
+}
@@ -63,6 +63,13 @@ typedef struct {
     MMBaseModemAtResponseProcessor response_processor;
 } MMBaseModemAtCommand;
 
+/* Best AT port to run the given command in. Read-only queries which don't
+ * depend on any per-port state may get the least busy of the primary and
+ * secondary ports; any other command gets the best AT port available. */
+MMAtSerialPort *mm_base_modem_at_peek_port_for_command (MMBaseModem *self,
+                                                        const gchar *command,
+                                                        GError **error);
+
 /* Generic AT sequence handling, using the best AT port available and without
  * explicit cancellations. */
 void     mm_base_modem_at_sequence         (MMBaseModem *self,
@@ -147,4 +154,22 @@ const gchar *mm_base_modem_at_command_full_finish (MMBaseModem *self,
                                                    GAsyncResult *res,
                                                    GError **error);
 
+/* AT command handling for commands with long replies made of records, each
+ * one starting with 'record_prefix', like SMS listings. Each record is given
+ * to 'record_fn' as soon as it is received, so the reply is never fully
+ * buffered. Use mm_base_modem_at_command_finish() to get the result; the
+ * response string won't include any record. */
+typedef void (* MMBaseModemAtRecordFn) (MMBaseModem *self,
+                                        const gchar *record,
+                                        gpointer user_data);
+
+void mm_base_modem_at_command_streamed (MMBaseModem *self,
+                                        const gchar *command,
+                                        const gchar *record_prefix,
+                                        guint timeout,
+                                        MMBaseModemAtRecordFn record_fn,
+                                        gpointer record_user_data,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data);
+
 #endif /* MM_BASE_MODEM_AT_H */
@@ -44,6 +44,7 @@ enum {
     PROP_VENDOR_ID,
     PROP_PRODUCT_ID,
     PROP_CONNECTION,
+    PROP_AT_PIPELINE,
     PROP_LAST
 };
 
@@ -69,6 +70,9 @@ struct _MMBaseModemPrivate {
 
     guint max_timeouts;
 
+    /* Whether queries may be pipelined in the AT ports */
+    gboolean at_pipeline;
+
     /* The authorization provider */
     MMAuthProvider *authp;
     GCancellable *authp_cancellable;
@@ -201,6 +205,12 @@ mm_base_modem_grab_port (MMBaseModem *self,
                                                    mm_serial_parser_v1_destroy);
             /* Store flags already */
             mm_at_serial_port_set_flags (MM_AT_SERIAL_PORT (port), at_pflags);
+            /* Report commands as timed out as soon as their replies are
+             * clearly late, based on previous replies to the same command */
+            g_object_set (port,
+                          MM_AT_SERIAL_PORT_PIPELINE, self->priv->at_pipeline,
+                          MM_SERIAL_PORT_ADAPTIVE_TIMEOUTS, TRUE,
+                          NULL);
         } else if (ptype == MM_PORT_TYPE_GPS) {
             /* Raw GPS port */
             port = MM_PORT (mm_gps_serial_port_new (name));
@@ -927,6 +937,22 @@ set_property (GObject *object,
         g_clear_object (&self->priv->connection);
         self->priv->connection = g_value_dup_object (value);
         break;
+    case PROP_AT_PIPELINE: {
+        GHashTableIter iter;
+        MMPort *port;
+
+        self->priv->at_pipeline = g_value_get_boolean (value);
+
+        /* Update the AT ports already grabbed */
+        g_hash_table_iter_init (&iter, self->priv->ports);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&port)) {
+            if (MM_IS_AT_SERIAL_PORT (port))
+                g_object_set (port,
+                              MM_AT_SERIAL_PORT_PIPELINE, self->priv->at_pipeline,
+                              NULL);
+        }
+        break;
+    }
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -966,6 +992,9 @@ get_property (GObject *object,
     case PROP_CONNECTION:
         g_value_set_object (value, self->priv->connection);
         break;
+    case PROP_AT_PIPELINE:
+        g_value_set_boolean (value, self->priv->at_pipeline);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -1104,4 +1133,13 @@ mm_base_modem_class_init (MMBaseModemClass *klass)
                              G_TYPE_DBUS_CONNECTION,
                              G_PARAM_READWRITE);
     g_object_class_install_property (object_class, PROP_CONNECTION, properties[PROP_CONNECTION]);
+
+    properties[PROP_AT_PIPELINE] =
+        g_param_spec_boolean (MM_BASE_MODEM_AT_PIPELINE,
+                              "AT pipeline",
+                              "Whether the modem accepts several queries "
+                              "in a single AT command line.",
+                              FALSE,
+                              G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_AT_PIPELINE, properties[PROP_AT_PIPELINE]);
 }
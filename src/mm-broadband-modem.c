@@ -44,6 +44,7 @@
 #include "mm-modem-helpers.h"
 #include "mm-error-helpers.h"
 #include "mm-qcdm-serial-port.h"
+#include "mm-context.h"
 #include "libqcdm/src/errors.h"
 #include "libqcdm/src/commands.h"
 
@@ -173,6 +174,10 @@ struct _MMBroadbandModemPrivate {
     /*<--- Modem Time interface --->*/
     /* Properties */
     GObject *modem_time_dbus_skeleton;
+
+    /* QCDM log codes requested with --qcdm-log-codes, while enabled */
+    MMQcdmSerialPort *qcdm_log_port;
+    guint qcdm_log_listener_id;
 };
 
 /*****************************************************************************/
@@ -1361,8 +1366,12 @@ modem_load_signal_quality (MMIfaceModem *self,
                                              modem_load_signal_quality);
 
     /* Check whether we can get a non-connected AT port */
-    ctx->port = (MMSerialPort *)mm_base_modem_get_best_at_port (MM_BASE_MODEM (self), &error);
+    ctx->port = (MMSerialPort *)mm_base_modem_at_peek_port_for_command (
+        MM_BASE_MODEM (self),
+        MM_BROADBAND_MODEM (self)->priv->modem_cind_supported ? "+CIND?" : "+CSQ",
+        &error);
     if (ctx->port) {
+        g_object_ref (ctx->port);
         if (MM_BROADBAND_MODEM (self)->priv->modem_cind_supported)
             signal_quality_cind (ctx);
         else
@@ -2392,6 +2401,9 @@ registration_state_changed (MMAtSerialPort *port,
                                                           act,
                                                           lac,
                                                           cell_id);
+
+    /* Reported by the modem itself, delay the next periodic check */
+    mm_iface_modem_3gpp_registration_state_indication (MM_IFACE_MODEM_3GPP (self));
 }
 
 static void
@@ -4328,21 +4340,57 @@ modem_messaging_enable_unsolicited_events (MMIfaceModemMessaging *self,
 /*****************************************************************************/
 /* Load initial list of SMS parts (Messaging interface) */
 
+/* The listing is streamed: each +CMGL record is decoded as soon as it is
+ * received, and the parts are handed over to the SMS list in batches */
+#define SMS_LIST_BATCH_SIZE 32
+
 typedef struct {
     MMBroadbandModem *self;
     GSimpleAsyncResult *result;
     MMSmsStorage list_storage;
+    MMSmsPart *batch_parts[SMS_LIST_BATCH_SIZE];
+    MMSmsState batch_states[SMS_LIST_BATCH_SIZE];
+    guint batch_len;
+    guint n_records;
+    guint n_parts;
+    /* Text mode only, compiled once per listing */
+    GRegex *text_part_regex;
 } ListPartsContext;
 
 static void
 list_parts_context_complete_and_free (ListPartsContext *ctx)
 {
     g_simple_async_result_complete (ctx->result);
+    if (ctx->text_part_regex)
+        g_regex_unref (ctx->text_part_regex);
     g_object_unref (ctx->result);
     g_object_unref (ctx->self);
     g_free (ctx);
 }
 
+static void
+list_parts_flush (ListPartsContext *ctx)
+{
+    mm_iface_modem_messaging_take_parts (MM_IFACE_MODEM_MESSAGING (ctx->self),
+                                         ctx->batch_parts,
+                                         ctx->batch_states,
+                                         ctx->batch_len,
+                                         ctx->list_storage);
+    ctx->batch_len = 0;
+}
+
+static void
+list_parts_add (ListPartsContext *ctx,
+                MMSmsPart *part,
+                MMSmsState state)
+{
+    ctx->batch_parts[ctx->batch_len] = part;
+    ctx->batch_states[ctx->batch_len] = state;
+    ctx->n_parts++;
+    if (++ctx->batch_len == SMS_LIST_BATCH_SIZE)
+        list_parts_flush (ctx);
+}
+
 static gboolean
 modem_messaging_load_initial_sms_parts_finish (MMIfaceModemMessaging *self,
                                                GAsyncResult *res,
@@ -4368,114 +4416,91 @@ sms_state_from_str (const gchar *str)
     return MM_SMS_STATE_UNKNOWN;
 }
 
+static GRegex *
+sms_text_part_regex_new (void)
+{
+    GRegex *regex;
+
+    /* +CMGL: <index>,<stat>,<oa/da>,[alpha],<scts><CR><LF><data> */
+    regex = g_regex_new ("^\\+CMGL:\\s*(\\d+)\\s*,\\s*([^,]*),\\s*([^,]*),\\s*([^,]*),\\s*([^\\r\\n]*)\\r\\n([^\\r\\n]*)",
+                         G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, NULL);
+    g_assert (regex);
+    return regex;
+}
+
 static void
-sms_text_part_list_ready (MMBroadbandModem *self,
-                          GAsyncResult *res,
-                          ListPartsContext *ctx)
+sms_text_part_record (MMBroadbandModem *self,
+                      const gchar *record,
+                      ListPartsContext *ctx)
 {
-    GRegex *r;
     GMatchInfo *match_info = NULL;
-    const gchar *response;
-    GError *error = NULL;
-
-    response = mm_base_modem_at_command_finish (MM_BASE_MODEM (self), res, &error);
-    if (error) {
-        g_simple_async_result_take_error (ctx->result, error);
-        list_parts_context_complete_and_free (ctx);
-        return;
-    }
+    MMSmsPart *part;
+    guint idx;
+    gchar *number, *timestamp, *text, *ucs2_text, *stat;
+    gsize ucs2_len = 0;
+    GByteArray *raw;
 
-    /* +CMGL: <index>,<stat>,<oa/da>,[alpha],<scts><CR><LF><data><CR><LF> */
-    r = g_regex_new ("\\+CMGL:\\s*(\\d+)\\s*,\\s*([^,]*),\\s*([^,]*),\\s*([^,]*),\\s*([^\\r\\n]*)\\r\\n([^\\r\\n]*)",
-                     0, 0, NULL);
-    g_assert (r);
+    ctx->n_records++;
 
-    if (!g_regex_match_full (r, response, strlen (response), 0, 0, &match_info, NULL)) {
-        g_simple_async_result_set_error (ctx->result,
-                                         MM_CORE_ERROR,
-                                         MM_CORE_ERROR_INVALID_ARGS,
-                                         "Couldn't parse SMS list response");
-        list_parts_context_complete_and_free (ctx);
-        g_regex_unref (r);
-        return;
+    if (!g_regex_match (ctx->text_part_regex, record, 0, &match_info)) {
+        mm_dbg ("Failed to match CMGL response record");
+        goto out;
     }
 
-    while (g_match_info_matches (match_info)) {
-        MMSmsPart *part;
-        guint matches, idx;
-        gchar *number, *timestamp, *text, *ucs2_text, *stat;
-        gsize ucs2_len = 0;
-        GByteArray *raw;
-
-        matches = g_match_info_get_match_count (match_info);
-        if (matches != 7) {
-            mm_dbg ("Failed to match entire CMGL response (count %d)", matches);
-            goto next;
-        }
-
-        if (!mm_get_uint_from_match_info (match_info, 1, &idx)) {
-            mm_dbg ("Failed to convert message index");
-            goto next;
-        }
+    if (!mm_get_uint_from_match_info (match_info, 1, &idx)) {
+        mm_dbg ("Failed to convert message index");
+        goto out;
+    }
 
-        /* Get and parse number */
-        number = mm_get_string_unquoted_from_match_info (match_info, 3);
-        if (!number) {
-            mm_dbg ("Failed to get message sender number");
-            goto next;
-        }
+    /* Get and parse number */
+    number = mm_get_string_unquoted_from_match_info (match_info, 3);
+    if (!number) {
+        mm_dbg ("Failed to get message sender number");
+        goto out;
+    }
 
-        number = mm_broadband_modem_take_and_convert_to_utf8 (MM_BROADBAND_MODEM (self),
-                                                              number);
+    number = mm_broadband_modem_take_and_convert_to_utf8 (MM_BROADBAND_MODEM (self),
+                                                          number);
 
-        /* Get part state */
-        stat = mm_get_string_unquoted_from_match_info (match_info, 2);
-        if (!stat) {
-            mm_dbg ("Failed to get part status");
-            g_free (number);
-            goto next;
-        }
+    /* Get part state */
+    stat = mm_get_string_unquoted_from_match_info (match_info, 2);
+    if (!stat) {
+        mm_dbg ("Failed to get part status");
+        g_free (number);
+        goto out;
+    }
 
-        /* Get and parse timestamp (always expected in ASCII) */
-        timestamp = mm_get_string_unquoted_from_match_info (match_info, 5);
+    /* Get and parse timestamp (always expected in ASCII) */
+    timestamp = mm_get_string_unquoted_from_match_info (match_info, 5);
 
-        /* Get and parse text */
-        text = mm_broadband_modem_take_and_convert_to_utf8 (MM_BROADBAND_MODEM (self),
-                                                            g_match_info_fetch (match_info, 6));
+    /* Get and parse text */
+    text = mm_broadband_modem_take_and_convert_to_utf8 (MM_BROADBAND_MODEM (self),
+                                                        g_match_info_fetch (match_info, 6));
 
-        /* The raw SMS data can only be GSM, UCS2, or unknown (8-bit), so we
-         * need to convert to UCS2 here.
-         */
-        ucs2_text = g_convert (text, -1, "UCS-2BE//TRANSLIT", "UTF-8", NULL, &ucs2_len, NULL);
-        g_assert (ucs2_text);
-        raw = g_byte_array_sized_new (ucs2_len);
-        g_byte_array_append (raw, (const guint8 *) ucs2_text, ucs2_len);
-        g_free (ucs2_text);
-
-        /* all take() methods pass ownership of the value as well */
-        part = mm_sms_part_new (idx);
-        mm_sms_part_take_number (part, number);
-        mm_sms_part_take_timestamp (part, timestamp);
-        mm_sms_part_take_text (part, text);
-        mm_sms_part_take_data (part, raw);
-        mm_sms_part_set_data_coding_scheme (part, 2); /* DCS = UCS2 */
-        mm_sms_part_set_class (part, 0);
-
-        mm_dbg ("Correctly parsed SMS list entry (%d)", idx);
-        mm_iface_modem_messaging_take_part (MM_IFACE_MODEM_MESSAGING (self),
-                                            part,
-                                            sms_state_from_str (stat),
-                                            ctx->list_storage);
-        g_free (stat);
-next:
-        g_match_info_next (match_info, NULL);
-    }
+    /* The raw SMS data can only be GSM, UCS2, or unknown (8-bit), so we
+     * need to convert to UCS2 here.
+     */
+    ucs2_text = (gchar *) mm_charset_utf8_to_ucs2be (text, &ucs2_len);
+    g_assert (ucs2_text);
+    raw = g_byte_array_sized_new (ucs2_len);
+    g_byte_array_append (raw, (const guint8 *) ucs2_text, ucs2_len);
+    g_free (ucs2_text);
+
+    /* all take() methods pass ownership of the value as well */
+    part = mm_sms_part_new (idx);
+    mm_sms_part_take_number (part, number);
+    mm_sms_part_take_timestamp (part, timestamp);
+    mm_sms_part_take_text (part, text);
+    mm_sms_part_take_data (part, raw);
+    mm_sms_part_set_data_coding_scheme (part, 2); /* DCS = UCS2 */
+    mm_sms_part_set_class (part, 0);
+
+    mm_dbg ("Correctly parsed SMS list entry (%d)", idx);
+    list_parts_add (ctx, part, sms_state_from_str (stat));
+    g_free (stat);
+
+out:
     g_match_info_free (match_info);
-    g_regex_unref (r);
-
-    /* We consider all done */
-    g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
-    list_parts_context_complete_and_free (ctx);
 }
 
 static MMSmsState
@@ -4496,60 +4521,58 @@ sms_state_from_index (guint index)
 }
 
 static void
-sms_pdu_part_list_ready (MMBroadbandModem *self,
-                         GAsyncResult *res,
-                         ListPartsContext *ctx)
+sms_pdu_part_record (MMBroadbandModem *self,
+                     const gchar *record,
+                     ListPartsContext *ctx)
 {
-    const gchar *response;
+    MMSmsPart *part;
+    gint idx;
+    gint status;
+    gint tpdu_len;
+    gchar pdu[SMS_MAX_PDU_LEN + 1];
+    gint rv;
     GError *error = NULL;
 
-    response = mm_base_modem_at_command_finish (MM_BASE_MODEM (self), res, &error);
-    if (error) {
-        g_simple_async_result_take_error (ctx->result, error);
-        list_parts_context_complete_and_free (ctx);
+    ctx->n_records++;
+
+    rv = sscanf (record,
+                 "+CMGL: %d,%d,,%d %" G_STRINGIFY (SMS_MAX_PDU_LEN) "s",
+                 &idx, &status, &tpdu_len, pdu);
+    if (4 != rv) {
+        mm_dbg ("Couldn't parse CMGL response record: only %d fields parsed", rv);
         return;
     }
 
-    while (*response) {
-        MMSmsPart *part;
-        gint idx;
-        gint status;
-        gint tpdu_len;
-        gchar pdu[SMS_MAX_PDU_LEN + 1];
-        gint offset;
-        gint rv;
-
-        rv = sscanf (response,
-                     "+CMGL: %d,%d,,%d %" G_STRINGIFY (SMS_MAX_PDU_LEN) "s %n",
-                     &idx, &status, &tpdu_len, pdu, &offset);
-        if (4 != rv) {
-            g_simple_async_result_set_error (ctx->result,
-                                             MM_CORE_ERROR,
-                                             MM_CORE_ERROR_INVALID_ARGS,
-                                             "Couldn't parse SMS list response: "
-                                             "only %d fields parsed",
-                                             rv);
-            list_parts_context_complete_and_free (ctx);
-            return;
-        }
+    part = mm_sms_part_new_from_pdu (idx, pdu, &error);
+    if (part) {
+        mm_dbg ("Correctly parsed PDU (%d)", idx);
+        list_parts_add (ctx, part, sms_state_from_index (status));
+    } else {
+        /* Don't treat the error as critical */
+        mm_dbg ("Error parsing PDU (%d): %s", idx, error->message);
+        g_error_free (error);
+    }
+}
 
-        /* Will try to keep on the loop */
-        response += offset;
+static void
+sms_part_list_ready (MMBroadbandModem *self,
+                     GAsyncResult *res,
+                     ListPartsContext *ctx)
+{
+    GError *error = NULL;
 
-        part = mm_sms_part_new_from_pdu (idx, pdu, &error);
-        if (part) {
-            mm_dbg ("Correctly parsed PDU (%d)", idx);
-            mm_iface_modem_messaging_take_part (MM_IFACE_MODEM_MESSAGING (self),
-                                                part,
-                                                sms_state_from_index (status),
-                                                ctx->list_storage);
-        } else {
-            /* Don't treat the error as critical */
-            mm_dbg ("Error parsing PDU (%d): %s", idx, error->message);
-            g_error_free (error);
-        }
+    /* Whatever was decoded is valid, even if the listing didn't finish */
+    list_parts_flush (ctx);
+
+    mm_base_modem_at_command_finish (MM_BASE_MODEM (self), res, &error);
+    if (error) {
+        g_simple_async_result_take_error (ctx->result, error);
+        list_parts_context_complete_and_free (ctx);
+        return;
     }
 
+    mm_dbg ("Listed %u SMS parts (%u records)", ctx->n_parts, ctx->n_records);
+
     /* We consider all done */
     g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
     list_parts_context_complete_and_free (ctx);
@@ -4573,18 +4596,23 @@ list_parts_storage_ready (MMBroadbandModem *self,
 
     /* Storage now set */
 
+    if (!MM_BROADBAND_MODEM (self)->priv->modem_messaging_sms_pdu_mode)
+        ctx->text_part_regex = sms_text_part_regex_new ();
+
     /* Get SMS parts from ALL types.
      * Different command to be used if we are on Text or PDU mode */
-    mm_base_modem_at_command (MM_BASE_MODEM (self),
-                              (MM_BROADBAND_MODEM (self)->priv->modem_messaging_sms_pdu_mode ?
-                               "+CMGL=4" :
-                               "+CMGL=\"ALL\""),
-                              20,
-                              FALSE,
-                              (GAsyncReadyCallback) (MM_BROADBAND_MODEM (self)->priv->modem_messaging_sms_pdu_mode ?
-                                                     sms_pdu_part_list_ready :
-                                                     sms_text_part_list_ready),
-                              ctx);
+    mm_base_modem_at_command_streamed (MM_BASE_MODEM (self),
+                                       (MM_BROADBAND_MODEM (self)->priv->modem_messaging_sms_pdu_mode ?
+                                        "+CMGL=4" :
+                                        "+CMGL=\"ALL\""),
+                                       "+CMGL:",
+                                       20,
+                                       (MMBaseModemAtRecordFn) (MM_BROADBAND_MODEM (self)->priv->modem_messaging_sms_pdu_mode ?
+                                                                sms_pdu_part_record :
+                                                                sms_text_part_record),
+                                       ctx,
+                                       (GAsyncReadyCallback) sms_part_list_ready,
+                                       ctx);
 }
 
 static void
@@ -5932,6 +5960,102 @@ setup_ports (MMBroadbandModem *self)
     g_regex_unref (regex);
 }
 
+/*****************************************************************************/
+/* QCDM log reporting */
+
+static void
+qcdm_log_records (MMQcdmSerialPort *port,
+                  const MMQcdmLogRecord *records,
+                  guint n_records,
+                  guint n_dropped,
+                  MMBroadbandModem *self)
+{
+    static const gchar *u32_items[] = {
+        QCDM_CMD_LOG_ITEM_WCDMA_CELL_ID,
+        QCDM_CMD_LOG_ITEM_WCDMA_RX_AGC,
+        QCDM_CMD_LOG_ITEM_WCDMA_TX_AGC,
+        QCDM_CMD_LOG_ITEM_GSM_ARFCN,
+        QCDM_CMD_LOG_ITEM_GSM_BSIC,
+        QCDM_CMD_LOG_ITEM_GSM_CELL_ID,
+        NULL
+    };
+    static const gchar *u8_items[] = {
+        QCDM_CMD_LOG_ITEM_WCDMA_RRC_STATE,
+        QCDM_CMD_LOG_ITEM_GSM_BAND,
+        QCDM_CMD_LOG_ITEM_CDMA_BAND_CLASS,
+        QCDM_CMD_LOG_ITEM_CDMA_RPC_RECORDS,
+        NULL
+    };
+    GString *str;
+    guint i;
+
+    if (n_dropped)
+        mm_info ("(%s) %u QCDM log records dropped",
+                 mm_port_get_device (MM_PORT (port)),
+                 n_dropped);
+
+    str = g_string_sized_new (128);
+    for (i = 0; i < n_records; i++) {
+        guint j;
+
+        if (records[i].type != MM_QCDM_LOG_RECORD_TYPE_LOG || !records[i].result)
+            continue;
+
+        g_string_printf (str, "QCDM log 0x%04X at %" G_GUINT64_FORMAT ":",
+                         records[i].code,
+                         records[i].timestamp);
+
+        for (j = 0; u32_items[j]; j++) {
+            u_int32_t value;
+
+            if (qcdm_result_get_u32 (records[i].result, u32_items[j], &value) == 0)
+                g_string_append_printf (str, " %s=%u", u32_items[j], value);
+        }
+        for (j = 0; u8_items[j]; j++) {
+            u_int8_t value;
+
+            if (qcdm_result_get_u8 (records[i].result, u8_items[j], &value) == 0)
+                g_string_append_printf (str, " %s=%u", u8_items[j], value);
+        }
+
+        mm_info ("(%s) %s", mm_port_get_device (MM_PORT (port)), str->str);
+    }
+    g_string_free (str, TRUE);
+}
+
+static void
+qcdm_log_start (MMBroadbandModem *self)
+{
+    const guint16 *log_codes;
+
+    log_codes = mm_context_get_qcdm_log_codes ();
+    if (!log_codes || self->priv->qcdm_log_port)
+        return;
+
+    self->priv->qcdm_log_port = mm_base_modem_get_port_qcdm (MM_BASE_MODEM (self));
+    if (!self->priv->qcdm_log_port)
+        return;
+
+    self->priv->qcdm_log_listener_id =
+        mm_qcdm_serial_port_add_log_listener (self->priv->qcdm_log_port,
+                                              log_codes,
+                                              FALSE,
+                                              (MMQcdmLogFn)qcdm_log_records,
+                                              self);
+}
+
+static void
+qcdm_log_stop (MMBroadbandModem *self)
+{
+    if (!self->priv->qcdm_log_port)
+        return;
+
+    mm_qcdm_serial_port_remove_log_listener (self->priv->qcdm_log_port,
+                                             self->priv->qcdm_log_listener_id);
+    self->priv->qcdm_log_listener_id = 0;
+    g_clear_object (&self->priv->qcdm_log_port);
+}
+
 /*****************************************************************************/
 
 typedef enum {
@@ -6058,6 +6182,8 @@ disabling_step (DisablingContext *ctx)
 
     switch (ctx->step) {
     case DISABLING_STEP_FIRST:
+        /* Stop QCDM logging while the port is still open */
+        qcdm_log_stop (ctx->self);
         /* Fall down to next step */
         ctx->step++;
 
@@ -6440,6 +6566,8 @@ enabling_step (EnablingContext *ctx)
         ctx->step++;
 
     case ENABLING_STEP_LAST:
+        /* Ports are open now */
+        qcdm_log_start (ctx->self);
         /* All enabled without errors! */
         g_simple_async_result_set_op_res_gboolean (G_SIMPLE_ASYNC_RESULT (ctx->result), TRUE);
         enabling_context_complete_and_free (ctx);
@@ -6857,6 +6985,12 @@ initialize_step (InitializeContext *ctx)
             return;
         }
 
+        /* Locked or not, the modem gets exported as soon as we complete; the
+         * properties not needed for that are loaded afterwards, in
+         * background. Initializing again after unlocking doesn't load them
+         * twice at once. */
+        mm_iface_modem_load_deferred_properties (MM_IFACE_MODEM (ctx->self));
+
         if (ctx->self->priv->modem_state == MM_MODEM_STATE_LOCKED) {
             /* We're locked :-/ */
             g_simple_async_result_set_error (ctx->result,
@@ -7225,6 +7359,8 @@ dispose (GObject *object)
 {
     MMBroadbandModem *self = MM_BROADBAND_MODEM (object);
 
+    qcdm_log_stop (self);
+
     if (self->priv->modem_dbus_skeleton) {
         mm_iface_modem_shutdown (MM_IFACE_MODEM (object));
         g_clear_object (&self->priv->modem_dbus_skeleton);
@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "mm-charsets.h"
 #include "mm-utils.h"
@@ -43,18 +44,38 @@ static CharsetEntry charset_map[] = {
     { NULL,      NULL,     NULL,        NULL,                  MM_MODEM_CHARSET_UNKNOWN }
 };
 
+/* Charsets are single bits, so entries are found by bit number */
+static const CharsetEntry *
+charset_entry (MMModemCharset charset)
+{
+    static const CharsetEntry *by_bit[32];
+    static gboolean initialized = FALSE;
+    gint bit;
+
+    if (G_UNLIKELY (!initialized)) {
+        const CharsetEntry *iter;
+
+        for (iter = &charset_map[0]; iter->gsm_name; iter++)
+            by_bit[g_bit_nth_lsf (iter->charset, -1)] = iter;
+        initialized = TRUE;
+    }
+
+    bit = g_bit_nth_lsf (charset, -1);
+    if (bit < 0 || charset != (1U << bit))
+        return NULL;
+    return by_bit[bit];
+}
+
 const char *
 mm_modem_charset_to_string (MMModemCharset charset)
 {
-    CharsetEntry *iter = &charset_map[0];
+    const CharsetEntry *entry;
 
     g_return_val_if_fail (charset != MM_MODEM_CHARSET_UNKNOWN, NULL);
 
-    while (iter->gsm_name) {
-        if (iter->charset == charset)
-            return iter->gsm_name;
-        iter++;
-    }
+    entry = charset_entry (charset);
+    if (entry)
+        return entry->gsm_name;
     g_warn_if_reached ();
     return NULL;
 }
@@ -76,36 +97,316 @@ mm_modem_charset_from_string (const char *string)
     return MM_MODEM_CHARSET_UNKNOWN;
 }
 
-static const char *
-charset_iconv_to (MMModemCharset charset)
+/*****************************************************************************/
+/* Conversions from and to UTF-8
+ *
+ * iconv descriptors are opened on first use and kept, as opening one costs
+ * far more than most of the conversions done with it; they're just reset
+ * before each use. Like the rest of the daemon, this is only used from the
+ * main thread. Output is appended to caller-provided byte arrays.
+ */
+
+typedef enum {
+    CONVERTER_ENCODE,         /* UTF-8 to charset, transliterating */
+    CONVERTER_ENCODE_STRICT,  /* UTF-8 to charset */
+    CONVERTER_DECODE,         /* Charset to UTF-8 */
+    N_CONVERTERS
+} ConverterType;
+
+static GIConv converters[G_N_ELEMENTS (charset_map)][N_CONVERTERS];
+
+static gsize gsm_to_utf8 (const guint8 *gsm, gsize len, guint8 *utf8);
+static gboolean utf8_to_gsm (const char *utf8, gsize len, gboolean translit, guint8 *gsm, gsize *out_len);
+
+static gboolean
+charset_is_convertible (const CharsetEntry *entry)
 {
-    CharsetEntry *iter = &charset_map[0];
+    return (entry->charset == MM_MODEM_CHARSET_GSM || entry->iconv_from_name);
+}
 
-    g_return_val_if_fail (charset != MM_MODEM_CHARSET_UNKNOWN, NULL);
+static GIConv
+charset_get_converter (const CharsetEntry *entry, ConverterType type)
+{
+    GIConv *cd = &converters[entry - charset_map][type];
+
+    if (*cd == NULL) {
+        const char *to = NULL, *from = NULL;
+
+        switch (type) {
+        case CONVERTER_ENCODE:
+            to = entry->iconv_to_name;
+            from = "UTF-8";
+            break;
+        case CONVERTER_ENCODE_STRICT:
+            to = entry->iconv_from_name;
+            from = "UTF-8";
+            break;
+        case CONVERTER_DECODE:
+            to = "UTF-8//TRANSLIT";
+            from = entry->iconv_from_name;
+            break;
+        default:
+            g_assert_not_reached ();
+        }
 
-    while (iter->gsm_name) {
-        if (iter->charset == charset)
-            return iter->iconv_to_name;
-        iter++;
+        /* Failures are kept as well, so they aren't retried every time */
+        if (to && from)
+            *cd = g_iconv_open (to, from);
+        else
+            *cd = (GIConv) -1;
     }
-    g_warn_if_reached ();
-    return NULL;
+
+    return *cd;
 }
 
-static const char *
-charset_iconv_from (MMModemCharset charset)
+static gboolean
+charset_iconv (const CharsetEntry *entry,
+               ConverterType type,
+               const gchar *in,
+               gsize in_len,
+               GByteArray *out)
 {
-    CharsetEntry *iter = &charset_map[0];
+    GIConv cd;
+    guint start = out->len;
+    gsize used = start;
+    gchar *inp = (gchar *) in;
+    gsize inleft = in_len;
+    gboolean flush = FALSE;
+
+    cd = charset_get_converter (entry, type);
+    if (cd == (GIConv) -1)
+        return FALSE;
 
-    g_return_val_if_fail (charset != MM_MODEM_CHARSET_UNKNOWN, NULL);
+    /* Start from the initial state, whatever the last use left */
+    g_iconv (cd, NULL, NULL, NULL, NULL);
 
-    while (iter->gsm_name) {
-        if (iter->charset == charset)
-            return iter->iconv_from_name;
-        iter++;
+    g_byte_array_set_size (out, start + in_len * 2 + 8);
+    for (;;) {
+        gchar *outp = (gchar *) out->data + used;
+        gsize outleft = out->len - used;
+        gsize res;
+
+        /* Once all input is converted, write out any final shift sequence */
+        if (flush)
+            res = g_iconv (cd, NULL, NULL, &outp, &outleft);
+        else
+            res = g_iconv (cd, &inp, &inleft, &outp, &outleft);
+        used = (guint8 *) outp - out->data;
+
+        if (res == (gsize) -1) {
+            if (errno == E2BIG) {
+                g_byte_array_set_size (out, out->len * 2);
+                continue;
+            }
+            /* Invalid or incomplete input */
+            g_byte_array_set_size (out, start);
+            return FALSE;
+        }
+
+        if (flush)
+            break;
+        flush = TRUE;
     }
-    g_warn_if_reached ();
-    return NULL;
+
+    g_byte_array_set_size (out, used);
+    return TRUE;
+}
+
+/* UCS-2 is converted directly; chars it can't represent (outside the BMP,
+ * surrogates) or invalid input make these fail, so that iconv is used for
+ * them and keeps its transliteration and error handling. */
+
+static gboolean
+utf8_to_ucs2be (const char *utf8, gsize len, GByteArray *out)
+{
+    const char *p, *end = utf8 + len;
+    guint start = out->len;
+    guint8 *ucs2;
+
+    /* Every char takes at least one byte in UTF-8 and two in UCS-2 */
+    g_byte_array_set_size (out, start + len * 2);
+    ucs2 = out->data + start;
+
+    for (p = utf8; p < end; p = g_utf8_next_char (p)) {
+        gunichar c;
+
+        c = g_utf8_get_char_validated (p, end - p);
+        if (c > 0xFFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+            /* Also (gunichar) -1 and -2 for invalid input */
+            g_byte_array_set_size (out, start);
+            return FALSE;
+        }
+        *ucs2++ = c >> 8;
+        *ucs2++ = c & 0xFF;
+    }
+
+    g_byte_array_set_size (out, ucs2 - out->data);
+    return TRUE;
+}
+
+static gboolean
+ucs2be_to_utf8 (const guint8 *ucs2, gsize len, GByteArray *out)
+{
+    guint start = out->len;
+    guint8 *p;
+    gsize i;
+
+    if (len % 2)
+        return FALSE;
+
+    /* Up to 3 bytes in UTF-8 for each UCS-2 char */
+    g_byte_array_set_size (out, start + (len / 2) * 3);
+    p = out->data + start;
+
+    for (i = 0; i < len; i += 2) {
+        gunichar c = (ucs2[i] << 8) | ucs2[i + 1];
+
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            g_byte_array_set_size (out, start);
+            return FALSE;
+        }
+        if (c < 0x80)
+            *p++ = c;
+        else
+            p += g_unichar_to_utf8 (c, (gchar *) p);
+    }
+
+    g_byte_array_set_size (out, p - out->data);
+    return TRUE;
+}
+
+static gboolean
+charset_encode (const CharsetEntry *entry,
+                gboolean translit,
+                const char *utf8,
+                gsize len,
+                GByteArray *out)
+{
+    guint start = out->len;
+
+    switch (entry->charset) {
+    case MM_MODEM_CHARSET_UCS2:
+        if (utf8_to_ucs2be (utf8, len, out))
+            return TRUE;
+        break;
+    case MM_MODEM_CHARSET_GSM:
+        if (!g_utf8_validate (utf8, len, NULL))
+            return FALSE;
+        /* Worst case, every char escaped */
+        g_byte_array_set_size (out, start + len * 2);
+        if (!utf8_to_gsm (utf8, len, translit, out->data + start, &len)) {
+            g_byte_array_set_size (out, start);
+            return FALSE;
+        }
+        g_byte_array_set_size (out, start + len);
+        return TRUE;
+    default:
+        break;
+    }
+
+    return charset_iconv (entry,
+                          translit ? CONVERTER_ENCODE : CONVERTER_ENCODE_STRICT,
+                          utf8, len, out);
+}
+
+static gboolean
+charset_decode (const CharsetEntry *entry,
+                const guint8 *in,
+                gsize len,
+                GByteArray *out)
+{
+    guint start = out->len;
+
+    switch (entry->charset) {
+    case MM_MODEM_CHARSET_UCS2:
+        if (ucs2be_to_utf8 (in, len, out))
+            return TRUE;
+        break;
+    case MM_MODEM_CHARSET_GSM:
+        /* Worst case, 2 bytes per char */
+        g_byte_array_set_size (out, start + len * 2);
+        g_byte_array_set_size (out, start + gsm_to_utf8 (in, len, out->data + start));
+        return TRUE;
+    default:
+        break;
+    }
+
+    return charset_iconv (entry, CONVERTER_DECODE, (const gchar *) in, len, out);
+}
+
+static gchar *
+byte_array_free_to_string (GByteArray *array)
+{
+    g_byte_array_append (array, (const guint8 *) "\0", 1);
+    return (gchar *) g_byte_array_free (array, FALSE);
+}
+
+static gboolean
+hex_decode (const char *hex, gsize hex_len, guint8 *out)
+{
+    gsize i;
+
+    for (i = 0; i < hex_len; i += 2) {
+        int a = utils_hex2byte (&hex[i]);
+
+        if (a < 0)
+            return FALSE;
+        *out++ = a;
+    }
+    return TRUE;
+}
+
+static gchar *
+hex_encode (const guint8 *bin, gsize len)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    gchar *hex, *p;
+    gsize i;
+
+    hex = p = g_malloc (len * 2 + 1);
+    for (i = 0; i < len; i++) {
+        *p++ = digits[bin[i] >> 4];
+        *p++ = digits[bin[i] & 0xF];
+    }
+    *p = '\0';
+    return hex;
+}
+
+guint8 *
+mm_charset_utf8_to_ucs2be (const char *utf8, gsize *out_len)
+{
+    GByteArray *ucs2;
+    gsize len;
+
+    g_return_val_if_fail (utf8 != NULL, NULL);
+
+    len = strlen (utf8);
+    ucs2 = g_byte_array_sized_new (len * 2 + 2);
+    if (!charset_encode (charset_entry (MM_MODEM_CHARSET_UCS2), TRUE, utf8, len, ucs2)) {
+        g_byte_array_free (ucs2, TRUE);
+        return NULL;
+    }
+
+    if (out_len)
+        *out_len = ucs2->len;
+    /* Terminated as g_convert() would */
+    g_byte_array_append (ucs2, (const guint8 *) "\0\0", 2);
+    return g_byte_array_free (ucs2, FALSE);
+}
+
+gchar *
+mm_charset_ucs2be_to_utf8 (const guint8 *ucs2, gsize len)
+{
+    GByteArray *utf8;
+
+    g_return_val_if_fail (ucs2 != NULL, NULL);
+
+    utf8 = g_byte_array_sized_new ((len / 2) * 3 + 1);
+    if (!charset_decode (charset_entry (MM_MODEM_CHARSET_UCS2), ucs2, len, utf8)) {
+        g_byte_array_free (utf8, TRUE);
+        return NULL;
+    }
+    return byte_array_free_to_string (utf8);
 }
 
 gboolean
@@ -114,102 +415,102 @@ mm_modem_charset_byte_array_append (GByteArray *array,
                                     gboolean quoted,
                                     MMModemCharset charset)
 {
-    const char *iconv_to;
-    char *converted;
-    GError *error = NULL;
-    gsize written = 0;
+    const CharsetEntry *entry;
+    guint start;
 
     g_return_val_if_fail (array != NULL, FALSE);
     g_return_val_if_fail (utf8 != NULL, FALSE);
 
-    iconv_to = charset_iconv_to (charset);
-    g_return_val_if_fail (iconv_to != NULL, FALSE);
+    entry = charset_entry (charset);
+    g_return_val_if_fail (entry != NULL && charset_is_convertible (entry), FALSE);
 
-    converted = g_convert (utf8, -1, iconv_to, "UTF-8", NULL, &written, &error);
-    if (!converted) {
-        if (error) {
-            g_warning ("%s: failed to convert '%s' to %s character set: (%d) %s",
-                       __func__, utf8, iconv_to,
-                       error->code, error->message);
-            g_error_free (error);
-        }
+    start = array->len;
+    if (quoted)
+        g_byte_array_append (array, (const guint8 *) "\"", 1);
+
+    if (!charset_encode (entry, TRUE, utf8, strlen (utf8), array)) {
+        g_warning ("%s: failed to convert '%s' to %s character set",
+                   __func__, utf8, entry->gsm_name);
+        g_byte_array_set_size (array, start);
         return FALSE;
     }
 
     if (quoted)
         g_byte_array_append (array, (const guint8 *) "\"", 1);
-    g_byte_array_append (array, (const guint8 *) converted, written);
-    if (quoted)
-        g_byte_array_append (array, (const guint8 *) "\"", 1);
-
-    g_free (converted);
     return TRUE;
 }
 
 char *
 mm_modem_charset_hex_to_utf8 (const char *src, MMModemCharset charset)
 {
-    char *unconverted, *converted;
-    const char *iconv_from;
-    gsize unconverted_len = 0;
-    GError *error = NULL;
+    const CharsetEntry *entry;
+    guint8 buf[256], *bin;
+    GByteArray *utf8 = NULL;
+    gsize len;
+    gboolean success;
 
     g_return_val_if_fail (src != NULL, NULL);
     g_return_val_if_fail (charset != MM_MODEM_CHARSET_UNKNOWN, NULL);
 
-    iconv_from = charset_iconv_from (charset);
-    g_return_val_if_fail (iconv_from != NULL, FALSE);
-
-    unconverted = utils_hexstr2bin (src, &unconverted_len);
-    if (!unconverted)
-        return NULL;
+    entry = charset_entry (charset);
+    g_return_val_if_fail (entry != NULL && charset_is_convertible (entry), NULL);
 
-    if (charset == MM_MODEM_CHARSET_UTF8 || charset == MM_MODEM_CHARSET_IRA)
-        return unconverted;
+    /* Length must be a multiple of 2 */
+    len = strlen (src);
+    g_return_val_if_fail ((len % 2) == 0, NULL);
 
-    converted = g_convert (unconverted, unconverted_len,
-                           "UTF-8//TRANSLIT", iconv_from,
-                           NULL, NULL, &error);
-    if (!converted || error) {
-        g_clear_error (&error);
-        converted = NULL;
+    if (charset == MM_MODEM_CHARSET_UTF8 || charset == MM_MODEM_CHARSET_IRA) {
+        bin = g_malloc (len / 2 + 1);
+        if (!hex_decode (src, len, bin)) {
+            g_free (bin);
+            return NULL;
+        }
+        bin[len / 2] = '\0';
+        return (char *) bin;
     }
 
-    g_free (unconverted);
+    /* Short strings, which are most, are decoded on the stack */
+    bin = (len / 2 <= sizeof (buf)) ? buf : g_malloc (len / 2);
+    success = hex_decode (src, len, bin);
+    if (success) {
+        utf8 = g_byte_array_sized_new (len + 1);
+        success = charset_decode (entry, bin, len / 2, utf8);
+        if (!success)
+            g_byte_array_free (utf8, TRUE);
+    }
+    if (bin != buf)
+        g_free (bin);
 
-    return converted;
+    return success ? byte_array_free_to_string (utf8) : NULL;
 }
 
 char *
 mm_modem_charset_utf8_to_hex (const char *src, MMModemCharset charset)
 {
-    gsize converted_len = 0;
-    char *converted;
-    const char *iconv_to;
-    GError *error = NULL;
+    const CharsetEntry *entry;
+    GByteArray *converted;
     gchar *hex;
+    gsize len;
 
     g_return_val_if_fail (src != NULL, NULL);
     g_return_val_if_fail (charset != MM_MODEM_CHARSET_UNKNOWN, NULL);
 
-    iconv_to = charset_iconv_from (charset);
-    g_return_val_if_fail (iconv_to != NULL, FALSE);
+    entry = charset_entry (charset);
+    g_return_val_if_fail (entry != NULL && charset_is_convertible (entry), NULL);
 
     if (charset == MM_MODEM_CHARSET_UTF8 || charset == MM_MODEM_CHARSET_IRA)
         return g_strdup (src);
 
-    converted = g_convert (src, strlen (src),
-                           iconv_to, "UTF-8//TRANSLIT",
-                           NULL, &converted_len, &error);
-    if (!converted || error) {
-        g_clear_error (&error);
-        g_free (converted);
+    len = strlen (src);
+    converted = g_byte_array_sized_new (len * 2);
+    if (!charset_encode (entry, FALSE, src, len, converted)) {
+        g_byte_array_free (converted, TRUE);
         return NULL;
     }
 
     /* Get hex representation of the string */
-    hex = utils_bin2hexstr ((guint8 *)converted, converted_len);
-    g_free (converted);
+    hex = hex_encode (converted->data, converted->len);
+    g_byte_array_free (converted, TRUE);
     return hex;
 }
 
@@ -302,33 +603,6 @@ static const GsmUtf8Mapping gsm_def_utf8_alphabet[GSM_DEF_ALPHABET_SIZE] = {
     TWO(0xc3, 0xb6), TWO(0xc3, 0xb1), TWO(0xc3, 0xbc), TWO(0xc3, 0xa0)
 };
 
-static guint8
-gsm_def_char_to_utf8 (const guint8 gsm, guint8 out_utf8[2])
-{
-    g_return_val_if_fail (gsm < GSM_DEF_ALPHABET_SIZE, 0);
-    memcpy (&out_utf8[0], &gsm_def_utf8_alphabet[gsm].chars[0], gsm_def_utf8_alphabet[gsm].len);
-    return gsm_def_utf8_alphabet[gsm].len;
-}
-
-static gboolean
-utf8_to_gsm_def_char (const char *utf8, guint32 len, guint8 *out_gsm)
-{
-    int i;
-
-    if (len > 0 && len < 4) {
-        for (i = 0; i < GSM_DEF_ALPHABET_SIZE; i++) {
-            if (gsm_def_utf8_alphabet[i].len == len) {
-                if (memcmp (&gsm_def_utf8_alphabet[i].chars[0], utf8, len) == 0) {
-                    *out_gsm = i;
-                    return TRUE;
-                }
-            }
-        }
-    }
-    return FALSE;
-}
-
-
 #define EONE(a, g)        { {a, 0x00, 0x00}, 1, g }
 #define ETHR(a, b, c, g)  { {a, b,    c},    3, g }
 
@@ -349,130 +623,220 @@ static const GsmUtf8Mapping gsm_ext_utf8_alphabet[GSM_EXT_ALPHABET_SIZE] = {
 
 #define GSM_ESCAPE_CHAR 0x1b
 
-static guint8
-gsm_ext_char_to_utf8 (const guint8 gsm, guint8 out_utf8[3])
+/* Reverse lookup from Unicode code points to GSM characters, built from the
+ * tables above on first use. All of the default alphabet and all but one of
+ * the extended one (the euro sign) is below GSM_UNICHAR_TABLE_SIZE. */
+#define GSM_UNICHAR_TABLE_SIZE 0x400
+#define GSM_UNICHAR_NONE       0xFF
+#define GSM_UNICHAR_EXT        0x80
+
+static guint8 gsm_from_unichar[GSM_UNICHAR_TABLE_SIZE];
+static gunichar gsm_ext_unichar[GSM_EXT_ALPHABET_SIZE];
+/* Index in gsm_ext_utf8_alphabet plus one, or 0 */
+static guint8 gsm_ext_index[GSM_DEF_ALPHABET_SIZE];
+
+static gunichar
+mapping_to_unichar (const GsmUtf8Mapping *m)
 {
+    /* The escape code in the default alphabet has no valid UTF-8 mapping */
+    return g_utf8_get_char_validated (m->chars, m->len);
+}
+
+static void
+gsm_tables_init (void)
+{
+    static gsize initialized = 0;
+    gunichar c;
     int i;
 
+    if (!g_once_init_enter (&initialized))
+        return;
+
+    memset (gsm_from_unichar, GSM_UNICHAR_NONE, sizeof (gsm_from_unichar));
+
+    for (i = 0; i < GSM_DEF_ALPHABET_SIZE; i++) {
+        c = mapping_to_unichar (&gsm_def_utf8_alphabet[i]);
+        if (c < GSM_UNICHAR_TABLE_SIZE)
+            gsm_from_unichar[c] = i;
+    }
+
+    /* Extended chars take precedence over default ones */
     for (i = 0; i < GSM_EXT_ALPHABET_SIZE; i++) {
-        if (gsm == gsm_ext_utf8_alphabet[i].gsm) {
-            memcpy (&out_utf8[0], &gsm_ext_utf8_alphabet[i].chars[0], gsm_ext_utf8_alphabet[i].len);
-            return gsm_ext_utf8_alphabet[i].len;
-        }
+        c = mapping_to_unichar (&gsm_ext_utf8_alphabet[i]);
+        gsm_ext_unichar[i] = c;
+        if (c < GSM_UNICHAR_TABLE_SIZE)
+            gsm_from_unichar[c] = GSM_UNICHAR_EXT | gsm_ext_utf8_alphabet[i].gsm;
+        gsm_ext_index[gsm_ext_utf8_alphabet[i].gsm] = i + 1;
     }
-    return 0;
+
+    g_once_init_leave (&initialized, 1);
+}
+
+static guint8
+gsm_def_char_to_utf8 (const guint8 gsm, guint8 out_utf8[2])
+{
+    g_return_val_if_fail (gsm < GSM_DEF_ALPHABET_SIZE, 0);
+    memcpy (&out_utf8[0], &gsm_def_utf8_alphabet[gsm].chars[0], gsm_def_utf8_alphabet[gsm].len);
+    return gsm_def_utf8_alphabet[gsm].len;
 }
 
+static guint8
+gsm_ext_char_to_utf8 (const guint8 gsm, guint8 out_utf8[3])
+{
+    const GsmUtf8Mapping *m;
+
+    if (gsm >= GSM_DEF_ALPHABET_SIZE || !gsm_ext_index[gsm])
+        return 0;
+
+    m = &gsm_ext_utf8_alphabet[gsm_ext_index[gsm] - 1];
+    memcpy (&out_utf8[0], &m->chars[0], m->len);
+    return m->len;
+}
+
+/* Returns whether 'c' is in the GSM charset, and sets 'out_gsm' to its
+ * value in the default alphabet or, if 'out_ext' is set to TRUE, in the
+ * extended one. */
 static gboolean
-utf8_to_gsm_ext_char (const char *utf8, guint32 len, guint8 *out_gsm)
+unichar_to_gsm (gunichar c, guint8 *out_gsm, gboolean *out_ext)
 {
+    guint8 g;
     int i;
 
-    if (len > 0 && len < 4) {
-        for (i = 0; i < GSM_EXT_ALPHABET_SIZE; i++) {
-            if (gsm_ext_utf8_alphabet[i].len == len) {
-                if (memcmp (&gsm_ext_utf8_alphabet[i].chars[0], utf8, len) == 0) {
-                    *out_gsm = gsm_ext_utf8_alphabet[i].gsm;
-                    return TRUE;
-                }
-            }
+    gsm_tables_init ();
+
+    if (c < GSM_UNICHAR_TABLE_SIZE) {
+        g = gsm_from_unichar[c];
+        if (g == GSM_UNICHAR_NONE)
+            return FALSE;
+        *out_gsm = g & ~GSM_UNICHAR_EXT;
+        *out_ext = !!(g & GSM_UNICHAR_EXT);
+        return TRUE;
+    }
+
+    for (i = 0; i < GSM_EXT_ALPHABET_SIZE; i++) {
+        if (gsm_ext_unichar[i] == c) {
+            *out_gsm = gsm_ext_utf8_alphabet[i].gsm;
+            *out_ext = TRUE;
+            return TRUE;
         }
     }
     return FALSE;
 }
 
-guint8 *
-mm_charset_gsm_unpacked_to_utf8 (const guint8 *gsm, guint32 len)
+/* 'utf8' must have room for 2 bytes per GSM char; returns the length */
+static gsize
+gsm_to_utf8 (const guint8 *gsm, gsize len, guint8 *utf8)
 {
-    int i;
-    GByteArray *utf8;
+    guint8 *p = utf8;
+    gsize i;
 
-    g_return_val_if_fail (gsm != NULL, NULL);
-    g_return_val_if_fail (len < 4096, NULL);
-
-    /* worst case initial length */
-    utf8 = g_byte_array_sized_new (len * 2 + 1);
+    gsm_tables_init ();
 
     for (i = 0; i < len; i++) {
-        guint8 uchars[4];
         guint8 ulen;
 
         if (gsm[i] == GSM_ESCAPE_CHAR) {
             /* Extended alphabet, decode next char */
-            ulen = gsm_ext_char_to_utf8 (gsm[i+1], uchars);
+            ulen = (i + 1 < len) ? gsm_ext_char_to_utf8 (gsm[i+1], p) : 0;
             if (ulen)
                 i += 1;
+        } else if (gsm[i] < 0x80 && gsm_def_utf8_alphabet[gsm[i]].len == 1) {
+            /* Plain ASCII, most of the time */
+            *p++ = gsm_def_utf8_alphabet[gsm[i]].chars[0];
+            continue;
         } else {
             /* Default alphabet */
-            ulen = gsm_def_char_to_utf8 (gsm[i], uchars);
+            ulen = gsm_def_char_to_utf8 (gsm[i], p);
         }
 
         if (ulen)
-            g_byte_array_append (utf8, &uchars[0], ulen);
+            p += ulen;
         else
-            g_byte_array_append (utf8, (guint8 *) "?", 1);
+            *p++ = '?';
     }
 
-    g_byte_array_append (utf8, (guint8 *) "\0", 1);  /* NULL terminator */
-    return g_byte_array_free (utf8, FALSE);
+    return p - utf8;
 }
 
-guint8 *
-mm_charset_utf8_to_unpacked_gsm (const char *utf8, guint32 *out_len)
+/* 'gsm' must have room for 2 GSM chars per byte of valid UTF-8 input, as
+ * all chars might need escaping. Chars not in the GSM charset are skipped if
+ * 'translit' is set, and make the conversion fail otherwise. */
+static gboolean
+utf8_to_gsm (const char *utf8,
+             gsize len,
+             gboolean translit,
+             guint8 *gsm,
+             gsize *out_len)
 {
-    GByteArray *gsm;
-    const char *c = utf8, *next = c;
-    static const guint8 gesc = GSM_ESCAPE_CHAR;
-    int i = 0;
+    const char *c, *end = utf8 + len;
+    guint8 *p = gsm;
 
-    g_return_val_if_fail (utf8 != NULL, NULL);
-    g_return_val_if_fail (out_len != NULL, NULL);
-    g_return_val_if_fail (g_utf8_validate (utf8, -1, NULL), NULL);
+    gsm_tables_init ();
+
+    for (c = utf8; c < end; c = g_utf8_next_char (c)) {
+        guint8 gch;
+        gboolean ext;
 
-    /* worst case initial length */
-    gsm = g_byte_array_sized_new (g_utf8_strlen (utf8, -1) * 2 + 1);
+        if (!unichar_to_gsm (g_utf8_get_char (c), &gch, &ext)) {
+            if (translit)
+                continue;
+            return FALSE;
+        }
 
-    if (*utf8 == 0x00) {
-        /* Zero-length string */
-        g_byte_array_append (gsm, (guint8 *) "\0", 1);
-        *out_len = 0;
-        return g_byte_array_free (gsm, FALSE);
+        if (ext)
+            *p++ = GSM_ESCAPE_CHAR;
+        *p++ = gch;
     }
 
-    while (next && *next) {
-        guint8 gch = 0x3f;  /* 0x3f == '?' */
+    *out_len = p - gsm;
+    return TRUE;
+}
+
+guint8 *
+mm_charset_gsm_unpacked_to_utf8 (const guint8 *gsm, guint32 len)
+{
+    guint8 *utf8;
+
+    g_return_val_if_fail (gsm != NULL, NULL);
+    g_return_val_if_fail (len < 4096, NULL);
 
-        next = g_utf8_next_char (c);
+    /* worst case length: 2 bytes per default char, 3 per escaped pair */
+    utf8 = g_malloc (len * 2 + 1);
+    utf8[gsm_to_utf8 (gsm, len, utf8)] = '\0';
+    return utf8;
+}
 
-        /* Try escaped chars first, then default alphabet */
-        if (utf8_to_gsm_ext_char (c, next - c, &gch)) {
-            /* Add the escape char */
-            g_byte_array_append (gsm, &gesc, 1);
-            g_byte_array_append (gsm, &gch, 1);
-        } else if (utf8_to_gsm_def_char (c, next - c, &gch))
-            g_byte_array_append (gsm, &gch, 1);
+guint8 *
+mm_charset_utf8_to_unpacked_gsm (const char *utf8, guint32 *out_len)
+{
+    guint8 *gsm;
+    gsize len;
 
-        c = next;
-        i++;
-    }
+    g_return_val_if_fail (utf8 != NULL, NULL);
+    g_return_val_if_fail (out_len != NULL, NULL);
+    g_return_val_if_fail (g_utf8_validate (utf8, -1, NULL), NULL);
 
-    *out_len = gsm->len;
-    return g_byte_array_free (gsm, FALSE);
+    /* worst case length, every char escaped */
+    len = strlen (utf8);
+    gsm = g_malloc (len * 2 + 1);
+    utf8_to_gsm (utf8, len, TRUE, gsm, &len);
+    gsm[len] = '\0';
+    *out_len = len;
+    return gsm;
 }
 
 static gboolean
 gsm_is_subset (gunichar c, const char *utf8, gsize ulen, guint *out_clen)
 {
     guint8 gsm;
+    gboolean ext = FALSE;
 
     *out_clen = 1;
-    if (utf8_to_gsm_def_char (utf8, ulen, &gsm))
-        return TRUE;
-    if (utf8_to_gsm_ext_char (utf8, ulen, &gsm)) {
+    if (!unichar_to_gsm (c, &gsm, &ext))
+        return FALSE;
+    if (ext)
         *out_clen = 2;
-        return TRUE;
-    }
-    return FALSE;
+    return TRUE;
 }
 
 static gboolean
@@ -634,18 +998,51 @@ mm_charset_get_encoded_len (const char *utf8,
     return len;
 }
 
+/* Septets are packed LSB first, so 8 of them fill exactly 7 octets which
+ * can be handled as one little endian word. */
+
+static inline guint64
+load_le64 (const guint8 *p)
+{
+    guint64 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT64_FROM_LE (v);
+}
+
+static inline void
+store_le56 (guint8 *p, guint64 v)
+{
+    v = GUINT64_TO_LE (v);
+    memcpy (p, &v, 7);
+}
+
 guint8 *
 gsm_unpack (const guint8 *gsm,
             guint32 num_septets,
             guint8 start_offset,  /* in _bits_ */
             guint32 *out_unpacked_len)
 {
-    GByteArray *unpacked;
-    int i;
-
-    unpacked = g_byte_array_sized_new (num_septets + 1);
+    guint8 *unpacked;
+    guint32 packed_len, i = 0;
+
+    packed_len = (start_offset + num_septets * 7 + 7) / 8;
+    unpacked = g_malloc (num_septets + 1);
+
+    /* 8 septets at a time, as long as a whole word can be read */
+    for (; i + 8 <= num_septets; i += 8) {
+        guint32 start_bit = start_offset + (i * 7);
+        guint64 word;
+        int j;
+
+        if (start_bit / 8 + 8 > packed_len)
+            break;
+        word = load_le64 (&gsm[start_bit / 8]) >> (start_bit % 8);
+        for (j = 0; j < 8; j++, word >>= 7)
+            unpacked[i + j] = word & 0x7F;
+    }
 
-    for (i = 0; i < num_septets; i++) {
+    for (; i < num_septets; i++) {
         guint8 bits_here, bits_in_next, octet, offset, c;
         guint32 start_bit;
 
@@ -663,11 +1060,12 @@ gsm_unpack (const guint8 *gsm,
             octet = gsm[(start_bit / 8) + 1];
             c |= (octet & (0xFF >> (8 - bits_in_next))) << bits_here;
         }
-        g_byte_array_append (unpacked, &c, 1);
+        unpacked[i] = c;
     }
 
-    *out_unpacked_len = unpacked->len;
-    return g_byte_array_free (unpacked, FALSE);
+    unpacked[num_septets] = 0;
+    *out_unpacked_len = num_septets;
+    return unpacked;
 }
 
 guint8 *
@@ -677,8 +1075,9 @@ gsm_pack (const guint8 *src,
           guint32 *out_packed_len)
 {
     guint8 *packed;
-    guint octet = 0, lshift, plen;
-    int i = 0;
+    guint octet = 0, plen, nbits;
+    guint64 acc;
+    guint32 i = 0;
 
     g_return_val_if_fail (start_offset < 8, NULL);
 
@@ -689,16 +1088,35 @@ gsm_pack (const guint8 *src,
 
     packed = g_malloc0 (plen);
 
-    for (i = 0, lshift = start_offset; i < src_len; i++) {
-        packed[octet] |= (src[i] & 0x7F) << lshift;
-        if (lshift > 1) {
-            /* Grab the lost bits and add to next octet */
-            g_assert (octet + 1 < plen);
-            packed[octet + 1] = (src[i] & 0x7F) >> (8 - lshift);
+    /* Pending bits not yet written out, fewer than 8 */
+    acc = 0;
+    nbits = start_offset;
+
+    for (; i + 8 <= src_len; i += 8) {
+        guint64 word = 0;
+        int j;
+
+        for (j = 7; j >= 0; j--)
+            word = (word << 7) | (src[i + j] & 0x7F);
+        acc |= word << nbits;
+        store_le56 (&packed[octet], acc);
+        octet += 7;
+        acc >>= 56;
+    }
+
+    for (; i < src_len; i++) {
+        acc |= (guint64) (src[i] & 0x7F) << nbits;
+        nbits += 7;
+        if (nbits >= 8) {
+            packed[octet++] = acc & 0xFF;
+            acc >>= 8;
+            nbits -= 8;
         }
-        if (lshift)
-            octet++;
-        lshift = lshift ? lshift - 1 : 7;
+    }
+
+    if (nbits) {
+        g_assert (octet < plen);
+        packed[octet] = acc & 0xFF;
     }
 
     if (out_packed_len)
@@ -734,15 +1152,15 @@ mm_charset_take_and_convert_to_utf8 (gchar *str,
     case MM_MODEM_CHARSET_8859_1:
     case MM_MODEM_CHARSET_PCCP437:
     case MM_MODEM_CHARSET_PCDN: {
-        const gchar *iconv_from;
-        GError *error = NULL;
-
-        iconv_from = charset_iconv_from (charset);
-        utf8 = g_convert (str, strlen (str),
-                          "UTF-8//TRANSLIT", iconv_from,
-                          NULL, NULL, &error);
-        if (!utf8 || error) {
-            g_clear_error (&error);
+        GByteArray *array;
+        gsize len;
+
+        len = strlen (str);
+        array = g_byte_array_sized_new (len * 2 + 1);
+        if (charset_decode (charset_entry (charset), (const guint8 *) str, len, array))
+            utf8 = byte_array_free_to_string (array);
+        else {
+            g_byte_array_free (array, TRUE);
             utf8 = NULL;
         }
 
@@ -837,15 +1255,15 @@ mm_utf8_take_and_convert_to_charset (gchar *str,
     case MM_MODEM_CHARSET_8859_1:
     case MM_MODEM_CHARSET_PCCP437:
     case MM_MODEM_CHARSET_PCDN: {
-        const gchar *iconv_to;
-        GError *error = NULL;
-
-        iconv_to = charset_iconv_from (charset);
-        encoded = g_convert (str, strlen (str),
-                             iconv_to, "UTF-8",
-                             NULL, NULL, &error);
-        if (!encoded || error) {
-            g_clear_error (&error);
+        GByteArray *array;
+        gsize len;
+
+        len = strlen (str);
+        array = g_byte_array_sized_new (len * 2 + 1);
+        if (charset_encode (charset_entry (charset), FALSE, str, len, array))
+            encoded = byte_array_free_to_string (array);
+        else {
+            g_byte_array_free (array, TRUE);
             encoded = NULL;
         }
 
@@ -854,24 +1272,18 @@ mm_utf8_take_and_convert_to_charset (gchar *str,
     }
 
     case MM_MODEM_CHARSET_UCS2: {
-        const gchar *iconv_to;
-        gsize encoded_len = 0;
-        GError *error = NULL;
-        gchar *hex;
-
-        iconv_to = charset_iconv_from (charset);
-        encoded = g_convert (str, strlen (str),
-                             iconv_to, "UTF-8",
-                             NULL, &encoded_len, &error);
-        if (!encoded || error) {
-            g_clear_error (&error);
-            encoded = NULL;
-        }
+        GByteArray *array;
+        gsize len;
 
         /* Get hex representation of the string */
-        hex = utils_bin2hexstr ((guint8 *)encoded, encoded_len);
-        g_free (encoded);
-        encoded = hex;
+        len = strlen (str);
+        array = g_byte_array_sized_new (len * 2);
+        if (charset_encode (charset_entry (charset), FALSE, str, len, array))
+            encoded = hex_encode (array->data, array->len);
+        else
+            encoded = NULL;
+
+        g_byte_array_free (array, TRUE);
         g_free (str);
         break;
     }
@@ -53,6 +53,12 @@ char *mm_modem_charset_hex_to_utf8 (const char *src, MMModemCharset charset);
  */
 char *mm_modem_charset_utf8_to_hex (const char *src, MMModemCharset charset);
 
+/* Conversions between UTF-8 and big endian UCS-2, as used in SMS. Both return
+ * NULL if the string can't be converted. */
+guint8 *mm_charset_utf8_to_ucs2be (const char *utf8, gsize *out_len);
+
+gchar *mm_charset_ucs2be_to_utf8 (const guint8 *ucs2, gsize len);
+
 guint8 *mm_charset_utf8_to_unpacked_gsm (const char *utf8, guint32 *out_len);
 
 guint8 *mm_charset_gsm_unpacked_to_utf8 (const guint8 *gsm, guint32 len);
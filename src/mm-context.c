@@ -21,15 +21,32 @@
 static gboolean debug;
 static const gchar *log_level;
 static const gchar *log_file;
+static const gchar *log_flush;
 static gboolean show_ts;
 static gboolean rel_ts;
+static gint capture_size;
+static const gchar *capture_dir;
+static gboolean sms_balance;
+static const gchar *probe_cache = MM_STATE_DIR "/probe-cache";
+static gboolean no_probe_cache;
+static gint probe_limit = 32;
+static const gchar *qcdm_log_codes_str;
+static guint16 *qcdm_log_codes;
 
 static const GOptionEntry entries[] = {
     { "debug", 0, 0, G_OPTION_ARG_NONE, &debug, "Run with extended debugging capabilities", NULL },
     { "log-level", 0, 0, G_OPTION_ARG_STRING, &log_level, "Log level: one of [ERR, WARN, INFO, DEBUG]", "INFO" },
     { "log-file", 0, 0, G_OPTION_ARG_STRING, &log_file, "Path to log file", NULL },
+    { "log-flush", 0, 0, G_OPTION_ARG_STRING, &log_flush, "Log file flush policy: one of [always, on-error, periodic, never]", "always" },
     { "timestamps", 0, 0, G_OPTION_ARG_NONE, &show_ts, "Show timestamps in log output", NULL },
     { "relative-timestamps", 0, 0, G_OPTION_ARG_NONE, &rel_ts, "Use relative timestamps (from MM start)", NULL },
+    { "capture-size", 0, 0, G_OPTION_ARG_INT, &capture_size, "KiB of raw serial traffic kept per port, 0 (default) to disable", "0" },
+    { "capture-dir", 0, 0, G_OPTION_ARG_STRING, &capture_dir, "Directory where serial traffic captures are written", MM_STATE_DIR "/captures" },
+    { "sms-balance", 0, 0, G_OPTION_ARG_NONE, &sms_balance, "Send SMS through the least busy modem, not only the one owning them", NULL },
+    { "probe-cache", 0, 0, G_OPTION_ARG_STRING, &probe_cache, "File where port probing results are kept between runs", MM_STATE_DIR "/probe-cache" },
+    { "no-probe-cache", 0, 0, G_OPTION_ARG_NONE, &no_probe_cache, "Always fully probe ports, ignoring previous results", NULL },
+    { "probe-limit", 0, 0, G_OPTION_ARG_INT, &probe_limit, "Maximum number of ports probed at once, 0 for no limit", "32" },
+    { "qcdm-log-codes", 0, 0, G_OPTION_ARG_STRING, &qcdm_log_codes_str, "Comma-separated QCDM log codes to enable and report in the log", "0x4127,0x4005" },
     { NULL }
 };
 
@@ -51,6 +68,12 @@ mm_context_get_log_file (void)
     return log_file;
 }
 
+const gchar *
+mm_context_get_log_flush (void)
+{
+    return log_flush;
+}
+
 gboolean
 mm_context_get_timestamps (void)
 {
@@ -63,6 +86,69 @@ mm_context_get_relative_timestamps (void)
     return rel_ts;
 }
 
+gsize
+mm_context_get_capture_size (void)
+{
+    return capture_size > 0 ? (gsize) capture_size * 1024 : 0;
+}
+
+const gchar *
+mm_context_get_capture_dir (void)
+{
+    return capture_dir ? capture_dir : MM_STATE_DIR "/captures";
+}
+
+gboolean
+mm_context_get_sms_balance (void)
+{
+    return sms_balance;
+}
+
+const gchar *
+mm_context_get_probe_cache (void)
+{
+    return no_probe_cache ? NULL : probe_cache;
+}
+
+guint
+mm_context_get_probe_limit (void)
+{
+    return probe_limit > 0 ? (guint) probe_limit : 0;
+}
+
+const guint16 *
+mm_context_get_qcdm_log_codes (void)
+{
+    return qcdm_log_codes;
+}
+
+/* Returns a 0-terminated array, or NULL if any code is invalid */
+static guint16 *
+parse_qcdm_log_codes (const gchar *str)
+{
+    gchar **split;
+    guint16 *codes;
+    guint i;
+
+    split = g_strsplit (str, ",", -1);
+    codes = g_new0 (guint16, g_strv_length (split) + 1);
+    for (i = 0; split[i]; i++) {
+        gchar *end = NULL;
+        gulong code;
+
+        code = strtoul (split[i], &end, 0);
+        if (end == split[i] || *end != '\0' || code == 0 || code > G_MAXUINT16) {
+            g_strfreev (split);
+            g_free (codes);
+            return NULL;
+        }
+        codes[i] = (guint16) code;
+    }
+    g_strfreev (split);
+
+    return codes;
+}
+
 void
 mm_context_init (gint argc,
                  gchar **argv)
@@ -82,6 +168,14 @@ mm_context_init (gint argc,
 
 	g_option_context_free (ctx);
 
+    if (qcdm_log_codes_str) {
+        qcdm_log_codes = parse_qcdm_log_codes (qcdm_log_codes_str);
+        if (!qcdm_log_codes) {
+            g_warning ("Invalid QCDM log codes: '%s'\n", qcdm_log_codes_str);
+            exit (1);
+        }
+    }
+
     /* Additional setup to be done on debug mode */
     if (debug) {
         log_level = "DEBUG";
@@ -24,7 +24,16 @@ void mm_context_init (gint argc,
 gboolean     mm_context_get_debug               (void);
 const gchar *mm_context_get_log_level           (void);
 const gchar *mm_context_get_log_file            (void);
+const gchar *mm_context_get_log_flush           (void);
 gboolean     mm_context_get_timestamps          (void);
 gboolean     mm_context_get_relative_timestamps (void);
+gsize        mm_context_get_capture_size        (void);
+const gchar *mm_context_get_capture_dir         (void);
+gboolean     mm_context_get_sms_balance         (void);
+const gchar *mm_context_get_probe_cache         (void);
+guint        mm_context_get_probe_limit         (void);
+
+/* 0-terminated, or NULL if none given */
+const guint16 *mm_context_get_qcdm_log_codes    (void);
 
 #endif /* MM_CONTEXT_H */
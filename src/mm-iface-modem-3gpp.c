@@ -25,8 +25,10 @@
 #include "mm-base-modem.h"
 #include "mm-modem-helpers.h"
 #include "mm-log.h"
+#include "mm-polling.h"
 
-#define REGISTRATION_CHECK_TIMEOUT_SEC 30
+#define REGISTRATION_CHECK_TIMEOUT_SEC     30
+#define REGISTRATION_CHECK_MAX_TIMEOUT_SEC 120
 
 #define SUBSYSTEM_3GPP "3gpp"
 
@@ -439,6 +441,7 @@ handle_scan (MmGdbusModem3gpp *skeleton,
 /*****************************************************************************/
 
 typedef struct {
+    MMIfaceModem3gpp *self;
     GSimpleAsyncResult *result;
     gboolean cs_supported;
     gboolean ps_supported;
@@ -454,6 +457,7 @@ run_all_registration_checks_context_complete_and_free (RunAllRegistrationChecksC
     g_clear_error (&ctx->cs_reg_error);
     g_clear_error (&ctx->ps_reg_error);
     g_object_unref (ctx->result);
+    g_object_unref (ctx->self);
     g_free (ctx);
 }
 
@@ -516,6 +520,7 @@ mm_iface_modem_3gpp_run_all_registration_checks (MMIfaceModem3gpp *self,
     RunAllRegistrationChecksContext *ctx;
 
     ctx = g_new0 (RunAllRegistrationChecksContext, 1);
+    ctx->self = g_object_ref (self);
     ctx->result = g_simple_async_result_new (G_OBJECT (self),
                                              callback,
                                              user_data,
@@ -864,15 +869,14 @@ mm_iface_modem_3gpp_update_ps_registration_state (MMIfaceModem3gpp *self,
 /*****************************************************************************/
 
 typedef struct {
-    guint timeout_source;
-    gboolean running;
+    MMPolling *polling;
+    MMModem3gppRegistrationState previous_state;
 } RegistrationCheckContext;
 
 static void
 registration_check_context_free (RegistrationCheckContext *ctx)
 {
-    if (ctx->timeout_source)
-        g_source_remove (ctx->timeout_source);
+    mm_polling_free (ctx->polling);
     g_free (ctx);
 }
 
@@ -889,26 +893,41 @@ periodic_registration_checks_ready (MMIfaceModem3gpp *self,
         g_error_free (error);
     }
 
-    /* Remove the running tag */
+    /* Schedule next check, unless checks got disabled meanwhile */
     ctx = g_object_get_qdata (G_OBJECT (self), registration_check_context_quark);
-    ctx->running = FALSE;
+    if (ctx)
+        mm_polling_done (ctx->polling,
+                         (get_consolidated_reg_state (get_registration_state_context (self)) !=
+                          ctx->previous_state));
 }
 
-static gboolean
+static void
 periodic_registration_check (MMIfaceModem3gpp *self)
 {
     RegistrationCheckContext *ctx;
 
-    /* Only launch a new one if not one running already */
+    /* Keep current state, to back off if it doesn't change */
     ctx = g_object_get_qdata (G_OBJECT (self), registration_check_context_quark);
-    if (!ctx->running) {
-        ctx->running = TRUE;
-        mm_iface_modem_3gpp_run_all_registration_checks (
-            self,
-            (GAsyncReadyCallback)periodic_registration_checks_ready,
-            NULL);
-    }
-    return TRUE;
+    ctx->previous_state = get_consolidated_reg_state (get_registration_state_context (self));
+
+    mm_iface_modem_3gpp_run_all_registration_checks (
+        self,
+        (GAsyncReadyCallback)periodic_registration_checks_ready,
+        NULL);
+}
+
+void
+mm_iface_modem_3gpp_registration_state_indication (MMIfaceModem3gpp *self)
+{
+    RegistrationCheckContext *ctx;
+
+    if (G_UNLIKELY (!registration_check_context_quark))
+        return;
+
+    /* Registration state reported by the modem itself, delay next check */
+    ctx = g_object_get_qdata (G_OBJECT (self), registration_check_context_quark);
+    if (ctx)
+        mm_polling_indication (ctx->polling);
 }
 
 static void
@@ -944,13 +963,15 @@ periodic_registration_check_enable (MMIfaceModem3gpp *self)
     /* Create context and keep it as object data */
     mm_dbg ("Periodic 3GPP registration checks enabled");
     ctx = g_new0 (RegistrationCheckContext, 1);
-    ctx->timeout_source = g_timeout_add_seconds (REGISTRATION_CHECK_TIMEOUT_SEC,
-                                                 (GSourceFunc)periodic_registration_check,
-                                                 self);
+    ctx->polling = mm_polling_new (REGISTRATION_CHECK_TIMEOUT_SEC,
+                                   REGISTRATION_CHECK_MAX_TIMEOUT_SEC,
+                                   (MMPollingFunc)periodic_registration_check,
+                                   self);
     g_object_set_qdata_full (G_OBJECT (self),
                              registration_check_context_quark,
                              ctx,
                              (GDestroyNotify)registration_check_context_free);
+    mm_polling_start (ctx->polling, FALSE);
 }
 
 /*****************************************************************************/
@@ -254,6 +254,11 @@ void mm_iface_modem_3gpp_update_ps_registration_state (MMIfaceModem3gpp *self,
                                                        gulong location_area_code,
                                                        gulong cell_id);
 
+/* Objects implementing this interface must call this after reporting a
+ * registration state received in an unsolicited message, so that the next
+ * periodic check is delayed. */
+void mm_iface_modem_3gpp_registration_state_indication (MMIfaceModem3gpp *self);
+
 /* Run all registration checks */
 void mm_iface_modem_3gpp_run_all_registration_checks (MMIfaceModem3gpp *self,
                                                       GAsyncReadyCallback callback,
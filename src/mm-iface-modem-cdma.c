@@ -23,8 +23,10 @@
 #include "mm-base-modem.h"
 #include "mm-modem-helpers.h"
 #include "mm-log.h"
+#include "mm-polling.h"
 
-#define REGISTRATION_CHECK_TIMEOUT_SEC 30
+#define REGISTRATION_CHECK_TIMEOUT_SEC     30
+#define REGISTRATION_CHECK_MAX_TIMEOUT_SEC 120
 
 #define SUBSYSTEM_CDMA1X "cdma1x"
 #define SUBSYSTEM_EVDO "evdo"
@@ -1005,15 +1007,15 @@ mm_iface_modem_cdma_update_cdma1x_registration_state (MMIfaceModemCdma *self,
 /*****************************************************************************/
 
 typedef struct {
-    guint timeout_source;
-    gboolean running;
+    MMPolling *polling;
+    MMModemCdmaRegistrationState previous_cdma1x_state;
+    MMModemCdmaRegistrationState previous_evdo_state;
 } RegistrationCheckContext;
 
 static void
 registration_check_context_free (RegistrationCheckContext *ctx)
 {
-    if (ctx->timeout_source)
-        g_source_remove (ctx->timeout_source);
+    mm_polling_free (ctx->polling);
     g_free (ctx);
 }
 
@@ -1030,26 +1032,38 @@ periodic_registration_checks_ready (MMIfaceModemCdma *self,
         g_error_free (error);
     }
 
-    /* Remove the running tag */
+    /* Schedule next check, unless checks got disabled meanwhile */
     ctx = g_object_get_qdata (G_OBJECT (self), registration_check_context_quark);
-    ctx->running = FALSE;
+    if (ctx) {
+        MMModemCdmaRegistrationState cdma1x_state = MM_MODEM_CDMA_REGISTRATION_STATE_UNKNOWN;
+        MMModemCdmaRegistrationState evdo_state = MM_MODEM_CDMA_REGISTRATION_STATE_UNKNOWN;
+
+        g_object_get (self,
+                      MM_IFACE_MODEM_CDMA_CDMA1X_REGISTRATION_STATE, &cdma1x_state,
+                      MM_IFACE_MODEM_CDMA_EVDO_REGISTRATION_STATE, &evdo_state,
+                      NULL);
+        mm_polling_done (ctx->polling,
+                         (cdma1x_state != ctx->previous_cdma1x_state ||
+                          evdo_state != ctx->previous_evdo_state));
+    }
 }
 
-static gboolean
+static void
 periodic_registration_check (MMIfaceModemCdma *self)
 {
     RegistrationCheckContext *ctx;
 
-    /* Only launch a new one if not one running already */
+    /* Keep current state, to back off if it doesn't change */
     ctx = g_object_get_qdata (G_OBJECT (self), registration_check_context_quark);
-    if (!ctx->running) {
-        ctx->running = TRUE;
-        mm_iface_modem_cdma_run_all_registration_checks (
-            self,
-            (GAsyncReadyCallback)periodic_registration_checks_ready,
-            NULL);
-    }
-    return TRUE;
+    g_object_get (self,
+                  MM_IFACE_MODEM_CDMA_CDMA1X_REGISTRATION_STATE, &ctx->previous_cdma1x_state,
+                  MM_IFACE_MODEM_CDMA_EVDO_REGISTRATION_STATE, &ctx->previous_evdo_state,
+                  NULL);
+
+    mm_iface_modem_cdma_run_all_registration_checks (
+        self,
+        (GAsyncReadyCallback)periodic_registration_checks_ready,
+        NULL);
 }
 
 static void
@@ -1085,13 +1099,15 @@ periodic_registration_check_enable (MMIfaceModemCdma *self)
     /* Create context and keep it as object data */
     mm_dbg ("Periodic CDMA registration checks enabled");
     ctx = g_new0 (RegistrationCheckContext, 1);
-    ctx->timeout_source = g_timeout_add_seconds (REGISTRATION_CHECK_TIMEOUT_SEC,
-                                                 (GSourceFunc)periodic_registration_check,
-                                                 self);
+    ctx->polling = mm_polling_new (REGISTRATION_CHECK_TIMEOUT_SEC,
+                                   REGISTRATION_CHECK_MAX_TIMEOUT_SEC,
+                                   (MMPollingFunc)periodic_registration_check,
+                                   self);
     g_object_set_qdata_full (G_OBJECT (self),
                              registration_check_context_quark,
                              ctx,
                              (GDestroyNotify)registration_check_context_free);
+    mm_polling_start (ctx->polling, FALSE);
 }
 
 /*****************************************************************************/
@@ -19,15 +19,18 @@
 #include "mm-iface-modem.h"
 #include "mm-iface-modem-messaging.h"
 #include "mm-sms-list.h"
+#include "mm-sms-send-queue.h"
 #include "mm-log.h"
 
 #define SUPPORT_CHECKED_TAG "messaging-support-checked-tag"
 #define SUPPORTED_TAG       "messaging-supported-tag"
 #define STORAGE_CONTEXT_TAG "messaging-storage-context-tag"
+#define SEND_QUEUE_TAG      "messaging-send-queue-tag"
 
 static GQuark support_checked_quark;
 static GQuark supported_quark;
 static GQuark storage_context_quark;
+static GQuark send_queue_quark;
 
 /*****************************************************************************/
 
@@ -37,6 +40,41 @@ mm_iface_modem_messaging_bind_simple_status (MMIfaceModemMessaging *self,
 {
 }
 
+/*****************************************************************************/
+/* Outgoing SMS queue, available while enabled */
+
+static void
+send_queue_release (MMSmsSendQueue *queue)
+{
+    mm_sms_send_queue_shutdown (queue);
+    g_object_unref (queue);
+}
+
+static void
+set_send_queue (MMIfaceModemMessaging *self,
+                MMSmsSendQueue *queue)
+{
+    if (G_UNLIKELY (!send_queue_quark))
+        send_queue_quark = (g_quark_from_static_string (
+                                SEND_QUEUE_TAG));
+
+    g_object_set_qdata_full (G_OBJECT (self),
+                             send_queue_quark,
+                             queue ? g_object_ref (queue) : NULL,
+                             (GDestroyNotify)send_queue_release);
+}
+
+MMSmsSendQueue *
+mm_iface_modem_messaging_peek_send_queue (MMIfaceModemMessaging *self)
+{
+    g_return_val_if_fail (MM_IS_IFACE_MODEM_MESSAGING (self), NULL);
+
+    if (G_UNLIKELY (!send_queue_quark))
+        return NULL;
+
+    return g_object_get_qdata (G_OBJECT (self), send_queue_quark);
+}
+
 /*****************************************************************************/
 
 typedef struct {
@@ -325,6 +363,27 @@ handle_list (MmGdbusModemMessaging *skeleton,
 
 /*****************************************************************************/
 
+static gboolean
+sms_list_take_part (MMSmsList *list,
+                    MMSmsPart *sms_part,
+                    MMSmsState state,
+                    MMSmsStorage storage)
+{
+    GError *error = NULL;
+    gboolean added;
+
+    added = mm_sms_list_take_part (list, sms_part, state, storage, &error);
+    if (!added) {
+        mm_dbg ("Couldn't take part in SMS list: '%s'", error->message);
+        g_error_free (error);
+
+        /* If part wasn't taken, we need to free the part ourselves */
+        mm_sms_part_free (sms_part);
+    }
+
+    return added;
+}
+
 gboolean
 mm_iface_modem_messaging_take_part (MMIfaceModemMessaging *self,
                                     MMSmsPart *sms_part,
@@ -332,24 +391,43 @@ mm_iface_modem_messaging_take_part (MMIfaceModemMessaging *self,
                                     MMSmsStorage storage)
 {
     MMSmsList *list = NULL;
-    GError *error = NULL;
     gboolean added;
 
     g_object_get (self,
                   MM_IFACE_MODEM_MESSAGING_SMS_LIST, &list,
                   NULL);
     g_assert (list != NULL);
-    added = mm_sms_list_take_part (list, sms_part, state, storage, &error);
-    if (!added) {
-        mm_dbg ("Couldn't take part in SMS list: '%s'", error->message);
-        g_error_free (error);
+    added = sms_list_take_part (list, sms_part, state, storage);
+    g_object_unref (list);
 
-        /* If part wasn't taken, we need to free the part ourselves */
-        mm_sms_part_free (sms_part);
+    return added;
+}
+
+guint
+mm_iface_modem_messaging_take_parts (MMIfaceModemMessaging *self,
+                                     MMSmsPart **sms_parts,
+                                     const MMSmsState *states,
+                                     guint n_parts,
+                                     MMSmsStorage storage)
+{
+    MMSmsList *list = NULL;
+    guint n_added = 0;
+    guint i;
+
+    if (!n_parts)
+        return 0;
+
+    g_object_get (self,
+                  MM_IFACE_MODEM_MESSAGING_SMS_LIST, &list,
+                  NULL);
+    g_assert (list != NULL);
+    for (i = 0; i < n_parts; i++) {
+        if (sms_list_take_part (list, sms_parts[i], states[i], storage))
+            n_added++;
     }
     g_object_unref (list);
 
-    return added;
+    return n_added;
 }
 
 /*****************************************************************************/
@@ -604,10 +682,11 @@ interface_disabling_step (DisablingContext *ctx)
         ctx->step++;
 
     case DISABLING_STEP_LAST:
-        /* Clear SMS list */
+        /* Clear SMS list and abort pending sends */
         g_object_set (ctx->self,
                       MM_IFACE_MODEM_MESSAGING_SMS_LIST, NULL,
                       NULL);
+        set_send_queue (ctx->self, NULL);
 
         /* We are done without errors! */
         g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
@@ -836,6 +915,11 @@ interface_enabling_step (EnablingContext *ctx)
     switch (ctx->step) {
     case ENABLING_STEP_FIRST: {
         MMSmsList *list;
+        MMSmsSendQueue *queue;
+
+        queue = mm_sms_send_queue_new (MM_BASE_MODEM (ctx->self));
+        set_send_queue (ctx->self, queue);
+        g_object_unref (queue);
 
         list = mm_sms_list_new (MM_BASE_MODEM (ctx->self));
         g_object_set (ctx->self,
@@ -1227,6 +1311,8 @@ mm_iface_modem_messaging_shutdown (MMIfaceModemMessaging *self)
 {
     g_return_if_fail (MM_IS_IFACE_MODEM_MESSAGING (self));
 
+    set_send_queue (self, NULL);
+
     /* Unexport DBus interface and remove the skeleton */
     mm_gdbus_object_skeleton_set_modem_messaging (MM_GDBUS_OBJECT_SKELETON (self), NULL);
     g_object_set (self,
@@ -22,6 +22,7 @@
 #include "mm-at-serial-port.h"
 #include "mm-sms-part.h"
 #include "mm-sms.h"
+#include "mm-sms-send-queue.h"
 
 #define MM_TYPE_IFACE_MODEM_MESSAGING               (mm_iface_modem_messaging_get_type ())
 #define MM_IFACE_MODEM_MESSAGING(obj)               (G_TYPE_CHECK_INSTANCE_CAST ((obj), MM_TYPE_IFACE_MODEM_MESSAGING, MMIfaceModemMessaging))
@@ -169,6 +170,18 @@ gboolean mm_iface_modem_messaging_take_part (MMIfaceModemMessaging *self,
                                              MMSmsState state,
                                              MMSmsStorage storage);
 
+/* Report several new SMS parts from the same storage at once, e.g. when
+ * listing them. 'states' holds the state of each part. Returns the number
+ * of parts actually taken. */
+guint mm_iface_modem_messaging_take_parts (MMIfaceModemMessaging *self,
+                                           MMSmsPart **sms_parts,
+                                           const MMSmsState *states,
+                                           guint n_parts,
+                                           MMSmsStorage storage);
+
+/* Queue where outgoing SMS are sent, NULL unless enabled */
+MMSmsSendQueue *mm_iface_modem_messaging_peek_send_queue (MMIfaceModemMessaging *self);
+
 /* Set preferred storages */
 void mm_iface_modem_messaging_set_preferred_storages (MMIfaceModemMessaging *self,
                                                       MMSmsStorage mem1,
@@ -25,20 +25,120 @@
 #include "mm-bearer-list.h"
 #include "mm-log.h"
 #include "mm-context.h"
+#include "mm-polling.h"
+#include "mm-staged-load.h"
+#include "mm-timer-wheel.h"
 
-#define SIGNAL_QUALITY_RECENT_TIMEOUT_SEC     60
-#define SIGNAL_QUALITY_CHECK_TIMEOUT_SEC      30
-#define ACCESS_TECHNOLOGIES_CHECK_TIMEOUT_SEC 30
+#define SIGNAL_QUALITY_RECENT_TIMEOUT_SEC         60
+#define SIGNAL_QUALITY_CHECK_TIMEOUT_SEC          30
+#define SIGNAL_QUALITY_CHECK_MAX_TIMEOUT_SEC      120
+#define ACCESS_TECHNOLOGIES_CHECK_TIMEOUT_SEC     30
+#define ACCESS_TECHNOLOGIES_CHECK_MAX_TIMEOUT_SEC 240
 
 #define STATE_UPDATE_CONTEXT_TAG              "state-update-context-tag"
 #define SIGNAL_QUALITY_UPDATE_CONTEXT_TAG     "signal-quality-update-context-tag"
 #define SIGNAL_QUALITY_CHECK_CONTEXT_TAG      "signal-quality-check-context-tag"
 #define ACCESS_TECHNOLOGIES_CHECK_CONTEXT_TAG "access-technologies-check-context-tag"
+#define STARTUP_CONTEXT_TAG                   "startup-context-tag"
+#define STAGED_LOAD_CONTEXT_TAG               "staged-load-context-tag"
 
 static GQuark state_update_context_quark;
 static GQuark signal_quality_update_context_quark;
 static GQuark signal_quality_check_context_quark;
 static GQuark access_technologies_check_context_quark;
+static GQuark startup_context_quark;
+static GQuark staged_load_context_quark;
+
+/*****************************************************************************/
+/* Startup timing */
+
+typedef struct {
+    /* When the Modem interface was first initialized, in monotonic time */
+    gint64 started;
+    /* Whether time-to-first-connect was already reported */
+    gboolean first_connect_reported;
+} StartupContext;
+
+static StartupContext *
+get_startup_context (MMIfaceModem *self)
+{
+    StartupContext *ctx;
+
+    if (G_UNLIKELY (!startup_context_quark))
+        startup_context_quark = (g_quark_from_static_string (
+                                     STARTUP_CONTEXT_TAG));
+
+    ctx = g_object_get_qdata (G_OBJECT (self), startup_context_quark);
+    if (!ctx) {
+        ctx = g_new0 (StartupContext, 1);
+        ctx->started = g_get_monotonic_time ();
+        g_object_set_qdata_full (G_OBJECT (self),
+                                 startup_context_quark,
+                                 ctx,
+                                 (GDestroyNotify)g_free);
+    }
+
+    return ctx;
+}
+
+static gdouble
+get_seconds_since_startup (MMIfaceModem *self)
+{
+    return ((g_get_monotonic_time () - get_startup_context (self)->started) /
+            (gdouble) G_USEC_PER_SEC);
+}
+
+static void
+report_first_connect (MMIfaceModem *self,
+                      const gchar *dbus_path)
+{
+    StartupContext *ctx;
+
+    ctx = get_startup_context (self);
+    if (ctx->first_connect_reported)
+        return;
+
+    ctx->first_connect_reported = TRUE;
+    mm_info ("Modem%s%s: first connection established %.3f s after initialization started",
+             dbus_path ? " " : "",
+             dbus_path ? dbus_path : "",
+             get_seconds_since_startup (self));
+}
+
+/*****************************************************************************/
+/* Deferred properties loading */
+
+static MMStagedLoad *
+get_staged_load_context (MMIfaceModem *self)
+{
+    MMStagedLoad *ctx;
+
+    if (G_UNLIKELY (!staged_load_context_quark))
+        staged_load_context_quark = (g_quark_from_static_string (
+                                         STAGED_LOAD_CONTEXT_TAG));
+
+    ctx = g_object_get_qdata (G_OBJECT (self), staged_load_context_quark);
+    if (!ctx) {
+        ctx = g_new0 (MMStagedLoad, 1);
+        g_object_set_qdata_full (G_OBJECT (self),
+                                 staged_load_context_quark,
+                                 ctx,
+                                 (GDestroyNotify)g_free);
+    }
+
+    return ctx;
+}
+
+static gboolean
+modem_is_usable (MMIfaceModem *self)
+{
+    MMModemState state = MM_MODEM_STATE_UNKNOWN;
+
+    g_object_get (self,
+                  MM_IFACE_MODEM_STATE, &state,
+                  NULL);
+    return state != MM_MODEM_STATE_FAILED;
+}
 
 /*****************************************************************************/
 
@@ -516,10 +616,13 @@ handle_list_bearers (MmGdbusModem *skeleton,
 
 /*****************************************************************************/
 
-void
-mm_iface_modem_update_access_technologies (MMIfaceModem *self,
-                                           MMModemAccessTechnology new_access_tech,
-                                           guint32 mask)
+static void access_technologies_check_indication (MMIfaceModem *self);
+
+/* Returns TRUE if the access technologies changed */
+static gboolean
+update_access_technologies (MMIfaceModem *self,
+                            MMModemAccessTechnology new_access_tech,
+                            guint32 mask)
 {
     MmGdbusModem *skeleton = NULL;
     MMModemAccessTechnology old_access_tech;
@@ -554,20 +657,28 @@ mm_iface_modem_update_access_technologies (MMIfaceModem *self,
     }
 
     g_object_unref (skeleton);
+    return (built_access_tech != old_access_tech);
+}
+
+void
+mm_iface_modem_update_access_technologies (MMIfaceModem *self,
+                                           MMModemAccessTechnology new_access_tech,
+                                           guint32 mask)
+{
+    update_access_technologies (self, new_access_tech, mask);
+    access_technologies_check_indication (self);
 }
 
 /*****************************************************************************/
 
 typedef struct {
-    guint timeout_source;
-    gboolean running;
+    MMPolling *polling;
 } AccessTechnologiesCheckContext;
 
 static void
 access_technologies_check_context_free (AccessTechnologiesCheckContext *ctx)
 {
-    if (ctx->timeout_source)
-        g_source_remove (ctx->timeout_source);
+    mm_polling_free (ctx->polling);
     g_free (ctx);
 }
 
@@ -579,6 +690,7 @@ access_technologies_check_ready (MMIfaceModem *self,
     MMModemAccessTechnology access_technologies = MM_MODEM_ACCESS_TECHNOLOGY_UNKNOWN;
     guint mask = MM_MODEM_ACCESS_TECHNOLOGY_ANY;
     AccessTechnologiesCheckContext *ctx;
+    gboolean changed = FALSE;
 
     if (!MM_IFACE_MODEM_GET_INTERFACE (self)->load_access_technologies_finish (
             self,
@@ -589,31 +701,35 @@ access_technologies_check_ready (MMIfaceModem *self,
         mm_dbg ("Couldn't refresh access technologies: '%s'", error->message);
         g_error_free (error);
     } else
-        mm_iface_modem_update_access_technologies (self, access_technologies, mask);
+        changed = update_access_technologies (self, access_technologies, mask);
 
-    /* Remove the running tag */
+    /* Schedule next check, unless checks got disabled meanwhile */
     ctx = g_object_get_qdata (G_OBJECT (self), access_technologies_check_context_quark);
-    ctx->running = FALSE;
+    if (ctx)
+        mm_polling_done (ctx->polling, changed);
 }
 
-static gboolean
+static void
 periodic_access_technologies_check (MMIfaceModem *self)
 {
-    AccessTechnologiesCheckContext *ctx;
+    MM_IFACE_MODEM_GET_INTERFACE (self)->load_access_technologies (
+        self,
+        (GAsyncReadyCallback)access_technologies_check_ready,
+        NULL);
+}
 
-    ctx = g_object_get_qdata (G_OBJECT (self), access_technologies_check_context_quark);
+static void
+access_technologies_check_indication (MMIfaceModem *self)
+{
+    AccessTechnologiesCheckContext *ctx;
 
-    /* Only launch a new one if not one running already OR if the last one run
-     * was more than 15s ago. */
-    if (!ctx->running) {
-        ctx->running = TRUE;
-        MM_IFACE_MODEM_GET_INTERFACE (self)->load_access_technologies (
-            self,
-            (GAsyncReadyCallback)access_technologies_check_ready,
-            NULL);
-    }
+    if (G_UNLIKELY (!access_technologies_check_context_quark))
+        return;
 
-    return TRUE;
+    /* Access technologies reported by the modem itself, delay next check */
+    ctx = g_object_get_qdata (G_OBJECT (self), access_technologies_check_context_quark);
+    if (ctx)
+        mm_polling_indication (ctx->polling);
 }
 
 static void
@@ -624,9 +740,9 @@ periodic_access_technologies_check_disable (MMIfaceModem *self)
                                                        ACCESS_TECHNOLOGIES_CHECK_CONTEXT_TAG));
 
     /* Clear access technology */
-    mm_iface_modem_update_access_technologies (self,
-                                               MM_MODEM_ACCESS_TECHNOLOGY_UNKNOWN,
-                                               MM_MODEM_ACCESS_TECHNOLOGY_ANY);
+    update_access_technologies (self,
+                                MM_MODEM_ACCESS_TECHNOLOGY_UNKNOWN,
+                                MM_MODEM_ACCESS_TECHNOLOGY_ANY);
 
     /* Overwriting the data will free the previous context */
     g_object_set_qdata (G_OBJECT (self),
@@ -656,29 +772,31 @@ periodic_access_technologies_check_enable (MMIfaceModem *self)
 
     /* If context is already there, we're already enabled */
     if (ctx) {
-        periodic_access_technologies_check (self);
+        mm_polling_start (ctx->polling, TRUE);
         return;
     }
 
-    /* Create context and keep it as object data */
+    /* Create context and keep it as object data. Checks are done every
+     * ACCESS_TECHNOLOGIES_CHECK_TIMEOUT_SEC, backing off while the value
+     * doesn't change or while the modem reports it by itself. */
     mm_dbg ("Periodic access technology checks enabled");
     ctx = g_new0 (AccessTechnologiesCheckContext, 1);
-    ctx->timeout_source = g_timeout_add_seconds (ACCESS_TECHNOLOGIES_CHECK_TIMEOUT_SEC,
-                                                 (GSourceFunc)periodic_access_technologies_check,
-                                                 self);
+    ctx->polling = mm_polling_new (ACCESS_TECHNOLOGIES_CHECK_TIMEOUT_SEC,
+                                   ACCESS_TECHNOLOGIES_CHECK_MAX_TIMEOUT_SEC,
+                                   (MMPollingFunc)periodic_access_technologies_check,
+                                   self);
     g_object_set_qdata_full (G_OBJECT (self),
                              access_technologies_check_context_quark,
                              ctx,
                              (GDestroyNotify)access_technologies_check_context_free);
 
     /* Get first access technology value */
-    periodic_access_technologies_check (self);
+    mm_polling_start (ctx->polling, TRUE);
 }
 
 /*****************************************************************************/
 
 typedef struct {
-    time_t last_update;
     guint recent_timeout_source;
 } SignalQualityUpdateContext;
 
@@ -686,24 +804,10 @@ static void
 signal_quality_update_context_free (SignalQualityUpdateContext *ctx)
 {
     if (ctx->recent_timeout_source)
-        g_source_remove (ctx->recent_timeout_source);
+        mm_timer_wheel_remove (ctx->recent_timeout_source);
     g_free (ctx);
 }
 
-static time_t
-get_last_signal_quality_update_time (MMIfaceModem *self)
-{
-    SignalQualityUpdateContext *ctx;
-
-    if (G_UNLIKELY (!signal_quality_update_context_quark))
-        signal_quality_update_context_quark = (g_quark_from_static_string (
-                                                   SIGNAL_QUALITY_UPDATE_CONTEXT_TAG));
-
-    ctx = g_object_get_qdata (G_OBJECT (self), signal_quality_update_context_quark);
-
-    return (ctx ? ctx->last_update : 0);
-}
-
 static gboolean
 expire_signal_quality (MMIfaceModem *self)
 {
@@ -742,6 +846,8 @@ expire_signal_quality (MMIfaceModem *self)
     return FALSE;
 }
 
+static guint get_signal_quality_check_interval (MMIfaceModem *self);
+
 static void
 update_signal_quality (MMIfaceModem *self,
                        guint signal_quality,
@@ -750,6 +856,7 @@ update_signal_quality (MMIfaceModem *self,
     SignalQualityUpdateContext *ctx;
     MmGdbusModem *skeleton = NULL;
     const gchar *dbus_path;
+    guint recent_timeout;
 
     if (G_UNLIKELY (!signal_quality_update_context_quark))
         signal_quality_update_context_quark = (g_quark_from_static_string (
@@ -766,9 +873,6 @@ update_signal_quality (MMIfaceModem *self,
             (GDestroyNotify)signal_quality_update_context_free);
     }
 
-    /* Keep current timestamp */
-    ctx->last_update = time (NULL);
-
     g_object_get (self,
                   MM_IFACE_MODEM_DBUS_SKELETON, &skeleton,
                   NULL);
@@ -790,42 +894,64 @@ update_signal_quality (MMIfaceModem *self,
 
     /* Remove any previous expiration refresh timeout */
     if (ctx->recent_timeout_source) {
-        g_source_remove (ctx->recent_timeout_source);
+        mm_timer_wheel_remove (ctx->recent_timeout_source);
         ctx->recent_timeout_source = 0;
     }
 
-    /* If we got a new expirable value, setup new timeout */
-    if (expire)
-        ctx->recent_timeout_source = (g_timeout_add_seconds (
-                                          SIGNAL_QUALITY_RECENT_TIMEOUT_SEC,
+    /* If we got a new expirable value, setup new timeout. While polling backs
+     * off, the next check is only due after the current interval, so keep the
+     * value recent until then, with the same margin as when not backing off. */
+    if (expire) {
+        recent_timeout = MAX (SIGNAL_QUALITY_RECENT_TIMEOUT_SEC,
+                              (get_signal_quality_check_interval (self) +
+                               SIGNAL_QUALITY_RECENT_TIMEOUT_SEC -
+                               SIGNAL_QUALITY_CHECK_TIMEOUT_SEC));
+        ctx->recent_timeout_source = (mm_timer_wheel_add_seconds (
+                                          self,
+                                          recent_timeout,
                                           (GSourceFunc)expire_signal_quality,
                                           self));
+    }
 
     g_object_unref (skeleton);
 }
 
+static void signal_quality_check_indication (MMIfaceModem *self);
+
 void
 mm_iface_modem_update_signal_quality (MMIfaceModem *self,
                                       guint signal_quality)
 {
+    /* Reported by the modem itself, delay next check */
+    signal_quality_check_indication (self);
     update_signal_quality (self, signal_quality, TRUE);
 }
 
 /*****************************************************************************/
 
 typedef struct {
-    guint timeout_source;
-    gboolean running;
+    MMPolling *polling;
 } SignalQualityCheckContext;
 
 static void
 signal_quality_check_context_free (SignalQualityCheckContext *ctx)
 {
-    if (ctx->timeout_source)
-        g_source_remove (ctx->timeout_source);
+    mm_polling_free (ctx->polling);
     g_free (ctx);
 }
 
+static guint
+get_signal_quality_check_interval (MMIfaceModem *self)
+{
+    SignalQualityCheckContext *ctx;
+
+    if (G_UNLIKELY (!signal_quality_check_context_quark))
+        return 0;
+
+    ctx = g_object_get_qdata (G_OBJECT (self), signal_quality_check_context_quark);
+    return (ctx ? mm_polling_get_interval (ctx->polling) : 0);
+}
+
 static void
 signal_quality_check_ready (MMIfaceModem *self,
                             GAsyncResult *res)
@@ -837,36 +963,58 @@ signal_quality_check_ready (MMIfaceModem *self,
     signal_quality = MM_IFACE_MODEM_GET_INTERFACE (self)->load_signal_quality_finish (self,
                                                                                       res,
                                                                                       &error);
+
+    /* Schedule next check first, so that the value expires after it */
+    ctx = g_object_get_qdata (G_OBJECT (self), signal_quality_check_context_quark);
+
     if (error) {
         mm_dbg ("Couldn't refresh signal quality: '%s'", error->message);
         g_error_free (error);
-    } else
-        update_signal_quality (self, signal_quality, TRUE);
+        if (ctx)
+            mm_polling_done (ctx->polling, FALSE);
+        return;
+    }
 
-    /* Remove the running tag */
-    ctx = g_object_get_qdata (G_OBJECT (self), signal_quality_check_context_quark);
-    ctx->running = FALSE;
+    if (ctx) {
+        MmGdbusModem *skeleton = NULL;
+        guint old_signal_quality = 0;
+        gboolean old_recent = FALSE;
+
+        g_object_get (self,
+                      MM_IFACE_MODEM_DBUS_SKELETON, &skeleton,
+                      NULL);
+        g_variant_get (mm_gdbus_modem_get_signal_quality (skeleton),
+                       "(ub)",
+                       &old_signal_quality,
+                       &old_recent);
+        g_object_unref (skeleton);
+
+        mm_polling_done (ctx->polling, signal_quality != old_signal_quality);
+    }
+
+    update_signal_quality (self, signal_quality, TRUE);
 }
 
-static gboolean
+static void
 periodic_signal_quality_check (MMIfaceModem *self)
 {
-    SignalQualityCheckContext *ctx;
+    MM_IFACE_MODEM_GET_INTERFACE (self)->load_signal_quality (
+        self,
+        (GAsyncReadyCallback)signal_quality_check_ready,
+        NULL);
+}
 
-    ctx = g_object_get_qdata (G_OBJECT (self), signal_quality_check_context_quark);
+static void
+signal_quality_check_indication (MMIfaceModem *self)
+{
+    SignalQualityCheckContext *ctx;
 
-    /* Only launch a new one if not one running already OR if the last one run
-     * was more than 15s ago. */
-    if (!ctx->running ||
-        (time (NULL) - get_last_signal_quality_update_time (self) > 15)) {
-        ctx->running = TRUE;
-        MM_IFACE_MODEM_GET_INTERFACE (self)->load_signal_quality (
-            self,
-            (GAsyncReadyCallback)signal_quality_check_ready,
-            NULL);
-    }
+    if (G_UNLIKELY (!signal_quality_check_context_quark))
+        return;
 
-    return TRUE;
+    ctx = g_object_get_qdata (G_OBJECT (self), signal_quality_check_context_quark);
+    if (ctx)
+        mm_polling_indication (ctx->polling);
 }
 
 static void
@@ -907,23 +1055,26 @@ periodic_signal_quality_check_enable (MMIfaceModem *self)
 
     /* If context is already there, we're already enabled */
     if (ctx) {
-        periodic_signal_quality_check (self);
+        mm_polling_start (ctx->polling, TRUE);
         return;
     }
 
-    /* Create context and keep it as object data */
+    /* Create context and keep it as object data. Checks are done every
+     * SIGNAL_QUALITY_CHECK_TIMEOUT_SEC, backing off while the value doesn't
+     * change or while the modem reports it by itself (e.g. +CIEV). */
     mm_dbg ("Periodic signal quality checks enabled");
     ctx = g_new0 (SignalQualityCheckContext, 1);
-    ctx->timeout_source = g_timeout_add_seconds (SIGNAL_QUALITY_CHECK_TIMEOUT_SEC,
-                                                 (GSourceFunc)periodic_signal_quality_check,
-                                                 self);
+    ctx->polling = mm_polling_new (SIGNAL_QUALITY_CHECK_TIMEOUT_SEC,
+                                   SIGNAL_QUALITY_CHECK_MAX_TIMEOUT_SEC,
+                                   (MMPollingFunc)periodic_signal_quality_check,
+                                   self);
     g_object_set_qdata_full (G_OBJECT (self),
                              signal_quality_check_context_quark,
                              ctx,
                              (GDestroyNotify)signal_quality_check_context_free);
 
     /* Get first signal quality value */
-    periodic_signal_quality_check (self);
+    mm_polling_start (ctx->polling, TRUE);
 }
 
 /*****************************************************************************/
@@ -991,6 +1142,11 @@ mm_iface_modem_update_state (MMIfaceModem *self,
                                                new_state,
                                                reason);
 
+        /* Report time-to-first-connect, measured since the modem started
+         * to get initialized */
+        if (new_state == MM_MODEM_STATE_CONNECTED)
+            report_first_connect (self, dbus_path);
+
         /* If we go to registered state (from unregistered), setup signal
          * quality and access technologies periodic retrieval */
         if (new_state == MM_MODEM_STATE_REGISTERED &&
@@ -2940,18 +3096,23 @@ typedef enum {
     INITIALIZATION_STEP_CURRENT_CAPABILITIES,
     INITIALIZATION_STEP_MODEM_CAPABILITIES,
     INITIALIZATION_STEP_BEARERS,
+    INITIALIZATION_STEP_UNLOCK_REQUIRED,
+    INITIALIZATION_STEP_SIM,
+    INITIALIZATION_STEP_SUPPORTED_MODES,
+    INITIALIZATION_STEP_SUPPORTED_BANDS,
+    INITIALIZATION_STEP_LAST,
+    /* Steps loading properties which are not needed to get the modem
+     * exported and connected; run in background via
+     * mm_iface_modem_load_deferred_properties() */
+    INITIALIZATION_STEP_DEFERRED_FIRST,
     INITIALIZATION_STEP_MANUFACTURER,
     INITIALIZATION_STEP_MODEL,
     INITIALIZATION_STEP_REVISION,
     INITIALIZATION_STEP_EQUIPMENT_ID,
     INITIALIZATION_STEP_DEVICE_ID,
     INITIALIZATION_STEP_OWN_NUMBERS,
-    INITIALIZATION_STEP_UNLOCK_REQUIRED,
     INITIALIZATION_STEP_UNLOCK_RETRIES,
-    INITIALIZATION_STEP_SIM,
-    INITIALIZATION_STEP_SUPPORTED_MODES,
-    INITIALIZATION_STEP_SUPPORTED_BANDS,
-    INITIALIZATION_STEP_LAST
+    INITIALIZATION_STEP_DEFERRED_LAST
 } InitializationStep;
 
 struct _InitializationContext {
@@ -2986,10 +3147,24 @@ initialization_context_new (MMIfaceModem *self,
     return ctx;
 }
 
+static void deferred_properties_load (MMIfaceModem *self);
+
 static void
 initialization_context_complete_and_free (InitializationContext *ctx)
 {
+    gboolean load_again = FALSE;
+
     g_assert (ctx->fatal_error == NULL);
+
+    /* Deferred properties requested again while being loaded? */
+    if (ctx->step > INITIALIZATION_STEP_LAST)
+        load_again = (mm_staged_load_deferred_done (
+                          get_staged_load_context (ctx->self),
+                          (!g_cancellable_is_cancelled (ctx->cancellable) &&
+                           modem_is_usable (ctx->self))));
+    if (load_again)
+        deferred_properties_load (ctx->self);
+
     g_simple_async_result_complete_in_idle (ctx->result);
     g_object_unref (ctx->cancellable);
     g_object_unref (ctx->self);
@@ -3354,102 +3529,6 @@ interface_initialization_step (InitializationContext *ctx)
         ctx->step++;
     }
 
-    case INITIALIZATION_STEP_MANUFACTURER:
-        /* Manufacturer is meant to be loaded only once during the whole
-         * lifetime of the modem. Therefore, if we already have them loaded,
-         * don't try to load them again. */
-        if (mm_gdbus_modem_get_manufacturer (ctx->skeleton) == NULL &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_manufacturer &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_manufacturer_finish) {
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_manufacturer (
-                ctx->self,
-                (GAsyncReadyCallback)load_manufacturer_ready,
-                ctx);
-            return;
-        }
-        /* Fall down to next step */
-        ctx->step++;
-
-    case INITIALIZATION_STEP_MODEL:
-        /* Model is meant to be loaded only once during the whole
-         * lifetime of the modem. Therefore, if we already have them loaded,
-         * don't try to load them again. */
-        if (mm_gdbus_modem_get_model (ctx->skeleton) == NULL &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_model &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_model_finish) {
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_model (
-                ctx->self,
-                (GAsyncReadyCallback)load_model_ready,
-                ctx);
-            return;
-        }
-        /* Fall down to next step */
-        ctx->step++;
-
-    case INITIALIZATION_STEP_REVISION:
-        /* Revision is meant to be loaded only once during the whole
-         * lifetime of the modem. Therefore, if we already have them loaded,
-         * don't try to load them again. */
-        if (mm_gdbus_modem_get_revision (ctx->skeleton) == NULL &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_revision &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_revision_finish) {
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_revision (
-                ctx->self,
-                (GAsyncReadyCallback)load_revision_ready,
-                ctx);
-            return;
-        }
-        /* Fall down to next step */
-        ctx->step++;
-
-    case INITIALIZATION_STEP_EQUIPMENT_ID:
-        /* Equipment ID is meant to be loaded only once during the whole
-         * lifetime of the modem. Therefore, if we already have them loaded,
-         * don't try to load them again. */
-        if (mm_gdbus_modem_get_equipment_identifier (ctx->skeleton) == NULL &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_equipment_identifier &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_equipment_identifier_finish) {
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_equipment_identifier (
-                ctx->self,
-                (GAsyncReadyCallback)load_equipment_identifier_ready,
-                ctx);
-            return;
-        }
-        /* Fall down to next step */
-        ctx->step++;
-
-    case INITIALIZATION_STEP_DEVICE_ID:
-        /* Device ID is meant to be loaded only once during the whole
-         * lifetime of the modem. Therefore, if we already have them loaded,
-         * don't try to load them again. */
-        if (mm_gdbus_modem_get_device_identifier (ctx->skeleton) == NULL &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_device_identifier &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_device_identifier_finish) {
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_device_identifier (
-                ctx->self,
-                (GAsyncReadyCallback)load_device_identifier_ready,
-                ctx);
-            return;
-        }
-        /* Fall down to next step */
-        ctx->step++;
-
-    case INITIALIZATION_STEP_OWN_NUMBERS:
-        /* Own numbers is meant to be loaded only once during the whole
-         * lifetime of the modem. Therefore, if we already have them loaded,
-         * don't try to load them again. */
-        if (mm_gdbus_modem_get_own_numbers (ctx->skeleton) == NULL &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_own_numbers &&
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_own_numbers_finish) {
-            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_own_numbers (
-                ctx->self,
-                (GAsyncReadyCallback)load_own_numbers_ready,
-                ctx);
-            return;
-        }
-        /* Fall down to next step */
-        ctx->step++;
-
     case INITIALIZATION_STEP_UNLOCK_REQUIRED:
         /* Only check unlock required if we were previously not unlocked */
         if (mm_gdbus_modem_get_unlock_required (ctx->skeleton) != MM_MODEM_LOCK_NONE) {
@@ -3461,12 +3540,6 @@ interface_initialization_step (InitializationContext *ctx)
         /* Fall down to next step */
         ctx->step++;
 
-    case INITIALIZATION_STEP_UNLOCK_RETRIES:
-        mm_iface_modem_update_unlock_retries (ctx->self,
-                                              (GAsyncReadyCallback)update_unlock_retries_ready,
-                                              ctx);
-        return;
-
     case INITIALIZATION_STEP_SIM:
         /* If the modem doesn't need any SIM, skip */
         if (MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->create_sim &&
@@ -3592,6 +3665,123 @@ interface_initialization_step (InitializationContext *ctx)
         /* Finally, export the new interface, even if we got errors */
         mm_gdbus_object_skeleton_set_modem (MM_GDBUS_OBJECT_SKELETON (ctx->self),
                                             MM_GDBUS_MODEM (ctx->skeleton));
+        mm_dbg ("Modem interface initialized (%.3f s since initialization started)",
+                get_seconds_since_startup (ctx->self));
+        initialization_context_complete_and_free (ctx);
+        return;
+
+    case INITIALIZATION_STEP_DEFERRED_FIRST:
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_MANUFACTURER:
+        /* Manufacturer is meant to be loaded only once during the whole
+         * lifetime of the modem. Therefore, if we already have them loaded,
+         * don't try to load them again. */
+        if (mm_gdbus_modem_get_manufacturer (ctx->skeleton) == NULL &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_manufacturer &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_manufacturer_finish) {
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_manufacturer (
+                ctx->self,
+                (GAsyncReadyCallback)load_manufacturer_ready,
+                ctx);
+            return;
+        }
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_MODEL:
+        /* Model is meant to be loaded only once during the whole
+         * lifetime of the modem. Therefore, if we already have them loaded,
+         * don't try to load them again. */
+        if (mm_gdbus_modem_get_model (ctx->skeleton) == NULL &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_model &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_model_finish) {
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_model (
+                ctx->self,
+                (GAsyncReadyCallback)load_model_ready,
+                ctx);
+            return;
+        }
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_REVISION:
+        /* Revision is meant to be loaded only once during the whole
+         * lifetime of the modem. Therefore, if we already have them loaded,
+         * don't try to load them again. */
+        if (mm_gdbus_modem_get_revision (ctx->skeleton) == NULL &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_revision &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_revision_finish) {
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_revision (
+                ctx->self,
+                (GAsyncReadyCallback)load_revision_ready,
+                ctx);
+            return;
+        }
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_EQUIPMENT_ID:
+        /* Equipment ID is meant to be loaded only once during the whole
+         * lifetime of the modem. Therefore, if we already have them loaded,
+         * don't try to load them again. */
+        if (mm_gdbus_modem_get_equipment_identifier (ctx->skeleton) == NULL &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_equipment_identifier &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_equipment_identifier_finish) {
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_equipment_identifier (
+                ctx->self,
+                (GAsyncReadyCallback)load_equipment_identifier_ready,
+                ctx);
+            return;
+        }
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_DEVICE_ID:
+        /* Device ID is meant to be loaded only once during the whole
+         * lifetime of the modem. Therefore, if we already have them loaded,
+         * don't try to load them again. */
+        if (mm_gdbus_modem_get_device_identifier (ctx->skeleton) == NULL &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_device_identifier &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_device_identifier_finish) {
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_device_identifier (
+                ctx->self,
+                (GAsyncReadyCallback)load_device_identifier_ready,
+                ctx);
+            return;
+        }
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_OWN_NUMBERS:
+        /* Own numbers is meant to be loaded only once during the whole
+         * lifetime of the modem. Therefore, if we already have them loaded,
+         * don't try to load them again. */
+        if (mm_gdbus_modem_get_own_numbers (ctx->skeleton) == NULL &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_own_numbers &&
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_own_numbers_finish) {
+            MM_IFACE_MODEM_GET_INTERFACE (ctx->self)->load_own_numbers (
+                ctx->self,
+                (GAsyncReadyCallback)load_own_numbers_ready,
+                ctx);
+            return;
+        }
+        /* Fall down to next step */
+        ctx->step++;
+
+    case INITIALIZATION_STEP_UNLOCK_RETRIES:
+        /* Unlock retries are reloaded every time, even if we already had
+         * them, as they change after each unlock attempt */
+        mm_iface_modem_update_unlock_retries (ctx->self,
+                                              (GAsyncReadyCallback)update_unlock_retries_ready,
+                                              ctx);
+        return;
+
+    case INITIALIZATION_STEP_DEFERRED_LAST:
+        mm_dbg ("Modem properties loaded (%.3f s since initialization started)",
+                get_seconds_since_startup (ctx->self));
+        g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
         initialization_context_complete_and_free (ctx);
         return;
     }
@@ -3660,6 +3850,9 @@ mm_iface_modem_initialize (MMIfaceModem *self,
         g_object_set (self,
                       MM_IFACE_MODEM_DBUS_SKELETON, skeleton,
                       NULL);
+
+        /* Startup time is measured from here */
+        get_startup_context (self);
     }
 
     /* Perform async initialization here */
@@ -3671,6 +3864,48 @@ mm_iface_modem_initialize (MMIfaceModem *self,
     return;
 }
 
+static void
+deferred_properties_load (MMIfaceModem *self)
+{
+    InitializationContext *ctx;
+
+    /* Properties are loaded in background, bound to the lifetime of the
+     * modem; no one waits for the result */
+    ctx = initialization_context_new (self,
+                                      mm_base_modem_peek_cancellable (MM_BASE_MODEM (self)),
+                                      NULL,
+                                      NULL);
+    ctx->step = INITIALIZATION_STEP_DEFERRED_FIRST;
+    interface_initialization_step (ctx);
+}
+
+void
+mm_iface_modem_load_deferred_properties (MMIfaceModem *self)
+{
+    MmGdbusModem *skeleton = NULL;
+
+    g_return_if_fail (MM_IS_IFACE_MODEM (self));
+
+    /* Nothing to do if the interface never got initialized */
+    g_object_get (self,
+                  MM_IFACE_MODEM_DBUS_SKELETON, &skeleton,
+                  NULL);
+    if (!skeleton)
+        return;
+    g_object_unref (skeleton);
+
+    /* Only one loading at a time; if already running, e.g. when initializing
+     * again after unlocking the SIM, it goes on once more when done */
+    if (!mm_staged_load_request_deferred (get_staged_load_context (self),
+                                          modem_is_usable (self))) {
+        mm_dbg ("Not loading modem properties: %s",
+                modem_is_usable (self) ? "already being loaded" : "modem unusable");
+        return;
+    }
+
+    deferred_properties_load (self);
+}
+
 void
 mm_iface_modem_shutdown (MMIfaceModem *self)
 {
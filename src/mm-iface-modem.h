@@ -324,6 +324,13 @@ gboolean mm_iface_modem_initialize_finish (MMIfaceModem *self,
                                            GAsyncResult *res,
                                            GError **error);
 
+/* Load in background the properties which are not needed to get the modem
+ * exported and connected (manufacturer, model, revision, identifiers, own
+ * numbers and unlock retries). Values show up in the interface as they get
+ * loaded. Nothing is loaded in failed modems; if already loading, it goes on
+ * once more when done. */
+void mm_iface_modem_load_deferred_properties (MMIfaceModem *self);
+
 /* Enable Modem interface (async) */
 void     mm_iface_modem_enable        (MMIfaceModem *self,
                                        GCancellable *cancellable,
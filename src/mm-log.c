@@ -23,6 +23,9 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <ModemManager.h>
 #include <mm-errors-types.h>
@@ -36,7 +39,7 @@ enum {
 };
 
 static gboolean ts_flags = TS_FLAG_NONE;
-static guint32 log_level = LOGL_INFO | LOGL_WARN | LOGL_ERR;
+guint32 mm_log_level = LOGL_INFO | LOGL_WARN | LOGL_ERR;
 static GTimeVal rel_start = { 0, 0 };
 static int logfd = -1;
 static gboolean func_loc = FALSE;
@@ -54,6 +57,257 @@ static const LogDesc level_descs[] = {
     { 0, NULL }
 };
 
+/*****************************************************************************/
+/* Log file writer
+ *
+ * When logging to a file, lines are not written by the threads logging them.
+ * They are appended to a bounded in-memory buffer instead, which a dedicated
+ * writer thread drains in batches, so that a busy daemon doesn't get blocked
+ * on disk latency. If the writer can't keep up and the buffer is full, lines
+ * are dropped and counted; the number of dropped lines is written to the log
+ * as soon as there is room again.
+ */
+
+/* Bytes of log waiting to be written, at most */
+#define LOG_BUFFER_SIZE (256 * 1024)
+
+/* Seconds between syncs with the periodic flush policy */
+#define LOG_FLUSH_PERIOD 1
+
+typedef enum {
+    LOG_FLUSH_ALWAYS,
+    LOG_FLUSH_ON_ERROR,
+    LOG_FLUSH_PERIODIC,
+    LOG_FLUSH_NEVER
+} LogFlushPolicy;
+
+typedef struct {
+    LogFlushPolicy policy;
+    const char *name;
+} LogFlushDesc;
+
+static const LogFlushDesc flush_descs[] = {
+    { LOG_FLUSH_ALWAYS,   "always" },
+    { LOG_FLUSH_ON_ERROR, "on-error" },
+    { LOG_FLUSH_PERIODIC, "periodic" },
+    { LOG_FLUSH_NEVER,    "never" },
+    { 0, NULL }
+};
+
+static LogFlushPolicy flush_policy = LOG_FLUSH_ALWAYS;
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer_thread;
+static gboolean writer_running;
+static gboolean writer_stop;
+static GString *writer_pending;
+static gboolean writer_sync_requested;
+static guint writer_dropped;
+static guint writer_dropped_total;
+static volatile sig_atomic_t writer_report_requested;
+
+/* Whether the current thread is already logging; e.g. if a signal handler
+ * logs while the interrupted code was also logging */
+static __thread gboolean in_log;
+
+static void
+write_all (const char *buf, gsize len)
+{
+    while (len > 0) {
+        ssize_t written;
+
+        written = write (logfd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            /* Nothing else we can do */
+            return;
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+static void *
+writer_thread_func (void *unused)
+{
+    GString *batch;
+    gboolean stop = FALSE;
+    gboolean unsynced = FALSE;
+    time_t last_sync = 0;
+
+    batch = g_string_sized_new (LOG_BUFFER_SIZE);
+
+    pthread_mutex_lock (&writer_lock);
+    while (!stop) {
+        GString *tmp;
+        gboolean sync_requested;
+        guint dropped;
+        gboolean report;
+        struct timespec deadline;
+
+        /* Wake up at least every second, for the periodic syncs and to
+         * handle SIGUSR1 reports */
+        deadline.tv_sec = time (NULL) + LOG_FLUSH_PERIOD;
+        deadline.tv_nsec = 0;
+        while (!writer_pending->len &&
+               !writer_dropped &&
+               !writer_stop &&
+               !writer_report_requested) {
+            if (pthread_cond_timedwait (&writer_cond, &writer_lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        /* Take the whole pending buffer */
+        tmp = batch;
+        batch = writer_pending;
+        writer_pending = tmp;
+
+        sync_requested = writer_sync_requested;
+        writer_sync_requested = FALSE;
+        dropped = writer_dropped;
+        writer_dropped = 0;
+        report = writer_report_requested;
+        writer_report_requested = FALSE;
+        stop = writer_stop;
+        pthread_mutex_unlock (&writer_lock);
+
+        if (dropped) {
+            char line[100];
+
+            snprintf (line, sizeof (line),
+                      "<warn>  log buffer full: %u messages dropped\n",
+                      dropped);
+            write_all (line, strlen (line));
+        }
+
+        if (batch->len) {
+            write_all (batch->str, batch->len);
+            g_string_truncate (batch, 0);
+            unsynced = TRUE;
+        }
+
+        if (report) {
+            char line[100];
+
+            snprintf (line, sizeof (line),
+                      "<info>  log: %u messages dropped since start\n",
+                      writer_dropped_total);
+            write_all (line, strlen (line));
+            unsynced = TRUE;
+        }
+
+        if (unsynced &&
+            (stop ||
+             sync_requested ||
+             flush_policy == LOG_FLUSH_ALWAYS ||
+             (flush_policy == LOG_FLUSH_PERIODIC &&
+              time (NULL) - last_sync >= LOG_FLUSH_PERIOD))) {
+            fsync (logfd);
+            last_sync = time (NULL);
+            unsynced = FALSE;
+        }
+
+        pthread_mutex_lock (&writer_lock);
+        if (writer_pending->len)
+            stop = FALSE;
+    }
+    pthread_mutex_unlock (&writer_lock);
+
+    g_string_free (batch, TRUE);
+    return NULL;
+}
+
+static void
+log_write (const char *line, gsize len, gboolean important)
+{
+    gboolean wakeup;
+
+    pthread_mutex_lock (&writer_lock);
+    if (!writer_running) {
+        write_all (line, len);
+        if (flush_policy == LOG_FLUSH_ALWAYS ||
+            (important && flush_policy != LOG_FLUSH_NEVER))
+            fsync (logfd);
+        pthread_mutex_unlock (&writer_lock);
+        return;
+    }
+
+    if (writer_pending->len + len > LOG_BUFFER_SIZE) {
+        writer_dropped++;
+        writer_dropped_total++;
+        pthread_mutex_unlock (&writer_lock);
+        return;
+    }
+
+    wakeup = (writer_pending->len == 0);
+    g_string_append_len (writer_pending, line, len);
+    if (important && flush_policy == LOG_FLUSH_ON_ERROR) {
+        writer_sync_requested = TRUE;
+        wakeup = TRUE;
+    }
+    if (wakeup)
+        pthread_cond_signal (&writer_cond);
+    pthread_mutex_unlock (&writer_lock);
+}
+
+static gboolean
+writer_start (GError **error)
+{
+    int err;
+
+    writer_pending = g_string_sized_new (LOG_BUFFER_SIZE);
+    err = pthread_create (&writer_thread, NULL, writer_thread_func, NULL);
+    if (err != 0) {
+        g_set_error (error, MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                     "Couldn't start log writer: (%d) %s",
+                     err, strerror (err));
+        g_string_free (writer_pending, TRUE);
+        writer_pending = NULL;
+        return FALSE;
+    }
+
+    writer_running = TRUE;
+    return TRUE;
+}
+
+static void
+writer_shutdown (void)
+{
+    if (!writer_running)
+        return;
+
+    pthread_mutex_lock (&writer_lock);
+    writer_stop = TRUE;
+    pthread_cond_signal (&writer_cond);
+    pthread_mutex_unlock (&writer_lock);
+
+    /* The writer flushes everything before exiting */
+    pthread_join (writer_thread, NULL);
+
+    pthread_mutex_lock (&writer_lock);
+    writer_running = FALSE;
+    g_string_free (writer_pending, TRUE);
+    writer_pending = NULL;
+    pthread_mutex_unlock (&writer_lock);
+}
+
+/* Write whatever is pending right away, e.g. before aborting. The writer
+ * thread may be in the middle of writing an earlier batch, so let it drain
+ * everything and exit instead of writing the pending buffer ourselves, which
+ * could reorder lines. Later messages are then written directly. */
+static void
+writer_flush_sync (void)
+{
+    if (!writer_running || pthread_equal (pthread_self (), writer_thread))
+        return;
+
+    writer_shutdown ();
+}
+
+/*****************************************************************************/
+
 void
 _mm_log (const char *loc,
          const char *func,
@@ -62,24 +316,43 @@ _mm_log (const char *loc,
          ...)
 {
     va_list args;
-    char *msg;
+    GString *line;
     GTimeVal tv;
-    char tsbuf[100] = { 0 };
-    char msgbuf[512] = { 0 };
     int syslog_priority = LOG_INFO;
     const char *prefix = NULL;
-    ssize_t ign;
 
-    if (!(log_level & level))
+    if (!(mm_log_level & level))
         return;
 
-    va_start (args, fmt);
-    msg = g_strdup_vprintf (fmt, args);
-    va_end (args);
+    /* Don't re-enter, the log lock may already be held */
+    if (in_log)
+        return;
+    in_log = TRUE;
+
+    if ((mm_log_level & LOGL_DEBUG) && (level == LOGL_DEBUG))
+        prefix = "<debug>";
+    else if ((mm_log_level & LOGL_INFO) && (level == LOGL_INFO))
+        prefix = "<info> ";
+    else if ((mm_log_level & LOGL_WARN) && (level == LOGL_WARN)) {
+        prefix = "<warn> ";
+        syslog_priority = LOG_WARNING;
+    } else if ((mm_log_level & LOGL_ERR) && (level == LOGL_ERR)) {
+        prefix = "<error>";
+        syslog_priority = LOG_ERR;
+    } else
+        g_warn_if_reached ();
+
+    if (!prefix) {
+        in_log = FALSE;
+        return;
+    }
+
+    line = g_string_sized_new (256);
+    g_string_append (line, prefix);
 
     if (ts_flags == TS_FLAG_WALL) {
         g_get_current_time (&tv);
-        snprintf (&tsbuf[0], sizeof (tsbuf), " [%09ld.%06ld]", tv.tv_sec, tv.tv_usec);
+        g_string_append_printf (line, " [%09ld.%06ld]", tv.tv_sec, tv.tv_usec);
     } else if (ts_flags == TS_FLAG_REL) {
         glong secs;
         glong usecs;
@@ -92,39 +365,26 @@ _mm_log (const char *loc,
             usecs += 1000000;
         }
 
-        snprintf (&tsbuf[0], sizeof (tsbuf), " [%06ld.%06ld]", secs, usecs);
+        g_string_append_printf (line, " [%06ld.%06ld]", secs, usecs);
     }
 
-    if ((log_level & LOGL_DEBUG) && (level == LOGL_DEBUG))
-        prefix = "<debug>";
-    else if ((log_level & LOGL_INFO) && (level == LOGL_INFO))
-        prefix = "<info> ";
-    else if ((log_level & LOGL_WARN) && (level == LOGL_WARN)) {
-        prefix = "<warn> ";
-        syslog_priority = LOG_WARNING;
-    } else if ((log_level & LOGL_ERR) && (level == LOGL_ERR)) {
-        prefix = "<error>";
-        syslog_priority = LOG_ERR;
-    } else
-        g_warn_if_reached ();
+    if (func_loc && mm_log_level & LOGL_DEBUG)
+        g_string_append_printf (line, " [%s] %s():", loc, func);
+    g_string_append_c (line, ' ');
 
-    if (prefix) {
-        if (func_loc && log_level & LOGL_DEBUG)
-            snprintf (msgbuf, sizeof (msgbuf), "%s%s [%s] %s(): %s\n", prefix, tsbuf, loc, func, msg);
-        else
-            snprintf (msgbuf, sizeof (msgbuf), "%s%s %s\n", prefix, tsbuf, msg);
+    va_start (args, fmt);
+    g_string_append_vprintf (line, fmt, args);
+    va_end (args);
 
-        if (logfd < 0)
-            syslog (syslog_priority, "%s", msgbuf);
-        else {
-            ign = write (logfd, msgbuf, strlen (msgbuf));
-            if (ign) {} /* whatever; really shut up about unused result */
+    g_string_append_c (line, '\n');
 
-            fsync (logfd);  /* Make sure output is dumped to disk immediately */
-        }
-    }
+    if (logfd < 0)
+        syslog (syslog_priority, "%s", line->str);
+    else
+        log_write (line->str, line->len, level == LOGL_ERR);
 
-    g_free (msg);
+    g_string_free (line, TRUE);
+    in_log = FALSE;
 }
 
 static void
@@ -134,9 +394,8 @@ log_handler (const gchar *log_domain,
              gpointer ignored)
 {
     int syslog_priority;
-    ssize_t ign;
 
-    switch (level) {
+    switch (level & G_LOG_LEVEL_MASK) {
     case G_LOG_LEVEL_ERROR:
         syslog_priority = LOG_CRIT;
         break;
@@ -160,9 +419,15 @@ log_handler (const gchar *log_domain,
 
     if (logfd < 0)
         syslog (syslog_priority, "%s", message);
-    else {
-        ign = write (logfd, message, strlen (message));
-        if (ign) {} /* whatever; really shut up about unused result */
+    else if (level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR)) {
+        /* We're about to abort, don't lose anything */
+        writer_flush_sync ();
+        write_all (message, strlen (message));
+        fsync (logfd);
+    } else if (!in_log) {
+        in_log = TRUE;
+        log_write (message, strlen (message), level & G_LOG_LEVEL_CRITICAL);
+        in_log = FALSE;
     }
 }
 
@@ -174,7 +439,7 @@ mm_log_set_level (const char *level, GError **error)
 
     for (diter = &level_descs[0]; diter->name; diter++) {
         if (!strcasecmp (diter->name, level)) {
-            log_level = diter->num;
+            mm_log_level = diter->num;
             found = TRUE;
             break;
         }
@@ -185,9 +450,27 @@ mm_log_set_level (const char *level, GError **error)
     return found;
 }
 
+static gboolean
+log_set_flush_policy (const char *policy, GError **error)
+{
+    const LogFlushDesc *diter;
+
+    for (diter = &flush_descs[0]; diter->name; diter++) {
+        if (!strcasecmp (diter->name, policy)) {
+            flush_policy = diter->policy;
+            return TRUE;
+        }
+    }
+
+    g_set_error (error, MM_CORE_ERROR, MM_CORE_ERROR_INVALID_ARGS,
+                 "Unknown log flush policy '%s'", policy);
+    return FALSE;
+}
+
 gboolean
 mm_log_setup (const char *level,
               const char *log_file,
+              const char *log_flush,
               gboolean show_timestamps,
               gboolean rel_timestamps,
               gboolean debug_func_loc,
@@ -197,6 +480,9 @@ mm_log_setup (const char *level,
     if (level && strlen (level) && !mm_log_set_level (level, error))
         return FALSE;
 
+    if (log_flush && strlen (log_flush) && !log_set_flush_policy (log_flush, error))
+        return FALSE;
+
     func_loc = debug_func_loc;
 
     if (show_timestamps)
@@ -219,6 +505,12 @@ mm_log_setup (const char *level,
                          errno, strerror (errno));
             return FALSE;
         }
+
+        if (!writer_start (error)) {
+            close (logfd);
+            logfd = -1;
+            return FALSE;
+        }
     }
 
     g_log_set_handler (G_LOG_DOMAIN,
@@ -229,9 +521,23 @@ mm_log_setup (const char *level,
     return TRUE;
 }
 
+/* Called from a signal handler, so just flag the writer */
 void
 mm_log_usr1 (void)
 {
+    writer_report_requested = TRUE;
+}
+
+/* Called from the main loop after SIGUSR1; when logging to a file the writer
+ * thread reports instead */
+void
+mm_log_usr1_report (void)
+{
+    if (logfd >= 0 || !writer_report_requested)
+        return;
+
+    writer_report_requested = FALSE;
+    syslog (LOG_INFO, "log: %u messages dropped since start", writer_dropped_total);
 }
 
 void
@@ -239,6 +545,8 @@ mm_log_shutdown (void)
 {
     if (logfd < 0)
         closelog ();
-    else
+    else {
+        writer_shutdown ();
         close (logfd);
+    }
 }
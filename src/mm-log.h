@@ -26,20 +26,41 @@ enum {
 	LOGL_DEBUG = 0x00000008
 };
 
+/* Currently enabled levels. Messages of other levels are skipped before
+ * their arguments are even evaluated. */
+extern guint32 mm_log_level;
+
+#define mm_log_enabled(level) (mm_log_level & (level))
+
 #define mm_err(...) \
-	_mm_log (G_STRLOC, G_STRFUNC, LOGL_ERR, ## __VA_ARGS__ )
+	G_STMT_START { \
+		if (mm_log_enabled (LOGL_ERR)) \
+			_mm_log (G_STRLOC, G_STRFUNC, LOGL_ERR, ## __VA_ARGS__ ); \
+	} G_STMT_END
 
 #define mm_warn(...) \
-	_mm_log (G_STRLOC, G_STRFUNC, LOGL_WARN, ## __VA_ARGS__ )
+	G_STMT_START { \
+		if (mm_log_enabled (LOGL_WARN)) \
+			_mm_log (G_STRLOC, G_STRFUNC, LOGL_WARN, ## __VA_ARGS__ ); \
+	} G_STMT_END
 
 #define mm_info(...) \
-	_mm_log (G_STRLOC, G_STRFUNC, LOGL_INFO, ## __VA_ARGS__ )
+	G_STMT_START { \
+		if (mm_log_enabled (LOGL_INFO)) \
+			_mm_log (G_STRLOC, G_STRFUNC, LOGL_INFO, ## __VA_ARGS__ ); \
+	} G_STMT_END
 
 #define mm_dbg(...) \
-	_mm_log (G_STRLOC, G_STRFUNC, LOGL_DEBUG, ## __VA_ARGS__ )
+	G_STMT_START { \
+		if (mm_log_enabled (LOGL_DEBUG)) \
+			_mm_log (G_STRLOC, G_STRFUNC, LOGL_DEBUG, ## __VA_ARGS__ ); \
+	} G_STMT_END
 
 #define mm_log(level, ...) \
-	_mm_log (G_STRLOC, G_STRFUNC, level, ## __VA_ARGS__ )
+	G_STMT_START { \
+		if (mm_log_enabled (level)) \
+			_mm_log (G_STRLOC, G_STRFUNC, level, ## __VA_ARGS__ ); \
+	} G_STMT_END
 
 void _mm_log (const char *loc,
               const char *func,
@@ -51,6 +72,7 @@ gboolean mm_log_set_level (const char *level, GError **error);
 
 gboolean mm_log_setup (const char *level,
                        const char *log_file,
+                       const char *log_flush,
                        gboolean show_ts,
                        gboolean rel_ts,
                        gboolean debug_func_loc,
@@ -58,6 +80,8 @@ gboolean mm_log_setup (const char *level,
 
 void mm_log_usr1 (void);
 
+void mm_log_usr1_report (void);
+
 void mm_log_shutdown (void);
 
 #endif  /* MM_LOG_H */
@@ -31,7 +31,12 @@
 #include "mm-auth.h"
 #include "mm-plugin.h"
 #include "mm-log.h"
+#include "mm-context.h"
+#include "mm-serial-capture.h"
 #include "mm-port-probe-cache.h"
+#include "mm-iface-modem.h"
+#include "mm-iface-modem-messaging.h"
+#include "mm-sms-send-queue.h"
 
 static void grab_port (MMManager *manager,
                        MMPlugin *plugin,
@@ -242,6 +247,10 @@ modem_valid (MMBaseModem *modem,
         remove_modem (manager, modem);
 }
 
+static void sms_send_queue_setup (MMBaseModem *modem,
+                                  GParamSpec *pspec,
+                                  MMManager *manager);
+
 #define MANAGER_PLUGIN_TAG "manager-plugin"
 
 static void
@@ -259,6 +268,14 @@ add_modem (MMManager *manager,
                              modem);
         g_object_set_data (G_OBJECT (modem), MANAGER_PLUGIN_TAG, plugin);
         g_signal_connect (modem, "notify::" MM_BASE_MODEM_VALID, G_CALLBACK (modem_valid), manager);
+
+        /* The send queue is created when messaging gets enabled */
+        if (mm_context_get_sms_balance ())
+            g_signal_connect_object (modem,
+                                     "notify::" MM_IFACE_MODEM_STATE,
+                                     G_CALLBACK (sms_send_queue_setup),
+                                     manager,
+                                     0);
     }
 
     check_export_modem (manager, modem);
@@ -776,6 +793,63 @@ handle_set_logging (MmGdbusOrgFreedesktopModemManager1 *manager,
 
 /*****************************************************************************/
 
+typedef struct {
+    MMManager *self;
+    GDBusMethodInvocation *invocation;
+} DumpSerialCaptureContext;
+
+static void
+dump_serial_capture_context_free (DumpSerialCaptureContext *ctx)
+{
+    g_object_unref (ctx->invocation);
+    g_object_unref (ctx->self);
+    g_free (ctx);
+}
+
+static void
+dump_serial_capture_auth_ready (MMAuthProvider *authp,
+                                GAsyncResult *res,
+                                DumpSerialCaptureContext *ctx)
+{
+    GError *error = NULL;
+    gchar *path;
+
+    if (!mm_auth_provider_authorize_finish (authp, res, &error))
+        g_dbus_method_invocation_take_error (ctx->invocation, error);
+    else if (!(path = mm_serial_capture_dump_all (mm_context_get_capture_dir (), &error)))
+        g_dbus_method_invocation_take_error (ctx->invocation, error);
+    else {
+        mm_gdbus_org_freedesktop_modem_manager1_complete_dump_serial_capture (
+            MM_GDBUS_ORG_FREEDESKTOP_MODEM_MANAGER1 (ctx->self),
+            ctx->invocation,
+            path);
+        g_free (path);
+    }
+
+    dump_serial_capture_context_free (ctx);
+}
+
+static gboolean
+handle_dump_serial_capture (MmGdbusOrgFreedesktopModemManager1 *manager,
+                            GDBusMethodInvocation *invocation)
+{
+    DumpSerialCaptureContext *ctx;
+
+    ctx = g_new (DumpSerialCaptureContext, 1);
+    ctx->self = g_object_ref (manager);
+    ctx->invocation = g_object_ref (invocation);
+
+    mm_auth_provider_authorize (ctx->self->priv->authp,
+                                invocation,
+                                MM_AUTHORIZATION_MANAGER_CONTROL,
+                                ctx->self->priv->authp_cancellable,
+                                (GAsyncReadyCallback)dump_serial_capture_auth_ready,
+                                ctx);
+    return TRUE;
+}
+
+/*****************************************************************************/
+
 typedef struct {
     MMManager *self;
     GDBusMethodInvocation *invocation;
@@ -879,6 +953,112 @@ get_property (GObject *object,
     }
 }
 
+/*****************************************************************************/
+/* SMS load balancing */
+
+/* A message is only moved to another modem if that one has at least these
+ * fewer parts waiting to be sent */
+#define SMS_BALANCE_MIN_GAIN 2
+
+static MMSmsSendQueue *
+sms_send_balance (MMSmsSendQueue *preferred,
+                  guint n_parts,
+                  MMManager *self)
+{
+    MMSmsSendQueueStats stats;
+    MMSmsSendQueue *best = preferred;
+    guint preferred_load, best_load, best_latency;
+    gboolean preferred_pdu_mode = FALSE;
+    GHashTableIter iter;
+    gpointer value;
+
+    mm_sms_send_queue_get_stats (preferred, &stats);
+    preferred_load = best_load = stats.pending_parts;
+    best_latency = stats.latency_avg_ms;
+    if (preferred_load < SMS_BALANCE_MIN_GAIN)
+        return g_object_ref (preferred);
+
+    /* Parts are encoded for the mode of the modem sending them, and
+     * multipart messages can only be sent in PDU mode */
+    g_object_get (mm_sms_send_queue_peek_modem (preferred),
+                  MM_IFACE_MODEM_MESSAGING_SMS_PDU_MODE, &preferred_pdu_mode,
+                  NULL);
+
+    g_hash_table_iter_init (&iter, self->priv->modems);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        MMSmsSendQueue *candidate;
+        MMModemState state = MM_MODEM_STATE_UNKNOWN;
+        gboolean pdu_mode = FALSE;
+
+        if (!MM_IS_IFACE_MODEM_MESSAGING (value))
+            continue;
+
+        candidate = mm_iface_modem_messaging_peek_send_queue (MM_IFACE_MODEM_MESSAGING (value));
+        if (!candidate ||
+            candidate == preferred ||
+            mm_sms_send_queue_is_shut_down (candidate))
+            continue;
+
+        g_object_get (value,
+                      MM_IFACE_MODEM_STATE, &state,
+                      MM_IFACE_MODEM_MESSAGING_SMS_PDU_MODE, &pdu_mode,
+                      NULL);
+        if (state < MM_MODEM_STATE_REGISTERED || pdu_mode != preferred_pdu_mode)
+            continue;
+
+        mm_sms_send_queue_get_stats (candidate, &stats);
+        if (stats.pending_parts + SMS_BALANCE_MIN_GAIN > preferred_load)
+            continue;
+
+        /* Least parts waiting first, then fastest */
+        if (best == preferred ||
+            stats.pending_parts < best_load ||
+            (stats.pending_parts == best_load && stats.latency_avg_ms < best_latency)) {
+            best = candidate;
+            best_load = stats.pending_parts;
+            best_latency = stats.latency_avg_ms;
+        }
+    }
+
+    return g_object_ref (best);
+}
+
+/* Spread outgoing SMS among the modems, if requested */
+static void
+sms_send_queue_setup (MMBaseModem *modem,
+                      GParamSpec *pspec,
+                      MMManager *manager)
+{
+    MMSmsSendQueue *queue;
+
+    if (!MM_IS_IFACE_MODEM_MESSAGING (modem))
+        return;
+
+    queue = mm_iface_modem_messaging_peek_send_queue (MM_IFACE_MODEM_MESSAGING (modem));
+    if (queue)
+        mm_sms_send_queue_set_balance_func (queue,
+                                            (MMSmsSendQueueBalanceFn)sms_send_balance,
+                                            manager);
+}
+
+static void
+sms_send_queue_cleanup (gpointer key,
+                        MMBaseModem *modem,
+                        MMManager *manager)
+{
+    MMSmsSendQueue *queue;
+
+    if (!MM_IS_IFACE_MODEM_MESSAGING (modem))
+        return;
+
+    /* Queues may outlive the manager while their last messages complete */
+    queue = mm_iface_modem_messaging_peek_send_queue (MM_IFACE_MODEM_MESSAGING (modem));
+    if (queue)
+        mm_sms_send_queue_set_balance_func (queue, NULL, NULL);
+}
+
+/*****************************************************************************/
+
 static void
 mm_manager_init (MMManager *manager)
 {
@@ -913,6 +1093,10 @@ mm_manager_init (MMManager *manager)
                       "handle-scan-devices",
                       G_CALLBACK (handle_scan_devices),
                       NULL);
+    g_signal_connect (manager,
+                      "handle-dump-serial-capture",
+                      G_CALLBACK (handle_dump_serial_capture),
+                      NULL);
 }
 
 static gboolean
@@ -947,6 +1131,7 @@ finalize (GObject *object)
 {
     MMManagerPrivate *priv = MM_MANAGER (object)->priv;
 
+    g_hash_table_foreach (priv->modems, (GHFunc)sms_send_queue_cleanup, object);
     g_hash_table_destroy (priv->modems);
 
     mm_port_probe_cache_clear ();
@@ -29,12 +29,14 @@
 
 #include "mm-plugin-base.h"
 #include "mm-port-probe-cache.h"
+#include "mm-probe-plan.h"
 #include "mm-at-serial-port.h"
 #include "mm-qcdm-serial-port.h"
 #include "mm-serial-parsers.h"
 #include "mm-marshal.h"
 #include "mm-utils.h"
 #include "mm-private-boxed-types.h"
+#include "mm-context.h"
 #include "libqcdm/src/commands.h"
 #include "libqcdm/src/utils.h"
 #include "libqcdm/src/errors.h"
@@ -68,6 +70,7 @@ typedef struct {
     gboolean qcdm;
     MMPortProbeAtCommand *custom_init;
     guint64 send_delay;
+    gboolean at_pipeline;
 } MMPluginBasePrivate;
 
 enum {
@@ -85,6 +88,7 @@ enum {
     PROP_ALLOWED_QCDM,
     PROP_CUSTOM_INIT,
     PROP_SEND_DELAY,
+    PROP_AT_PIPELINE,
     LAST_PROP
 };
 
@@ -280,9 +284,11 @@ apply_pre_probing_filters (MMPluginBase *self,
                            const gchar *name,
                            const gchar *driver,
                            gboolean *need_vendor_probing,
-                           gboolean *need_product_probing)
+                           gboolean *need_product_probing,
+                           MMProbePlanMatch *match)
 {
     MMPluginBasePrivate *priv = MM_PLUGIN_BASE_GET_PRIVATE (self);
+    MMProbePlanMatch matched = MM_PROBE_PLAN_MATCH_ANY;
     guint16 vendor = 0;
     guint16 product = 0;
     gboolean product_filtered = FALSE;
@@ -316,6 +322,8 @@ apply_pre_probing_filters (MMPluginBase *self,
         /* If we didn't match any driver: unsupported */
         if (!priv->drivers[i])
             return TRUE;
+
+        matched = MM_PROBE_PLAN_MATCH_DRIVER;
     }
 
     mm_plugin_base_get_device_ids (self, subsys, name, &vendor, &product);
@@ -362,6 +370,11 @@ apply_pre_probing_filters (MMPluginBase *self,
         !priv->product_strings)
         return TRUE;
 
+    if (priv->product_ids && !product_filtered)
+        matched = MM_PROBE_PLAN_MATCH_PRODUCT_ID;
+    else if (priv->vendor_ids && !vendor_filtered)
+        matched = MM_PROBE_PLAN_MATCH_VENDOR_ID;
+
     /* If we need to filter by vendor/product strings, need to probe for both.
      * This covers the case where a RS232 modem is connected via a USB<->RS232
      * adaptor, and we get in udev the vendor ID of the adaptor */
@@ -385,8 +398,12 @@ apply_pre_probing_filters (MMPluginBase *self,
         /* If we didn't match any udev tag: unsupported */
         if (!priv->udev_tags[i])
             return TRUE;
+
+        matched = MAX (matched, MM_PROBE_PLAN_MATCH_UDEV_TAG);
     }
 
+    if (match)
+        *match = matched;
     return FALSE;
 }
 
@@ -474,6 +491,54 @@ apply_post_probing_filters (MMPluginBase *self,
     return FALSE;
 }
 
+static gchar *
+get_port_driver (GUdevDevice *port,
+                 const gchar *name)
+{
+    /* Detect any modems accessible through the list of virtual ports */
+    return (is_virtual_port (name) ?
+            g_strdup ("virtual") :
+            get_driver_name (port));
+}
+
+static MMPortProbeFlag
+get_probe_run_flags (MMPluginBase *self,
+                     gboolean need_vendor_probing,
+                     gboolean need_product_probing)
+{
+    MMPluginBasePrivate *priv = MM_PLUGIN_BASE_GET_PRIVATE (self);
+    MMPortProbeFlag probe_run_flags;
+
+    /* Build flags depending on what probing needed */
+    probe_run_flags = MM_PORT_PROBE_NONE;
+    if (priv->at)
+        probe_run_flags |= MM_PORT_PROBE_AT;
+    else if (priv->single_at)
+        probe_run_flags |= MM_PORT_PROBE_AT;
+    if (need_vendor_probing)
+        probe_run_flags |= (MM_PORT_PROBE_AT | MM_PORT_PROBE_AT_VENDOR);
+    if (need_product_probing)
+        probe_run_flags |= (MM_PORT_PROBE_AT | MM_PORT_PROBE_AT_PRODUCT);
+    if (priv->qcdm)
+        probe_run_flags |= MM_PORT_PROBE_QCDM;
+
+    return probe_run_flags;
+}
+
+/* If a modem is already available and the plugin says that only one AT port is
+ * expected, check if we alredy got the single AT port. And if so, we know this
+ * port being probed won't be AT. */
+static gboolean
+has_single_at_port (MMPluginBase *self,
+                    MMBaseModem *existing)
+{
+    MMPluginBasePrivate *priv = MM_PLUGIN_BASE_GET_PRIVATE (self);
+
+    return (priv->single_at &&
+            existing &&
+            mm_base_modem_has_at_port (existing));
+}
+
 /* Context for the asynchronous probing operation */
 typedef struct {
     GSimpleAsyncResult *result;
@@ -508,6 +573,9 @@ port_probe_run_ready (MMPortProbe *probe,
         /* Probing succeeded */
         MMPluginSupportsResult supports_result;
 
+        /* Keep the results for the next time the device shows up */
+        mm_port_probe_cache_store (probe);
+
         if (!apply_post_probing_filters (ctx->plugin, probe)) {
             /* Port is supported! Leave it in the internal HT until port gets
              * grabbed. */
@@ -616,10 +684,7 @@ supports_port (MMPlugin *plugin,
         goto out;
     }
 
-    /* Detect any modems accessible through the list of virtual ports */
-    if (!(driver = (is_virtual_port (name) ?
-                    g_strdup ("virtual") :
-                    get_driver_name (port)))) {
+    if (!(driver = get_port_driver (port, name))) {
         g_simple_async_result_set_error (async_result,
                                          MM_CORE_ERROR,
                                          MM_CORE_ERROR_FAILED,
@@ -637,7 +702,8 @@ supports_port (MMPlugin *plugin,
                                    name,
                                    driver,
                                    &need_vendor_probing,
-                                   &need_product_probing)) {
+                                   &need_product_probing,
+                                   NULL)) {
         /* Filtered! */
         g_simple_async_result_set_op_res_gpointer (async_result,
                                                    GUINT_TO_POINTER (MM_PLUGIN_SUPPORTS_PORT_UNSUPPORTED),
@@ -679,27 +745,12 @@ supports_port (MMPlugin *plugin,
         goto out;
     }
 
-    /* Build flags depending on what probing needed */
-    probe_run_flags = MM_PORT_PROBE_NONE;
-    if (priv->at)
-        probe_run_flags |= MM_PORT_PROBE_AT;
-    else if (priv->single_at)
-        probe_run_flags |= MM_PORT_PROBE_AT;
-    if (need_vendor_probing)
-        probe_run_flags |= (MM_PORT_PROBE_AT | MM_PORT_PROBE_AT_VENDOR);
-    if (need_product_probing)
-        probe_run_flags |= (MM_PORT_PROBE_AT | MM_PORT_PROBE_AT_PRODUCT);
-    if (priv->qcdm)
-        probe_run_flags |= MM_PORT_PROBE_QCDM;
-
+    probe_run_flags = get_probe_run_flags (self,
+                                           need_vendor_probing,
+                                           need_product_probing);
     g_assert (probe_run_flags != MM_PORT_PROBE_NONE);
 
-    /* If a modem is already available and the plugin says that only one AT port is
-     * expected, check if we alredy got the single AT port. And if so, we know this
-     * port being probed won't be AT. */
-    if (priv->single_at &&
-        existing &&
-        mm_base_modem_has_at_port (existing)) {
+    if (has_single_at_port (self, existing)) {
         mm_dbg ("(%s)   not setting up AT probing tasks for (%s,%s): "
                 "modem already has the expected single AT port",
                 priv->name, subsys, name);
@@ -781,11 +832,351 @@ grab_port (MMPlugin *plugin,
                                                         probe,
                                                         error);
 
+    /* Let the modem know whether queries may be pipelined in its AT ports */
+    if (modem && priv->at_pipeline)
+        g_object_set (modem,
+                      MM_BASE_MODEM_AT_PIPELINE, TRUE,
+                      NULL);
+
     g_hash_table_remove (priv->tasks, key);
     g_free (key);
     return modem;
 }
 
+/*****************************************************************************/
+/* Probing shared by all plugins */
+
+typedef struct {
+    GSimpleAsyncResult *result;
+    MMPortProbe *probe;
+    /* Plugins which passed the pre-probing filters, in order */
+    GSList *candidates;
+    MMPortProbeFlag flags;
+    guint64 send_delay;
+    const MMPortProbeAtCommand *custom_init;
+    /* Set while waiting for the plugin of another port of the device to be
+     * chosen, as AT probing isn't needed if it's this one */
+    MMPluginBase *single_at_plugin;
+} ProbePlanContext;
+
+/* Shared probings currently running, and those waiting because too many are
+ * running already. All ports of a device show up at once, so they are
+ * usually probed together. */
+static MMProbePlanQueue plans = MM_PROBE_PLAN_QUEUE_INIT;
+
+static void probe_plan_run_ready (MMPortProbe *probe,
+                                  GAsyncResult *probe_result,
+                                  ProbePlanContext *ctx);
+
+static void
+probe_plan_context_free (ProbePlanContext *ctx)
+{
+    mm_probe_plan_queue_remove (&plans, ctx);
+
+    if (ctx->single_at_plugin)
+        g_object_unref (ctx->single_at_plugin);
+    g_slist_foreach (ctx->candidates, (GFunc)g_object_unref, NULL);
+    g_slist_free (ctx->candidates);
+    g_object_unref (ctx->probe);
+    g_object_unref (ctx->result);
+    g_free (ctx);
+}
+
+static gboolean
+probe_plan_is_ready (ProbePlanContext *ctx)
+{
+    return !ctx->single_at_plugin;
+}
+
+static void
+probe_plan_start (ProbePlanContext *ctx)
+{
+    mm_dbg ("(%s) launching probing shared by %u plugins",
+            mm_port_probe_get_port_name (ctx->probe),
+            g_slist_length (ctx->candidates));
+    mm_port_probe_run (ctx->probe,
+                       ctx->flags,
+                       ctx->send_delay,
+                       ctx->custom_init,
+                       (GAsyncReadyCallback)probe_plan_run_ready,
+                       ctx);
+}
+
+static void
+probe_plan_start_pending (void)
+{
+    mm_probe_plan_queue_start_pending (&plans,
+                                       mm_context_get_probe_limit (),
+                                       (MMProbePlanReadyFunc)probe_plan_is_ready,
+                                       (MMProbePlanStartFunc)probe_plan_start);
+}
+
+static void
+skip_probing_in_plan (ProbePlanContext *other,
+                      ProbePlanContext *ctx,
+                      MMPortProbeFlag flags,
+                      MMPluginBase *single_at_plugin)
+{
+    MMPortProbeFlag probed;
+
+    if (other == ctx ||
+        !g_str_equal (mm_port_probe_get_port_physdev (ctx->probe),
+                      mm_port_probe_get_port_physdev (other->probe)))
+        return;
+
+    probed = mm_port_probe_get_probed (other->probe);
+
+    /* The first plugin accepting the results may not be the one getting the
+     * port, so AT probing is only skipped once it's known. Until then, ports
+     * still waiting are not probed, and those being probed go on. */
+    if (flags & MM_PORT_PROBE_AT &&
+        !(probed & MM_PORT_PROBE_AT)) {
+        if (other->single_at_plugin)
+            g_object_unref (other->single_at_plugin);
+        other->single_at_plugin = g_object_ref (single_at_plugin);
+    }
+
+    if (flags & MM_PORT_PROBE_QCDM &&
+        !(probed & MM_PORT_PROBE_QCDM)) {
+        mm_dbg ("(%s) no need to probe for QCDM support",
+                mm_port_probe_get_port_name (other->probe));
+        mm_port_probe_run_cancel_qcdm_probing (other->probe);
+        mm_port_probe_set_result_qcdm (other->probe, FALSE);
+    }
+}
+
+static void
+skip_probing_in_other_plans (ProbePlanContext *ctx,
+                             MMPortProbeFlag flags,
+                             MMPluginBase *single_at_plugin)
+{
+    GList *l;
+
+    for (l = plans.running; l; l = g_list_next (l))
+        skip_probing_in_plan (l->data, ctx, flags, single_at_plugin);
+    for (l = plans.pending.head; l; l = g_list_next (l))
+        skip_probing_in_plan (l->data, ctx, flags, single_at_plugin);
+}
+
+static void
+probe_plan_run_ready (MMPortProbe *probe,
+                      GAsyncResult *probe_result,
+                      ProbePlanContext *ctx)
+{
+    GError *error = NULL;
+    GSList *l;
+
+    if (!mm_port_probe_run_finish (probe, probe_result, &error)) {
+        g_simple_async_result_take_error (ctx->result, error);
+        g_simple_async_result_complete (ctx->result);
+        probe_plan_context_free (ctx);
+        probe_plan_start_pending ();
+        return;
+    }
+
+    /* The first plugin accepting the results is the one which will most
+     * likely get the port; if it expects a single AT port, there is no need
+     * to keep on looking for AT in the other ports of the device once that
+     * plugin gets the port. */
+    for (l = ctx->candidates; l; l = g_slist_next (l)) {
+        MMPluginBasePrivate *priv = MM_PLUGIN_BASE_GET_PRIVATE (l->data);
+
+        if (apply_post_probing_filters (MM_PLUGIN_BASE (l->data), probe))
+            continue;
+
+        if (priv->single_at &&
+            ctx->flags & MM_PORT_PROBE_AT &&
+            mm_port_probe_is_at (probe))
+            skip_probing_in_other_plans (ctx, MM_PORT_PROBE_AT, MM_PLUGIN_BASE (l->data));
+        break;
+    }
+
+    /* Modems use a single QCDM port, so once one is found there is no need
+     * to look for more in the device */
+    if (ctx->flags & MM_PORT_PROBE_QCDM &&
+        mm_port_probe_is_qcdm (probe))
+        skip_probing_in_other_plans (ctx, MM_PORT_PROBE_QCDM, NULL);
+
+    g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
+    g_simple_async_result_complete (ctx->result);
+    probe_plan_context_free (ctx);
+    probe_plan_start_pending ();
+}
+
+void
+mm_plugin_base_port_support_found (const gchar *physdev_path,
+                                   MMPlugin *plugin)
+{
+    GList *l;
+
+    for (l = plans.running; l; l = g_list_next (l)) {
+        ProbePlanContext *ctx = l->data;
+
+        if (!ctx->single_at_plugin ||
+            !g_str_equal (mm_port_probe_get_port_physdev (ctx->probe), physdev_path))
+            continue;
+
+        if (MM_PLUGIN (ctx->single_at_plugin) == plugin) {
+            mm_dbg ("(%s) no need to keep on probing for AT support, modem has its single AT port",
+                    mm_port_probe_get_port_name (ctx->probe));
+            mm_port_probe_run_cancel_at_probing (ctx->probe);
+        }
+
+        g_object_unref (ctx->single_at_plugin);
+        ctx->single_at_plugin = NULL;
+    }
+
+    for (l = plans.pending.head; l; l = g_list_next (l)) {
+        ProbePlanContext *ctx = l->data;
+
+        if (!ctx->single_at_plugin ||
+            !g_str_equal (mm_port_probe_get_port_physdev (ctx->probe), physdev_path))
+            continue;
+
+        if (MM_PLUGIN (ctx->single_at_plugin) == plugin) {
+            mm_dbg ("(%s) no need to probe for AT support, modem has its single AT port",
+                    mm_port_probe_get_port_name (ctx->probe));
+            mm_port_probe_set_result_at (ctx->probe, FALSE);
+        } else
+            mm_dbg ("(%s) modem may have more AT ports, probing for AT support",
+                    mm_port_probe_get_port_name (ctx->probe));
+
+        g_object_unref (ctx->single_at_plugin);
+        ctx->single_at_plugin = NULL;
+    }
+
+    probe_plan_start_pending ();
+}
+
+gboolean
+mm_plugin_base_probe_port_finish (GAsyncResult *result,
+                                  GError **error)
+{
+    if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error))
+        return FALSE;
+
+    return g_simple_async_result_get_op_res_gboolean (G_SIMPLE_ASYNC_RESULT (result));
+}
+
+void
+mm_plugin_base_probe_port (GSList *plugins,
+                           const gchar *subsys,
+                           const gchar *name,
+                           const gchar *physdev_path,
+                           MMBaseModem *existing,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
+{
+    GSimpleAsyncResult *result;
+    ProbePlanContext *ctx;
+    GUdevDevice *port = NULL;
+    gchar *driver = NULL;
+    MMProbePlan plan;
+    GSList *candidates = NULL;
+    gboolean no_at = FALSE;
+    GSList *l;
+
+    result = g_simple_async_result_new (NULL,
+                                        callback,
+                                        user_data,
+                                        mm_plugin_base_probe_port);
+
+    /* Only serial ports get probed */
+    if (!plugins ||
+        !MM_IS_PLUGIN_BASE (plugins->data) ||
+        !g_str_equal (subsys, "tty"))
+        goto out;
+
+    port = g_udev_client_query_by_subsystem_and_name (MM_PLUGIN_BASE_GET_PRIVATE (plugins->data)->client,
+                                                      subsys,
+                                                      name);
+    if (!port)
+        goto out;
+
+    driver = get_port_driver (port, name);
+    if (!driver)
+        goto out;
+
+    /* Merge the probing requested by every plugin which may support the port */
+    mm_probe_plan_init (&plan);
+    for (l = plugins; l; l = g_slist_next (l)) {
+        MMPluginBase *plugin;
+        MMPluginBasePrivate *priv;
+        gboolean need_vendor_probing;
+        gboolean need_product_probing;
+        MMProbePlanMatch match;
+
+        if (!MM_IS_PLUGIN_BASE (l->data))
+            continue;
+
+        plugin = MM_PLUGIN_BASE (l->data);
+        priv = MM_PLUGIN_BASE_GET_PRIVATE (plugin);
+
+        if (apply_pre_probing_filters (plugin,
+                                       port,
+                                       subsys,
+                                       name,
+                                       driver,
+                                       &need_vendor_probing,
+                                       &need_product_probing,
+                                       &match))
+            continue;
+
+        mm_probe_plan_add (&plan,
+                           get_probe_run_flags (plugin,
+                                                need_vendor_probing,
+                                                need_product_probing),
+                           match,
+                           priv->send_delay,
+                           priv->custom_init);
+        if (has_single_at_port (plugin, existing))
+            no_at = TRUE;
+
+        candidates = g_slist_append (candidates, g_object_ref (plugin));
+    }
+
+    /* Plugins equally specific but wanting different custom init commands
+     * or send delay check support on their own */
+    if (!mm_probe_plan_is_valid (&plan)) {
+        if (plan.conflict)
+            mm_dbg ("(%s) plugins disagree on how to probe the port, not sharing probing",
+                    name);
+        goto out;
+    }
+
+    ctx = g_new0 (ProbePlanContext, 1);
+    ctx->result = g_object_ref (result);
+    ctx->probe = mm_port_probe_cache_get (port, physdev_path, driver);
+    ctx->candidates = candidates;
+    ctx->flags = plan.flags;
+    ctx->send_delay = plan.send_delay;
+    ctx->custom_init = plan.custom_init;
+    candidates = NULL;
+
+    if (no_at)
+        mm_port_probe_set_result_at (ctx->probe, FALSE);
+
+    mm_probe_plan_queue_push (&plans, ctx);
+    probe_plan_start_pending ();
+
+    g_object_unref (result);
+    g_free (driver);
+    g_object_unref (port);
+    return;
+
+out:
+    /* Nothing probed; plugins will check support on their own */
+    g_simple_async_result_set_op_res_gboolean (result, FALSE);
+    g_simple_async_result_complete_in_idle (result);
+    g_object_unref (result);
+
+    g_slist_foreach (candidates, (GFunc)g_object_unref, NULL);
+    g_slist_free (candidates);
+    g_free (driver);
+    if (port)
+        g_object_unref (port);
+}
+
 /*****************************************************************************/
 
 static void
@@ -876,6 +1267,10 @@ set_property (GObject *object, guint prop_id,
         /* Construct only */
         priv->send_delay = (guint64)g_value_get_uint64 (value);
         break;
+    case PROP_AT_PIPELINE:
+        /* Construct only */
+        priv->at_pipeline = g_value_get_boolean (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -928,6 +1323,9 @@ get_property (GObject *object, guint prop_id,
     case PROP_SEND_DELAY:
         g_value_set_uint64 (value, priv->send_delay);
         break;
+    case PROP_AT_PIPELINE:
+        g_value_set_boolean (value, priv->at_pipeline);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -1074,4 +1472,13 @@ mm_plugin_base_class_init (MMPluginBaseClass *klass)
                               "in microseconds",
                               0, G_MAXUINT64, 100000,
                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+    g_object_class_install_property
+        (object_class, PROP_AT_PIPELINE,
+         g_param_spec_boolean (MM_PLUGIN_BASE_AT_PIPELINE,
+                               "AT pipeline",
+                               "Whether the modems handled by this plugin accept "
+                               "several queries in a single AT command line",
+                               FALSE,
+                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 }
@@ -46,6 +46,7 @@
 #define MM_PLUGIN_BASE_CUSTOM_INIT             "custom-init"
 #define MM_PLUGIN_BASE_SEND_DELAY              "send-delay"
 #define MM_PLUGIN_BASE_SORT_LAST               "sort-last"
+#define MM_PLUGIN_BASE_AT_PIPELINE             "at-pipeline"
 
 typedef struct _MMPluginBase MMPluginBase;
 typedef struct _MMPluginBaseClass MMPluginBaseClass;
@@ -72,4 +73,22 @@ gboolean mm_plugin_base_get_device_ids (MMPluginBase *self,
                                         guint16 *vendor,
                                         guint16 *product);
 
+/* Runs a single probing of the port for all the given plugins, merging the
+ * probing flags of those passing the pre-probing filters. Support checks
+ * launched afterwards reuse the results. */
+void     mm_plugin_base_probe_port        (GSList *plugins,
+                                           const gchar *subsys,
+                                           const gchar *name,
+                                           const gchar *physdev_path,
+                                           MMBaseModem *existing,
+                                           GAsyncReadyCallback callback,
+                                           gpointer user_data);
+gboolean mm_plugin_base_probe_port_finish (GAsyncResult *result,
+                                           GError **error);
+
+/* Lets probings of the other ports of the device waiting for the plugin of
+ * the port to be known go on */
+void     mm_plugin_base_port_support_found (const gchar *physdev_path,
+                                            MMPlugin *plugin);
+
 #endif /* MM_PLUGIN_BASE_H */
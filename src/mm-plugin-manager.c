@@ -26,9 +26,12 @@
 
 #include "mm-plugin-manager.h"
 #include "mm-plugin.h"
+#include "mm-plugin-base.h"
+#include "mm-probe-plan.h"
 #include "mm-log.h"
 
-/* Default time to defer probing checks */
+/* Default time to defer probing checks, if no other port of the same device
+ * finishes its check before */
 #define SUPPORTS_DEFER_TIMEOUT_SECS 3
 
 static void initable_iface_init (GInitableIface *iface);
@@ -49,6 +52,9 @@ struct _MMPluginManagerPrivate {
      * as we want to be able to modify the list without replacing items with
      * the HT API, which also replaces keys). */
     GHashTable *supports;
+
+    /* Support checks deferred, by physical path of the device */
+    MMProbePlanDeferrals *deferrals;
 };
 
 /* List of support infos associated to the same physical device */
@@ -194,6 +200,19 @@ suggest_supports_info_result (MMPluginManager *self,
     }
 }
 
+static void
+retry_deferred_supports_info (MMPluginManager *self,
+                              const gchar *physdev_path)
+{
+    guint n;
+
+    /* Another port of the device is ready, which is what deferred checks
+     * usually wait for; no need to wait for the timeout */
+    n = mm_probe_plan_deferrals_retry (self->priv->deferrals, physdev_path);
+    if (n > 0)
+        mm_dbg ("(%s) retrying %u deferred support checks", physdev_path, n);
+}
+
 static void
 cancel_all_deferred_supports_info (MMPluginManager *self,
                                    const gchar *physdev_path)
@@ -325,9 +344,11 @@ supports_port_ready_cb (MMPlugin *plugin,
                     info->name);
         }
         /* Schedule checking support */
-        info->source_id = g_timeout_add_seconds (SUPPORTS_DEFER_TIMEOUT_SECS,
-                                                 (GSourceFunc)find_port_support_idle,
-                                                 info);
+        mm_probe_plan_deferrals_add (info->self->priv->deferrals,
+                                     info->physdev_path,
+                                     SUPPORTS_DEFER_TIMEOUT_SECS,
+                                     (GSourceFunc)find_port_support_idle,
+                                     info);
         break;
 
     case MM_PLUGIN_SUPPORTS_PORT_DEFER_UNTIL_SUGGESTED:
@@ -377,6 +398,11 @@ find_port_support_idle (SupportsInfo *info)
          * before completing the operation. */
         remove_supports_info (info->self, info);
 
+        /* Checks deferred in the other ports of the device may go on now,
+         * and so may probings waiting to know the plugin */
+        retry_deferred_supports_info (info->self, info->physdev_path);
+        mm_plugin_base_port_support_found (info->physdev_path, info->best_plugin);
+
         /* We are reporting a best plugin found to a port. We can now
          * 'suggest' this same plugin to other ports of the same device. */
         if (info->best_plugin)
@@ -406,6 +432,25 @@ find_port_support_idle (SupportsInfo *info)
     return FALSE;
 }
 
+static void
+probe_port_ready (GObject *source,
+                  GAsyncResult *result,
+                  SupportsInfo *info)
+{
+    GError *error = NULL;
+
+    if (!mm_plugin_base_probe_port_finish (result, &error) && error) {
+        mm_dbg ("(%s) shared port probing failed: '%s'",
+                info->name,
+                error->message);
+        g_error_free (error);
+    }
+
+    /* Now ask the plugins one by one; the probing results are already
+     * available, so they just need to be matched */
+    find_port_support_idle (info);
+}
+
 MMPlugin *
 mm_plugin_manager_find_port_support_finish (MMPluginManager *self,
                                             GAsyncResult *result,
@@ -463,9 +508,26 @@ mm_plugin_manager_find_port_support (MMPluginManager *self,
      * Ownership of the supports info will belong to the manager now. */
     add_supports_info (self, info);
 
-    /* Schedule the processing of the supports task in an idle */
-    info->source_id = g_idle_add ((GSourceFunc)find_port_support_idle,
-                                  info);
+    /* Probe the port once for all the plugins which may support it. If we got
+     * a suggested plugin, it is the only one which can get the port. */
+    if (info->suggested_plugin) {
+        GSList single = { info->suggested_plugin, NULL };
+
+        mm_plugin_base_probe_port (&single,
+                                   subsys,
+                                   name,
+                                   physdev_path,
+                                   existing,
+                                   (GAsyncReadyCallback)probe_port_ready,
+                                   info);
+    } else
+        mm_plugin_base_probe_port (self->priv->plugins,
+                                   subsys,
+                                   name,
+                                   physdev_path,
+                                   existing,
+                                   (GAsyncReadyCallback)probe_port_ready,
+                                   info);
 }
 
 gboolean
@@ -712,6 +774,7 @@ mm_plugin_manager_init (MMPluginManager *manager)
         g_str_equal,
         g_free,
         (GDestroyNotify)supports_info_list_free);
+    manager->priv->deferrals = mm_probe_plan_deferrals_new ();
 }
 
 static gboolean
@@ -734,6 +797,7 @@ finalize (GObject *object)
      */
     g_assert (g_hash_table_size (self->priv->supports) == 0);
     g_hash_table_destroy (self->priv->supports);
+    mm_probe_plan_deferrals_free (self->priv->deferrals);
 
     /* Cleanup list of plugins */
     g_slist_foreach (self->priv->plugins, (GFunc)g_object_unref, NULL);
@@ -0,0 +1,147 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include "mm-polling.h"
+#include "mm-timer-wheel.h"
+
+struct _MMPolling {
+    guint min_interval;
+    guint max_interval;
+    guint interval;
+    guint timeout_id;
+    gboolean running;
+    MMPollingFunc func;
+    gpointer user_data;
+};
+
+static void
+run_poll (MMPolling *polling)
+{
+    polling->running = TRUE;
+    polling->func (polling->user_data);
+}
+
+static gboolean
+poll_timeout (MMPolling *polling)
+{
+    polling->timeout_id = 0;
+    run_poll (polling);
+    return FALSE;
+}
+
+static void
+schedule_poll (MMPolling *polling)
+{
+    if (polling->timeout_id)
+        mm_timer_wheel_remove (polling->timeout_id);
+    polling->timeout_id = mm_timer_wheel_add_seconds (polling->user_data,
+                                                      polling->interval,
+                                                      (GSourceFunc)poll_timeout,
+                                                      polling);
+}
+
+void
+mm_polling_start (MMPolling *polling,
+                  gboolean immediately)
+{
+    g_return_if_fail (polling != NULL);
+
+    polling->interval = polling->min_interval;
+
+    /* The ongoing poll will schedule the next one */
+    if (polling->running)
+        return;
+
+    if (!immediately) {
+        schedule_poll (polling);
+        return;
+    }
+
+    if (polling->timeout_id) {
+        mm_timer_wheel_remove (polling->timeout_id);
+        polling->timeout_id = 0;
+    }
+    run_poll (polling);
+}
+
+void
+mm_polling_done (MMPolling *polling,
+                 gboolean changed)
+{
+    g_return_if_fail (polling != NULL);
+
+    polling->running = FALSE;
+
+    if (changed)
+        polling->interval = polling->min_interval;
+    else
+        polling->interval = MIN (polling->interval * 2, polling->max_interval);
+
+    schedule_poll (polling);
+}
+
+void
+mm_polling_indication (MMPolling *polling)
+{
+    g_return_if_fail (polling != NULL);
+
+    /* The ongoing poll will schedule the next one */
+    if (polling->running)
+        return;
+
+    /* The modem reports changes by itself, so polling is just a safety net */
+    polling->interval = polling->max_interval;
+    schedule_poll (polling);
+}
+
+guint
+mm_polling_get_interval (MMPolling *polling)
+{
+    g_return_val_if_fail (polling != NULL, 0);
+
+    return polling->interval;
+}
+
+MMPolling *
+mm_polling_new (guint min_interval,
+                guint max_interval,
+                MMPollingFunc func,
+                gpointer user_data)
+{
+    MMPolling *polling;
+
+    g_return_val_if_fail (min_interval > 0, NULL);
+    g_return_val_if_fail (max_interval >= min_interval, NULL);
+    g_return_val_if_fail (func != NULL, NULL);
+
+    polling = g_new0 (MMPolling, 1);
+    polling->min_interval = min_interval;
+    polling->max_interval = max_interval;
+    polling->interval = min_interval;
+    polling->func = func;
+    polling->user_data = user_data;
+    return polling;
+}
+
+void
+mm_polling_free (MMPolling *polling)
+{
+    if (!polling)
+        return;
+
+    if (polling->timeout_id)
+        mm_timer_wheel_remove (polling->timeout_id);
+    g_free (polling);
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_POLLING_H
+#define MM_POLLING_H
+
+#include <glib.h>
+
+/*
+ * Fallback polling of a value which may also be reported by the modem
+ * through unsolicited messages.
+ *
+ * The poll function is called once the current interval elapses, or right
+ * away when starting if requested; it is expected to launch the poll and
+ * report its outcome with mm_polling_done(), which schedules the next one.
+ * The interval starts at the minimum and doubles every time a poll finds the
+ * value unchanged, up to the maximum; a change brings it back to the
+ * minimum. Values reported by unsolicited messages are notified with
+ * mm_polling_indication(), which postpones the next poll.
+ *
+ * Polls are scheduled in the shared timer wheel, with 'user_data' (usually
+ * the modem) as owner, so that the polls of all modems share wakeups.
+ */
+
+typedef struct _MMPolling MMPolling;
+
+typedef void (* MMPollingFunc) (gpointer user_data);
+
+MMPolling *mm_polling_new  (guint min_interval,
+                            guint max_interval,
+                            MMPollingFunc func,
+                            gpointer user_data);
+void       mm_polling_free (MMPolling *polling);
+
+void     mm_polling_start        (MMPolling *polling,
+                                  gboolean immediately);
+void     mm_polling_done         (MMPolling *polling,
+                                  gboolean changed);
+void     mm_polling_indication   (MMPolling *polling);
+guint    mm_polling_get_interval (MMPolling *polling);
+
+#endif /* MM_POLLING_H */
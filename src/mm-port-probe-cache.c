@@ -13,14 +13,152 @@
  * Copyright (C) 2011 Aleksander Morgado <aleksander@gnu.org>
  */
 
+#include <stdlib.h>
+#include <errno.h>
+
 #include <glib.h>
 
 #include "mm-port-probe.h"
 #include "mm-port-probe-cache.h"
+#include "mm-port-probe-hints.h"
+#include "mm-modem-helpers.h"
+#include "mm-context.h"
+#include "mm-log.h"
 
 /* Cache of port probing objects */
 static GHashTable *cache;
 
+/* Probing results of previous runs, keyed by device */
+static GKeyFile *store;
+static gboolean store_loaded;
+static guint store_save_id;
+
+/*****************************************************************************/
+/* Persistent store */
+
+/* Ports are identified by the device they belong to, not by their name, so
+ * that results survive both daemon restarts and re-enumerations */
+static gchar *
+get_device_key (GUdevDevice *port,
+                const gchar *driver)
+{
+    const gchar *vid;
+    const gchar *pid;
+
+    if (!g_str_equal (g_udev_device_get_subsystem (port), "tty"))
+        return NULL;
+
+    vid = g_udev_device_get_property (port, "ID_VENDOR_ID");
+    pid = g_udev_device_get_property (port, "ID_MODEL_ID");
+    if (!vid || !pid)
+        return NULL;
+
+    return mm_port_probe_hints_build_key (strtoul (vid, NULL, 16),
+                                          strtoul (pid, NULL, 16),
+                                          g_udev_device_get_property (port, "ID_SERIAL_SHORT"),
+                                          g_udev_device_get_property (port, "ID_REVISION"),
+                                          g_udev_device_get_property (port, "ID_MODEL"),
+                                          g_udev_device_get_property (port, "ID_VENDOR"),
+                                          g_udev_device_get_property (port, "ID_USB_INTERFACE_NUM"),
+                                          driver);
+}
+
+static void
+store_load (void)
+{
+    const gchar *path;
+    GError *error = NULL;
+
+    store_loaded = TRUE;
+
+    path = mm_context_get_probe_cache ();
+    if (!path)
+        return;
+
+    store = g_key_file_new ();
+    if (!g_key_file_load_from_file (store, path, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            mm_warn ("Couldn't load port probing results from '%s': %s",
+                     path, error->message);
+        g_error_free (error);
+    }
+}
+
+static gboolean
+store_save (void)
+{
+    const gchar *path;
+    gchar *dir;
+    gchar *data;
+    gsize len;
+    GError *error = NULL;
+
+    store_save_id = 0;
+
+    path = mm_context_get_probe_cache ();
+    dir = g_path_get_dirname (path);
+    if (g_mkdir_with_parents (dir, 0755) < 0)
+        mm_warn ("Couldn't create directory '%s': %s", dir, g_strerror (errno));
+    g_free (dir);
+
+    data = g_key_file_to_data (store, &len, NULL);
+    if (!g_file_set_contents (path, data, len, &error)) {
+        mm_warn ("Couldn't save port probing results to '%s': %s",
+                 path, error->message);
+        g_error_free (error);
+    }
+    g_free (data);
+
+    return FALSE;
+}
+
+static void
+store_load_hint (MMPortProbe *probe,
+                 const gchar *key)
+{
+    MMPortType type;
+    gchar *vendor = NULL;
+    gchar *product = NULL;
+
+    if (!mm_port_probe_hints_lookup (store, key, &type, &vendor, &product))
+        return;
+
+    mm_port_probe_set_hint (probe, type, vendor, product);
+    g_free (vendor);
+    g_free (product);
+}
+
+void
+mm_port_probe_cache_store (MMPortProbe *probe)
+{
+    MMPortProbeFlag probed;
+    gchar *key;
+
+    if (!store)
+        return;
+
+    key = get_device_key (mm_port_probe_get_port (probe),
+                          mm_port_probe_get_port_driver (probe));
+    if (!key)
+        return;
+
+    probed = mm_port_probe_get_probed (probe);
+    mm_port_probe_hints_update (store,
+                                key,
+                                mm_port_probe_get_port_type (probe),
+                                !!(probed & MM_PORT_PROBE_AT_VENDOR),
+                                mm_port_probe_get_vendor (probe),
+                                !!(probed & MM_PORT_PROBE_AT_PRODUCT),
+                                mm_port_probe_get_product (probe));
+    g_free (key);
+
+    /* Several ports usually finish probing at once; write them together */
+    if (!store_save_id)
+        store_save_id = g_timeout_add_seconds (1, (GSourceFunc)store_save, NULL);
+}
+
+/*****************************************************************************/
+
 static gchar *
 get_key (GUdevDevice *port)
 {
@@ -58,6 +196,18 @@ mm_port_probe_cache_get (GUdevDevice *port,
     if (!probe) {
         probe = mm_port_probe_new (port, physdev_path, driver);
         g_hash_table_insert (cache, key, probe);
+
+        if (G_UNLIKELY (!store_loaded))
+            store_load ();
+
+        if (store) {
+            gchar *device_key;
+
+            device_key = get_device_key (port, driver);
+            if (device_key)
+                store_load_hint (probe, device_key);
+            g_free (device_key);
+        }
     } else
         g_free (key);
 
@@ -80,6 +230,12 @@ mm_port_probe_cache_remove (GUdevDevice *port)
 void
 mm_port_probe_cache_clear (void)
 {
+    /* Write any pending results before going away */
+    if (store_save_id) {
+        g_source_remove (store_save_id);
+        store_save ();
+    }
+
     if (G_UNLIKELY (!cache))
         return;
 
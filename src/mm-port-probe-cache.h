@@ -26,6 +26,8 @@ MMPortProbe *mm_port_probe_cache_get    (GUdevDevice *port,
 
 void         mm_port_probe_cache_remove (GUdevDevice *port);
 
+void         mm_port_probe_cache_store  (MMPortProbe *probe);
+
 void         mm_port_probe_cache_clear  (void);
 
 #endif /* MM_PORT_PROBE_CACHE_H */
@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <glib.h>
+
+#include "mm-port-probe-hints.h"
+#include "mm-modem-helpers.h"
+
+gchar *
+mm_port_probe_hints_build_key (guint16 vid,
+                               guint16 pid,
+                               const gchar *serial,
+                               const gchar *revision,
+                               const gchar *model,
+                               const gchar *manufacturer,
+                               const gchar *ifnum,
+                               const gchar *driver)
+{
+    gchar *devid;
+    gchar *key;
+
+    devid = mm_create_device_identifier (vid,
+                                         pid,
+                                         NULL,
+                                         NULL,
+                                         serial,
+                                         revision,
+                                         model,
+                                         manufacturer);
+    if (!devid)
+        return NULL;
+
+    key = g_strdup_printf ("%s:%s:%s",
+                           devid,
+                           ifnum ? ifnum : "",
+                           driver ? driver : "");
+    g_free (devid);
+    return key;
+}
+
+gboolean
+mm_port_probe_hints_lookup (GKeyFile *store,
+                            const gchar *key,
+                            MMPortType *type,
+                            gchar **vendor,
+                            gchar **product)
+{
+    gchar *str;
+
+    g_return_val_if_fail (type != NULL, FALSE);
+
+    if (!store || !key || !g_key_file_has_group (store, key))
+        return FALSE;
+
+    str = g_key_file_get_string (store, key, "type", NULL);
+    if (g_strcmp0 (str, "at") == 0)
+        *type = MM_PORT_TYPE_AT;
+    else if (g_strcmp0 (str, "qcdm") == 0)
+        *type = MM_PORT_TYPE_QCDM;
+    else
+        *type = MM_PORT_TYPE_UNKNOWN;
+    g_free (str);
+
+    if (*type == MM_PORT_TYPE_UNKNOWN)
+        return FALSE;
+
+    /* Vendor and product only make sense for AT ports */
+    if (vendor)
+        *vendor = (*type == MM_PORT_TYPE_AT ?
+                   g_key_file_get_string (store, key, "vendor", NULL) :
+                   NULL);
+    if (product)
+        *product = (*type == MM_PORT_TYPE_AT ?
+                    g_key_file_get_string (store, key, "product", NULL) :
+                    NULL);
+    return TRUE;
+}
+
+void
+mm_port_probe_hints_update (GKeyFile *store,
+                            const gchar *key,
+                            MMPortType type,
+                            gboolean vendor_probed,
+                            const gchar *vendor,
+                            gboolean product_probed,
+                            const gchar *product)
+{
+    const gchar *type_str;
+    gchar *previous;
+
+    g_return_if_fail (store != NULL);
+    g_return_if_fail (key != NULL);
+
+    /* Ports which are neither may just not have answered this time */
+    switch (type) {
+    case MM_PORT_TYPE_AT:
+        type_str = "at";
+        break;
+    case MM_PORT_TYPE_QCDM:
+        type_str = "qcdm";
+        break;
+    default:
+        g_key_file_remove_group (store, key, NULL);
+        return;
+    }
+
+    /* Results of another type are no longer valid at all */
+    previous = g_key_file_get_string (store, key, "type", NULL);
+    if (g_strcmp0 (previous, type_str) != 0)
+        g_key_file_remove_group (store, key, NULL);
+    g_free (previous);
+    g_key_file_set_string (store, key, "type", type_str);
+
+    if (type != MM_PORT_TYPE_AT)
+        return;
+
+    if (vendor_probed) {
+        if (vendor)
+            g_key_file_set_string (store, key, "vendor", vendor);
+        else
+            g_key_file_remove_key (store, key, "vendor", NULL);
+    }
+    if (product_probed) {
+        if (product)
+            g_key_file_set_string (store, key, "product", product);
+        else
+            g_key_file_remove_key (store, key, "product", NULL);
+    }
+}
+
+MMPortProbeHintsAtStep
+mm_port_probe_hints_at_step (MMPortType hint,
+                             gboolean at_requested,
+                             gboolean at_probed)
+{
+    if (!at_requested || at_probed)
+        return MM_PORT_PROBE_HINTS_AT_STEP_NONE;
+    if (hint == MM_PORT_TYPE_AT)
+        return MM_PORT_PROBE_HINTS_AT_STEP_CONFIRM;
+    return MM_PORT_PROBE_HINTS_AT_STEP_FULL;
+}
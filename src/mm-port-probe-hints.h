@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_PORT_PROBE_HINTS_H
+#define MM_PORT_PROBE_HINTS_H
+
+#include <glib.h>
+
+#include "mm-port.h"
+
+/*
+ * Port probing results kept across daemon runs by the port probe cache.
+ *
+ * Each port has a group in a key file, named after the device the port
+ * belongs to rather than after the port itself, with the port type ("at" or
+ * "qcdm") and, for AT ports, the vendor and product strings. A port found in
+ * there is probed with a single check confirming those results (the hint);
+ * only if that check fails the whole probing is run.
+ */
+
+gchar    *mm_port_probe_hints_build_key (guint16 vid,
+                                         guint16 pid,
+                                         const gchar *serial,
+                                         const gchar *revision,
+                                         const gchar *model,
+                                         const gchar *manufacturer,
+                                         const gchar *ifnum,
+                                         const gchar *driver);
+
+/* Returns FALSE if there are no results for the key */
+gboolean  mm_port_probe_hints_lookup    (GKeyFile *store,
+                                         const gchar *key,
+                                         MMPortType *type,
+                                         gchar **vendor,
+                                         gchar **product);
+
+/* Only AT and QCDM results are kept, other types remove the results of the
+ * port. Vendor and product are only updated if they were probed. */
+void      mm_port_probe_hints_update    (GKeyFile *store,
+                                         const gchar *key,
+                                         MMPortType type,
+                                         gboolean vendor_probed,
+                                         const gchar *vendor,
+                                         gboolean product_probed,
+                                         const gchar *product);
+
+typedef enum {
+    MM_PORT_PROBE_HINTS_AT_STEP_NONE,    /* no AT probing left */
+    MM_PORT_PROBE_HINTS_AT_STEP_CONFIRM, /* single check of the hint */
+    MM_PORT_PROBE_HINTS_AT_STEP_FULL     /* full AT probing */
+} MMPortProbeHintsAtStep;
+
+/* How to check for AT support given the hint still to be checked, if any;
+ * hints are cleared once checked, so a failed check leads to full probing */
+MMPortProbeHintsAtStep mm_port_probe_hints_at_step (MMPortType hint,
+                                                    gboolean at_requested,
+                                                    gboolean at_probed);
+
+#endif /* MM_PORT_PROBE_HINTS_H */
@@ -28,6 +28,8 @@
 #include "mm-serial-port.h"
 #include "mm-serial-parsers.h"
 #include "mm-port-probe-at.h"
+#include "mm-port-probe-hints.h"
+#include "mm-probe-plan.h"
 #include "libqcdm/src/commands.h"
 #include "libqcdm/src/utils.h"
 #include "libqcdm/src/errors.h"
@@ -43,15 +45,25 @@
  *      |----> Product
  * ----> QCDM Serial Open
  *   |----> QCDM?
+ *
+ * When a hint with the results of a previous probing is available, a single
+ * AT (or QCDM) check confirms it; only if that fails the steps above follow.
  */
 
 G_DEFINE_TYPE (MMPortProbe, mm_port_probe, G_TYPE_OBJECT)
 
+/* Opening the AT port is retried waiting 125 ms, 250 ms, 500 ms and then 1 s
+ * between tries, for almost 5 s in total */
+#define AT_OPEN_TRIES        7
+#define AT_OPEN_RETRY_MIN_MS 125
+#define AT_OPEN_RETRY_MAX_MS 1000
+
 typedef struct {
     /* ---- Generic task context ---- */
     GSimpleAsyncResult *result;
     GCancellable *cancellable;
     GCancellable *at_probing_cancellable;
+    GCancellable *qcdm_probing_cancellable;
     guint32 flags;
     guint source_id;
     guint buffer_full_id;
@@ -85,6 +97,11 @@ struct _MMPortProbePrivate {
     gchar *vendor;
     gchar *product;
 
+    /* Results of a previous probing, to be confirmed */
+    MMPortType hint;
+    gchar *hint_vendor;
+    gchar *hint_product;
+
     /* Current probing task. Only one can be available at a time */
     PortProbeRunTask *task;
 };
@@ -162,8 +179,25 @@ mm_port_probe_set_result_qcdm (MMPortProbe *self,
         mm_dbg ("(%s) port is not QCDM-capable", self->priv->name);
 }
 
+void
+mm_port_probe_set_hint (MMPortProbe *self,
+                        MMPortType port_type,
+                        const gchar *vendor,
+                        const gchar *product)
+{
+    g_return_if_fail (port_type == MM_PORT_TYPE_AT ||
+                      port_type == MM_PORT_TYPE_QCDM);
+
+    self->priv->hint = port_type;
+    g_free (self->priv->hint_vendor);
+    self->priv->hint_vendor = g_strdup (vendor);
+    g_free (self->priv->hint_product);
+    self->priv->hint_product = g_strdup (product);
+}
+
 static gboolean serial_probe_at (MMPortProbe *self);
 static gboolean serial_probe_qcdm (MMPortProbe *self);
+static gboolean serial_open_at (MMPortProbe *self);
 static void serial_probe_schedule (MMPortProbe *self);
 
 static void
@@ -185,6 +219,8 @@ port_probe_run_task_free (PortProbeRunTask *task)
         g_object_unref (task->cancellable);
     if (task->at_probing_cancellable)
         g_object_unref (task->at_probing_cancellable);
+    if (task->qcdm_probing_cancellable)
+        g_object_unref (task->qcdm_probing_cancellable);
 
     g_object_unref (task->result);
     g_free (task);
@@ -253,6 +289,13 @@ serial_probe_qcdm_parse_response (MMQcdmSerialPort *port,
     if (port_probe_run_is_cancelled (self))
         return;
 
+    /* QCDM probing cancelled, the result was already given */
+    if (g_cancellable_is_cancelled (self->priv->task->qcdm_probing_cancellable)) {
+        self->priv->hint = MM_PORT_TYPE_UNKNOWN;
+        serial_probe_schedule (self);
+        return;
+    }
+
     if (!error) {
         /* Parse the response */
         result = qcdm_cmd_version_info_result ((const gchar *) response->data,
@@ -273,6 +316,14 @@ serial_probe_qcdm_parse_response (MMQcdmSerialPort *port,
     /* Set probing result */
     mm_port_probe_set_result_qcdm (self, is_qcdm);
 
+    /* When confirming a hint this runs before any AT probing, and custom
+     * init commands make no sense in a QCDM port */
+    if (is_qcdm)
+        self->priv->task->at_custom_init = NULL;
+
+    /* A hint is checked only once */
+    self->priv->hint = MM_PORT_TYPE_UNKNOWN;
+
     /* Reschedule probing */
     serial_probe_schedule (self);
 }
@@ -351,13 +402,13 @@ serial_probe_qcdm (MMPortProbe *self)
     mm_qcdm_serial_port_queue_command (MM_QCDM_SERIAL_PORT (task->serial),
                                        verinfo,
                                        3,
-                                       NULL,
+                                       task->qcdm_probing_cancellable,
                                        (MMQcdmSerialResponseFn)serial_probe_qcdm_parse_response,
                                        NULL);
     mm_qcdm_serial_port_queue_command (MM_QCDM_SERIAL_PORT (task->serial),
                                        verinfo2,
                                        3,
-                                       NULL,
+                                       task->qcdm_probing_cancellable,
                                        (MMQcdmSerialResponseFn)serial_probe_qcdm_parse_response,
                                        self);
 
@@ -411,6 +462,26 @@ serial_probe_at_result_processor (MMPortProbe *self,
     mm_port_probe_set_result_at (self, FALSE);
 }
 
+static void
+serial_probe_at_hint_result_processor (MMPortProbe *self,
+                                       GVariant *result)
+{
+    /* A hint is checked only once */
+    self->priv->hint = MM_PORT_TYPE_UNKNOWN;
+
+    if (!result || !g_variant_get_boolean (result)) {
+        mm_dbg ("(%s) previous probing results not confirmed", self->priv->name);
+        return;
+    }
+
+    mm_dbg ("(%s) previous probing results confirmed", self->priv->name);
+    mm_port_probe_set_result_at (self, TRUE);
+    if (self->priv->hint_vendor)
+        mm_port_probe_set_result_at_vendor (self, self->priv->hint_vendor);
+    if (self->priv->hint_product)
+        mm_port_probe_set_result_at_product (self, self->priv->hint_product);
+}
+
 static void
 serial_probe_at_custom_init_result_processor (MMPortProbe *self,
                                               GVariant *result)
@@ -525,6 +596,11 @@ serial_probe_at (MMPortProbe *self)
     return FALSE;
 }
 
+static const MMPortProbeAtCommand at_hint_probing[] = {
+    { "AT",  3, mm_port_probe_response_processor_is_at },
+    { NULL }
+};
+
 static const MMPortProbeAtCommand at_probing[] = {
     { "AT",  3, mm_port_probe_response_processor_is_at },
     { "AT",  3, mm_port_probe_response_processor_is_at },
@@ -550,6 +626,7 @@ static void
 serial_probe_schedule (MMPortProbe *self)
 {
     PortProbeRunTask *task = self->priv->task;
+    MMPortProbeHintsAtStep at_step;
 
     /* If already cancelled, do nothing else */
     if (port_probe_run_is_cancelled (self))
@@ -559,15 +636,25 @@ serial_probe_schedule (MMPortProbe *self)
     task->at_result_processor = NULL;
     task->at_commands = NULL;
 
+    /* A failed confirmation clears the hint, so full probing follows it */
+    at_step = mm_port_probe_hints_at_step (self->priv->hint,
+                                           !!(task->flags & MM_PORT_PROBE_AT),
+                                           !!(self->priv->flags & MM_PORT_PROBE_AT));
+
     /* If we got some custom initialization commands requested, go on with them
      * first. */
     if (task->at_custom_init) {
         task->at_result_processor = serial_probe_at_custom_init_result_processor;
         task->at_commands = task->at_custom_init;
     }
+    /* AT check requested, not already probed, and known to be AT before? */
+    else if (at_step == MM_PORT_PROBE_HINTS_AT_STEP_CONFIRM) {
+        /* Prepare confirming the hint */
+        task->at_result_processor = serial_probe_at_hint_result_processor;
+        task->at_commands = at_hint_probing;
+    }
     /* AT check requested and not already probed? */
-    else if ((task->flags & MM_PORT_PROBE_AT) &&
-             !(self->priv->flags & MM_PORT_PROBE_AT)) {
+    else if (at_step == MM_PORT_PROBE_HINTS_AT_STEP_FULL) {
         /* Prepare AT probing */
         task->at_result_processor = serial_probe_at_result_processor;
         task->at_commands = at_probing;
@@ -590,6 +677,14 @@ serial_probe_schedule (MMPortProbe *self)
     /* If a next AT group detected, go for it */
     if (task->at_result_processor &&
         task->at_commands) {
+        /* When a QCDM hint wasn't confirmed, the port is still open as QCDM */
+        if (!MM_IS_AT_SERIAL_PORT (task->serial)) {
+            mm_serial_port_close (task->serial);
+            g_clear_object (&task->serial);
+            task->source_id = g_idle_add ((GSourceFunc)serial_open_at, self);
+            return;
+        }
+
         task->source_id = g_idle_add ((GSourceFunc)serial_probe_at, self);
         return;
     }
@@ -713,22 +808,26 @@ serial_open_at (MMPortProbe *self)
     /* Try to open the port */
     if (!mm_serial_port_open (task->serial, &error)) {
         /* Abort if maximum number of open tries reached */
-        if (++task->at_open_tries > 4) {
+        if (++task->at_open_tries > AT_OPEN_TRIES) {
             /* took too long to open the port; give up */
             port_probe_run_task_complete (
                 task,
                 FALSE,
                 g_error_new (MM_CORE_ERROR,
                              MM_CORE_ERROR_FAILED,
-                             "(%s) failed to open port after 4 tries",
-                             self->priv->name));
+                             "(%s) failed to open port after %u tries",
+                             self->priv->name,
+                             AT_OPEN_TRIES));
         } else if (g_error_matches (error,
                                     MM_SERIAL_ERROR,
                                     MM_SERIAL_ERROR_OPEN_FAILED_NO_DEVICE)) {
-            /* this is nozomi being dumb; try again */
-            task->source_id = g_timeout_add_seconds (1,
-                                                     (GSourceFunc)serial_open_at,
-                                                     self);
+            /* this is nozomi being dumb; try again, soon at first as the
+             * device is usually there after a short while */
+            task->source_id = g_timeout_add (mm_probe_plan_open_retry_delay (task->at_open_tries,
+                                                                             AT_OPEN_RETRY_MIN_MS,
+                                                                             AT_OPEN_RETRY_MAX_MS),
+                                             (GSourceFunc)serial_open_at,
+                                             self);
         } else {
             port_probe_run_task_complete (
                 task,
@@ -772,6 +871,20 @@ mm_port_probe_run_cancel_at_probing (MMPortProbe *self)
     return FALSE;
 }
 
+gboolean
+mm_port_probe_run_cancel_qcdm_probing (MMPortProbe *self)
+{
+    g_return_val_if_fail (MM_IS_PORT_PROBE (self), FALSE);
+
+    if (self->priv->task) {
+        mm_dbg ("(%s) requested to cancel QCDM probing", self->priv->name);
+        g_cancellable_cancel (self->priv->task->qcdm_probing_cancellable);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 gboolean
 mm_port_probe_run_cancel (MMPortProbe *self)
 {
@@ -859,18 +972,28 @@ mm_port_probe_run (MMPortProbe *self,
 
     /* Setup internal cancellable */
     task->cancellable = g_cancellable_new ();
+    task->qcdm_probing_cancellable = g_cancellable_new ();
 
     probe_list_str = mm_port_probe_flag_build_string_from_mask (task->flags);
-    mm_info ("(%s) launching port probing: '%s'",
+    mm_info ("(%s) launching port probing: '%s'%s",
              self->priv->name,
-             probe_list_str);
+             probe_list_str,
+             self->priv->hint != MM_PORT_TYPE_UNKNOWN ? " (confirming previous results)" : "");
     g_free (probe_list_str);
 
-    /* If any AT probing is needed, start by opening as AT port */
     if (task->flags & MM_PORT_PROBE_AT ||
         task->flags & MM_PORT_PROBE_AT_VENDOR ||
         task->flags & MM_PORT_PROBE_AT_PRODUCT) {
         task->at_probing_cancellable = g_cancellable_new ();
+
+        /* If the port was QCDM before, check that first; a QCDM port is
+         * known not to be AT, so all AT probing is skipped */
+        if (self->priv->hint == MM_PORT_TYPE_QCDM) {
+            task->source_id = g_idle_add ((GSourceFunc)serial_probe_qcdm, self);
+            return;
+        }
+
+        /* Otherwise, if any AT probing is needed, start by opening as AT port */
         task->source_id = g_idle_add ((GSourceFunc)serial_open_at, self);
         return;
     }
@@ -913,6 +1036,14 @@ mm_port_probe_is_qcdm (MMPortProbe *self)
     return self->priv->is_qcdm;
 }
 
+MMPortProbeFlag
+mm_port_probe_get_probed (MMPortProbe *self)
+{
+    g_return_val_if_fail (MM_IS_PORT_PROBE (self), MM_PORT_PROBE_NONE);
+
+    return (MMPortProbeFlag) self->priv->flags;
+}
+
 MMPortType
 mm_port_probe_get_port_type (MMPortProbe *self)
 {
@@ -1041,6 +1172,8 @@ finalize (GObject *object)
 
     g_free (self->priv->vendor);
     g_free (self->priv->product);
+    g_free (self->priv->hint_vendor);
+    g_free (self->priv->hint_product);
 
     G_OBJECT_CLASS (mm_port_probe_parent_class)->finalize (object);
 }
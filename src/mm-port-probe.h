@@ -75,6 +75,13 @@ void mm_port_probe_set_result_at_product (MMPortProbe *self,
 void mm_port_probe_set_result_qcdm       (MMPortProbe *self,
                                           gboolean qcdm);
 
+/* Results of a previous probing of the same device; they are confirmed with a
+ * single check on the next run instead of running the whole probing */
+void mm_port_probe_set_hint (MMPortProbe *self,
+                             MMPortType port_type,
+                             const gchar *vendor,
+                             const gchar *product);
+
 /* Run probing */
 void     mm_port_probe_run        (MMPortProbe *self,
                                    MMPortProbeFlag flags,
@@ -88,8 +95,10 @@ gboolean mm_port_probe_run_finish (MMPortProbe *self,
 gboolean mm_port_probe_run_cancel (MMPortProbe *self);
 
 gboolean mm_port_probe_run_cancel_at_probing (MMPortProbe *self);
+gboolean mm_port_probe_run_cancel_qcdm_probing (MMPortProbe *self);
 
 /* Probing result getters */
+MMPortProbeFlag mm_port_probe_get_probed     (MMPortProbe *self);
 MMPortType    mm_port_probe_get_port_type    (MMPortProbe *self);
 gboolean      mm_port_probe_is_at            (MMPortProbe *self);
 gboolean      mm_port_probe_is_qcdm          (MMPortProbe *self);
@@ -0,0 +1,216 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "mm-probe-plan.h"
+
+/*****************************************************************************/
+
+void
+mm_probe_plan_init (MMProbePlan *plan)
+{
+    memset (plan, 0, sizeof (MMProbePlan));
+}
+
+void
+mm_probe_plan_add (MMProbePlan *plan,
+                   guint flags,
+                   MMProbePlanMatch match,
+                   guint64 send_delay,
+                   const MMPortProbeAtCommand *custom_init)
+{
+    plan->flags |= flags;
+
+    /* Custom init commands and send delay can't be merged; the most specific
+     * plugin is the one most likely getting the port, so its settings are
+     * used. Plugins as specific as that one must agree. */
+    if (!plan->n_plugins || match > plan->match) {
+        plan->match = match;
+        plan->send_delay = send_delay;
+        plan->custom_init = custom_init;
+        plan->conflict = FALSE;
+    } else if (match == plan->match &&
+               (send_delay != plan->send_delay ||
+                custom_init != plan->custom_init))
+        plan->conflict = TRUE;
+
+    plan->n_plugins++;
+}
+
+gboolean
+mm_probe_plan_is_valid (const MMProbePlan *plan)
+{
+    return (plan->n_plugins > 0 &&
+            plan->flags != 0 &&
+            !plan->conflict);
+}
+
+/*****************************************************************************/
+
+void
+mm_probe_plan_queue_push (MMProbePlanQueue *queue,
+                          gpointer plan)
+{
+    g_queue_push_tail (&queue->pending, plan);
+}
+
+void
+mm_probe_plan_queue_remove (MMProbePlanQueue *queue,
+                            gpointer plan)
+{
+    queue->running = g_list_remove (queue->running, plan);
+    g_queue_remove (&queue->pending, plan);
+}
+
+guint
+mm_probe_plan_queue_start_pending (MMProbePlanQueue *queue,
+                                   guint limit,
+                                   MMProbePlanReadyFunc ready,
+                                   MMProbePlanStartFunc start)
+{
+    GList *l;
+    guint n = 0;
+
+    l = queue->pending.head;
+    while (l && (!limit || g_list_length (queue->running) < limit)) {
+        gpointer plan = l->data;
+
+        if (ready && !ready (plan)) {
+            l = g_list_next (l);
+            continue;
+        }
+
+        g_queue_delete_link (&queue->pending, l);
+        queue->running = g_list_prepend (queue->running, plan);
+        n++;
+        start (plan);
+
+        /* Starting the plan may have finished it, or others, right away, so
+         * scan the queue again */
+        l = queue->pending.head;
+    }
+
+    return n;
+}
+
+guint
+mm_probe_plan_open_retry_delay (guint retry,
+                                guint min_ms,
+                                guint max_ms)
+{
+    guint delay = min_ms;
+
+    while (retry-- > 1 && delay < max_ms)
+        delay *= 2;
+
+    return MIN (delay, max_ms);
+}
+
+/*****************************************************************************/
+
+struct _MMProbePlanDeferrals {
+    GList *deferrals;
+};
+
+typedef struct {
+    MMProbePlanDeferrals *self;
+    gchar *device;
+    GSourceFunc callback;
+    gpointer user_data;
+    guint source_id;
+    gboolean retried;
+} Deferral;
+
+static void
+deferral_free (Deferral *deferral)
+{
+    if (deferral->source_id)
+        g_source_remove (deferral->source_id);
+    g_free (deferral->device);
+    g_slice_free (Deferral, deferral);
+}
+
+static gboolean
+deferral_run (Deferral *deferral)
+{
+    GSourceFunc callback = deferral->callback;
+    gpointer user_data = deferral->user_data;
+
+    deferral->source_id = 0;
+    deferral->self->deferrals = g_list_remove (deferral->self->deferrals, deferral);
+    deferral_free (deferral);
+
+    callback (user_data);
+    return FALSE;
+}
+
+void
+mm_probe_plan_deferrals_add (MMProbePlanDeferrals *self,
+                             const gchar *device,
+                             guint timeout_secs,
+                             GSourceFunc callback,
+                             gpointer user_data)
+{
+    Deferral *deferral;
+
+    deferral = g_slice_new0 (Deferral);
+    deferral->self = self;
+    deferral->device = g_strdup (device);
+    deferral->callback = callback;
+    deferral->user_data = user_data;
+    deferral->source_id = g_timeout_add_seconds (timeout_secs,
+                                                 (GSourceFunc)deferral_run,
+                                                 deferral);
+    self->deferrals = g_list_append (self->deferrals, deferral);
+}
+
+guint
+mm_probe_plan_deferrals_retry (MMProbePlanDeferrals *self,
+                               const gchar *device)
+{
+    GList *l;
+    guint n = 0;
+
+    for (l = self->deferrals; l; l = g_list_next (l)) {
+        Deferral *deferral = l->data;
+
+        if (deferral->retried || g_strcmp0 (deferral->device, device) != 0)
+            continue;
+
+        g_source_remove (deferral->source_id);
+        deferral->source_id = g_idle_add ((GSourceFunc)deferral_run, deferral);
+        deferral->retried = TRUE;
+        n++;
+    }
+
+    return n;
+}
+
+MMProbePlanDeferrals *
+mm_probe_plan_deferrals_new (void)
+{
+    return g_new0 (MMProbePlanDeferrals, 1);
+}
+
+void
+mm_probe_plan_deferrals_free (MMProbePlanDeferrals *self)
+{
+    g_list_foreach (self->deferrals, (GFunc)deferral_free, NULL);
+    g_list_free (self->deferrals);
+    g_free (self);
+}
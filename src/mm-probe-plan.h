@@ -0,0 +1,108 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_PROBE_PLAN_H
+#define MM_PROBE_PLAN_H
+
+#include <glib.h>
+
+#include "mm-port-probe-at.h"
+
+/*
+ * A port is probed once for all the plugins which may support it. The probe
+ * plan merges what each of those plugins requests, and the plan queue limits
+ * how many of those probings run at once. The deferrals let support checks
+ * waiting for other ports of the same device go on as soon as one of those
+ * finishes.
+ */
+
+/* How specifically a plugin matched the port before probing, from least to
+ * most specific */
+typedef enum {
+    MM_PROBE_PLAN_MATCH_ANY,
+    MM_PROBE_PLAN_MATCH_DRIVER,
+    MM_PROBE_PLAN_MATCH_UDEV_TAG,
+    MM_PROBE_PLAN_MATCH_VENDOR_ID,
+    MM_PROBE_PLAN_MATCH_PRODUCT_ID
+} MMProbePlanMatch;
+
+typedef struct {
+    /* MMPortProbeFlag requested by any of the plugins */
+    guint flags;
+    /* Settings of the most specific plugin */
+    MMProbePlanMatch match;
+    guint64 send_delay;
+    const MMPortProbeAtCommand *custom_init;
+    /* Set if plugins as specific as that one want other settings */
+    gboolean conflict;
+    guint n_plugins;
+} MMProbePlan;
+
+void     mm_probe_plan_init      (MMProbePlan *plan);
+void     mm_probe_plan_add       (MMProbePlan *plan,
+                                  guint flags,
+                                  MMProbePlanMatch match,
+                                  guint64 send_delay,
+                                  const MMPortProbeAtCommand *custom_init);
+/* FALSE if the plugins can't share the probing, or there is nothing to probe */
+gboolean mm_probe_plan_is_valid  (const MMProbePlan *plan);
+
+/* Plans running, and those waiting to be started */
+typedef struct {
+    GList *running;
+    GQueue pending;
+} MMProbePlanQueue;
+
+#define MM_PROBE_PLAN_QUEUE_INIT { NULL, G_QUEUE_INIT }
+
+/* Returns FALSE if the plan can't be started yet */
+typedef gboolean (* MMProbePlanReadyFunc) (gpointer plan);
+typedef void     (* MMProbePlanStartFunc) (gpointer plan);
+
+void     mm_probe_plan_queue_push          (MMProbePlanQueue *queue,
+                                            gpointer plan);
+/* Removes the plan, whether running or pending */
+void     mm_probe_plan_queue_remove        (MMProbePlanQueue *queue,
+                                            gpointer plan);
+/* Starts pending plans in order while fewer than 'limit' run (0 for no
+ * limit), skipping those not ready; returns how many were started */
+guint    mm_probe_plan_queue_start_pending (MMProbePlanQueue *queue,
+                                            guint limit,
+                                            MMProbePlanReadyFunc ready,
+                                            MMProbePlanStartFunc start);
+
+/* Time to wait before the given retry (1 for the first one) to open a port,
+ * doubling from 'min_ms' up to 'max_ms' */
+guint    mm_probe_plan_open_retry_delay    (guint retry,
+                                            guint min_ms,
+                                            guint max_ms);
+
+typedef struct _MMProbePlanDeferrals MMProbePlanDeferrals;
+
+MMProbePlanDeferrals *mm_probe_plan_deferrals_new    (void);
+void                  mm_probe_plan_deferrals_free   (MMProbePlanDeferrals *self);
+/* The callback runs once, after the timeout or earlier if retried; its
+ * return value is ignored */
+void                  mm_probe_plan_deferrals_add    (MMProbePlanDeferrals *self,
+                                                      const gchar *device,
+                                                      guint timeout_secs,
+                                                      GSourceFunc callback,
+                                                      gpointer user_data);
+/* Schedules right away the callbacks deferred in the device; returns how
+ * many were scheduled */
+guint                 mm_probe_plan_deferrals_retry  (MMProbePlanDeferrals *self,
+                                                      const gchar *device);
+
+#endif /* MM_PROBE_PLAN_H */
@@ -24,6 +24,8 @@
 
 #include "mm-qcdm-serial-port.h"
 #include "libqcdm/src/com.h"
+#include "libqcdm/src/commands.h"
+#include "libqcdm/src/dm-commands.h"
 #include "libqcdm/src/utils.h"
 #include "libqcdm/src/errors.h"
 #include "mm-log.h"
@@ -32,44 +34,633 @@ G_DEFINE_TYPE (MMQcdmSerialPort, mm_qcdm_serial_port, MM_TYPE_SERIAL_PORT)
 
 #define MM_QCDM_SERIAL_PORT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), MM_TYPE_QCDM_SERIAL_PORT, MMQcdmSerialPortPrivate))
 
+/* Limits of the log records received but not yet given to the listeners;
+ * further records are dropped until they catch up */
+#define LOG_PENDING_MAX_RECORDS 512
+#define LOG_PENDING_MAX_BYTES   (256 * 1024)
+
+/* Records decoded and delivered per main loop iteration */
+#define LOG_BATCH_SIZE 64
+
+/* Enough for the mask of every item of an equipment ID, escaped */
+#define LOG_CONFIG_CMD_SIZE 1100
+
+typedef struct {
+    guint id;
+    /* Set of log codes */
+    GHashTable *codes;
+    gboolean events;
+    MMQcdmLogFn callback;
+    gpointer user_data;
+    /* Removed while records were being delivered */
+    gboolean removed;
+} LogListener;
+
+/* Header of each frame stored in the pending buffer */
+typedef struct {
+    guint32 len;
+    guint8 type;
+} PendingHeader;
+
 typedef struct {
-    gboolean foo;
+    /* How much of the response buffer was already looked at */
+    gsize scan_offset;
+    /* Non-marker bytes seen since the last frame marker */
+    gsize frame_bytes;
+
+    /* Log and event listeners */
+    GSList *log_listeners;
+    guint next_listener_id;
+    /* Log code -> number of listeners asking for it */
+    GHashTable *log_codes;
+    guint n_event_listeners;
+    gboolean events_enabled;
+    gboolean log_delivering;
+
+    /* Unescaped log and event frames not yet decoded, from offset on */
+    GByteArray *log_pending;
+    gsize log_pending_offset;
+    guint log_pending_n;
+    guint log_dropped;
+    guint log_flush_id;
+    guint log_config_id;
+    GArray *log_batch;
+    GArray *log_filtered;
 } MMQcdmSerialPortPrivate;
 
+static gboolean log_flush (MMQcdmSerialPort *self);
+
 
 /*****************************************************************************/
 
 static gboolean
-find_qcdm_start (GByteArray *response, gsize *start)
+parse_response (MMSerialPort *port, GByteArray *response, GError **error)
 {
-    int i, last = -1;
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (port);
+    gsize i;
 
     /* Look for 3 bytes and a QCDM frame marker, ie enough data for a valid
      * frame.  There will usually be three cases here; (1) a QCDM frame
      * starting with data and terminated by 0x7E, and (2) a QCDM frame starting
      * with 0x7E and ending with 0x7E, and (3) a non-QCDM frame that still
      * uses HDLC framing (like Sierra CnS) that starts and ends with 0x7E.
+     *
+     * Only the data received since the last call is scanned; the frames
+     * themselves are unescaped and checked when handling the response.
      */
-    for (i = 0; i < response->len; i++) {
-        if (response->data[i] == 0x7E) {
-            if (i > last + 3) {
-                /* Got a full QCDM frame; 3 non-0x7E bytes and a terminator */
-                if (start)
-                    *start = last + 1;
+    for (i = priv->scan_offset; i < response->len; i++) {
+        if (response->data[i] == DIAG_CONTROL_CHAR) {
+            if (priv->frame_bytes >= 3) {
+                priv->scan_offset = i;
                 return TRUE;
             }
+            priv->frame_bytes = 0;
+        } else
+            priv->frame_bytes++;
+    }
 
-            /* Save position of the last QCDM frame marker */
-            last = i;
-        }
+    priv->scan_offset = response->len;
+    return FALSE;
+}
+
+static void
+response_trimmed (MMSerialPort *port)
+{
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (port);
+
+    priv->scan_offset = 0;
+    priv->frame_bytes = 0;
+}
+
+/*****************************************************************************/
+/* Unsolicited log packets and event reports */
+
+/* Given the unescaped length of the frame, without CRC */
+static gboolean
+frame_is_unsolicited (const guint8 *frame,
+                      gsize len,
+                      MMQcdmLogRecordType *out_type)
+{
+    if (len < 1)
+        return FALSE;
+
+    if (frame[0] == DIAG_CMD_LOG) {
+        *out_type = MM_QCDM_LOG_RECORD_TYPE_LOG;
+        return TRUE;
+    }
+
+    /* The reply to the event report command itself is shorter */
+    if (frame[0] == DIAG_CMD_EVENT_REPORT && len > sizeof (DMCmdEventReport)) {
+        *out_type = MM_QCDM_LOG_RECORD_TYPE_EVENT;
+        return TRUE;
     }
+
     return FALSE;
 }
 
+static void
+log_pending_clear (MMQcdmSerialPort *self)
+{
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+
+    g_byte_array_set_size (priv->log_pending, 0);
+    priv->log_pending_offset = 0;
+    priv->log_pending_n = 0;
+    priv->log_dropped = 0;
+    if (priv->log_flush_id) {
+        g_source_remove (priv->log_flush_id);
+        priv->log_flush_id = 0;
+    }
+}
+
+static void
+log_enqueue (MMQcdmSerialPort *self,
+             MMQcdmLogRecordType type,
+             const guint8 *frame,
+             gsize len)
+{
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+    PendingHeader header;
+
+    /* Skip what no listener asked for (eg, still enabled by someone else) */
+    if (type == MM_QCDM_LOG_RECORD_TYPE_LOG) {
+        u_int16_t log_code;
+
+        if (!qcdm_cmd_log_get_header ((const char *) frame, len, &log_code, NULL) ||
+            !g_hash_table_lookup (priv->log_codes, GUINT_TO_POINTER ((guint) log_code)))
+            return;
+    } else if (!priv->n_event_listeners)
+        return;
+
+    /* Decoding is done later, so this only has to keep up with the port */
+    if (priv->log_pending_n >= LOG_PENDING_MAX_RECORDS ||
+        (priv->log_pending->len - priv->log_pending_offset) + sizeof (header) + len > LOG_PENDING_MAX_BYTES) {
+        if (!priv->log_dropped)
+            mm_warn ("(%s): QCDM log listeners are too slow, dropping records",
+                     mm_port_get_device (MM_PORT (self)));
+        priv->log_dropped++;
+        return;
+    }
+
+    header.len = (guint32) len;
+    header.type = (guint8) type;
+    g_byte_array_append (priv->log_pending, (const guint8 *) &header, sizeof (header));
+    g_byte_array_append (priv->log_pending, frame, len);
+    priv->log_pending_n++;
+
+    /* Low priority, so that replies in other ports are processed first */
+    if (!priv->log_flush_id)
+        priv->log_flush_id = g_idle_add_full (G_PRIORITY_LOW,
+                                              (GSourceFunc) log_flush,
+                                              self,
+                                              NULL);
+}
+
 static gboolean
-parse_response (MMSerialPort *port, GByteArray *response, GError **error)
+log_listener_wants (LogListener *listener,
+                    const MMQcdmLogRecord *record)
+{
+    if (listener->removed)
+        return FALSE;
+    if (record->type == MM_QCDM_LOG_RECORD_TYPE_EVENT)
+        return listener->events;
+    return !!g_hash_table_lookup (listener->codes, GUINT_TO_POINTER ((guint) record->code));
+}
+
+static void
+log_listener_free (LogListener *listener)
+{
+    g_hash_table_destroy (listener->codes);
+    g_slice_free (LogListener, listener);
+}
+
+static gboolean
+log_flush (MMQcdmSerialPort *self)
+{
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+    GSList *listeners;
+    GSList *l;
+    gsize pos;
+    guint n_dropped;
+    guint i;
+    gboolean more;
+
+    /* Decode a batch of records */
+    g_array_set_size (priv->log_batch, 0);
+    pos = priv->log_pending_offset;
+    while (pos < priv->log_pending->len && priv->log_batch->len < LOG_BATCH_SIZE) {
+        MMQcdmLogRecord record;
+        PendingHeader header;
+        const char *frame;
+
+        memcpy (&header, &priv->log_pending->data[pos], sizeof (header));
+        frame = (const char *) &priv->log_pending->data[pos + sizeof (header)];
+        pos += sizeof (header) + header.len;
+        priv->log_pending_n--;
+
+        memset (&record, 0, sizeof (record));
+        record.type = header.type;
+        if (record.type == MM_QCDM_LOG_RECORD_TYPE_LOG) {
+            u_int16_t log_code = 0;
+            u_int64_t timestamp = 0;
+            int err = QCDM_SUCCESS;
+
+            record.result = qcdm_cmd_log_result (frame, header.len, &err);
+            if (!record.result)
+                continue;
+            qcdm_cmd_log_get_header (frame, header.len, &log_code, &timestamp);
+            record.code = log_code;
+            record.timestamp = timestamp;
+        } else {
+            u_int16_t event_id = 0;
+
+            if (!qcdm_cmd_event_get_id (frame, header.len, &event_id))
+                continue;
+            record.code = event_id;
+        }
+        g_array_append_val (priv->log_batch, record);
+    }
+
+    /* Only move the remaining records to the front once most of the buffer
+     * was consumed, not after every batch */
+    if (pos == priv->log_pending->len) {
+        g_byte_array_set_size (priv->log_pending, 0);
+        priv->log_pending_offset = 0;
+    } else if (pos > LOG_PENDING_MAX_BYTES / 2) {
+        g_byte_array_remove_range (priv->log_pending, 0, pos);
+        priv->log_pending_offset = 0;
+    } else
+        priv->log_pending_offset = pos;
+
+    n_dropped = priv->log_dropped;
+    priv->log_dropped = 0;
+
+    /* Listeners may add or remove listeners, or drop the last reference;
+     * only those already there get this batch */
+    g_object_ref (self);
+    listeners = g_slist_copy (priv->log_listeners);
+    priv->log_delivering = TRUE;
+    for (l = listeners; l; l = g_slist_next (l)) {
+        LogListener *listener = l->data;
+
+        g_array_set_size (priv->log_filtered, 0);
+        for (i = 0; i < priv->log_batch->len; i++) {
+            MMQcdmLogRecord *record = &g_array_index (priv->log_batch, MMQcdmLogRecord, i);
+
+            if (log_listener_wants (listener, record))
+                g_array_append_val (priv->log_filtered, *record);
+        }
+
+        if (priv->log_filtered->len || (n_dropped && !listener->removed))
+            listener->callback (self,
+                                (const MMQcdmLogRecord *) priv->log_filtered->data,
+                                priv->log_filtered->len,
+                                n_dropped,
+                                listener->user_data);
+    }
+    priv->log_delivering = FALSE;
+    g_slist_free (listeners);
+
+    for (i = 0; i < priv->log_batch->len; i++) {
+        MMQcdmLogRecord *record = &g_array_index (priv->log_batch, MMQcdmLogRecord, i);
+
+        if (record->result)
+            qcdm_result_unref (record->result);
+    }
+    g_array_set_size (priv->log_batch, 0);
+
+    for (l = priv->log_listeners; l; ) {
+        LogListener *listener = l->data;
+
+        l = g_slist_next (l);
+        if (listener->removed) {
+            priv->log_listeners = g_slist_remove (priv->log_listeners, listener);
+            log_listener_free (listener);
+        }
+    }
+
+    more = (priv->log_pending_n > 0 && priv->log_listeners);
+    if (!more) {
+        /* The source is removed by returning FALSE */
+        priv->log_flush_id = 0;
+        log_pending_clear (self);
+    }
+
+    g_object_unref (self);
+    return more;
+}
+
+static void
+log_config_ready (MMQcdmSerialPort *self,
+                  GByteArray *response,
+                  GError *error,
+                  gpointer user_data)
+{
+    QcdmResult *result;
+    int err = QCDM_SUCCESS;
+
+    if (error) {
+        mm_dbg ("(%s): couldn't update QCDM log mask: %s",
+                mm_port_get_device (MM_PORT (self)),
+                error->message);
+        return;
+    }
+
+    result = qcdm_cmd_log_config_set_mask_result ((const char *) response->data,
+                                                  response->len,
+                                                  &err);
+    if (!result) {
+        mm_dbg ("(%s): couldn't update QCDM log mask: %d",
+                mm_port_get_device (MM_PORT (self)),
+                err);
+        return;
+    }
+    qcdm_result_unref (result);
+}
+
+static void
+event_report_ready (MMQcdmSerialPort *self,
+                    GByteArray *response,
+                    GError *error,
+                    gpointer user_data)
+{
+    QcdmResult *result;
+    int err = QCDM_SUCCESS;
+
+    if (error) {
+        mm_dbg ("(%s): couldn't update QCDM event reporting: %s",
+                mm_port_get_device (MM_PORT (self)),
+                error->message);
+        return;
+    }
+
+    result = qcdm_cmd_event_report_result ((const char *) response->data,
+                                           response->len,
+                                           &err);
+    if (!result) {
+        mm_dbg ("(%s): couldn't update QCDM event reporting: %d",
+                mm_port_get_device (MM_PORT (self)),
+                err);
+        return;
+    }
+    qcdm_result_unref (result);
+}
+
+/* Sends the log mask of each of the given equipment IDs, and enables or
+ * disables event reports, as needed by the current listeners */
+static void
+log_config_update (MMQcdmSerialPort *self,
+                   guint16 equip_ids)
+{
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+    GByteArray *cmd;
+    guint equip_id;
+
+    /* Sent when the port gets opened */
+    if (!mm_serial_port_is_open (MM_SERIAL_PORT (self)))
+        return;
+
+    for (equip_id = 0; equip_id < 16; equip_id++) {
+        GHashTableIter iter;
+        gpointer key;
+        GArray *items;
+
+        if (!(equip_ids & (1 << equip_id)))
+            continue;
+
+        /* 0-terminated; an empty list disables all items */
+        items = g_array_new (TRUE, TRUE, sizeof (guint16));
+        g_hash_table_iter_init (&iter, priv->log_codes);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+            guint16 log_code = (guint16) GPOINTER_TO_UINT (key);
+
+            if ((log_code >> 12) == equip_id)
+                g_array_append_val (items, log_code);
+        }
+
+        cmd = g_byte_array_sized_new (LOG_CONFIG_CMD_SIZE);
+        cmd->len = qcdm_cmd_log_config_set_mask_new ((char *) cmd->data,
+                                                     LOG_CONFIG_CMD_SIZE,
+                                                     equip_id,
+                                                     (u_int16_t *) items->data);
+        g_array_free (items, TRUE);
+        g_assert (cmd->len);
+
+        mm_qcdm_serial_port_queue_command (self, cmd, 3, NULL, log_config_ready, NULL);
+    }
+
+    if ((priv->n_event_listeners > 0) != priv->events_enabled) {
+        priv->events_enabled = !priv->events_enabled;
+
+        cmd = g_byte_array_sized_new (10);
+        cmd->len = qcdm_cmd_event_report_new ((char *) cmd->data, 10, priv->events_enabled);
+        g_assert (cmd->len);
+
+        mm_qcdm_serial_port_queue_command (self, cmd, 3, NULL, event_report_ready, NULL);
+    }
+}
+
+static gboolean
+log_config_resend (MMQcdmSerialPort *self)
+{
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+    GHashTableIter iter;
+    gpointer key;
+    guint16 equip_ids = 0;
+
+    priv->log_config_id = 0;
+
+    g_hash_table_iter_init (&iter, priv->log_codes);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        equip_ids |= 1 << (GPOINTER_TO_UINT (key) >> 12);
+    log_config_update (self, equip_ids);
+
+    return FALSE;
+}
+
+guint
+mm_qcdm_serial_port_add_log_listener (MMQcdmSerialPort *self,
+                                      const guint16 *log_codes,
+                                      gboolean events,
+                                      MMQcdmLogFn callback,
+                                      gpointer user_data)
+{
+    MMQcdmSerialPortPrivate *priv;
+    LogListener *listener;
+    guint16 equip_ids = 0;
+    guint i;
+
+    g_return_val_if_fail (MM_IS_QCDM_SERIAL_PORT (self), 0);
+    g_return_val_if_fail (callback != NULL, 0);
+
+    priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+
+    listener = g_slice_new0 (LogListener);
+    listener->id = priv->next_listener_id++;
+    if (G_UNLIKELY (!priv->next_listener_id))
+        priv->next_listener_id = 1;
+    listener->codes = g_hash_table_new (g_direct_hash, g_direct_equal);
+    listener->events = events;
+    listener->callback = callback;
+    listener->user_data = user_data;
+
+    for (i = 0; log_codes && log_codes[i]; i++) {
+        gpointer key = GUINT_TO_POINTER ((guint) log_codes[i]);
+        guint n;
+
+        if (g_hash_table_lookup (listener->codes, key))
+            continue;
+        g_hash_table_insert (listener->codes, key, key);
+
+        /* Only codes not enabled yet need a new mask */
+        n = GPOINTER_TO_UINT (g_hash_table_lookup (priv->log_codes, key));
+        g_hash_table_insert (priv->log_codes, key, GUINT_TO_POINTER (n + 1));
+        if (!n)
+            equip_ids |= 1 << (log_codes[i] >> 12);
+    }
+
+    if (events)
+        priv->n_event_listeners++;
+
+    priv->log_listeners = g_slist_append (priv->log_listeners, listener);
+    log_config_update (self, equip_ids);
+
+    return listener->id;
+}
+
+void
+mm_qcdm_serial_port_remove_log_listener (MMQcdmSerialPort *self,
+                                         guint id)
+{
+    MMQcdmSerialPortPrivate *priv;
+    LogListener *listener = NULL;
+    GHashTableIter iter;
+    gpointer key;
+    guint16 equip_ids = 0;
+    GSList *l;
+
+    g_return_if_fail (MM_IS_QCDM_SERIAL_PORT (self));
+
+    priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+
+    for (l = priv->log_listeners; l; l = g_slist_next (l)) {
+        if (((LogListener *) l->data)->id == id &&
+            !((LogListener *) l->data)->removed) {
+            listener = l->data;
+            break;
+        }
+    }
+    if (!listener)
+        return;
+
+    g_hash_table_iter_init (&iter, listener->codes);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        guint n;
+
+        n = GPOINTER_TO_UINT (g_hash_table_lookup (priv->log_codes, key));
+        if (n > 1)
+            g_hash_table_insert (priv->log_codes, key, GUINT_TO_POINTER (n - 1));
+        else {
+            g_hash_table_remove (priv->log_codes, key);
+            equip_ids |= 1 << (GPOINTER_TO_UINT (key) >> 12);
+        }
+    }
+
+    if (listener->events)
+        priv->n_event_listeners--;
+
+    if (priv->log_delivering)
+        /* Freed once the current batch is delivered */
+        listener->removed = TRUE;
+    else {
+        priv->log_listeners = g_slist_remove (priv->log_listeners, listener);
+        log_listener_free (listener);
+        if (!priv->log_listeners)
+            log_pending_clear (self);
+    }
+
+    log_config_update (self, equip_ids);
+}
+
+/*****************************************************************************/
+
+static void
+parse_unsolicited (MMSerialPort *port, GByteArray *response)
 {
-    return find_qcdm_start (response, NULL);
+    MMQcdmSerialPort *self = MM_QCDM_SERIAL_PORT (port);
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (port);
+    gsize pos = 0;
+
+    /* No new frame marker, no new complete frame */
+    if (!memchr (&response->data[priv->scan_offset],
+                 DIAG_CONTROL_CHAR,
+                 response->len - priv->scan_offset))
+        return;
+
+    /* Take the log packets and event reports at the beginning of the buffer,
+     * so that the reply to the current command is the first frame left.
+     * Frames after the reply are taken when the reply is handled. */
+    while (pos < response->len) {
+        guint8 *frame = &response->data[pos];
+        guint8 *end;
+        MMQcdmLogRecordType type;
+        gsize raw_len;
+        gsize unesc_len;
+        gsize decap_len = 0;
+        gsize used = 0;
+        qcdmbool more = FALSE;
+        gsize i;
+
+        if (*frame == DIAG_CONTROL_CHAR) {
+            pos++;
+            continue;
+        }
+
+        end = memchr (frame, DIAG_CONTROL_CHAR, response->len - pos);
+        if (!end)
+            break;
+        raw_len = end - frame;
+
+        /* Unescaped length (with CRC), without unescaping yet */
+        unesc_len = raw_len;
+        for (i = 0; i < raw_len; i++) {
+            if (frame[i] == DIAG_ESC_CHAR)
+                unesc_len--;
+        }
+        if (unesc_len < 2 || !frame_is_unsolicited (frame, unesc_len - 2, &type))
+            break;
+
+        if (dm_decapsulate_buffer ((const char *) frame, raw_len + 1,
+                                   (char *) frame, raw_len + 1,
+                                   &decap_len, &used, &more) && !more)
+            log_enqueue (self, type, frame, decap_len);
+        pos += raw_len + 1;
+    }
+
+    if (pos) {
+        g_byte_array_remove_range (response, 0, pos);
+        priv->scan_offset = 0;
+        priv->frame_bytes = 0;
+    }
+}
+
+static void
+handle_extra_frame (MMQcdmSerialPort *self,
+                    const guint8 *frame,
+                    gsize len)
+{
+    MMQcdmLogRecordType type;
+
+    if (frame_is_unsolicited (frame, len, &type)) {
+        log_enqueue (self, type, frame, len);
+        return;
+    }
+
+    mm_dbg ("(%s): ignoring QCDM frame 0x%02X (%" G_GSIZE_FORMAT " bytes) "
+            "received after the command's reply",
+            mm_port_get_device (MM_PORT (self)),
+            frame[0],
+            len);
 }
 
 static gsize
@@ -80,63 +671,72 @@ handle_response (MMSerialPort *port,
                  gpointer callback_data)
 {
     MMQcdmSerialResponseFn response_callback = (MMQcdmSerialResponseFn) callback;
-    GByteArray *unescaped = NULL;
+    GByteArray reply = { NULL, 0 };
     GError *dm_error = NULL;
-    gsize used = 0;
-    gsize start = 0;
-    gboolean success = FALSE;
-    qcdmbool more = FALSE;
-    gsize unescaped_len = 0;
-
-    if (error)
-        goto callback;
-
-    /* Get the offset into the buffer of where the QCDM frame starts */
-    if (!find_qcdm_start (response, &start)) {
-        g_set_error_literal (&dm_error,
-                             MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
-                             "Failed to parse QCDM packet.");
-        /* Discard the unparsable data */
-        used = response->len;
-        goto callback;
-    }
+    gboolean invalid = FALSE;
+    gsize pos = 0;
 
-    /* FIXME: don't munge around with byte array internals */
-    unescaped = g_byte_array_sized_new (1024);
-    success = dm_decapsulate_buffer ((const char *) (response->data + start),
-                                     response->len - start,
-                                     (char *) unescaped->data,
-                                     1024,
-                                     &unescaped_len,
-                                     &used,
-                                     &more);
-    if (!success) {
-        g_set_error_literal (&dm_error,
-                             MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
-                             "Failed to unescape QCDM packet.");
-        g_byte_array_free (unescaped, TRUE);
-        unescaped = NULL;
-    } else if (more) {
-        /* Need more data; we shouldn't have gotten here since the parse
-         * function checks for the end-of-frame marker, but whatever.
-         */
+    if (error) {
+        response_callback (MM_QCDM_SERIAL_PORT (port), NULL, error, callback_data);
         return 0;
-    } else {
-        /* Successfully decapsulated the DM command */
-        unescaped->len = (guint) unescaped_len;
     }
 
-callback:
+    /* Unescape every complete frame in place; the first valid one is the
+     * reply to the command, and it is given to the callback without copying
+     * it out of the response buffer. */
+    while (pos < response->len) {
+        gchar *frame = (gchar *) &response->data[pos];
+        gsize avail = response->len - pos;
+        gsize decap_len = 0;
+        gsize used = 0;
+        qcdmbool more = FALSE;
+
+        /* Skip frame markers in between frames */
+        if (*frame == DIAG_CONTROL_CHAR) {
+            pos++;
+            continue;
+        }
+
+        if (!dm_decapsulate_buffer (frame, avail, frame, avail,
+                                    &decap_len, &used, &more)) {
+            invalid = TRUE;
+            pos += used;
+            continue;
+        }
+
+        /* Keep an incomplete frame for later */
+        if (more)
+            break;
+
+        if (!reply.data) {
+            reply.data = (guint8 *) frame;
+            reply.len = (guint) decap_len;
+        } else
+            handle_extra_frame (MM_QCDM_SERIAL_PORT (port), (const guint8 *) frame, decap_len);
+        pos += used;
+    }
+
+    if (!reply.data) {
+        if (invalid)
+            g_set_error_literal (&dm_error,
+                                 MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                                 "Failed to unescape QCDM packet.");
+        else {
+            g_set_error_literal (&dm_error,
+                                 MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                                 "Failed to parse QCDM packet.");
+            /* Discard the unparsable data */
+            pos = response->len;
+        }
+    }
+
     response_callback (MM_QCDM_SERIAL_PORT (port),
-                       unescaped,
-                       dm_error ? dm_error : error,
+                       dm_error ? NULL : &reply,
+                       dm_error,
                        callback_data);
-
-    if (unescaped)
-        g_byte_array_free (unescaped, TRUE);
     g_clear_error (&dm_error);
 
-    return start + used;
+    return pos;
 }
 
 /*****************************************************************************/
@@ -208,6 +808,7 @@ debug_log (MMSerialPort *port, const char *prefix, const char *buf, gsize len)
 static gboolean
 config_fd (MMSerialPort *port, int fd, GError **error)
 {
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (port);
     int err;
 
     err = qcdm_port_setup (fd);
@@ -216,6 +817,13 @@ config_fd (MMSerialPort *port, int fd, GError **error)
                      "Failed to open QCDM port: %d", err);
         return FALSE;
     }
+
+    /* Newly opened; the device may have been reset meanwhile, so send the
+     * whole log configuration again once the port is fully open */
+    priv->events_enabled = FALSE;
+    if (priv->log_listeners && !priv->log_config_id)
+        priv->log_config_id = g_idle_add ((GSourceFunc) log_config_resend, port);
+
     return TRUE;
 }
 
@@ -251,11 +859,30 @@ mm_qcdm_serial_port_new_fd (int fd)
 static void
 mm_qcdm_serial_port_init (MMQcdmSerialPort *self)
 {
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (self);
+
+    priv->next_listener_id = 1;
+    priv->log_codes = g_hash_table_new (g_direct_hash, g_direct_equal);
+    priv->log_pending = g_byte_array_new ();
+    priv->log_batch = g_array_sized_new (FALSE, FALSE, sizeof (MMQcdmLogRecord), LOG_BATCH_SIZE);
+    priv->log_filtered = g_array_sized_new (FALSE, FALSE, sizeof (MMQcdmLogRecord), LOG_BATCH_SIZE);
 }
 
 static void
 finalize (GObject *object)
 {
+    MMQcdmSerialPortPrivate *priv = MM_QCDM_SERIAL_PORT_GET_PRIVATE (object);
+
+    if (priv->log_flush_id)
+        g_source_remove (priv->log_flush_id);
+    if (priv->log_config_id)
+        g_source_remove (priv->log_config_id);
+    g_slist_free_full (priv->log_listeners, (GDestroyNotify) log_listener_free);
+    g_hash_table_destroy (priv->log_codes);
+    g_byte_array_free (priv->log_pending, TRUE);
+    g_array_free (priv->log_batch, TRUE);
+    g_array_free (priv->log_filtered, TRUE);
+
     G_OBJECT_CLASS (mm_qcdm_serial_port_parent_class)->finalize (object);
 }
 
@@ -270,7 +897,9 @@ mm_qcdm_serial_port_class_init (MMQcdmSerialPortClass *klass)
     /* Virtual methods */
     object_class->finalize = finalize;
 
+    port_class->parse_unsolicited = parse_unsolicited;
     port_class->parse_response = parse_response;
+    port_class->response_trimmed = response_trimmed;
     port_class->handle_response = handle_response;
     port_class->config_fd = config_fd;
     port_class->debug_log = debug_log;
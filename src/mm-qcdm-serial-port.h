@@ -21,6 +21,7 @@
 #include <glib-object.h>
 
 #include "mm-serial-port.h"
+#include "libqcdm/src/result.h"
 
 #define MM_TYPE_QCDM_SERIAL_PORT            (mm_qcdm_serial_port_get_type ())
 #define MM_QCDM_SERIAL_PORT(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MM_TYPE_QCDM_SERIAL_PORT, MMQcdmSerialPort))
@@ -32,11 +33,41 @@
 typedef struct _MMQcdmSerialPort MMQcdmSerialPort;
 typedef struct _MMQcdmSerialPortClass MMQcdmSerialPortClass;
 
+/* 'response' holds the unescaped reply without CRC. It points into the
+ * port's receive buffer, so it is only valid during the callback and must
+ * not be kept, resized or freed. */
 typedef void (*MMQcdmSerialResponseFn)     (MMQcdmSerialPort *port,
                                             GByteArray *response,
                                             GError *error,
                                             gpointer user_data);
 
+typedef enum {
+    MM_QCDM_LOG_RECORD_TYPE_LOG,
+    MM_QCDM_LOG_RECORD_TYPE_EVENT
+} MMQcdmLogRecordType;
+
+/* A decoded unsolicited log packet or event report. For logs 'code' is the
+ * log code (see libqcdm's log-items.h) and 'result' holds the values given by
+ * qcdm_cmd_log_result(); for events 'code' is the event ID, and there is no
+ * result nor timestamp. */
+typedef struct {
+    MMQcdmLogRecordType type;
+    guint16 code;
+    guint64 timestamp;
+    QcdmResult *result;
+} MMQcdmLogRecord;
+
+/* Records are given in batches, in the order they were received, and are
+ * only valid during the callback (ref 'result' to keep it). 'n_dropped' is
+ * the number of records discarded since the previous batch because they
+ * were not delivered fast enough; listeners seeing it should ask for fewer
+ * log codes. */
+typedef void (*MMQcdmLogFn)                (MMQcdmSerialPort *port,
+                                            const MMQcdmLogRecord *records,
+                                            guint n_records,
+                                            guint n_dropped,
+                                            gpointer user_data);
+
 struct _MMQcdmSerialPort {
     MMSerialPort parent;
 };
@@ -65,4 +96,18 @@ void     mm_qcdm_serial_port_queue_command_cached (MMQcdmSerialPort *self,
                                                    MMQcdmSerialResponseFn callback,
                                                    gpointer user_data);
 
+/* Enables the given 0-terminated list of log codes (and event reports, if
+ * 'events' is TRUE) in the device, and starts delivering the matching
+ * records to 'callback'. The log configuration is updated whenever listeners
+ * are added or removed while the port is open, and sent again every time the
+ * port is opened. */
+guint    mm_qcdm_serial_port_add_log_listener    (MMQcdmSerialPort *self,
+                                                  const guint16 *log_codes,
+                                                  gboolean events,
+                                                  MMQcdmLogFn callback,
+                                                  gpointer user_data);
+
+void     mm_qcdm_serial_port_remove_log_listener (MMQcdmSerialPort *self,
+                                                  guint id);
+
 #endif /* MM_QCDM_SERIAL_PORT_H */
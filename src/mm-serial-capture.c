@@ -0,0 +1,409 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Capture of the raw traffic of the serial ports, enabled with --capture-size.
+ *
+ * Each port owns a fixed-size ring where every chunk written to or read from
+ * the device is stored as-is, with a small binary header. When the ring is
+ * full the oldest records are evicted, so that the last few KiB of traffic of
+ * each port are always available to be dumped after something went wrong,
+ * without the cost of formatting debug logs.
+ *
+ * Commands carrying PINs, passwords or message contents are cut right after
+ * their '=' before being stored, so that dumps can be shared safely.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include <ModemManager.h>
+#include <mm-errors-types.h>
+
+#include "mm-serial-capture.h"
+#include "mm-log.h"
+
+/* Smallest ring allowed, so that at least a few records fit */
+#define MIN_RING_SIZE 256
+
+struct _MMSerialCapture {
+    gchar *port_name;
+    guint8 *ring;
+    gsize size;
+    /* Where the oldest record starts */
+    gsize tail;
+    /* Bytes currently stored */
+    gsize used;
+};
+
+/* Ring size for new captures, in bytes; disabled unless configured */
+static gsize default_size;
+
+/* Commands whose arguments are never stored; +CPIN also covers +CPIN2 */
+static const gchar *redacted_commands[] = {
+    "+CPIN",
+    "+CLCK",
+    "+CPWD",
+    "+CMGS",
+    "+CMGW",
+    NULL
+};
+
+/* All live captures, to dump them at once */
+static GSList *captures;
+
+void
+mm_serial_capture_set_default_size (gsize size)
+{
+    default_size = size;
+}
+
+gsize
+mm_serial_capture_get_default_size (void)
+{
+    return default_size;
+}
+
+/*****************************************************************************/
+
+static void
+ring_write (MMSerialCapture *capture,
+            gsize pos,
+            const guint8 *data,
+            gsize len)
+{
+    gsize first;
+
+    pos %= capture->size;
+    first = MIN (len, capture->size - pos);
+    memcpy (&capture->ring[pos], data, first);
+    if (first < len)
+        memcpy (capture->ring, data + first, len - first);
+}
+
+static void
+ring_read (MMSerialCapture *capture,
+           gsize pos,
+           guint8 *data,
+           gsize len)
+{
+    gsize first;
+
+    pos %= capture->size;
+    first = MIN (len, capture->size - pos);
+    memcpy (data, &capture->ring[pos], first);
+    if (first < len)
+        memcpy (data + first, capture->ring, len - first);
+}
+
+static void
+record_header_build (guint8 *header,
+                     MMSerialCaptureRecordType type,
+                     guint8 flags,
+                     guint16 len,
+                     guint64 timestamp)
+{
+    guint i;
+
+    header[0] = (guint8) type;
+    header[1] = flags;
+    header[2] = len & 0xFF;
+    header[3] = (len >> 8) & 0xFF;
+    for (i = 0; i < 8; i++)
+        header[4 + i] = (timestamp >> (8 * i)) & 0xFF;
+}
+
+static void
+evict_oldest (MMSerialCapture *capture)
+{
+    guint8 header[MM_SERIAL_CAPTURE_RECORD_SIZE];
+    gsize record_len;
+
+    ring_read (capture, capture->tail, header, sizeof (header));
+    record_len = MM_SERIAL_CAPTURE_RECORD_SIZE + (header[2] | (header[3] << 8));
+
+    g_assert (record_len <= capture->used);
+    capture->tail = (capture->tail + record_len) % capture->size;
+    capture->used -= record_len;
+}
+
+/* Returns how many bytes of the TX chunk can be stored: everything up to the
+ * '=' of the first sensitive command, or the whole chunk */
+static gsize
+tx_redacted_len (const guint8 *data,
+                 gsize len)
+{
+    gsize i;
+
+    for (i = 0; i < len; i++) {
+        guint j;
+
+        if (data[i] != '+')
+            continue;
+
+        for (j = 0; redacted_commands[j]; j++) {
+            gsize cmd_len = strlen (redacted_commands[j]);
+            gsize k;
+
+            if (len - i < cmd_len ||
+                g_ascii_strncasecmp ((const gchar *) &data[i], redacted_commands[j], cmd_len) != 0)
+                continue;
+
+            for (k = i + cmd_len; k < len; k++) {
+                if (data[k] == '=')
+                    return k + 1;
+                /* Next command in the line, this one had no arguments */
+                if (data[k] == ';' || data[k] == '\r')
+                    break;
+            }
+        }
+    }
+
+    return len;
+}
+
+void
+mm_serial_capture_add (MMSerialCapture *capture,
+                       MMSerialCaptureRecordType type,
+                       const guint8 *data,
+                       gsize len)
+{
+    guint8 header[MM_SERIAL_CAPTURE_RECORD_SIZE];
+    guint8 flags = 0;
+    gsize max_len;
+    gsize head;
+
+    g_return_if_fail (capture != NULL);
+
+    if (type == MM_SERIAL_CAPTURE_RECORD_TX) {
+        gsize allowed;
+
+        allowed = tx_redacted_len (data, len);
+        if (allowed < len) {
+            len = allowed;
+            flags |= MM_SERIAL_CAPTURE_FLAG_REDACTED;
+        }
+    }
+
+    max_len = MIN (G_MAXUINT16, capture->size - MM_SERIAL_CAPTURE_RECORD_SIZE);
+    if (len > max_len) {
+        /* Keep the end of the chunk, which is the most recent traffic */
+        data += len - max_len;
+        len = max_len;
+        flags |= MM_SERIAL_CAPTURE_FLAG_TRUNCATED;
+    }
+
+    while (capture->size - capture->used < MM_SERIAL_CAPTURE_RECORD_SIZE + len)
+        evict_oldest (capture);
+
+    record_header_build (header, type, flags, (guint16) len, (guint64) g_get_real_time ());
+
+    head = capture->tail + capture->used;
+    ring_write (capture, head, header, sizeof (header));
+    ring_write (capture, head + sizeof (header), data, len);
+    capture->used += sizeof (header) + len;
+}
+
+void
+mm_serial_capture_dump (MMSerialCapture *capture,
+                        GByteArray *out)
+{
+    guint8 header[MM_SERIAL_CAPTURE_RECORD_SIZE];
+    gsize name_len;
+    gsize start;
+
+    g_return_if_fail (capture != NULL);
+    g_return_if_fail (out != NULL);
+
+    name_len = MIN (strlen (capture->port_name), G_MAXUINT16);
+    record_header_build (header,
+                         MM_SERIAL_CAPTURE_RECORD_PORT,
+                         0,
+                         (guint16) name_len,
+                         (guint64) g_get_real_time ());
+    g_byte_array_append (out, header, sizeof (header));
+    g_byte_array_append (out, (const guint8 *) capture->port_name, name_len);
+
+    start = out->len;
+    g_byte_array_set_size (out, start + capture->used);
+    ring_read (capture, capture->tail, &out->data[start], capture->used);
+}
+
+/* Creates a new file only readable by us; the name has microsecond
+ * resolution plus a counter, and is never reused */
+static gint
+dump_file_create (const gchar *directory,
+                  gchar **out_path,
+                  GError **error)
+{
+    gchar stamp[32];
+    gint64 now;
+    time_t secs;
+    guint i;
+
+    if (g_mkdir_with_parents (directory, 0700) < 0) {
+        g_set_error (error, MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                     "Couldn't create directory '%s': %s",
+                     directory, g_strerror (errno));
+        return -1;
+    }
+
+    now = g_get_real_time ();
+    secs = (time_t) (now / G_USEC_PER_SEC);
+    strftime (stamp, sizeof (stamp), "%Y%m%d-%H%M%S", localtime (&secs));
+
+    for (i = 0; i < 100; i++) {
+        gchar *name;
+        gchar *path;
+        gint fd;
+
+        name = g_strdup_printf ("mm-serial-capture-%s.%06u-%u.bin",
+                                stamp,
+                                (guint) (now % G_USEC_PER_SEC),
+                                i);
+        path = g_build_filename (directory, name, NULL);
+        g_free (name);
+
+        fd = g_open (path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd >= 0) {
+            *out_path = path;
+            return fd;
+        }
+
+        if (errno != EEXIST) {
+            g_set_error (error, MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                         "Couldn't create '%s': %s",
+                         path, g_strerror (errno));
+            g_free (path);
+            return -1;
+        }
+        g_free (path);
+    }
+
+    g_set_error (error, MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                 "Couldn't find an unused file name in '%s'",
+                 directory);
+    return -1;
+}
+
+static gboolean
+dump_file_write (gint fd,
+                 const guint8 *data,
+                 gsize len,
+                 const gchar *path,
+                 GError **error)
+{
+    while (len > 0) {
+        gssize written;
+
+        written = write (fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            g_set_error (error, MM_CORE_ERROR, MM_CORE_ERROR_FAILED,
+                         "Couldn't write '%s': %s",
+                         path, g_strerror (errno));
+            return FALSE;
+        }
+        data += written;
+        len -= written;
+    }
+
+    return TRUE;
+}
+
+gchar *
+mm_serial_capture_dump_all (const gchar *directory,
+                            GError **error)
+{
+    guint8 file_header[MM_SERIAL_CAPTURE_HEADER_SIZE] = { 0 };
+    GByteArray *out;
+    GSList *l;
+    gchar *path = NULL;
+    gint fd;
+    gboolean success;
+
+    g_return_val_if_fail (directory != NULL, NULL);
+
+    if (!default_size) {
+        g_set_error_literal (error, MM_CORE_ERROR, MM_CORE_ERROR_UNSUPPORTED,
+                             "Serial traffic capture is disabled");
+        return NULL;
+    }
+
+    out = g_byte_array_sized_new (MM_SERIAL_CAPTURE_HEADER_SIZE +
+                                  g_slist_length (captures) * default_size);
+    memcpy (file_header, MM_SERIAL_CAPTURE_MAGIC, 4);
+    file_header[4] = MM_SERIAL_CAPTURE_VERSION;
+    g_byte_array_append (out, file_header, sizeof (file_header));
+    for (l = captures; l; l = g_slist_next (l))
+        mm_serial_capture_dump ((MMSerialCapture *) l->data, out);
+
+    fd = dump_file_create (directory, &path, error);
+    if (fd < 0) {
+        g_byte_array_unref (out);
+        return NULL;
+    }
+
+    success = dump_file_write (fd, out->data, out->len, path, error);
+    close (fd);
+    g_byte_array_unref (out);
+
+    if (!success) {
+        g_unlink (path);
+        g_free (path);
+        return NULL;
+    }
+
+    mm_info ("Serial traffic of %u ports written to '%s'",
+             g_slist_length (captures), path);
+    return path;
+}
+
+/*****************************************************************************/
+
+MMSerialCapture *
+mm_serial_capture_new (const gchar *port_name,
+                       gsize size)
+{
+    MMSerialCapture *capture;
+
+    g_return_val_if_fail (port_name != NULL, NULL);
+
+    capture = g_slice_new0 (MMSerialCapture);
+    capture->port_name = g_strdup (port_name);
+    capture->size = MAX (size, MIN_RING_SIZE);
+    capture->ring = g_malloc (capture->size);
+
+    captures = g_slist_append (captures, capture);
+    return capture;
+}
+
+void
+mm_serial_capture_free (MMSerialCapture *capture)
+{
+    if (!capture)
+        return;
+
+    captures = g_slist_remove (captures, capture);
+    g_free (capture->ring);
+    g_free (capture->port_name);
+    g_slice_free (MMSerialCapture, capture);
+}
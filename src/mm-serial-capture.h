@@ -0,0 +1,77 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_SERIAL_CAPTURE_H
+#define MM_SERIAL_CAPTURE_H
+
+#include <glib.h>
+
+/*
+ * Capture file format (all integers little endian):
+ *
+ *   File header: "MMSC" magic, 1 byte version, 3 reserved bytes.
+ *
+ *   Then a list of records, each made of a 12 byte header followed by
+ *   'length' bytes of payload:
+ *     guint8  type       (one of MMSerialCaptureRecordType)
+ *     guint8  flags      (MM_SERIAL_CAPTURE_FLAG_*)
+ *     guint16 length
+ *     guint64 timestamp  (microseconds since the Epoch)
+ *
+ *   A PORT record, whose payload is the port name, precedes the RX/TX
+ *   records of each port.
+ */
+
+#define MM_SERIAL_CAPTURE_MAGIC       "MMSC"
+#define MM_SERIAL_CAPTURE_VERSION     1
+#define MM_SERIAL_CAPTURE_HEADER_SIZE 8
+#define MM_SERIAL_CAPTURE_RECORD_SIZE 12
+
+/* Payload was cut to fit in the ring */
+#define MM_SERIAL_CAPTURE_FLAG_TRUNCATED 0x01
+/* Payload was cut after the '=' of a command carrying secrets */
+#define MM_SERIAL_CAPTURE_FLAG_REDACTED  0x02
+
+typedef enum {
+    MM_SERIAL_CAPTURE_RECORD_PORT = 1,
+    MM_SERIAL_CAPTURE_RECORD_RX   = 2,
+    MM_SERIAL_CAPTURE_RECORD_TX   = 3
+} MMSerialCaptureRecordType;
+
+typedef struct _MMSerialCapture MMSerialCapture;
+
+/* Ring size used for new captures; 0 disables capturing */
+void   mm_serial_capture_set_default_size (gsize size);
+gsize  mm_serial_capture_get_default_size (void);
+
+MMSerialCapture *mm_serial_capture_new  (const gchar *port_name,
+                                         gsize size);
+void             mm_serial_capture_free (MMSerialCapture *capture);
+
+void mm_serial_capture_add (MMSerialCapture *capture,
+                            MMSerialCaptureRecordType type,
+                            const guint8 *data,
+                            gsize len);
+
+/* Appends the PORT record and the captured records, oldest first */
+void mm_serial_capture_dump (MMSerialCapture *capture,
+                             GByteArray *out);
+
+/* Writes a new capture file, only readable by its owner, with the traffic of
+ * every port into 'directory'; returns the path of the new file */
+gchar *mm_serial_capture_dump_all (const gchar *directory,
+                                   GError **error);
+
+#endif /* MM_SERIAL_CAPTURE_H */
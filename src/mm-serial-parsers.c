@@ -23,100 +23,301 @@
 
 /* Clean up the response by removing control characters like <CR><LF> etc */
 static void
-response_clean (GString *response)
+response_clean (GByteArray *response)
 {
-    char *s;
+    const guint8 *s = response->data;
+    guint start = 0;
+    guint end = response->len;
 
     /* Ends with one or more '<CR><LF>' */
-    s = response->str + response->len - 1;
-    while ((s > response->str) && (*s == '\n') && (*(s - 1) == '\r')) {
-        g_string_truncate (response, response->len - 2);
-        s -= 2;
-    }
+    while ((end >= 2) && (s[end - 1] == '\n') && (s[end - 2] == '\r'))
+        end -= 2;
 
     /* Contains duplicate '<CR><CR>' */
-    s = response->str;
-    while ((response->len >= 2) && (*s == '\r') && (*(s + 1) == '\r')) {
-        g_string_erase (response, 0, 1);
-        s = response->str;
-    }
+    while ((end - start >= 2) && (s[start] == '\r') && (s[start + 1] == '\r'))
+        start++;
 
     /* Starts with one or more '<CR><LF>' */
-    s = response->str;
-    while ((response->len >= 2) && (*s == '\r') && (*(s + 1) == '\n')) {
-        g_string_erase (response, 0, 2);
-        s = response->str;
+    while ((end - start >= 2) && (s[start] == '\r') && (s[start + 1] == '\n'))
+        start += 2;
+
+    g_byte_array_set_size (response, end);
+    if (start)
+        g_byte_array_remove_range (response, 0, start);
+}
+
+/*****************************************************************************/
+/* Final response recognizer
+ *
+ * Instead of running one regular expression per known final result code over
+ * the whole response, the response is walked once, line by line, and each
+ * complete line is classified by its leading keyword. Only the last non-empty
+ * line of the response may be a final result code (optionally followed by
+ * additional empty lines), with the exception of CONNECT, which may be
+ * followed by data.
+ */
+
+typedef enum {
+    FINAL_RESPONSE_NONE,
+    FINAL_RESPONSE_OK,
+    FINAL_RESPONSE_CONNECT,
+    FINAL_RESPONSE_CME_ERROR,
+    FINAL_RESPONSE_CMS_ERROR,
+    FINAL_RESPONSE_EZX_ERROR,
+    FINAL_RESPONSE_UNKNOWN_ERROR,
+    FINAL_RESPONSE_CONNECT_FAILED,
+} FinalResponseType;
+
+typedef struct {
+    const gchar *keyword;
+    guint keyword_len;
+    /* Whether the keyword must be the whole line, or just its beginning */
+    gboolean whole_line;
+    FinalResponseType type;
+    MMConnectionError connection_error;
+} FinalResponseKeyword;
+
+#define KEYWORD(str) str, (sizeof (str) - 1)
+
+/* Keywords starting alike are tried in this order, see match_keyword() */
+static const FinalResponseKeyword keywords[] = {
+    { KEYWORD ("OK"),                  TRUE,  FINAL_RESPONSE_OK,             0 },
+    { KEYWORD ("CONNECT"),             FALSE, FINAL_RESPONSE_CONNECT,        0 },
+    { KEYWORD ("COMMAND NOT SUPPORT"), FALSE, FINAL_RESPONSE_UNKNOWN_ERROR,  0 },
+    { KEYWORD ("+CME ERROR:"),         FALSE, FINAL_RESPONSE_CME_ERROR,      0 },
+    { KEYWORD ("+CMS ERROR:"),         FALSE, FINAL_RESPONSE_CMS_ERROR,      0 },
+    { KEYWORD ("MODEM ERROR:"),        FALSE, FINAL_RESPONSE_EZX_ERROR,      0 },
+    { KEYWORD ("ERROR"),               FALSE, FINAL_RESPONSE_UNKNOWN_ERROR,  0 },
+    { KEYWORD ("NO CARRIER"),          FALSE, FINAL_RESPONSE_CONNECT_FAILED, MM_CONNECTION_ERROR_NO_CARRIER },
+    { KEYWORD ("NO ANSWER"),           FALSE, FINAL_RESPONSE_CONNECT_FAILED, MM_CONNECTION_ERROR_NO_ANSWER },
+    { KEYWORD ("NO DIALTONE"),         FALSE, FINAL_RESPONSE_CONNECT_FAILED, MM_CONNECTION_ERROR_NO_DIALTONE },
+    { KEYWORD ("BUSY"),                FALSE, FINAL_RESPONSE_CONNECT_FAILED, MM_CONNECTION_ERROR_BUSY },
+};
+
+#undef KEYWORD
+
+typedef struct {
+    FinalResponseType type;
+    /* Offset of the <CR><LF> preceding the final response line */
+    gsize start;
+    /* Text following the keyword, up to the end of the line */
+    const gchar *value;
+    gsize value_len;
+    MMConnectionError connection_error;
+} FinalResponse;
+
+static const FinalResponseKeyword *
+match_keyword (const gchar *line, gsize len)
+{
+    static gboolean first_chars_set;
+    static gboolean first_chars[256];
+    guint i;
+
+    /* Most lines (responses, URC leftovers...) don't start like any keyword,
+     * and are discarded with a single lookup of their first character. */
+    if (G_UNLIKELY (!first_chars_set)) {
+        for (i = 0; i < G_N_ELEMENTS (keywords); i++)
+            first_chars[(guchar) keywords[i].keyword[0]] = TRUE;
+        first_chars_set = TRUE;
+    }
+
+    if (!first_chars[(guchar) line[0]])
+        return NULL;
+
+    for (i = 0; i < G_N_ELEMENTS (keywords); i++) {
+        if (keywords[i].keyword[0] == line[0] &&
+            (keywords[i].whole_line ?
+             len == keywords[i].keyword_len :
+             len >= keywords[i].keyword_len) &&
+            memcmp (line, keywords[i].keyword, keywords[i].keyword_len) == 0)
+            return &keywords[i];
     }
+
+    return NULL;
 }
 
+/* Returns TRUE if there is nothing but empty lines from 'pos' to the end */
+static gboolean
+only_empty_lines_left (const gchar *str, gsize len, gsize pos)
+{
+    while (pos + 1 < len && str[pos] == '\r' && str[pos + 1] == '\n')
+        pos += 2;
+    return (pos == len);
+}
+
+/* Returns the offset of the <CR><LF> ending the line starting at 'pos', or
+ * 'len' if the line is not complete yet */
+static gsize
+find_line_end (const gchar *str, gsize len, gsize pos)
+{
+    const gchar *p;
+
+    while (pos + 1 < len) {
+        p = memchr (str + pos, '\r', len - pos - 1);
+        if (!p)
+            break;
+        pos = p - str;
+        if (str[pos + 1] == '\n')
+            return pos;
+        pos++;
+    }
 
+    return len;
+}
+
+/* Looks for the final response, starting at offset 'from', which must be
+ * either 0 or the 'resume' offset given by a previous call on the same
+ * response. When no final response is found, 'resume' is set to the offset
+ * from which the search needs to be restarted once more data is appended to
+ * the response, so that lines already classified are not scanned again. */
 static gboolean
-remove_eval_cb (const GMatchInfo *match_info,
-                GString *result,
-                gpointer user_data)
+find_final_response (const gchar *str,
+                     gsize len,
+                     gsize from,
+                     FinalResponse *final,
+                     gsize *resume)
 {
-    int *result_len = (int *) user_data;
-    int start;
-    int end;
+    gsize pos = from;
+    /* Start of a final response line which is not the last one, but which
+     * may still be if only empty lines follow */
+    gsize pending = G_MAXSIZE;
+
+    while (pos + 1 < len) {
+        const gchar *p;
+        const gchar *line;
+        const FinalResponseKeyword *keyword;
+        gsize line_start;
+        gsize line_end;
+
+        /* Look for the next line start, i.e. a <CR><LF> */
+        p = memchr (str + pos, '\r', len - pos - 1);
+        if (!p) {
+            /* The last byte may still be the <CR> of a line start */
+            pos = len - 1;
+            break;
+        }
+        pos = p - str;
+        if (str[pos + 1] != '\n') {
+            pos++;
+            continue;
+        }
+        line_start = pos + 2;
+
+        /* And for the <CR><LF> ending the line; if the line is not complete
+         * yet, resume the search from its start next time */
+        line_end = find_line_end (str, len, line_start);
+        if (line_end == len)
+            break;
+
+        /* The <CR><LF> ending this line is the one starting the next one */
+        pos = line_end;
+
+        if (line_end == line_start)
+            continue;
+
+        line = str + line_start;
+        keyword = match_keyword (line, line_end - line_start);
+        if (!keyword) {
+            pending = G_MAXSIZE;
+            continue;
+        }
+
+        /* All final responses but CONNECT must be the last non-empty line */
+        if (keyword->type != FINAL_RESPONSE_CONNECT &&
+            !only_empty_lines_left (str, len, line_end)) {
+            pending = line_start - 2;
+            continue;
+        }
 
-    if (g_match_info_fetch_pos  (match_info, 0, &start, &end))
-        *result_len -= (end - start);
+        final->type = keyword->type;
+        final->start = line_start - 2;
+        final->value = line + keyword->keyword_len;
+        final->value_len = line_end - line_start - keyword->keyword_len;
+        final->connection_error = keyword->connection_error;
+
+        /* Skip leading and trailing whitespace in the value */
+        while (final->value_len && g_ascii_isspace (final->value[0])) {
+            final->value++;
+            final->value_len--;
+        }
+        while (final->value_len && g_ascii_isspace (final->value[final->value_len - 1]))
+            final->value_len--;
+
+        return TRUE;
+    }
+
+    *resume = MIN (pos, pending);
+    return FALSE;
+}
+
+static gboolean
+final_response_value_is_numeric (const FinalResponse *final)
+{
+    gsize i;
+
+    if (!final->value_len)
+        return FALSE;
+
+    for (i = 0; i < final->value_len; i++) {
+        if (!g_ascii_isdigit (final->value[i]))
+            return FALSE;
+    }
 
     return TRUE;
 }
 
-static void
-remove_matches (GRegex *r, GString *string)
+static GError *
+final_response_to_error (const FinalResponse *final)
 {
-    char *str;
-    int result_len = string->len;
+    GError *error = NULL;
+    gchar *value;
 
-    str = g_regex_replace_eval (r, string->str, string->len, 0, 0,
-                                remove_eval_cb, &result_len, NULL);
+    value = g_strndup (final->value, final->value_len);
 
-    g_string_truncate (string, 0);
-    g_string_append_len (string, str, result_len);
-    g_free (str);
+    switch (final->type) {
+    case FINAL_RESPONSE_CME_ERROR:
+        if (final_response_value_is_numeric (final))
+            error = mm_mobile_equipment_error_for_code (atoi (value));
+        else if (final->value_len)
+            error = mm_mobile_equipment_error_for_string (value);
+        else
+            error = mm_mobile_equipment_error_for_code (MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN);
+        break;
+    case FINAL_RESPONSE_CMS_ERROR:
+        if (final_response_value_is_numeric (final))
+            error = mm_message_error_for_code (atoi (value));
+        else if (final->value_len)
+            error = mm_message_error_for_string (value);
+        else
+            error = mm_message_error_for_code (MM_MESSAGE_ERROR_UNKNOWN);
+        break;
+    case FINAL_RESPONSE_EZX_ERROR:
+    case FINAL_RESPONSE_UNKNOWN_ERROR:
+        error = mm_mobile_equipment_error_for_code (MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN);
+        break;
+    case FINAL_RESPONSE_CONNECT_FAILED:
+        error = mm_connection_error_for_code (final->connection_error);
+        break;
+    default:
+        g_assert_not_reached ();
+    }
+
+    g_free (value);
+    return error;
 }
 
+/*****************************************************************************/
+
 typedef struct {
-    /* Regular expressions for successful replies */
-    GRegex *regex_ok;
-    GRegex *regex_connect;
+    /* Regular expressions for custom successful and error replies, if any */
     GRegex *regex_custom_successful;
-    /* Regular expressions for error replies */
-    GRegex *regex_cme_error;
-    GRegex *regex_cms_error;
-    GRegex *regex_cme_error_str;
-    GRegex *regex_cms_error_str;
-    GRegex *regex_ezx_error;
-    GRegex *regex_unknown_error;
-    GRegex *regex_connect_failed;
     GRegex *regex_custom_error;
 } MMSerialParserV1;
 
 gpointer
 mm_serial_parser_v1_new (void)
 {
-    MMSerialParserV1 *parser;
-    GRegexCompileFlags flags = G_REGEX_DOLLAR_ENDONLY | G_REGEX_RAW | G_REGEX_OPTIMIZE;
-
-    parser = g_slice_new (MMSerialParserV1);
-
-    parser->regex_ok = g_regex_new ("\\r\\nOK(\\r\\n)+$", flags, 0, NULL);
-    parser->regex_connect = g_regex_new ("\\r\\nCONNECT.*\\r\\n", flags, 0, NULL);
-    parser->regex_cme_error = g_regex_new ("\\r\\n\\+CME ERROR:\\s*(\\d+)\\r\\n$", flags, 0, NULL);
-    parser->regex_cms_error = g_regex_new ("\\r\\n\\+CMS ERROR:\\s*(\\d+)\\r\\n$", flags, 0, NULL);
-    parser->regex_cme_error_str = g_regex_new ("\\r\\n\\+CME ERROR:\\s*([^\\n\\r]+)\\r\\n$", flags, 0, NULL);
-    parser->regex_cms_error_str = g_regex_new ("\\r\\n\\+CMS ERROR:\\s*([^\\n\\r]+)\\r\\n$", flags, 0, NULL);
-    parser->regex_ezx_error = g_regex_new ("\\r\\n\\MODEM ERROR:\\s*(\\d+)\\r\\n$", flags, 0, NULL);
-    parser->regex_unknown_error = g_regex_new ("\\r\\n(ERROR)|(COMMAND NOT SUPPORT)\\r\\n$", flags, 0, NULL);
-    parser->regex_connect_failed = g_regex_new ("\\r\\n(NO CARRIER)|(BUSY)|(NO ANSWER)|(NO DIALTONE)\\r\\n$", flags, 0, NULL);
-
-    parser->regex_custom_successful = NULL;
-    parser->regex_custom_error = NULL;
-
-    return parser;
+    return g_slice_new0 (MMSerialParserV1);
 }
 
 void
@@ -139,48 +340,63 @@ mm_serial_parser_v1_set_custom_regex (gpointer data,
 
 gboolean
 mm_serial_parser_v1_parse (gpointer data,
-                           GString *response,
+                           GByteArray *response,
+                           gsize *resume,
                            GError **error)
 {
     MMSerialParserV1 *parser = (MMSerialParserV1 *) data;
-    GMatchInfo *match_info;
+    FinalResponse final = { FINAL_RESPONSE_NONE };
     GError *local_error = NULL;
     gboolean found = FALSE;
-    char *str = NULL;
+    gsize from = 0;
+    gsize next = 0;
+    guint n_nul = 0;
 
     g_return_val_if_fail (parser != NULL, FALSE);
     g_return_val_if_fail (response != NULL, FALSE);
 
+    if (resume && *resume <= response->len)
+        from = *resume;
+
     /* Skip NUL bytes if they are found leading the response */
-    while (response->len > 0 && response->str[0] == '\0')
-        g_string_erase (response, 0, 1);
+    while (n_nul < response->len && response->data[n_nul] == '\0')
+        n_nul++;
+    if (n_nul) {
+        g_byte_array_remove_range (response, 0, n_nul);
+        from = (from > n_nul ? from - n_nul : 0);
+    }
 
-    if (G_UNLIKELY (!response->len))
+    if (G_UNLIKELY (!response->len)) {
+        if (resume)
+            *resume = 0;
         return FALSE;
+    }
+
+    /* Single pass over the new data looking for a final result code */
+    find_final_response ((const gchar *) response->data, response->len, from, &final, &next);
 
     /* First, check for successful responses */
 
     /* Custom successful replies first, if any */
     if (parser->regex_custom_successful) {
         found = g_regex_match_full (parser->regex_custom_successful,
-                                    response->str, response->len,
+                                    (const gchar *) response->data, response->len,
                                     0, 0, NULL, NULL);
     }
 
     if (!found) {
-        found = g_regex_match_full (parser->regex_ok,
-                                    response->str, response->len,
-                                    0, 0, NULL, NULL);
-        if (found)
-            remove_matches (parser->regex_ok, response);
-        else
-            found = g_regex_match_full (parser->regex_connect,
-                                        response->str, response->len,
-                                        0, 0, NULL, NULL);
+        if (final.type == FINAL_RESPONSE_OK) {
+            /* Remove the OK and the empty lines after it */
+            g_byte_array_set_size (response, final.start);
+            found = TRUE;
+        } else if (final.type == FINAL_RESPONSE_CONNECT)
+            found = TRUE;
     }
 
     if (found) {
         response_clean (response);
+        if (resume)
+            *resume = 0;
         return TRUE;
     }
 
@@ -188,120 +404,33 @@ mm_serial_parser_v1_parse (gpointer data,
 
     /* Custom error matches first, if any */
     if (parser->regex_custom_error) {
+        GMatchInfo *match_info = NULL;
+
         found = g_regex_match_full (parser->regex_custom_error,
-                                    response->str, response->len,
+                                    (const gchar *) response->data, response->len,
                                     0, 0, &match_info, NULL);
         if (found) {
+            gchar *str;
+
             str = g_match_info_fetch (match_info, 1);
             g_assert (str);
             local_error = mm_mobile_equipment_error_for_code (atoi (str));
-            goto done;
+            g_free (str);
         }
         g_match_info_free (match_info);
     }
 
-    /* Numeric CME errors */
-    found = g_regex_match_full (parser->regex_cme_error,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        str = g_match_info_fetch (match_info, 1);
-        g_assert (str);
-        local_error = mm_mobile_equipment_error_for_code (atoi (str));
-        goto done;
-    }
-    g_match_info_free (match_info);
-
-    /* Numeric CMS errors */
-    found = g_regex_match_full (parser->regex_cms_error,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        str = g_match_info_fetch (match_info, 1);
-        g_assert (str);
-        local_error = mm_message_error_for_code (atoi (str));
-        goto done;
-    }
-    g_match_info_free (match_info);
-
-    /* String CME errors */
-    found = g_regex_match_full (parser->regex_cme_error_str,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        str = g_match_info_fetch (match_info, 1);
-        g_assert (str);
-        local_error = mm_mobile_equipment_error_for_string (str);
-        goto done;
-    }
-    g_match_info_free (match_info);
-
-    /* String CMS errors */
-    found = g_regex_match_full (parser->regex_cms_error_str,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        str = g_match_info_fetch (match_info, 1);
-        g_assert (str);
-        local_error = mm_message_error_for_string (str);
-        goto done;
-    }
-    g_match_info_free (match_info);
-
-    /* Motorola EZX errors */
-    found = g_regex_match_full (parser->regex_ezx_error,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        str = g_match_info_fetch (match_info, 1);
-        g_assert (str);
-        local_error = mm_mobile_equipment_error_for_code (MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN);
-        goto done;
-    }
-    g_match_info_free (match_info);
-
-    /* Last resort; unknown error */
-    found = g_regex_match_full (parser->regex_unknown_error,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        local_error = mm_mobile_equipment_error_for_code (MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN);
-        goto done;
+    if (!found && final.type != FINAL_RESPONSE_NONE) {
+        local_error = final_response_to_error (&final);
+        found = TRUE;
     }
-    g_match_info_free (match_info);
 
-    /* Connection failures */
-    found = g_regex_match_full (parser->regex_connect_failed,
-                                response->str, response->len,
-                                0, 0, &match_info, NULL);
-    if (found) {
-        MMConnectionError code;
-
-        str = g_match_info_fetch (match_info, 1);
-        g_assert (str);
-
-        if (!strcmp (str, "NO CARRIER"))
-            code = MM_CONNECTION_ERROR_NO_CARRIER;
-        else if (!strcmp (str, "BUSY"))
-            code = MM_CONNECTION_ERROR_BUSY;
-        else if (!strcmp (str, "NO ANSWER"))
-            code = MM_CONNECTION_ERROR_NO_ANSWER;
-        else if (!strcmp (str, "NO DIALTONE"))
-            code = MM_CONNECTION_ERROR_NO_DIALTONE;
-        else {
-            /* uhm... make something up (yes, ok, lie!). */
-            code = MM_CONNECTION_ERROR_NO_CARRIER;
-        }
-
-        local_error = mm_connection_error_for_code (code);
-    }
-
-done:
-    g_free (str);
-    g_match_info_free (match_info);
     if (found)
         response_clean (response);
 
+    if (resume)
+        *resume = (found ? 0 : next);
+
     if (local_error) {
         mm_dbg ("Got failure code %d: %s", local_error->code, local_error->message);
         g_propagate_error (error, local_error);
@@ -326,16 +455,6 @@ mm_serial_parser_v1_destroy (gpointer data)
 
     g_return_if_fail (parser != NULL);
 
-    g_regex_unref (parser->regex_ok);
-    g_regex_unref (parser->regex_connect);
-    g_regex_unref (parser->regex_cme_error);
-    g_regex_unref (parser->regex_cms_error);
-    g_regex_unref (parser->regex_cme_error_str);
-    g_regex_unref (parser->regex_cms_error_str);
-    g_regex_unref (parser->regex_ezx_error);
-    g_regex_unref (parser->regex_unknown_error);
-    g_regex_unref (parser->regex_connect_failed);
-
     if (parser->regex_custom_successful)
         g_regex_unref (parser->regex_custom_successful);
     if (parser->regex_custom_error)
@@ -23,7 +23,8 @@ void     mm_serial_parser_v1_set_custom_regex (gpointer data,
                                                GRegex *successful,
                                                GRegex *error);
 gboolean mm_serial_parser_v1_parse            (gpointer parser,
-                                               GString *response,
+                                               GByteArray *response,
+                                               gsize *resume,
                                                GError **error);
 void     mm_serial_parser_v1_destroy          (gpointer parser);
 gboolean mm_serial_parser_v1_is_known_error   (const GError *error);
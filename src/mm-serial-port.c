@@ -32,6 +32,7 @@
 #include <mm-errors-types.h>
 
 #include "mm-serial-port.h"
+#include "mm-serial-capture.h"
 #include "mm-log.h"
 
 static gboolean mm_serial_port_queue_process (gpointer data);
@@ -50,6 +51,7 @@ enum {
     PROP_SPEW_CONTROL,
     PROP_RTS_CTS,
     PROP_FLASH_OK,
+    PROP_ADAPTIVE_TIMEOUTS,
 
     LAST_PROP
 };
@@ -65,6 +67,15 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 #define SERIAL_BUF_SIZE 2048
 
+/* Adaptive timeouts: once enough replies to a given command have been seen,
+ * stop waiting for the next one as soon as it is clearly late, instead of
+ * always waiting the full timeout given by the caller, which stays as the
+ * upper bound. */
+#define ADAPTIVE_TIMEOUT_MIN_SAMPLES 5
+#define ADAPTIVE_TIMEOUT_MIN_MS      300
+/* Commands with arguments may give lots of different keys */
+#define ADAPTIVE_TIMEOUT_MAX_KEYS    64
+
 #define MM_SERIAL_PORT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), MM_TYPE_SERIAL_PORT, MMSerialPortPrivate))
 
 typedef struct {
@@ -98,8 +109,22 @@ typedef struct {
 
     guint flash_id;
     guint connected_id;
+
+    gboolean adaptive_timeouts;
+    /* Command key -> CommandStats */
+    GHashTable *command_stats;
+
+    /* Raw traffic, created on first use */
+    MMSerialCapture *capture;
 } MMSerialPortPrivate;
 
+/* Round trip times of the replies to a given command, in milliseconds */
+typedef struct {
+    gdouble srtt;
+    gdouble rttvar;
+    guint n_samples;
+} CommandStats;
+
 typedef struct {
     GByteArray *command;
     guint32 idx;
@@ -108,9 +133,15 @@ typedef struct {
     gboolean done;
     GCallback callback;
     gpointer user_data;
-    guint32 timeout;
+    guint32 timeout_ms;
     gboolean cached;
     GCancellable *cancellable;
+    /* When the command was fully sent, in monotonic time */
+    gint64 sent_time;
+    /* Round trip stats to update when the reply arrives, if any */
+    CommandStats *stats;
+    /* Whether the timeout was shortened by the stats */
+    gboolean adaptive;
 } MMQueueData;
 
 #if 0
@@ -418,6 +449,26 @@ real_config_fd (MMSerialPort *self, int fd, GError **error)
     return TRUE;
 }
 
+static void
+serial_capture (MMSerialPort *self,
+                MMSerialCaptureRecordType type,
+                const char *buf,
+                gsize len)
+{
+    MMSerialPortPrivate *priv = MM_SERIAL_PORT_GET_PRIVATE (self);
+
+    if (G_UNLIKELY (!priv->capture)) {
+        gsize size;
+
+        size = mm_serial_capture_get_default_size ();
+        if (!size)
+            return;
+        priv->capture = mm_serial_capture_new (mm_port_get_device (MM_PORT (self)), size);
+    }
+
+    mm_serial_capture_add (priv->capture, type, (const guint8 *) buf, len);
+}
+
 static void
 serial_debug (MMSerialPort *self, const char *prefix, const char *buf, gsize len)
 {
@@ -451,6 +502,10 @@ mm_serial_port_process_command (MMSerialPort *self,
     /* Only print command the first time */
     if (info->started == FALSE) {
         info->started = TRUE;
+        serial_capture (self,
+                        MM_SERIAL_CAPTURE_RECORD_TX,
+                        (const char *) info->command->data,
+                        info->command->len);
         serial_debug (self, "-->", (const char *) info->command->data, info->command->len);
     }
 
@@ -544,6 +599,21 @@ mm_serial_port_schedule_queue_process (MMSerialPort *self, guint timeout_ms)
         priv->queue_id = g_idle_add (mm_serial_port_queue_process, self);
 }
 
+static void
+response_trim (MMSerialPort *self, guint len)
+{
+    MMSerialPortPrivate *priv = MM_SERIAL_PORT_GET_PRIVATE (self);
+
+    if (!len)
+        return;
+
+    g_byte_array_remove_range (priv->response, 0, len);
+
+    /* Let subclasses know that the data they may have already parsed is gone */
+    if (MM_SERIAL_PORT_GET_CLASS (self)->response_trimmed)
+        MM_SERIAL_PORT_GET_CLASS (self)->response_trimmed (self);
+}
+
 static gsize
 real_handle_response (MMSerialPort *self,
                       GByteArray *response,
@@ -557,6 +627,72 @@ real_handle_response (MMSerialPort *self,
     return response->len;
 }
 
+static void
+command_stats_free (CommandStats *stats)
+{
+    g_slice_free (CommandStats, stats);
+}
+
+/* Returns the timeout to use for the given command, setting up the stats to
+ * update when its reply arrives */
+static guint32
+command_stats_get_timeout (MMSerialPort *self, MMQueueData *info)
+{
+    MMSerialPortPrivate *priv = MM_SERIAL_PORT_GET_PRIVATE (self);
+    CommandStats *stats;
+    gchar *key;
+    gdouble timeout_ms;
+
+    if (!priv->adaptive_timeouts ||
+        !MM_SERIAL_PORT_GET_CLASS (self)->command_key)
+        return info->timeout_ms;
+
+    key = MM_SERIAL_PORT_GET_CLASS (self)->command_key (self, info->command);
+    if (!key)
+        return info->timeout_ms;
+
+    stats = g_hash_table_lookup (priv->command_stats, key);
+    if (!stats) {
+        if (g_hash_table_size (priv->command_stats) >= ADAPTIVE_TIMEOUT_MAX_KEYS) {
+            g_free (key);
+            return info->timeout_ms;
+        }
+        stats = g_slice_new0 (CommandStats);
+        g_hash_table_insert (priv->command_stats, key, stats);
+    } else
+        g_free (key);
+    info->stats = stats;
+
+    if (stats->n_samples < ADAPTIVE_TIMEOUT_MIN_SAMPLES)
+        return info->timeout_ms;
+
+    /* RFC 6298 retransmission timeout, SRTT + 4 * RTTVAR, with a lower bound
+     * better suited to serial links than its 1 s */
+    timeout_ms = stats->srtt + (4 * stats->rttvar);
+    timeout_ms = MAX (timeout_ms, ADAPTIVE_TIMEOUT_MIN_MS);
+    if (timeout_ms >= info->timeout_ms)
+        return info->timeout_ms;
+
+    info->adaptive = TRUE;
+    return (guint32) timeout_ms;
+}
+
+static void
+command_stats_add_sample (CommandStats *stats, gdouble rtt_ms)
+{
+    /* Same estimators as for the TCP retransmission timer (RFC 6298) */
+    if (stats->n_samples == 0) {
+        stats->srtt = rtt_ms;
+        stats->rttvar = rtt_ms / 2;
+    } else {
+        stats->rttvar = (0.75 * stats->rttvar) + (0.25 * ABS (stats->srtt - rtt_ms));
+        stats->srtt = (0.875 * stats->srtt) + (0.125 * rtt_ms);
+    }
+
+    if (stats->n_samples < G_MAXUINT)
+        stats->n_samples++;
+}
+
 static void
 mm_serial_port_got_response (MMSerialPort *self, GError *error)
 {
@@ -580,6 +716,10 @@ mm_serial_port_got_response (MMSerialPort *self, GError *error)
 
     info = (MMQueueData *) g_queue_pop_head (priv->queue);
     if (info) {
+        if (info->stats && info->sent_time)
+            command_stats_add_sample (info->stats,
+                                      (g_get_monotonic_time () - info->sent_time) / 1000.0);
+
         if (info->cached && !error)
             mm_serial_port_set_cached_reply (self, info->command, priv->response);
 
@@ -600,8 +740,7 @@ mm_serial_port_got_response (MMSerialPort *self, GError *error)
     if (error)
         g_error_free (error);
 
-    if (consumed)
-        g_byte_array_remove_range (priv->response, 0, consumed);
+    response_trim (self, consumed);
     if (!g_queue_is_empty (priv->queue))
         mm_serial_port_schedule_queue_process (self, 0);
 }
@@ -611,6 +750,7 @@ mm_serial_port_timed_out (gpointer data)
 {
     MMSerialPort *self = MM_SERIAL_PORT (data);
     MMSerialPortPrivate *priv = MM_SERIAL_PORT_GET_PRIVATE (self);
+    MMQueueData *info;
     GError *error;
 
     priv->timeout_id = 0;
@@ -618,6 +758,19 @@ mm_serial_port_timed_out (gpointer data)
     /* Update number of consecutive timeouts found */
     priv->n_consecutive_timeouts++;
 
+    info = (MMQueueData *) g_queue_peek_head (priv->queue);
+    if (info && info->stats) {
+        /* Back off, like RFC 6298 does, so that a command which is just
+         * slower than usual doesn't keep on timing out */
+        if (info->adaptive) {
+            mm_dbg ("(%s) command timed out after %u ms (adaptive timeout)",
+                    mm_port_get_device (MM_PORT (self)),
+                    (guint) ((g_get_monotonic_time () - info->sent_time) / 1000));
+            info->stats->srtt *= 2;
+        }
+        info->stats = NULL;
+    }
+
     error = g_error_new_literal (MM_SERIAL_ERROR,
                                  MM_SERIAL_ERROR_RESPONSE_TIMEOUT,
                                  "Serial command timed out");
@@ -639,11 +792,17 @@ serial_port_response_wait_cancelled (GCancellable *cancellable,
                                      MMSerialPort *self)
 {
     MMSerialPortPrivate *priv = MM_SERIAL_PORT_GET_PRIVATE (self);
+    MMQueueData *info;
     GError *error;
 
     /* We don't want to call disconnect () while in the signal handler */
     priv->cancellable_id = 0;
 
+    /* No reply, so nothing to learn from this one */
+    info = (MMQueueData *) g_queue_peek_head (priv->queue);
+    if (info)
+        info->stats = NULL;
+
     error = g_error_new_literal (MM_CORE_ERROR,
                                  MM_CORE_ERROR_CANCELLED,
                                  "Waiting for the reply cancelled");
@@ -680,7 +839,7 @@ mm_serial_port_queue_process (gpointer data)
                            __func__,
                            mm_port_get_device (MM_PORT (self)),
                            priv->response->len);
-                g_byte_array_set_size (priv->response, 0);
+                response_trim (self, priv->response->len);
             }
 
             g_byte_array_append (priv->response, cached->data, cached->len);
@@ -709,9 +868,10 @@ mm_serial_port_queue_process (gpointer data)
             }
 
             /* If the command is finished being sent, schedule the timeout */
-            priv->timeout_id = g_timeout_add_seconds (info->timeout,
-                                                      mm_serial_port_timed_out,
-                                                      self);
+            info->sent_time = g_get_monotonic_time ();
+            priv->timeout_id = g_timeout_add (command_stats_get_timeout (self, info),
+                                              mm_serial_port_timed_out,
+                                              self);
         } else {
             /* Schedule the next byte of the command to be sent */
             mm_serial_port_schedule_queue_process (self, priv->send_delay / 1000);
@@ -751,15 +911,13 @@ data_available (GIOChannel *source,
         device = mm_port_get_device (MM_PORT (self));
         mm_dbg ("(%s) unexpected port hangup!", device);
 
-        if (priv->response->len)
-            g_byte_array_remove_range (priv->response, 0, priv->response->len);
+        response_trim (self, priv->response->len);
         mm_serial_port_close_force (self);
         return FALSE;
     }
 
     if (condition & G_IO_ERR) {
-        if (priv->response->len)
-            g_byte_array_remove_range (priv->response, 0, priv->response->len);
+        response_trim (self, priv->response->len);
         return TRUE;
     }
 
@@ -787,6 +945,7 @@ data_available (GIOChannel *source,
             break;
 
         if (bytes_read > 0) {
+            serial_capture (self, MM_SERIAL_CAPTURE_RECORD_RX, buf, bytes_read);
             serial_debug (self, "<--", buf, bytes_read);
             g_byte_array_append (priv->response, (const guint8 *) buf, bytes_read);
         }
@@ -795,7 +954,7 @@ data_available (GIOChannel *source,
         if ((priv->response->len > SERIAL_BUF_SIZE) && priv->spew_control) {
             /* Notify listeners and then trim the buffer */
             g_signal_emit (self, signals[BUFFER_FULL], 0, priv->response);
-            g_byte_array_remove_range (priv->response, 0, (SERIAL_BUF_SIZE / 2));
+            response_trim (self, (SERIAL_BUF_SIZE / 2));
         }
 
         if (parse_response (self, priv->response, &err)) {
@@ -1091,7 +1250,7 @@ internal_queue_command (MMSerialPort *self,
                         GByteArray *command,
                         gboolean take_command,
                         gboolean cached,
-                        guint32 timeout_seconds,
+                        guint32 timeout_ms,
                         GCancellable *cancellable,
                         MMSerialResponseFn callback,
                         gpointer user_data)
@@ -1127,7 +1286,7 @@ internal_queue_command (MMSerialPort *self,
         info->eagain_count = 1000;
 
     info->cached = cached;
-    info->timeout = timeout_seconds;
+    info->timeout_ms = timeout_ms;
     info->cancellable = (cancellable ? g_object_ref (cancellable) : NULL);
     info->callback = (GCallback) callback;
     info->user_data = user_data;
@@ -1151,7 +1310,19 @@ mm_serial_port_queue_command (MMSerialPort *self,
                               MMSerialResponseFn callback,
                               gpointer user_data)
 {
-    internal_queue_command (self, command, take_command, FALSE, timeout_seconds, cancellable, callback, user_data);
+    internal_queue_command (self, command, take_command, FALSE, timeout_seconds * 1000, cancellable, callback, user_data);
+}
+
+void
+mm_serial_port_queue_command_ms (MMSerialPort *self,
+                                 GByteArray *command,
+                                 gboolean take_command,
+                                 guint32 timeout_ms,
+                                 GCancellable *cancellable,
+                                 MMSerialResponseFn callback,
+                                 gpointer user_data)
+{
+    internal_queue_command (self, command, take_command, FALSE, timeout_ms, cancellable, callback, user_data);
 }
 
 void
@@ -1163,7 +1334,7 @@ mm_serial_port_queue_command_cached (MMSerialPort *self,
                                      MMSerialResponseFn callback,
                                      gpointer user_data)
 {
-    internal_queue_command (self, command, take_command, TRUE, timeout_seconds, cancellable, callback, user_data);
+    internal_queue_command (self, command, take_command, TRUE, timeout_seconds * 1000, cancellable, callback, user_data);
 }
 
 static gboolean
@@ -1363,6 +1534,32 @@ mm_serial_port_get_flash_ok (MMSerialPort *self)
     return MM_SERIAL_PORT_GET_PRIVATE (self)->flash_ok;
 }
 
+guint
+mm_serial_port_get_queue_length (MMSerialPort *self)
+{
+    g_return_val_if_fail (MM_IS_SERIAL_PORT (self), 0);
+
+    return g_queue_get_length (MM_SERIAL_PORT_GET_PRIVATE (self)->queue);
+}
+
+gpointer
+mm_serial_port_get_current_command_data (MMSerialPort *self)
+{
+    MMSerialPortPrivate *priv;
+    MMQueueData *info;
+
+    g_return_val_if_fail (MM_IS_SERIAL_PORT (self), NULL);
+
+    priv = MM_SERIAL_PORT_GET_PRIVATE (self);
+
+    /* Only once fully sent, while waiting for the reply */
+    if (!priv->timeout_id)
+        return NULL;
+
+    info = (MMQueueData *) g_queue_peek_head (priv->queue);
+    return info ? info->user_data : NULL;
+}
+
 /*****************************************************************************/
 
 MMSerialPort *
@@ -1433,6 +1630,11 @@ mm_serial_port_init (MMSerialPort *self)
 
     priv->queue = g_queue_new ();
     priv->response = g_byte_array_sized_new (500);
+
+    priv->command_stats = g_hash_table_new_full (g_str_hash,
+                                                 g_str_equal,
+                                                 g_free,
+                                                 (GDestroyNotify) command_stats_free);
 }
 
 static void
@@ -1473,6 +1675,9 @@ set_property (GObject *object, guint prop_id,
     case PROP_FLASH_OK:
         priv->flash_ok = g_value_get_boolean (value);
         break;
+    case PROP_ADAPTIVE_TIMEOUTS:
+        priv->adaptive_timeouts = g_value_get_boolean (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -1517,6 +1722,9 @@ get_property (GObject *object, guint prop_id,
     case PROP_FLASH_OK:
         g_value_set_boolean (value, priv->flash_ok);
         break;
+    case PROP_ADAPTIVE_TIMEOUTS:
+        g_value_set_boolean (value, priv->adaptive_timeouts);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -1547,6 +1755,8 @@ finalize (GObject *object)
     MMSerialPortPrivate *priv = MM_SERIAL_PORT_GET_PRIVATE (self);
 
     g_hash_table_destroy (priv->reply_cache);
+    g_hash_table_destroy (priv->command_stats);
+    mm_serial_capture_free (priv->capture);
     g_byte_array_free (priv->response, TRUE);
     g_queue_free (priv->queue);
 
@@ -1643,6 +1853,15 @@ mm_serial_port_class_init (MMSerialPortClass *klass)
                                TRUE,
                                G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
+    g_object_class_install_property
+        (object_class, PROP_ADAPTIVE_TIMEOUTS,
+         g_param_spec_boolean (MM_SERIAL_PORT_ADAPTIVE_TIMEOUTS,
+                               "AdaptiveTimeouts",
+                               "Shorten command timeouts based on the round "
+                               "trip times seen for previous replies",
+                               FALSE,
+                               G_PARAM_READWRITE));
+
     /* Signals */
     signals[BUFFER_FULL] =
         g_signal_new ("buffer-full",
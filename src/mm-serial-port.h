@@ -39,6 +39,7 @@
 #define MM_SERIAL_PORT_FD           "fd" /* Construct-only */
 #define MM_SERIAL_PORT_SPEW_CONTROL "spew-control" /* Construct-only */
 #define MM_SERIAL_PORT_FLASH_OK     "flash-ok" /* Construct-only */
+#define MM_SERIAL_PORT_ADAPTIVE_TIMEOUTS "adaptive-timeouts"
 
 typedef struct _MMSerialPort MMSerialPort;
 typedef struct _MMSerialPortClass MMSerialPortClass;
@@ -77,6 +78,13 @@ struct _MMSerialPortClass {
                                    GByteArray *response,
                                    GError **error);
 
+    /* Called whenever data is removed from the beginning of the response
+     * byte array by the serial port itself (consumed replies, overflows,
+     * I/O errors...), so that subclasses which parse the response
+     * incrementally can reset their parsing state.
+     */
+    void     (*response_trimmed)  (MMSerialPort *self);
+
     /* Called after parsing to allow the command response to be delivered to
      * it's callback to be handled.  Returns the # of bytes of the response
      * consumed.
@@ -87,6 +95,14 @@ struct _MMSerialPortClass {
                                    GCallback callback,
                                    gpointer callback_data);
 
+    /* Called to get the key under which the round trip times of the replies
+     * to the given command are tracked when adaptive timeouts are enabled.
+     * Commands which should always get the full timeout given by the caller
+     * must return NULL.
+     */
+    gchar *   (*command_key)      (MMSerialPort *self,
+                                   const GByteArray *command);
+
     /* Called to configure the serial port after it's opened.  On error, should
      * return FALSE and set 'error' as appropriate.
      */
@@ -127,6 +143,12 @@ void     mm_serial_port_flash_cancel      (MMSerialPort *self);
 
 gboolean mm_serial_port_get_flash_ok      (MMSerialPort *self);
 
+/* Number of commands waiting for a reply or to be sent */
+guint    mm_serial_port_get_queue_length  (MMSerialPort *self);
+
+/* User data of the command whose reply is being received, if any */
+gpointer mm_serial_port_get_current_command_data (MMSerialPort *self);
+
 void     mm_serial_port_queue_command     (MMSerialPort *self,
                                            GByteArray *command,
                                            gboolean take_command,
@@ -135,6 +157,15 @@ void     mm_serial_port_queue_command     (MMSerialPort *self,
                                            MMSerialResponseFn callback,
                                            gpointer user_data);
 
+/* Same as mm_serial_port_queue_command(), with the timeout in milliseconds */
+void     mm_serial_port_queue_command_ms  (MMSerialPort *self,
+                                           GByteArray *command,
+                                           gboolean take_command,
+                                           guint32 timeout_ms,
+                                           GCancellable *cancellable,
+                                           MMSerialResponseFn callback,
+                                           gpointer user_data);
+
 void     mm_serial_port_queue_command_cached (MMSerialPort *self,
                                               GByteArray *command,
                                               gboolean take_command,
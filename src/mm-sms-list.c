@@ -49,16 +49,160 @@ static guint signals[SIGNAL_LAST];
 struct _MMSmsListPrivate {
     /* The owner modem */
     MMBaseModem *modem;
-    /* List of sms objects */
+    /* List of SmsEntry, most recent first */
     GList *list;
+    guint count;
+    /* Indexes over the list */
+    GHashTable *by_path;      /* path -> SmsEntry */
+    GHashTable *by_multipart; /* "reference/sender" -> SmsEntry */
+    GHashTable *by_part;      /* PartKey -> SmsEntry */
+    /* Entries whose parts are not known to the index, i.e. SMS created
+     * by the user, whose storage and part index change when stored */
+    GList *unindexed;
 };
 
+/*****************************************************************************/
+/* Indexes */
+
+typedef struct {
+    MMSmsStorage storage;
+    guint index;
+} PartKey;
+
+typedef struct {
+    MMSms *sms;
+    GList *link;
+    gchar *path;
+    gchar *multipart_key;
+    GSList *part_keys;
+    gboolean unindexed;
+} SmsEntry;
+
+static guint
+part_key_hash (const PartKey *key)
+{
+    return (key->index * 31) ^ key->storage;
+}
+
+static gboolean
+part_key_equal (const PartKey *a,
+                const PartKey *b)
+{
+    return (a->index == b->index && a->storage == b->storage);
+}
+
+/* Concat references are only 8 or 16 bits wide, so two senders may well use
+ * the same one at the same time; parts are only merged if both match. */
+static gchar *
+build_multipart_key (guint reference,
+                     const gchar *sender)
+{
+    return g_strdup_printf ("%u/%s", reference, sender ? sender : "");
+}
+
+static void
+sms_entry_free (SmsEntry *entry)
+{
+    g_slist_free_full (entry->part_keys, g_free);
+    g_free (entry->multipart_key);
+    g_free (entry->path);
+    g_object_unref (entry->sms);
+    g_free (entry);
+}
+
+static SmsEntry *
+list_add (MMSmsList *self,
+          MMSms *sms,
+          gchar *multipart_key,
+          gboolean unindexed)
+{
+    SmsEntry *entry;
+
+    entry = g_new0 (SmsEntry, 1);
+    entry->sms = sms;
+    entry->path = g_strdup (mm_sms_get_path (sms));
+    entry->multipart_key = multipart_key;
+    entry->unindexed = unindexed;
+
+    self->priv->list = g_list_prepend (self->priv->list, entry);
+    entry->link = self->priv->list;
+    self->priv->count++;
+
+    if (entry->path)
+        g_hash_table_insert (self->priv->by_path, entry->path, entry);
+    if (entry->multipart_key)
+        g_hash_table_insert (self->priv->by_multipart, entry->multipart_key, entry);
+    if (entry->unindexed)
+        self->priv->unindexed = g_list_prepend (self->priv->unindexed, entry);
+
+    return entry;
+}
+
+static void
+list_index_part (MMSmsList *self,
+                 SmsEntry *entry,
+                 MMSmsStorage storage,
+                 guint index)
+{
+    PartKey *key;
+
+    key = g_new (PartKey, 1);
+    key->storage = storage;
+    key->index = index;
+    entry->part_keys = g_slist_prepend (entry->part_keys, key);
+    g_hash_table_insert (self->priv->by_part, key, entry);
+}
+
+static void
+list_remove (MMSmsList *self,
+             SmsEntry *entry)
+{
+    GSList *l;
+
+    for (l = entry->part_keys; l; l = g_slist_next (l))
+        g_hash_table_remove (self->priv->by_part, l->data);
+    if (entry->multipart_key)
+        g_hash_table_remove (self->priv->by_multipart, entry->multipart_key);
+    if (entry->path)
+        g_hash_table_remove (self->priv->by_path, entry->path);
+    if (entry->unindexed)
+        self->priv->unindexed = g_list_remove (self->priv->unindexed, entry);
+
+    self->priv->list = g_list_delete_link (self->priv->list, entry->link);
+    self->priv->count--;
+    sms_entry_free (entry);
+}
+
+static gboolean
+list_has_part (MMSmsList *self,
+               MMSmsStorage storage,
+               guint index)
+{
+    PartKey key;
+    GList *l;
+
+    key.storage = storage;
+    key.index = index;
+    if (g_hash_table_lookup (self->priv->by_part, &key))
+        return TRUE;
+
+    for (l = self->priv->unindexed; l; l = g_list_next (l)) {
+        MMSms *sms = ((SmsEntry *)l->data)->sms;
+
+        if (mm_sms_get_storage (sms) == storage &&
+            mm_sms_has_part_index (sms, index))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
 /*****************************************************************************/
 
 guint
 mm_sms_list_get_count (MMSmsList *self)
 {
-    return g_list_length (self->priv->list);
+    return self->priv->count;
 }
 
 GStrv
@@ -68,14 +212,13 @@ mm_sms_list_get_paths (MMSmsList *self)
     GList *l;
     guint i;
 
-    path_list = g_new0 (gchar *,
-                        1 + g_list_length (self->priv->list));
+    path_list = g_new0 (gchar *, 1 + self->priv->count);
 
     for (i = 0, l = self->priv->list; l; l = g_list_next (l)) {
         const gchar *path;
 
         /* Don't try to add NULL paths (not yet exported SMS objects) */
-        path = mm_sms_get_path (MM_SMS (l->data));
+        path = ((SmsEntry *)l->data)->path;
         if (path)
             path_list[i++] = g_strdup (path);
     }
@@ -109,20 +252,13 @@ mm_sms_list_delete_sms_finish (MMSmsList *self,
     return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
 }
 
-static guint
-cmp_sms_by_path (MMSms *sms,
-                 const gchar *path)
-{
-    return g_strcmp0 (mm_sms_get_path (sms), path);
-}
-
 static void
 delete_ready (MMSms *sms,
               GAsyncResult *res,
               DeleteSmsContext *ctx)
 {
     GError *error = NULL;
-    GList *l;
+    SmsEntry *entry;
 
     if (!mm_sms_delete_finish (sms, res, &error)) {
         /* We report the error */
@@ -132,13 +268,9 @@ delete_ready (MMSms *sms,
     }
 
     /* The SMS was properly deleted, we now remove it from our list */
-    l = g_list_find_custom (ctx->self->priv->list,
-                            ctx->path,
-                            (GCompareFunc)cmp_sms_by_path);
-    if (l) {
-        g_object_unref (MM_SMS (l->data));
-        ctx->self->priv->list = g_list_delete_link (ctx->self->priv->list, l);
-    }
+    entry = g_hash_table_lookup (ctx->self->priv->by_path, ctx->path);
+    if (entry)
+        list_remove (ctx->self, entry);
 
     /* We don't need to unref the SMS any more, but we can use the
      * reference we got in the method, which is the one kept alive
@@ -160,12 +292,10 @@ mm_sms_list_delete_sms (MMSmsList *self,
                         gpointer user_data)
 {
     DeleteSmsContext *ctx;
-    GList *l;
+    SmsEntry *entry;
 
-    l = g_list_find_custom (self->priv->list,
-                            (gpointer)sms_path,
-                            (GCompareFunc)cmp_sms_by_path);
-    if (!l) {
+    entry = g_hash_table_lookup (self->priv->by_path, sms_path);
+    if (!entry) {
         g_simple_async_report_error_in_idle (G_OBJECT (self),
                                              callback,
                                              user_data,
@@ -185,7 +315,7 @@ mm_sms_list_delete_sms (MMSmsList *self,
                                              user_data,
                                              mm_sms_list_delete_sms);
 
-    mm_sms_delete (MM_SMS (l->data),
+    mm_sms_delete (entry->sms,
                    (GAsyncReadyCallback)delete_ready,
                    ctx);
 }
@@ -196,34 +326,11 @@ void
 mm_sms_list_add_sms (MMSmsList *self,
                      MMSms *sms)
 {
-    self->priv->list = g_list_prepend (self->priv->list, g_object_ref (sms));
+    list_add (self, g_object_ref (sms), NULL, TRUE);
 }
 
 /*****************************************************************************/
 
-static guint
-cmp_sms_by_concat_reference (MMSms *sms,
-                             gpointer user_data)
-{
-    if (!mm_sms_is_multipart (sms))
-        return -1;
-
-    return (GPOINTER_TO_UINT (user_data) - mm_sms_get_multipart_reference (sms));
-}
-
-typedef struct {
-    guint part_index;
-    MMSmsStorage storage;
-} PartIndexAndStorage;
-
-static guint
-cmp_sms_by_part_index_and_storage (MMSms *sms,
-                                   PartIndexAndStorage *ctx)
-{
-    return !(mm_sms_get_storage (sms) == ctx->storage &&
-             mm_sms_has_part_index (sms, ctx->part_index));
-}
-
 static gboolean
 take_singlepart (MMSmsList *self,
                  MMSmsPart *part,
@@ -231,8 +338,11 @@ take_singlepart (MMSmsList *self,
                  MMSmsStorage storage,
                  GError **error)
 {
+    SmsEntry *entry;
     MMSms *sms;
+    guint index;
 
+    index = mm_sms_part_get_index (part);
     sms = mm_sms_singlepart_new (self->priv->modem,
                                  state,
                                  storage,
@@ -241,9 +351,10 @@ take_singlepart (MMSmsList *self,
     if (!sms)
         return FALSE;
 
-    self->priv->list = g_list_prepend (self->priv->list, sms);
+    entry = list_add (self, sms, NULL, FALSE);
+    list_index_part (self, entry, storage, index);
     g_signal_emit (self, signals[SIGNAL_ADDED], 0,
-                   mm_sms_get_path (sms),
+                   entry->path,
                    state == MM_SMS_STATE_RECEIVED);
     return TRUE;
 }
@@ -255,17 +366,24 @@ take_multipart (MMSmsList *self,
                 MMSmsStorage storage,
                 GError **error)
 {
-    GList *l;
+    SmsEntry *entry;
     MMSms *sms;
     guint concat_reference;
+    guint index;
+    gchar *key;
 
+    index = mm_sms_part_get_index (part);
     concat_reference = mm_sms_part_get_concat_reference (part);
-    l = g_list_find_custom (self->priv->list,
-                            GUINT_TO_POINTER (concat_reference),
-                            (GCompareFunc)cmp_sms_by_concat_reference);
-    if (l)
+    key = build_multipart_key (concat_reference, mm_sms_part_get_number (part));
+    entry = g_hash_table_lookup (self->priv->by_multipart, key);
+    if (entry) {
+        g_free (key);
         /* Try to take the part */
-        return mm_sms_multipart_take_part (MM_SMS (l->data), part, error);
+        if (!mm_sms_multipart_take_part (entry->sms, part, error))
+            return FALSE;
+        list_index_part (self, entry, storage, index);
+        return TRUE;
+    }
 
     /* Create new Multipart */
     sms = mm_sms_multipart_new (self->priv->modem,
@@ -275,8 +393,10 @@ take_multipart (MMSmsList *self,
                                 mm_sms_part_get_concat_max (part),
                                 part,
                                 error);
-    if (!sms)
+    if (!sms) {
+        g_free (key);
         return FALSE;
+    }
 
     /* We do export uncomplete multipart messages, in order to be able to
      *  request removal of all parts of those multipart SMS that will never
@@ -285,9 +405,10 @@ take_multipart (MMSmsList *self,
      *  interface.*/
     mm_sms_export (sms);
 
-    self->priv->list = g_list_prepend (self->priv->list, sms);
+    entry = list_add (self, sms, key, FALSE);
+    list_index_part (self, entry, storage, index);
     g_signal_emit (self, signals[SIGNAL_ADDED], 0,
-                   mm_sms_get_path (sms),
+                   entry->path,
                    (state == MM_SMS_STATE_RECEIVED ||
                     state == MM_SMS_STATE_RECEIVING));
 
@@ -301,15 +422,8 @@ mm_sms_list_take_part (MMSmsList *self,
                        MMSmsStorage storage,
                        GError **error)
 {
-    PartIndexAndStorage ctx;
-
-    ctx.part_index = mm_sms_part_get_index (part);
-    ctx.storage = storage;
-
     /* Ensure we don't have already taken a part with the same index */
-    if (g_list_find_custom (self->priv->list,
-                            &ctx,
-                            (GCompareFunc)cmp_sms_by_part_index_and_storage)) {
+    if (list_has_part (self, storage, mm_sms_part_get_index (part))) {
         g_set_error (error,
                      MM_CORE_ERROR,
                      MM_CORE_ERROR_FAILED,
@@ -381,6 +495,11 @@ mm_sms_list_init (MMSmsList *self)
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE ((self),
                                               MM_TYPE_SMS_LIST,
                                               MMSmsListPrivate);
+
+    self->priv->by_path = g_hash_table_new (g_str_hash, g_str_equal);
+    self->priv->by_multipart = g_hash_table_new (g_str_hash, g_str_equal);
+    self->priv->by_part = g_hash_table_new ((GHashFunc)part_key_hash,
+                                            (GEqualFunc)part_key_equal);
 }
 
 static void
@@ -389,11 +508,32 @@ dispose (GObject *object)
     MMSmsList *self = MM_SMS_LIST (object);
 
     g_clear_object (&self->priv->modem);
-    g_list_free_full (self->priv->list, (GDestroyNotify)g_object_unref);
+
+    /* Entries own the keys, so drop the indexes first */
+    g_hash_table_remove_all (self->priv->by_part);
+    g_hash_table_remove_all (self->priv->by_multipart);
+    g_hash_table_remove_all (self->priv->by_path);
+    g_list_free (self->priv->unindexed);
+    self->priv->unindexed = NULL;
+    g_list_free_full (self->priv->list, (GDestroyNotify)sms_entry_free);
+    self->priv->list = NULL;
+    self->priv->count = 0;
 
     G_OBJECT_CLASS (mm_sms_list_parent_class)->dispose (object);
 }
 
+static void
+finalize (GObject *object)
+{
+    MMSmsList *self = MM_SMS_LIST (object);
+
+    g_hash_table_destroy (self->priv->by_part);
+    g_hash_table_destroy (self->priv->by_multipart);
+    g_hash_table_destroy (self->priv->by_path);
+
+    G_OBJECT_CLASS (mm_sms_list_parent_class)->finalize (object);
+}
+
 static void
 mm_sms_list_class_init (MMSmsListClass *klass)
 {
@@ -405,6 +545,7 @@ mm_sms_list_class_init (MMSmsListClass *klass)
     object_class->get_property = get_property;
     object_class->set_property = set_property;
     object_class->dispose = dispose;
+    object_class->finalize = finalize;
 
     /* Properties */
     properties[PROP_MODEM] =
@@ -58,6 +58,13 @@
 #define SMS_TIMESTAMP_LEN 7
 #define SMS_MIN_PDU_LEN (7 + SMS_TIMESTAMP_LEN)
 
+/* Text limits per part, in septets for GSM and octets for UCS2; parts of a
+ * multipart message lose 6 octets to the concatenation header */
+#define SMS_MAX_GSM7_LEN         160
+#define SMS_MAX_UCS2_LEN         140
+#define SMS_MAX_CONCAT_GSM7_LEN  153
+#define SMS_MAX_CONCAT_UCS2_LEN  134
+
 typedef enum {
     MM_SMS_ENCODING_UNKNOWN = 0x0,
     MM_SMS_ENCODING_GSM7,
@@ -252,7 +259,7 @@ sms_decode_text (const guint8 *text, int len, SmsEncoding encoding, int bit_offs
         utf8 = (char *) mm_charset_gsm_unpacked_to_utf8 (unpacked, unpacked_len);
         g_free (unpacked);
     } else if (encoding == MM_SMS_ENCODING_UCS2)
-        utf8 = g_convert ((char *) text, len, "UTF8", "UCS-2BE", NULL, NULL, NULL);
+        utf8 = mm_charset_ucs2be_to_utf8 (text, len);
     else {
         g_warn_if_reached ();
         utf8 = g_strdup ("");
@@ -401,7 +408,7 @@ mm_sms_part_new_from_pdu (guint index,
     guint smsc_addr_num_octets, variable_length_items, msg_start_offset,
             sender_addr_num_digits, sender_addr_num_octets,
             tp_pid_offset, tp_dcs_offset, user_data_offset, user_data_len,
-            user_data_len_offset, bit_offset;
+            user_data_len_offset, user_data_num_octets, bit_offset;
     SmsEncoding user_data_encoding;
     GByteArray *raw;
 
@@ -416,7 +423,7 @@ mm_sms_part_new_from_pdu (guint index,
     }
 
     /* SMSC, in address format, precedes the TPDU */
-    smsc_addr_num_octets = pdu[0];
+    smsc_addr_num_octets = pdu_len > 0 ? pdu[0] : 0;
     variable_length_items = smsc_addr_num_octets;
     if (pdu_len < variable_length_items + SMS_MIN_PDU_LEN) {
         g_set_error (error,
@@ -440,11 +447,12 @@ mm_sms_part_new_from_pdu (guint index,
     sender_addr_num_octets = (sender_addr_num_digits + 1) >> 1;
     variable_length_items += sender_addr_num_octets;
     if (pdu_len < variable_length_items + SMS_MIN_PDU_LEN) {
-        *error = g_error_new (MM_CORE_ERROR,
-                              MM_CORE_ERROR_FAILED,
-                              "PDU too short (2): %zd < %d",
-                              pdu_len,
-                              variable_length_items + SMS_MIN_PDU_LEN);
+        g_set_error (error,
+                     MM_CORE_ERROR,
+                     MM_CORE_ERROR_FAILED,
+                     "PDU too short (2): %zd < %d",
+                     pdu_len,
+                     variable_length_items + SMS_MIN_PDU_LEN);
         g_free (pdu);
         return NULL;
     }
@@ -458,9 +466,10 @@ mm_sms_part_new_from_pdu (guint index,
     user_data_encoding = sms_encoding_type(pdu[tp_dcs_offset]);
 
     if (user_data_encoding == MM_SMS_ENCODING_GSM7)
-        variable_length_items += (7 * (user_data_len + 1 )) / 8;
+        user_data_num_octets = (7 * (user_data_len + 1 )) / 8;
     else
-        variable_length_items += user_data_len;
+        user_data_num_octets = user_data_len;
+    variable_length_items += user_data_num_octets;
 
     if (pdu_len < variable_length_items + SMS_MIN_PDU_LEN) {
         g_set_error (error,
@@ -486,8 +495,9 @@ mm_sms_part_new_from_pdu (guint index,
 
     /* Create the new MMSmsPart */
     sms_part = mm_sms_part_new (index);
-    mm_sms_part_take_smsc (sms_part,
-                           sms_decode_address (&pdu[1], 2 * (pdu[0] - 1)));
+    if (smsc_addr_num_octets > 0)
+        mm_sms_part_take_smsc (sms_part,
+                               sms_decode_address (&pdu[1], 2 * (smsc_addr_num_octets - 1)));
     mm_sms_part_take_number (sms_part,
                              sms_decode_address (&pdu[msg_start_offset + 2],
                                                  pdu[msg_start_offset + 1]));
@@ -496,15 +506,31 @@ mm_sms_part_new_from_pdu (guint index,
 
     bit_offset = 0;
     if (pdu[msg_start_offset] & SMS_TP_UDHI) {
-        int udhl, end, offset;
-        udhl = pdu[user_data_offset] + 1;
+        guint udhl, end, offset, header_len;
+
+        /* The header must fit in the user data */
+        udhl = user_data_num_octets > 0 ? pdu[user_data_offset] + 1 : 0;
+        if (udhl == 0 || udhl > user_data_num_octets) {
+            g_set_error (error,
+                         MM_CORE_ERROR,
+                         MM_CORE_ERROR_FAILED,
+                         "Invalid user data header length: %u > %u",
+                         udhl,
+                         user_data_num_octets);
+            mm_sms_part_free (sms_part);
+            g_free (pdu);
+            return NULL;
+        }
         end = user_data_offset + udhl;
 
-        for (offset = user_data_offset + 1; offset < end;) {
+        /* IEs not fully within the header are ignored */
+        for (offset = user_data_offset + 1; offset + 2 <= end;) {
             guint8 ie_id, ie_len;
 
             ie_id = pdu[offset++];
             ie_len = pdu[offset++];
+            if (offset + ie_len > end)
+                break;
 
             switch (ie_id) {
                 case 0x00:
@@ -513,7 +539,8 @@ mm_sms_part_new_from_pdu (guint index,
                      *  - it claims to be part 0 of M
                      *  - it claims to be part N of M, N > M
                      */
-                    if (pdu[offset + 2] == 0 ||
+                    if (ie_len < 3 ||
+                        pdu[offset + 2] == 0 ||
                         pdu[offset + 2] > pdu[offset + 1])
                         break;
 
@@ -526,7 +553,8 @@ mm_sms_part_new_from_pdu (guint index,
                     break;
                 case 0x08:
                     /* Concatenated short message, 16-bit reference */
-                    if (pdu[offset + 3] == 0 ||
+                    if (ie_len < 4 ||
+                        pdu[offset + 3] == 0 ||
                         pdu[offset + 3] > pdu[offset + 2])
                         break;
 
@@ -547,15 +575,17 @@ mm_sms_part_new_from_pdu (guint index,
          * decoded into garbage text.
          */
         user_data_offset += udhl;
+        user_data_num_octets -= udhl;
         if (user_data_encoding == MM_SMS_ENCODING_GSM7) {
             /*
              * Find the number of bits we need to add to the length of the
              * user data to get a multiple of 7 (the padding).
              */
             bit_offset = (7 - udhl % 7) % 7;
-            user_data_len -= (udhl * 8 + bit_offset) / 7;
+            header_len = (udhl * 8 + bit_offset) / 7;
         } else
-            user_data_len -= udhl;
+            header_len = udhl;
+        user_data_len = (header_len < user_data_len ? user_data_len - header_len : 0);
     }
 
     if (   user_data_encoding == MM_SMS_ENCODING_8BIT
@@ -569,12 +599,15 @@ mm_sms_part_new_from_pdu (guint index,
         mm_sms_part_take_text (sms_part,
                                sms_decode_text (&pdu[user_data_offset], user_data_len,
                                                 user_data_encoding, bit_offset));
-        g_warn_if_fail (sms_part->text != NULL);
+        if (!sms_part->text) {
+            mm_dbg ("Couldn't decode SMS text, ignoring it");
+            mm_sms_part_set_text (sms_part, "");
+        }
     }
 
-    /* Add the raw PDU data */
-    raw = g_byte_array_sized_new (user_data_len);
-    g_byte_array_append (raw, &pdu[user_data_offset], user_data_len);
+    /* Add the raw PDU data; the length is in septets for GSM */
+    raw = g_byte_array_sized_new (user_data_num_octets);
+    g_byte_array_append (raw, &pdu[user_data_offset], user_data_num_octets);
     mm_sms_part_take_data (sms_part, raw);
     mm_sms_part_set_data_coding_scheme (sms_part, pdu[tp_dcs_offset] & 0xFF);
 
@@ -673,6 +706,74 @@ validity_to_relative (guint validity)
     return 255; /* 63 weeks */
 }
 
+/**
+ * mm_sms_part_util_split_text:
+ *
+ * @text: the body of the message, in UTF-8
+ *
+ * Splits the text of a message in the chunks to be sent in each part, so that
+ * each of them fits in a PDU built by mm_sms_part_get_submit_pdu(). The same
+ * character set choice is made: UCS2 if there are characters which cannot be
+ * represented in the GSM one, GSM otherwise. Characters are never split.
+ *
+ * Returns: a %NULL-terminated array with one string per part, to be freed with
+ * g_strfreev().
+ **/
+gchar **
+mm_sms_part_util_split_text (const gchar *text)
+{
+    MMModemCharset cs = MM_MODEM_CHARSET_GSM;
+    guint gsm_unsupported = 0;
+    guint len, max;
+    GPtrArray *chunks;
+    const gchar *p, *start;
+
+    g_return_val_if_fail (text != NULL, NULL);
+
+    len = mm_charset_get_encoded_len (text, MM_MODEM_CHARSET_GSM, &gsm_unsupported);
+    max = SMS_MAX_GSM7_LEN;
+    if (gsm_unsupported > 0) {
+        cs = MM_MODEM_CHARSET_UCS2;
+        len = mm_charset_get_encoded_len (text, MM_MODEM_CHARSET_UCS2, NULL);
+        max = SMS_MAX_UCS2_LEN;
+    }
+
+    chunks = g_ptr_array_new ();
+
+    if (len <= max) {
+        g_ptr_array_add (chunks, g_strdup (text));
+        g_ptr_array_add (chunks, NULL);
+        return (gchar **) g_ptr_array_free (chunks, FALSE);
+    }
+
+    max = (cs == MM_MODEM_CHARSET_GSM ? SMS_MAX_CONCAT_GSM7_LEN : SMS_MAX_CONCAT_UCS2_LEN);
+    len = 0;
+    for (start = p = text; *p; p = g_utf8_next_char (p)) {
+        gchar c[7];
+        gsize clen;
+        guint enclen;
+
+        /* Encoded length of this single character; GSM extension
+         * characters take 2 septets */
+        clen = g_utf8_next_char (p) - p;
+        memcpy (c, p, clen);
+        c[clen] = '\0';
+        enclen = mm_charset_get_encoded_len (c, cs, NULL);
+
+        if (len + enclen > max) {
+            g_ptr_array_add (chunks, g_strndup (start, p - start));
+            start = p;
+            len = 0;
+        }
+        len += enclen;
+    }
+    if (p > start)
+        g_ptr_array_add (chunks, g_strndup (start, p - start));
+
+    g_ptr_array_add (chunks, NULL);
+    return (gchar **) g_ptr_array_free (chunks, FALSE);
+}
+
 /**
  * mm_sms_part_get_submit_pdu:
  *
@@ -687,9 +788,11 @@ validity_to_relative (guint validity)
  *  message starts (ie, skipping the SMSC length byte and address, if present)
  * @error: on error, filled with the error that occurred
  *
- * Constructs a single-part SMS message with the given details, preferring to
- * use the UCS2 character set when the message will fit, otherwise falling back
- * to the GSM character set.
+ * Constructs a SMS-SUBMIT PDU with the given details, preferring to use the
+ * UCS2 character set when the message will fit, otherwise falling back to the
+ * GSM character set. If the part belongs to a multipart message, a
+ * concatenation header is added, leaving less room for the text; see
+ * mm_sms_part_util_split_text().
  *
  * Returns: the constructed PDU data on success, or %NULL on error
  **/
@@ -704,14 +807,19 @@ mm_sms_part_get_submit_pdu (MMSmsPart *part,
     MMModemCharset best_cs = MM_MODEM_CHARSET_GSM;
     guint ucs2len = 0, gsm_unsupported = 0;
     guint textlen = 0;
+    guint max_gsm_len = SMS_MAX_GSM7_LEN;
+    guint max_ucs2_len = SMS_MAX_UCS2_LEN;
 
     g_return_val_if_fail (part->number != NULL, NULL);
     g_return_val_if_fail (part->text != NULL, NULL);
 
-    /* FIXME: support multiple fragments. */
+    if (part->should_concat) {
+        max_gsm_len = SMS_MAX_CONCAT_GSM7_LEN;
+        max_ucs2_len = SMS_MAX_CONCAT_UCS2_LEN;
+    }
 
     textlen = mm_charset_get_encoded_len (part->text, MM_MODEM_CHARSET_GSM, &gsm_unsupported);
-    if (textlen > 160) {
+    if (textlen > max_gsm_len) {
         g_set_error_literal (error,
                              MM_CORE_ERROR,
                              MM_CORE_ERROR_UNSUPPORTED,
@@ -725,7 +833,7 @@ mm_sms_part_get_submit_pdu (MMSmsPart *part,
      */
     if (gsm_unsupported > 0) {
         ucs2len = mm_charset_get_encoded_len (part->text, MM_MODEM_CHARSET_UCS2, NULL);
-        if (ucs2len <= 140) {
+        if (ucs2len <= max_ucs2_len) {
             best_cs = MM_MODEM_CHARSET_UCS2;
             textlen = ucs2len;
         }
@@ -757,6 +865,8 @@ mm_sms_part_get_submit_pdu (MMSmsPart *part,
     else
         pdu[offset] = 0;      /* TP-VP not present */
     pdu[offset++] |= 0x01;    /* TP-MTI = SMS-SUBMIT */
+    if (part->should_concat)
+        pdu[offset - 1] |= SMS_TP_UDHI;
 
     pdu[offset++] = 0x00;     /* TP-Message-Reference: filled by device */
 
@@ -783,8 +893,21 @@ mm_sms_part_get_submit_pdu (MMSmsPart *part,
     if (part->validity > 0)
         pdu[offset++] = validity_to_relative (part->validity);
 
-    /* TP-User-Data-Length */
-    pdu[offset++] = textlen;
+    /* TP-User-Data-Length, in septets for GSM, including the header */
+    if (part->should_concat)
+        pdu[offset++] = textlen + (best_cs == MM_MODEM_CHARSET_GSM ? 7 : 6);
+    else
+        pdu[offset++] = textlen;
+
+    /* Concatenation header: 8-bit reference IE */
+    if (part->should_concat) {
+        pdu[offset++] = 0x05; /* UDHL */
+        pdu[offset++] = 0x00; /* IEI: concatenated, 8-bit reference */
+        pdu[offset++] = 0x03; /* IEDL */
+        pdu[offset++] = part->concat_reference & 0xFF;
+        pdu[offset++] = part->concat_max;
+        pdu[offset++] = part->concat_sequence;
+    }
 
     if (best_cs == MM_MODEM_CHARSET_GSM) {
         guint8 *unpacked, *packed;
@@ -800,7 +923,8 @@ mm_sms_part_get_submit_pdu (MMSmsPart *part,
             goto error;
         }
 
-        packed = gsm_pack (unpacked, unlen, 0, &packlen);
+        /* After the 6-octet header, one fill bit aligns text to a septet */
+        packed = gsm_pack (unpacked, unlen, part->should_concat ? 1 : 0, &packlen);
         g_free (unpacked);
         if (!packed || packlen == 0) {
             g_free (packed);
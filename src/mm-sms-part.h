@@ -94,6 +94,8 @@ void              mm_sms_part_set_concat_sequence    (MMSmsPart *part,
 
 gboolean          mm_sms_part_should_concat          (MMSmsPart *part);
 
+gchar           **mm_sms_part_util_split_text        (const gchar *text);
+
 /* For testcases only */
 guint mm_sms_part_encode_address (const gchar *address,
                                   guint8 *buf,
@@ -0,0 +1,728 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include <ModemManager.h>
+#include <libmm-common.h>
+
+#include "mm-sms-send-queue.h"
+#include "mm-base-modem-at.h"
+#include "mm-log.h"
+
+/* Timeout of each send command, in seconds */
+#define SEND_TIMEOUT 10
+
+/* Messages waiting longer than this are sent first, whatever their class;
+ * the tests use a shorter wait */
+#ifndef MAX_WAIT_USEC
+#define MAX_WAIT_USEC (30 * G_USEC_PER_SEC)
+#endif
+
+/* Length of the window used to compute the rate */
+#define RATE_WINDOW_USEC (60 * G_USEC_PER_SEC)
+
+/* Weight of the last sample in the average latency */
+#define LATENCY_EWMA_WEIGHT 0.125
+
+/* Priority of the idle building the commands of deferred messages; below
+ * the one of the port I/O, so that sending goes on meanwhile */
+#define PREPARE_PRIORITY G_PRIORITY_DEFAULT_IDLE
+
+G_DEFINE_TYPE (MMSmsSendQueue, mm_sms_send_queue, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_MODEM,
+    PROP_LAST
+};
+static GParamSpec *properties[PROP_LAST];
+
+typedef struct {
+    MMSmsSendQueue *self;
+    GSimpleAsyncResult *result;
+    MMSmsSendPriority priority;
+    guint n_parts;
+    /* Commands to send; NULL while being prepared */
+    GPtrArray *commands;
+    guint next;
+    /* Preparation */
+    MMSmsSendQueuePrepareFn prepare;
+    gpointer data;
+    GDestroyNotify data_free;
+    /* Timing, monotonic */
+    gint64 submitted;
+    gint64 started;
+} Job;
+
+struct _MMSmsSendQueuePrivate {
+    /* The owner modem */
+    MMBaseModem *modem;
+    /* Jobs waiting, one queue per priority class */
+    GQueue waiting[MM_SMS_SEND_PRIORITY_LAST];
+    /* Jobs whose commands are still to be built, in submission order */
+    GQueue preparing;
+    guint prepare_id;
+    /* Job being sent */
+    Job *current;
+    gboolean shut_down;
+    /* +CMMS handling */
+    gboolean cmms_enabled;
+    gboolean cmms_unsupported;
+    /* Metrics */
+    guint pending;
+    guint pending_parts;
+    guint sent;
+    guint failed;
+    guint parts_sent;
+    gdouble latency_avg_ms;
+    guint latency_max_ms;
+    gint64 rate_window_start;
+    guint rate_window_parts;
+    gdouble parts_per_minute;
+    /* Load balancing */
+    MMSmsSendQueueBalanceFn balance_func;
+    gpointer balance_user_data;
+};
+
+static void queue_process (MMSmsSendQueue *self);
+static void job_send_next (Job *job);
+
+/*****************************************************************************/
+
+static void
+job_free (Job *job)
+{
+    if (job->commands)
+        g_ptr_array_unref (job->commands);
+    if (job->data && job->data_free)
+        job->data_free (job->data);
+    g_object_unref (job->result);
+    g_object_unref (job->self);
+    g_slice_free (Job, job);
+}
+
+static void
+update_rate (MMSmsSendQueue *self,
+             gint64 now)
+{
+    gint64 elapsed;
+
+    elapsed = now - self->priv->rate_window_start;
+    if (elapsed < RATE_WINDOW_USEC)
+        return;
+
+    self->priv->parts_per_minute = (self->priv->rate_window_parts * 60.0 * G_USEC_PER_SEC) / elapsed;
+    self->priv->rate_window_start = now;
+    self->priv->rate_window_parts = 0;
+}
+
+static void
+job_complete (Job *job,
+              GError *error)
+{
+    MMSmsSendQueue *self = job->self;
+    gint64 now;
+    guint latency_ms;
+
+    now = g_get_monotonic_time ();
+    latency_ms = (guint) ((now - job->submitted) / 1000);
+
+    g_assert (self->priv->pending > 0);
+    self->priv->pending--;
+    self->priv->pending_parts -= (job->n_parts - MIN (job->next, job->n_parts));
+
+    if (error) {
+        self->priv->failed++;
+        mm_dbg ("(%s) couldn't send SMS (%u/%u parts sent): '%s'",
+                mm_base_modem_get_device (self->priv->modem),
+                job->next, job->n_parts,
+                error->message);
+        g_simple_async_result_take_error (job->result, error);
+    } else {
+        self->priv->sent++;
+        if (self->priv->sent == 1)
+            self->priv->latency_avg_ms = latency_ms;
+        else
+            self->priv->latency_avg_ms += LATENCY_EWMA_WEIGHT * (latency_ms - self->priv->latency_avg_ms);
+        self->priv->latency_max_ms = MAX (self->priv->latency_max_ms, latency_ms);
+
+        update_rate (self, now);
+        mm_dbg ("(%s) SMS sent: %u parts in %u ms (%u ms queued); "
+                "%u sent, %u failed, %u pending, avg %u ms, max %u ms, %.1f parts/min",
+                mm_base_modem_get_device (self->priv->modem),
+                job->n_parts,
+                latency_ms,
+                (guint) ((job->started - job->submitted) / 1000),
+                self->priv->sent,
+                self->priv->failed,
+                self->priv->pending,
+                (guint) self->priv->latency_avg_ms,
+                self->priv->latency_max_ms,
+                self->priv->parts_per_minute);
+        g_simple_async_result_set_op_res_gboolean (job->result, TRUE);
+    }
+
+    g_simple_async_result_complete_in_idle (job->result);
+    job_free (job);
+}
+
+/*****************************************************************************/
+
+static gboolean
+more_parts_queued (MMSmsSendQueue *self)
+{
+    guint i;
+
+    for (i = 0; i < MM_SMS_SEND_PRIORITY_LAST; i++) {
+        if (!g_queue_is_empty (&self->priv->waiting[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void
+command_ready (MMBaseModem *modem,
+               GAsyncResult *res,
+               Job *job)
+{
+    MMSmsSendQueue *self = job->self;
+    GError *error = NULL;
+
+    g_assert (self->priv->current == job);
+
+    mm_base_modem_at_command_finish (modem, res, &error);
+    if (error) {
+        self->priv->current = NULL;
+        job_complete (job, error);
+        queue_process (self);
+        return;
+    }
+
+    job->next++;
+    self->priv->pending_parts--;
+    self->priv->parts_sent++;
+    self->priv->rate_window_parts++;
+
+    if (job->next < job->commands->len) {
+        job_send_next (job);
+        return;
+    }
+
+    self->priv->current = NULL;
+    job_complete (job, NULL);
+    queue_process (self);
+}
+
+static void
+cmms_ready (MMBaseModem *modem,
+            GAsyncResult *res,
+            Job *job)
+{
+    MMSmsSendQueue *self = job->self;
+    GError *error = NULL;
+
+    mm_base_modem_at_command_finish (modem, res, &error);
+    if (error) {
+        /* Not fatal, parts are just sent with the default link handling */
+        mm_dbg ("(%s) couldn't keep the SMS relay link open: '%s'",
+                mm_base_modem_get_device (self->priv->modem),
+                error->message);
+        g_error_free (error);
+        self->priv->cmms_unsupported = TRUE;
+    } else
+        self->priv->cmms_enabled = TRUE;
+
+    job_send_next (job);
+}
+
+static void
+job_send_next (Job *job)
+{
+    MMSmsSendQueue *self = job->self;
+
+    /* When more parts follow, ask the modem to keep the relay link open
+     * between them instead of setting it up for each one. Mode 2 keeps it
+     * enabled after the link times out, so this is only needed once. */
+    if (!self->priv->cmms_enabled &&
+        !self->priv->cmms_unsupported &&
+        (job->next + 1 < job->commands->len || more_parts_queued (self))) {
+        mm_base_modem_at_command (self->priv->modem,
+                                  "+CMMS=2",
+                                  3,
+                                  FALSE,
+                                  (GAsyncReadyCallback)cmms_ready,
+                                  job);
+        return;
+    }
+
+    mm_base_modem_at_command (self->priv->modem,
+                              g_ptr_array_index (job->commands, job->next),
+                              SEND_TIMEOUT,
+                              FALSE,
+                              (GAsyncReadyCallback)command_ready,
+                              job);
+}
+
+static void
+cmms_disable_ready (MMBaseModem *modem,
+                    GAsyncResult *res,
+                    MMSmsSendQueue *self)
+{
+    GError *error = NULL;
+
+    mm_base_modem_at_command_finish (modem, res, &error);
+    if (error) {
+        mm_dbg ("(%s) couldn't release the SMS relay link: '%s'",
+                mm_base_modem_get_device (modem),
+                error->message);
+        g_error_free (error);
+    }
+    g_object_unref (self);
+}
+
+/* The batch is over: let the modem close the relay link as usual */
+static void
+cmms_disable (MMSmsSendQueue *self)
+{
+    if (!self->priv->cmms_enabled)
+        return;
+
+    self->priv->cmms_enabled = FALSE;
+    mm_base_modem_at_command (self->priv->modem,
+                              "+CMMS=0",
+                              3,
+                              FALSE,
+                              (GAsyncReadyCallback)cmms_disable_ready,
+                              g_object_ref (self));
+}
+
+static Job *
+queue_pick (MMSmsSendQueue *self)
+{
+    GQueue *oldest = NULL;
+    GQueue *best = NULL;
+    Job *job;
+    gint64 now;
+    guint i;
+
+    now = g_get_monotonic_time ();
+    for (i = 0; i < MM_SMS_SEND_PRIORITY_LAST; i++) {
+        GQueue *queue = &self->priv->waiting[i];
+
+        /* Only jobs already prepared can be taken; they are usually ready
+         * long before their turn comes */
+        job = g_queue_peek_head (queue);
+        if (!job || !job->commands)
+            continue;
+
+        if (!best)
+            best = queue;
+        if (now - job->submitted > MAX_WAIT_USEC &&
+            (!oldest || job->submitted < ((Job *)g_queue_peek_head (oldest))->submitted))
+            oldest = queue;
+    }
+
+    if (oldest)
+        return g_queue_pop_head (oldest);
+    if (best)
+        return g_queue_pop_head (best);
+    return NULL;
+}
+
+static void
+queue_process (MMSmsSendQueue *self)
+{
+    Job *job;
+
+    if (self->priv->current || self->priv->shut_down)
+        return;
+
+    job = queue_pick (self);
+    if (!job) {
+        /* Keep the link while messages are still being prepared */
+        if (!more_parts_queued (self))
+            cmms_disable (self);
+        return;
+    }
+
+    self->priv->current = job;
+    job->started = g_get_monotonic_time ();
+    job_send_next (job);
+}
+
+/*****************************************************************************/
+
+static Job *
+job_new (MMSmsSendQueue *self,
+         MMSmsSendPriority priority,
+         guint n_parts,
+         GAsyncReadyCallback callback,
+         gpointer user_data)
+{
+    Job *job;
+
+    g_assert (priority < MM_SMS_SEND_PRIORITY_LAST);
+
+    job = g_slice_new0 (Job);
+    job->self = g_object_ref (self);
+    job->result = g_simple_async_result_new (G_OBJECT (self),
+                                             callback,
+                                             user_data,
+                                             mm_sms_send_queue_submit);
+    job->priority = priority;
+    job->n_parts = n_parts;
+    job->submitted = g_get_monotonic_time ();
+    return job;
+}
+
+static gboolean
+job_enqueue (Job *job)
+{
+    MMSmsSendQueue *self = job->self;
+
+    if (self->priv->shut_down) {
+        g_simple_async_result_set_error (job->result,
+                                         MM_CORE_ERROR,
+                                         MM_CORE_ERROR_WRONG_STATE,
+                                         "Cannot send SMS: messaging is disabled");
+        g_simple_async_result_complete_in_idle (job->result);
+        job_free (job);
+        return FALSE;
+    }
+
+    self->priv->pending++;
+    self->priv->pending_parts += job->n_parts;
+    g_queue_push_tail (&self->priv->waiting[job->priority], job);
+    return TRUE;
+}
+
+static void
+job_prepare (Job *job)
+{
+    MMSmsSendQueue *self = job->self;
+    GError *error = NULL;
+
+    job->commands = job->prepare (job->data, &error);
+    if (job->data && job->data_free)
+        job->data_free (job->data);
+    job->data = NULL;
+
+    if (job->commands && job->commands->len != job->n_parts) {
+        g_set_error (&error,
+                     MM_CORE_ERROR,
+                     MM_CORE_ERROR_FAILED,
+                     "Expected %u commands to send SMS, got %u",
+                     job->n_parts, job->commands->len);
+    }
+
+    if (error) {
+        g_queue_remove (&self->priv->waiting[job->priority], job);
+        job_complete (job, error);
+    }
+}
+
+/* Commands are built in the main loop, as encoding uses the charset
+ * converters which aren't thread-safe; one message per idle run, so that
+ * large batches don't hold the main loop */
+static gboolean
+prepare_idle_cb (MMSmsSendQueue *self)
+{
+    gboolean more;
+    Job *job;
+
+    /* Failed jobs drop their reference on the queue */
+    g_object_ref (self);
+
+    job = g_queue_pop_head (&self->priv->preparing);
+    if (job) {
+        job_prepare (job);
+        queue_process (self);
+    }
+
+    more = !g_queue_is_empty (&self->priv->preparing);
+    if (!more)
+        self->priv->prepare_id = 0;
+
+    g_object_unref (self);
+    return more;
+}
+
+void
+mm_sms_send_queue_submit (MMSmsSendQueue *self,
+                          MMSmsSendPriority priority,
+                          GPtrArray *commands,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+    Job *job;
+
+    g_return_if_fail (MM_IS_SMS_SEND_QUEUE (self));
+    g_return_if_fail (commands != NULL && commands->len > 0);
+
+    job = job_new (self, priority, commands->len, callback, user_data);
+    job->commands = commands;
+    if (job_enqueue (job))
+        queue_process (self);
+}
+
+void
+mm_sms_send_queue_submit_deferred (MMSmsSendQueue *self,
+                                   MMSmsSendPriority priority,
+                                   guint n_parts,
+                                   MMSmsSendQueuePrepareFn prepare,
+                                   gpointer data,
+                                   GDestroyNotify data_free,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+    Job *job;
+
+    g_return_if_fail (MM_IS_SMS_SEND_QUEUE (self));
+    g_return_if_fail (prepare != NULL);
+    g_return_if_fail (n_parts > 0);
+
+    job = job_new (self, priority, n_parts, callback, user_data);
+    job->prepare = prepare;
+    job->data = data;
+    job->data_free = data_free;
+
+    /* Queued right away, so that it counts in the load of the queue while
+     * the commands are being built */
+    if (!job_enqueue (job))
+        return;
+
+    g_queue_push_tail (&self->priv->preparing, job);
+    if (!self->priv->prepare_id)
+        self->priv->prepare_id = g_idle_add_full (PREPARE_PRIORITY,
+                                                  (GSourceFunc)prepare_idle_cb,
+                                                  self,
+                                                  NULL);
+}
+
+gboolean
+mm_sms_send_queue_submit_finish (MMSmsSendQueue *self,
+                                 GAsyncResult *res,
+                                 GError **error)
+{
+    return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
+}
+
+/*****************************************************************************/
+
+void
+mm_sms_send_queue_shutdown (MMSmsSendQueue *self)
+{
+    guint i;
+
+    g_return_if_fail (MM_IS_SMS_SEND_QUEUE (self));
+
+    if (self->priv->shut_down)
+        return;
+    self->priv->shut_down = TRUE;
+
+    if (self->priv->prepare_id) {
+        g_source_remove (self->priv->prepare_id);
+        self->priv->prepare_id = 0;
+    }
+    g_queue_clear (&self->priv->preparing);
+
+    for (i = 0; i < MM_SMS_SEND_PRIORITY_LAST; i++) {
+        Job *job;
+
+        while ((job = g_queue_pop_head (&self->priv->waiting[i])) != NULL)
+            job_complete (job,
+                          g_error_new (MM_CORE_ERROR,
+                                       MM_CORE_ERROR_ABORTED,
+                                       "SMS sending aborted: messaging is disabled"));
+    }
+}
+
+gboolean
+mm_sms_send_queue_is_shut_down (MMSmsSendQueue *self)
+{
+    g_return_val_if_fail (MM_IS_SMS_SEND_QUEUE (self), TRUE);
+
+    return self->priv->shut_down;
+}
+
+void
+mm_sms_send_queue_get_stats (MMSmsSendQueue *self,
+                             MMSmsSendQueueStats *stats)
+{
+    gint64 now, elapsed;
+
+    g_return_if_fail (MM_IS_SMS_SEND_QUEUE (self));
+    g_return_if_fail (stats != NULL);
+
+    now = g_get_monotonic_time ();
+    update_rate (self, now);
+
+    stats->pending = self->priv->pending;
+    stats->pending_parts = self->priv->pending_parts;
+    stats->sent = self->priv->sent;
+    stats->failed = self->priv->failed;
+    stats->parts_sent = self->priv->parts_sent;
+    stats->latency_avg_ms = (guint) self->priv->latency_avg_ms;
+    stats->latency_max_ms = self->priv->latency_max_ms;
+
+    /* Until a whole window is over, estimate from the current one */
+    elapsed = now - self->priv->rate_window_start;
+    if (self->priv->parts_per_minute == 0.0 && elapsed > 0)
+        stats->parts_per_minute = (self->priv->rate_window_parts * 60.0 * G_USEC_PER_SEC) / elapsed;
+    else
+        stats->parts_per_minute = self->priv->parts_per_minute;
+}
+
+MMBaseModem *
+mm_sms_send_queue_peek_modem (MMSmsSendQueue *self)
+{
+    g_return_val_if_fail (MM_IS_SMS_SEND_QUEUE (self), NULL);
+
+    return self->priv->modem;
+}
+
+/*****************************************************************************/
+
+void
+mm_sms_send_queue_set_balance_func (MMSmsSendQueue *self,
+                                    MMSmsSendQueueBalanceFn func,
+                                    gpointer user_data)
+{
+    g_return_if_fail (MM_IS_SMS_SEND_QUEUE (self));
+
+    self->priv->balance_func = func;
+    self->priv->balance_user_data = user_data;
+}
+
+MMSmsSendQueue *
+mm_sms_send_queue_balance (MMSmsSendQueue *preferred,
+                           guint n_parts)
+{
+    MMSmsSendQueue *queue = NULL;
+
+    g_return_val_if_fail (MM_IS_SMS_SEND_QUEUE (preferred), NULL);
+
+    if (preferred->priv->balance_func)
+        queue = preferred->priv->balance_func (preferred,
+                                               n_parts,
+                                               preferred->priv->balance_user_data);
+    if (!queue)
+        queue = g_object_ref (preferred);
+    else if (queue != preferred)
+        mm_dbg ("SMS of %u parts from '%s' to be sent by '%s'",
+                n_parts,
+                mm_base_modem_get_device (preferred->priv->modem),
+                mm_base_modem_get_device (queue->priv->modem));
+
+    return queue;
+}
+
+/*****************************************************************************/
+
+MMSmsSendQueue *
+mm_sms_send_queue_new (MMBaseModem *modem)
+{
+    return g_object_new (MM_TYPE_SMS_SEND_QUEUE,
+                         MM_SMS_SEND_QUEUE_MODEM, modem,
+                         NULL);
+}
+
+static void
+set_property (GObject *object,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    MMSmsSendQueue *self = MM_SMS_SEND_QUEUE (object);
+
+    switch (prop_id) {
+    case PROP_MODEM:
+        g_clear_object (&self->priv->modem);
+        self->priv->modem = g_value_dup_object (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+get_property (GObject *object,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    MMSmsSendQueue *self = MM_SMS_SEND_QUEUE (object);
+
+    switch (prop_id) {
+    case PROP_MODEM:
+        g_value_set_object (value, self->priv->modem);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+mm_sms_send_queue_init (MMSmsSendQueue *self)
+{
+    guint i;
+
+    /* Initialize private data */
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              MM_TYPE_SMS_SEND_QUEUE,
+                                              MMSmsSendQueuePrivate);
+
+    for (i = 0; i < MM_SMS_SEND_PRIORITY_LAST; i++)
+        g_queue_init (&self->priv->waiting[i]);
+    g_queue_init (&self->priv->preparing);
+    self->priv->rate_window_start = g_get_monotonic_time ();
+}
+
+static void
+dispose (GObject *object)
+{
+    MMSmsSendQueue *self = MM_SMS_SEND_QUEUE (object);
+
+    /* Every job holds a reference, so there are none left here */
+    g_clear_object (&self->priv->modem);
+
+    G_OBJECT_CLASS (mm_sms_send_queue_parent_class)->dispose (object);
+}
+
+static void
+mm_sms_send_queue_class_init (MMSmsSendQueueClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (object_class, sizeof (MMSmsSendQueuePrivate));
+
+    /* Virtual methods */
+    object_class->get_property = get_property;
+    object_class->set_property = set_property;
+    object_class->dispose = dispose;
+
+    /* Properties */
+    properties[PROP_MODEM] =
+        g_param_spec_object (MM_SMS_SEND_QUEUE_MODEM,
+                             "Modem",
+                             "The Modem which owns this SMS send queue",
+                             MM_TYPE_BASE_MODEM,
+                             G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_MODEM, properties[PROP_MODEM]);
+}
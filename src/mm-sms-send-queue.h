@@ -0,0 +1,133 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_SMS_SEND_QUEUE_H
+#define MM_SMS_SEND_QUEUE_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "mm-base-modem.h"
+
+/*
+ * Outgoing SMS queue of a modem.
+ *
+ * Messages are submitted as the list of AT commands which send each of their
+ * parts, and the queue runs them one after the other. Commands may also be
+ * built by the queue itself from an idle, so that the PDUs of the next
+ * messages are encoded while the current one is being sent.
+ *
+ * Messages are taken by priority class, oldest first within each class; a
+ * message which has waited too long is taken before any other, so that bulk
+ * traffic is never starved. While there is more than one part to send, the
+ * modem is asked to keep the link to the SMSC open between them (+CMMS), and
+ * to handle it as usual again once the queue is empty.
+ *
+ * Every queue keeps delivery counters, latency and rate figures, which are
+ * logged as messages complete and used to balance the load among modems.
+ */
+
+#define MM_TYPE_SMS_SEND_QUEUE            (mm_sms_send_queue_get_type ())
+#define MM_SMS_SEND_QUEUE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MM_TYPE_SMS_SEND_QUEUE, MMSmsSendQueue))
+#define MM_SMS_SEND_QUEUE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  MM_TYPE_SMS_SEND_QUEUE, MMSmsSendQueueClass))
+#define MM_IS_SMS_SEND_QUEUE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MM_TYPE_SMS_SEND_QUEUE))
+#define MM_IS_SMS_SEND_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  MM_TYPE_SMS_SEND_QUEUE))
+#define MM_SMS_SEND_QUEUE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  MM_TYPE_SMS_SEND_QUEUE, MMSmsSendQueueClass))
+
+typedef struct _MMSmsSendQueue MMSmsSendQueue;
+typedef struct _MMSmsSendQueueClass MMSmsSendQueueClass;
+typedef struct _MMSmsSendQueuePrivate MMSmsSendQueuePrivate;
+
+#define MM_SMS_SEND_QUEUE_MODEM "sms-send-queue-modem"
+
+typedef enum {
+    MM_SMS_SEND_PRIORITY_HIGH = 0, /* messages with a short validity */
+    MM_SMS_SEND_PRIORITY_NORMAL,   /* single part messages */
+    MM_SMS_SEND_PRIORITY_BULK,     /* multipart messages */
+    MM_SMS_SEND_PRIORITY_LAST
+} MMSmsSendPriority;
+
+typedef struct {
+    guint pending;          /* messages queued or being sent */
+    guint pending_parts;
+    guint sent;
+    guint failed;
+    guint parts_sent;
+    guint latency_avg_ms;   /* from submission until the last part is sent */
+    guint latency_max_ms;
+    gdouble parts_per_minute;
+} MMSmsSendQueueStats;
+
+/* Run from an idle in the main loop; returns the array of commands to send,
+ * one per part, or NULL and sets @error. */
+typedef GPtrArray *(* MMSmsSendQueuePrepareFn) (gpointer data,
+                                                GError **error);
+
+/* Selects the queue where a message of @n_parts would be sent, given the one
+ * of the modem owning it; returns a new reference. */
+typedef MMSmsSendQueue *(* MMSmsSendQueueBalanceFn) (MMSmsSendQueue *preferred,
+                                                     guint n_parts,
+                                                     gpointer user_data);
+
+struct _MMSmsSendQueue {
+    GObject parent;
+    MMSmsSendQueuePrivate *priv;
+};
+
+struct _MMSmsSendQueueClass {
+    GObjectClass parent;
+};
+
+GType mm_sms_send_queue_get_type (void);
+
+MMSmsSendQueue *mm_sms_send_queue_new (MMBaseModem *modem);
+
+MMBaseModem *mm_sms_send_queue_peek_modem (MMSmsSendQueue *self);
+
+/* Takes ownership of @commands */
+void     mm_sms_send_queue_submit          (MMSmsSendQueue *self,
+                                            MMSmsSendPriority priority,
+                                            GPtrArray *commands,
+                                            GAsyncReadyCallback callback,
+                                            gpointer user_data);
+void     mm_sms_send_queue_submit_deferred (MMSmsSendQueue *self,
+                                            MMSmsSendPriority priority,
+                                            guint n_parts,
+                                            MMSmsSendQueuePrepareFn prepare,
+                                            gpointer data,
+                                            GDestroyNotify data_free,
+                                            GAsyncReadyCallback callback,
+                                            gpointer user_data);
+gboolean mm_sms_send_queue_submit_finish   (MMSmsSendQueue *self,
+                                            GAsyncResult *res,
+                                            GError **error);
+
+/* Fails every message not yet being sent; no more are accepted */
+void     mm_sms_send_queue_shutdown        (MMSmsSendQueue *self);
+gboolean mm_sms_send_queue_is_shut_down    (MMSmsSendQueue *self);
+
+void     mm_sms_send_queue_get_stats       (MMSmsSendQueue *self,
+                                            MMSmsSendQueueStats *stats);
+
+/* Load balancing among modems; without a balance function, messages are
+ * always sent by the modem owning the queue. */
+void            mm_sms_send_queue_set_balance_func (MMSmsSendQueue *self,
+                                                    MMSmsSendQueueBalanceFn func,
+                                                    gpointer user_data);
+MMSmsSendQueue *mm_sms_send_queue_balance          (MMSmsSendQueue *preferred,
+                                                    guint n_parts);
+
+#endif /* MM_SMS_SEND_QUEUE_H */
@@ -28,6 +28,7 @@
 #include "mm-iface-modem.h"
 #include "mm-iface-modem-messaging.h"
 #include "mm-sms.h"
+#include "mm-sms-send-queue.h"
 #include "mm-base-modem-at.h"
 #include "mm-base-modem.h"
 #include "mm-utils.h"
@@ -576,9 +577,12 @@ sms_store (MMSms *self,
 /*****************************************************************************/
 /* Send the SMS */
 
+/* Messages expiring before this many minutes are sent first */
+#define SHORT_VALIDITY_MINUTES 60
+
 typedef struct {
     MMSms *self;
-    MMBaseModem *modem;
+    MMSmsSendQueue *queue;
     GSimpleAsyncResult *result;
 } SmsSendContext;
 
@@ -587,7 +591,7 @@ sms_send_context_complete_and_free (SmsSendContext *ctx)
 {
     g_simple_async_result_complete_in_idle (ctx->result);
     g_object_unref (ctx->result);
-    g_object_unref (ctx->modem);
+    g_object_unref (ctx->queue);
     g_object_unref (ctx->self);
     g_free (ctx);
 }
@@ -600,64 +604,123 @@ sms_send_finish (MMSms *self,
     return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
 }
 
+static MMSmsSendPriority
+sms_get_send_priority (MMSms *self)
+{
+    MMSmsPart *part = (MMSmsPart *)self->priv->parts->data;
+    guint validity;
+
+    validity = mm_sms_part_get_validity (part);
+    if (validity > 0 && validity <= SHORT_VALIDITY_MINUTES)
+        return MM_SMS_SEND_PRIORITY_HIGH;
+    if (self->priv->parts->next)
+        return MM_SMS_SEND_PRIORITY_BULK;
+    return MM_SMS_SEND_PRIORITY_NORMAL;
+}
+
+typedef struct {
+    MMSms *self;
+    gboolean use_pdu_mode;
+} SmsEncodeData;
+
 static void
-send_generic_ready (MMBaseModem *modem,
+sms_encode_data_free (SmsEncodeData *data)
+{
+    g_object_unref (data->self);
+    g_slice_free (SmsEncodeData, data);
+}
+
+/* Run by the send queue from an idle, once the message's turn to be encoded
+ * comes */
+static GPtrArray *
+sms_encode_parts (SmsEncodeData *data,
+                  GError **error)
+{
+    GPtrArray *commands;
+    GList *l;
+
+    commands = g_ptr_array_new_with_free_func (g_free);
+    for (l = data->self->priv->parts; l; l = g_list_next (l)) {
+        gchar *cmd;
+
+        cmd = sms_get_store_or_send_command ((MMSmsPart *)l->data,
+                                             data->use_pdu_mode,
+                                             TRUE,
+                                             error);
+        if (!cmd) {
+            g_ptr_array_unref (commands);
+            return NULL;
+        }
+        g_ptr_array_add (commands, cmd);
+    }
+
+    return commands;
+}
+
+static void
+send_generic_ready (MMSmsSendQueue *queue,
                     GAsyncResult *res,
                     SmsSendContext *ctx)
 {
     GError *error = NULL;
 
-    mm_base_modem_at_command_finish (MM_BASE_MODEM (modem), res, &error);
-    if (error) {
+    if (!mm_sms_send_queue_submit_finish (queue, res, &error))
         g_simple_async_result_take_error (ctx->result, error);
-        sms_send_context_complete_and_free (ctx);
-        return;
-    }
-
-    g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
+    else
+        g_simple_async_result_set_op_res_gboolean (ctx->result, TRUE);
     sms_send_context_complete_and_free (ctx);
 }
 
 static void
 sms_send_generic (SmsSendContext *ctx)
 {
-    gchar *cmd;
-    GError *error = NULL;
-    gboolean use_pdu_mode = FALSE;
+    MMSmsSendQueue *queue;
+    SmsEncodeData *data;
+    guint n_parts;
+
+    n_parts = g_list_length (ctx->self->priv->parts);
+
+    /* The message may be sent by a less busy modem */
+    queue = mm_sms_send_queue_balance (ctx->queue, n_parts);
+    g_object_unref (ctx->queue);
+    ctx->queue = queue;
 
     /* Different ways to do it if on PDU or text mode */
-    g_object_get (ctx->self->priv->modem,
-                  MM_IFACE_MODEM_MESSAGING_SMS_PDU_MODE, &use_pdu_mode,
+    data = g_slice_new0 (SmsEncodeData);
+    data->self = g_object_ref (ctx->self);
+    g_object_get (mm_sms_send_queue_peek_modem (ctx->queue),
+                  MM_IFACE_MODEM_MESSAGING_SMS_PDU_MODE, &data->use_pdu_mode,
                   NULL);
 
-    cmd = sms_get_store_or_send_command ((MMSmsPart *)ctx->self->priv->parts->data,
-                                         use_pdu_mode,
-                                         FALSE,
-                                         &error);
-    if (!cmd) {
-        g_simple_async_result_take_error (ctx->result, error);
+    if (!data->use_pdu_mode && n_parts > 1) {
+        g_simple_async_result_set_error (ctx->result,
+                                         MM_CORE_ERROR,
+                                         MM_CORE_ERROR_UNSUPPORTED,
+                                         "Cannot send SMS with %u parts in text mode",
+                                         n_parts);
+        sms_encode_data_free (data);
         sms_send_context_complete_and_free (ctx);
         return;
     }
 
-    mm_base_modem_at_command (ctx->modem,
-                              cmd,
-                              10,
-                              FALSE,
-                              (GAsyncReadyCallback)send_generic_ready,
-                              ctx);
-    g_free (cmd);
+    mm_sms_send_queue_submit_deferred (ctx->queue,
+                                       sms_get_send_priority (ctx->self),
+                                       n_parts,
+                                       (MMSmsSendQueuePrepareFn)sms_encode_parts,
+                                       data,
+                                       (GDestroyNotify)sms_encode_data_free,
+                                       (GAsyncReadyCallback)send_generic_ready,
+                                       ctx);
 }
 
 static void
-send_from_storage_ready (MMBaseModem *modem,
+send_from_storage_ready (MMSmsSendQueue *queue,
                          GAsyncResult *res,
                          SmsSendContext *ctx)
 {
     GError *error = NULL;
 
-    mm_base_modem_at_command_finish (MM_BASE_MODEM (modem), res, &error);
-    if (error) {
+    if (!mm_sms_send_queue_submit_finish (queue, res, &error)) {
         mm_dbg ("Couldn't send SMS from storage: '%s'; trying generic send...",
                 error->message);
         g_error_free (error);
@@ -673,17 +736,18 @@ send_from_storage_ready (MMBaseModem *modem,
 static void
 sms_send_from_storage (SmsSendContext *ctx)
 {
-    gchar *cmd;
-
-    cmd = g_strdup_printf ("+CMSS=%d",
-                           mm_sms_part_get_index ((MMSmsPart *)ctx->self->priv->parts->data));
-    mm_base_modem_at_command (ctx->modem,
-                              cmd,
-                              10,
-                              FALSE,
+    GPtrArray *commands;
+
+    /* Always through the queue of the modem owning the storage */
+    commands = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (commands,
+                     g_strdup_printf ("+CMSS=%d",
+                                      mm_sms_part_get_index ((MMSmsPart *)ctx->self->priv->parts->data)));
+    mm_sms_send_queue_submit (ctx->queue,
+                              sms_get_send_priority (ctx->self),
+                              commands,
                               (GAsyncReadyCallback)send_from_storage_ready,
                               ctx);
-    g_free (cmd);
 }
 
 static void
@@ -692,16 +756,26 @@ sms_send (MMSms *self,
           gpointer user_data)
 {
     SmsSendContext *ctx;
+    MMSmsSendQueue *queue;
 
-    /* We currently support storing *only* single part SMS */
-    if (g_list_length (self->priv->parts) != 1) {
+    if (!self->priv->parts) {
         g_simple_async_report_error_in_idle (G_OBJECT (self),
                                              callback,
                                              user_data,
                                              MM_CORE_ERROR,
-                                             MM_CORE_ERROR_UNSUPPORTED,
-                                             "Cannot send SMS with %u parts",
-                                             g_list_length (self->priv->parts));
+                                             MM_CORE_ERROR_FAILED,
+                                             "Cannot send SMS without parts");
+        return;
+    }
+
+    queue = mm_iface_modem_messaging_peek_send_queue (MM_IFACE_MODEM_MESSAGING (self->priv->modem));
+    if (!queue) {
+        g_simple_async_report_error_in_idle (G_OBJECT (self),
+                                             callback,
+                                             user_data,
+                                             MM_CORE_ERROR,
+                                             MM_CORE_ERROR_WRONG_STATE,
+                                             "Cannot send SMS: messaging is not enabled");
         return;
     }
 
@@ -712,10 +786,11 @@ sms_send (MMSms *self,
                                              user_data,
                                              sms_send);
     ctx->self = g_object_ref (self);
-    ctx->modem = g_object_ref (self->priv->modem);
+    ctx->queue = g_object_ref (queue);
 
-    /* If the part is STORED, try to send from storage */
-    if (mm_sms_part_get_index ((MMSmsPart *)self->priv->parts->data) != SMS_PART_INVALID_INDEX)
+    /* If a single part is STORED, try to send from storage */
+    if (!self->priv->parts->next &&
+        mm_sms_part_get_index ((MMSmsPart *)self->priv->parts->data) != SMS_PART_INVALID_INDEX)
         sms_send_from_storage (ctx);
     else
         sms_send_generic (ctx);
@@ -876,14 +951,22 @@ assemble_sms (MMSms *self,
 {
     GList *l;
     gchar **textparts;
-    guint idx;
+    guint idx, first_idx;
     gchar *fulltext;
     MMSmsPart *first = NULL;
 
+    /* Concatenation sequence numbers start at 1; single part messages
+     * have none, so they use 0 */
+    first_idx = self->priv->is_multipart ? 1 : 0;
+
     /* Assemble text from all parts */
-    textparts = g_malloc0 ((1 + self->priv->max_parts) * sizeof (* textparts));
+    textparts = g_malloc0 ((2 + self->priv->max_parts) * sizeof (* textparts));
     for (l = self->priv->parts; l; l = g_list_next (l)) {
         idx = mm_sms_part_get_concat_sequence ((MMSmsPart *)l->data);
+        if (idx < first_idx || idx >= first_idx + self->priv->max_parts) {
+            mm_warn ("Invalid part index (%u) found, ignoring", idx);
+            continue;
+        }
         if (textparts[idx]) {
             mm_warn ("Duplicate part index (%u) found, ignoring", idx);
             continue;
@@ -892,12 +975,12 @@ assemble_sms (MMSms *self,
         textparts[idx] = (gchar *)mm_sms_part_get_text ((MMSmsPart *)l->data);
 
         /* If first in multipart, keep it for later */
-        if (idx == 0)
+        if (idx == first_idx)
             first = (MMSmsPart *)l->data;
     }
 
     /* Check if we have all parts */
-    for (idx = 0; idx < self->priv->max_parts; idx++) {
+    for (idx = first_idx; idx < first_idx + self->priv->max_parts; idx++) {
         if (!textparts[idx]) {
             g_set_error (error,
                          MM_CORE_ERROR,
@@ -913,7 +996,7 @@ assemble_sms (MMSms *self,
     g_assert (first != NULL);
 
     /* If we got everything, assemble the text! */
-    fulltext = g_strjoinv (NULL, textparts);
+    fulltext = g_strjoinv (NULL, &textparts[first_idx]);
     g_object_set (self,
                   "text",      fulltext,
                   "smsc",      mm_sms_part_get_smsc (first),
@@ -1087,7 +1170,11 @@ mm_sms_new_from_properties (MMBaseModem *modem,
                             MMSmsProperties *properties,
                             GError **error)
 {
+    static guint8 reference = 0;
     MMSmsPart *part;
+    MMSms *self;
+    gchar **chunks;
+    guint n_chunks, i;
 
     /* Don't create SMS from properties if either text or number is missing */
     if (!mm_sms_properties_get_text (properties) ||
@@ -1098,20 +1185,82 @@ mm_sms_new_from_properties (MMBaseModem *modem,
                      "Cannot create SMS: mandatory parameter '%s' is missing",
                      (mm_sms_properties_get_text (properties) == NULL ?
                       "text" : "number"));
+        return NULL;
     }
 
-    part = mm_sms_part_new (SMS_PART_INVALID_INDEX);
-    mm_sms_part_set_text (part, mm_sms_properties_get_text (properties));
-    mm_sms_part_set_number (part, mm_sms_properties_get_number (properties));
-    mm_sms_part_set_smsc (part, mm_sms_properties_get_smsc (properties));
-    mm_sms_part_set_validity (part, mm_sms_properties_get_validity (properties));
-    mm_sms_part_set_class (part, mm_sms_properties_get_class (properties));
-
-    return mm_sms_singlepart_new (modem,
-                                  MM_SMS_STATE_UNKNOWN,
-                                  MM_SMS_STORAGE_UNKNOWN, /* not stored anywhere yet */
-                                  part,
-                                  error);
+    /* Texts which don't fit in a single PDU are sent in several parts */
+    chunks = mm_sms_part_util_split_text (mm_sms_properties_get_text (properties));
+    n_chunks = g_strv_length (chunks);
+    if (n_chunks > 255) {
+        g_set_error (error,
+                     MM_CORE_ERROR,
+                     MM_CORE_ERROR_INVALID_ARGS,
+                     "Cannot create SMS: text too long (%u parts needed)",
+                     n_chunks);
+        g_strfreev (chunks);
+        return NULL;
+    }
+
+    if (n_chunks == 1) {
+        part = mm_sms_part_new (SMS_PART_INVALID_INDEX);
+        mm_sms_part_set_text (part, mm_sms_properties_get_text (properties));
+        mm_sms_part_set_number (part, mm_sms_properties_get_number (properties));
+        mm_sms_part_set_smsc (part, mm_sms_properties_get_smsc (properties));
+        mm_sms_part_set_validity (part, mm_sms_properties_get_validity (properties));
+        mm_sms_part_set_class (part, mm_sms_properties_get_class (properties));
+        g_strfreev (chunks);
+
+        return mm_sms_singlepart_new (modem,
+                                      MM_SMS_STATE_UNKNOWN,
+                                      MM_SMS_STORAGE_UNKNOWN, /* not stored anywhere yet */
+                                      part,
+                                      error);
+    }
+
+    /* Every multipart message we create gets its own 8-bit reference; the
+     * recipient only needs it to be unique among the recent ones */
+    if (reference == 0)
+        reference = g_random_int_range (1, 256);
+    else if (++reference == 0)
+        reference = 1;
+
+    self = NULL;
+    for (i = 0; i < n_chunks; i++) {
+        part = mm_sms_part_new (SMS_PART_INVALID_INDEX);
+        mm_sms_part_set_text (part, chunks[i]);
+        mm_sms_part_set_number (part, mm_sms_properties_get_number (properties));
+        mm_sms_part_set_smsc (part, mm_sms_properties_get_smsc (properties));
+        mm_sms_part_set_validity (part, mm_sms_properties_get_validity (properties));
+        mm_sms_part_set_class (part, mm_sms_properties_get_class (properties));
+        mm_sms_part_set_concat_reference (part, reference);
+        mm_sms_part_set_concat_max (part, n_chunks);
+        mm_sms_part_set_concat_sequence (part, i + 1);
+
+        if (!self) {
+            self = mm_sms_multipart_new (modem,
+                                         MM_SMS_STATE_UNKNOWN,
+                                         MM_SMS_STORAGE_UNKNOWN, /* not stored anywhere yet */
+                                         reference,
+                                         n_chunks,
+                                         part,
+                                         error);
+            if (!self) {
+                mm_sms_part_free (part);
+                break;
+            }
+        } else if (!mm_sms_multipart_take_part (self, part, error)) {
+            mm_sms_part_free (part);
+            g_clear_object (&self);
+            break;
+        }
+    }
+    g_strfreev (chunks);
+
+    /* Only export once properly created; all parts given, so assembled */
+    if (self)
+        mm_sms_export (self);
+
+    return self;
 }
 
 /*****************************************************************************/
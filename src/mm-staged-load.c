@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <glib.h>
+
+#include "mm-staged-load.h"
+
+gboolean
+mm_staged_load_request_deferred (MMStagedLoad *self,
+                                 gboolean usable)
+{
+    if (!usable)
+        return FALSE;
+
+    /* Values loaded meanwhile are skipped when running again, so a single
+     * extra run covers any number of requests */
+    if (self->running) {
+        self->again = TRUE;
+        return FALSE;
+    }
+
+    self->running = TRUE;
+    self->again = FALSE;
+    return TRUE;
+}
+
+gboolean
+mm_staged_load_deferred_done (MMStagedLoad *self,
+                              gboolean can_run_again)
+{
+    g_return_val_if_fail (self->running, FALSE);
+
+    if (self->again && can_run_again) {
+        self->again = FALSE;
+        return TRUE;
+    }
+
+    self->running = FALSE;
+    self->again = FALSE;
+    return FALSE;
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_STAGED_LOAD_H
+#define MM_STAGED_LOAD_H
+
+#include <glib.h>
+
+/*
+ * Loading of properties split in two stages: the one needed before an object
+ * gets exported, and a deferred one run in background afterwards. The
+ * deferred stage may be requested several times, e.g. each time the object
+ * gets initialized again; only one runs at a time, and requests arriving
+ * while it runs get it run once more when done.
+ */
+
+typedef struct {
+    gboolean running;
+    gboolean again;
+} MMStagedLoad;
+
+/* Returns TRUE if the deferred stage must be started now. Unusable objects
+ * don't load anything else. */
+gboolean mm_staged_load_request_deferred (MMStagedLoad *self,
+                                          gboolean usable);
+
+/* Returns TRUE if the deferred stage must be started again, if requested
+ * while running and 'can_run_again' */
+gboolean mm_staged_load_deferred_done    (MMStagedLoad *self,
+                                          gboolean can_run_again);
+
+#endif /* MM_STAGED_LOAD_H */
@@ -0,0 +1,347 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include "mm-timer-wheel.h"
+#include "mm-log.h"
+
+/* Ticks (seconds) covered by one revolution of the wheel; the tests build
+ * a smaller wheel so that it wraps quickly */
+#ifndef WHEEL_SLOTS
+#define WHEEL_SLOTS 64
+#endif
+
+/* Largest alignment applied to expiration times, in seconds */
+#define ALIGN_MAX_SEC 10
+
+typedef struct {
+    guint id;
+    gpointer owner;
+    guint interval;
+    guint64 expires;
+    GSourceFunc callback;
+    gpointer user_data;
+    /* Expired and not in any slot, until the current tick is processed */
+    gboolean dispatching;
+    gboolean removed;
+} Timer;
+
+typedef struct {
+    GList *slots[WHEEL_SLOTS];
+    /* id -> Timer */
+    GHashTable *timers;
+    guint next_id;
+    gint64 start;
+    /* Last tick processed */
+    guint64 current;
+    guint source_id;
+    guint64 source_tick;
+    guint budget;
+} Wheel;
+
+static Wheel *wheel;
+
+static void arm (void);
+
+/*****************************************************************************/
+
+static guint64
+now_tick (void)
+{
+    return (guint64) ((g_get_monotonic_time () - wheel->start) / G_USEC_PER_SEC);
+}
+
+static Wheel *
+get_wheel (void)
+{
+    if (G_UNLIKELY (!wheel)) {
+        wheel = g_new0 (Wheel, 1);
+        wheel->timers = g_hash_table_new (g_direct_hash, g_direct_equal);
+        wheel->next_id = 1;
+        wheel->start = g_get_monotonic_time ();
+        wheel->budget = MM_TIMER_WHEEL_DEFAULT_BUDGET;
+    }
+    return wheel;
+}
+
+/* Alignment for a given interval: 1, 2, 5 or 10 seconds, the largest one not
+ * above a sixth of the interval, so that the added delay stays small. */
+static guint
+align_quantum (guint interval)
+{
+    static const guint quanta[] = { ALIGN_MAX_SEC, 5, 2 };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (quanta); i++) {
+        if (quanta[i] * 6 <= interval)
+            return quanta[i];
+    }
+    return 1;
+}
+
+static void
+timer_schedule (Timer *timer,
+                guint64 from)
+{
+    guint64 expires;
+    guint quantum;
+
+    expires = from + MAX (timer->interval, 1);
+    quantum = align_quantum (timer->interval);
+    /* Align on absolute ticks, so that timers of other owners meet here */
+    expires = ((expires + quantum - 1) / quantum) * quantum;
+
+    timer->expires = expires;
+    wheel->slots[expires % WHEEL_SLOTS] = g_list_prepend (wheel->slots[expires % WHEEL_SLOTS], timer);
+}
+
+static void
+timer_unschedule (Timer *timer)
+{
+    guint slot = timer->expires % WHEEL_SLOTS;
+
+    wheel->slots[slot] = g_list_remove (wheel->slots[slot], timer);
+}
+
+static void
+timer_free (Timer *timer)
+{
+    g_hash_table_remove (wheel->timers, GUINT_TO_POINTER (timer->id));
+    g_slice_free (Timer, timer);
+}
+
+/*****************************************************************************/
+
+static gint
+timer_cmp (const Timer *a,
+           const Timer *b)
+{
+    if (a->expires != b->expires)
+        return a->expires < b->expires ? -1 : 1;
+    return a->id < b->id ? -1 : (a->id > b->id ? 1 : 0);
+}
+
+/* Takes out of the wheel the timers expired up to 'now', oldest first */
+static GList *
+collect_expired (guint64 now)
+{
+    GList *expired = NULL;
+    guint64 ticks;
+    guint64 t;
+
+    ticks = MIN (now - wheel->current, WHEEL_SLOTS);
+    for (t = 1; t <= ticks; t++) {
+        guint slot = (wheel->current + t) % WHEEL_SLOTS;
+        GList *l;
+        GList *next;
+
+        for (l = wheel->slots[slot]; l; l = next) {
+            Timer *timer = l->data;
+
+            next = g_list_next (l);
+            if (timer->expires <= now) {
+                wheel->slots[slot] = g_list_delete_link (wheel->slots[slot], l);
+                timer->dispatching = TRUE;
+                expired = g_list_prepend (expired, timer);
+            }
+        }
+    }
+    wheel->current = now;
+
+    return g_list_sort (expired, (GCompareFunc) timer_cmp);
+}
+
+static gboolean
+wheel_tick (gpointer unused)
+{
+    GHashTable *fired;
+    GList *expired;
+    GList *l;
+    guint64 now;
+    guint n_fired = 0;
+    guint n_delayed = 0;
+
+    wheel->source_id = 0;
+
+    now = now_tick ();
+    expired = collect_expired (now);
+    fired = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    for (l = expired; l; l = g_list_next (l)) {
+        Timer *timer = l->data;
+        guint count;
+
+        /* Removed by the callback of a previous timer */
+        if (timer->removed) {
+            timer_free (timer);
+            continue;
+        }
+
+        if (timer->owner && wheel->budget) {
+            count = GPOINTER_TO_UINT (g_hash_table_lookup (fired, timer->owner));
+            if (count >= wheel->budget) {
+                /* Owner already got its share, retry in the next tick */
+                timer->dispatching = FALSE;
+                timer->expires = now + 1;
+                wheel->slots[timer->expires % WHEEL_SLOTS] =
+                    g_list_prepend (wheel->slots[timer->expires % WHEEL_SLOTS], timer);
+                n_delayed++;
+                continue;
+            }
+            g_hash_table_insert (fired, timer->owner, GUINT_TO_POINTER (count + 1));
+        }
+
+        n_fired++;
+        if (timer->callback (timer->user_data) && !timer->removed) {
+            timer->dispatching = FALSE;
+            timer_schedule (timer, now);
+        } else
+            timer_free (timer);
+    }
+
+    g_hash_table_destroy (fired);
+    g_list_free (expired);
+
+    if (n_delayed)
+        mm_dbg ("Timer wheel: %u timers fired, %u delayed by owner budget",
+                n_fired, n_delayed);
+
+    arm ();
+    return FALSE;
+}
+
+/* Finds the tick of the closest expiration; the wheel is scanned for one
+ * revolution and only far away timers require looking at all of them. */
+static gboolean
+next_expiration (guint64 *tick)
+{
+    guint64 closest = G_MAXUINT64;
+    guint64 t;
+
+    for (t = 1; t <= WHEEL_SLOTS; t++) {
+        GList *l;
+
+        for (l = wheel->slots[(wheel->current + t) % WHEEL_SLOTS]; l; l = g_list_next (l)) {
+            Timer *timer = l->data;
+
+            if (timer->expires == wheel->current + t) {
+                *tick = timer->expires;
+                return TRUE;
+            }
+            closest = MIN (closest, timer->expires);
+        }
+    }
+
+    if (closest == G_MAXUINT64)
+        return FALSE;
+
+    *tick = closest;
+    return TRUE;
+}
+
+static void
+arm (void)
+{
+    guint64 tick;
+    gint64 deadline;
+    gint64 now;
+
+    if (!next_expiration (&tick)) {
+        /* Nothing left, don't wake up at all */
+        if (wheel->source_id) {
+            g_source_remove (wheel->source_id);
+            wheel->source_id = 0;
+        }
+        return;
+    }
+
+    if (wheel->source_id) {
+        if (wheel->source_tick <= tick)
+            return;
+        g_source_remove (wheel->source_id);
+    }
+
+    /* Wake up right at the tick boundary. g_timeout_add_seconds() would
+     * round to its own per-process second boundaries, adding up to one more
+     * tick of delay; wakeups are already grouped by the wheel itself. */
+    now = g_get_monotonic_time ();
+    deadline = wheel->start + (gint64) tick * G_USEC_PER_SEC;
+    wheel->source_tick = tick;
+    wheel->source_id = g_timeout_add (deadline > now ? (guint) ((deadline - now + 999) / 1000) : 0,
+                                      wheel_tick,
+                                      NULL);
+}
+
+/*****************************************************************************/
+
+guint
+mm_timer_wheel_add_seconds (gpointer owner,
+                            guint interval,
+                            GSourceFunc callback,
+                            gpointer user_data)
+{
+    Timer *timer;
+
+    g_return_val_if_fail (callback != NULL, 0);
+
+    get_wheel ();
+
+    timer = g_slice_new0 (Timer);
+    timer->id = wheel->next_id++;
+    if (G_UNLIKELY (!wheel->next_id))
+        wheel->next_id = 1;
+    timer->owner = owner;
+    timer->interval = interval;
+    timer->callback = callback;
+    timer->user_data = user_data;
+    g_hash_table_insert (wheel->timers, GUINT_TO_POINTER (timer->id), timer);
+
+    /* Count the interval from the next tick boundary, so that the timer
+     * never fires early */
+    if (!wheel->source_id)
+        wheel->current = MAX (wheel->current, now_tick ());
+    timer_schedule (timer, MAX (wheel->current, now_tick ()) + 1);
+
+    arm ();
+    return timer->id;
+}
+
+void
+mm_timer_wheel_remove (guint id)
+{
+    Timer *timer;
+
+    if (!wheel)
+        return;
+
+    timer = g_hash_table_lookup (wheel->timers, GUINT_TO_POINTER (id));
+    if (!timer)
+        return;
+
+    if (timer->dispatching) {
+        /* Freed once its callback returns */
+        timer->removed = TRUE;
+        return;
+    }
+
+    timer_unschedule (timer);
+    timer_free (timer);
+    arm ();
+}
+
+void
+mm_timer_wheel_set_budget (guint budget)
+{
+    get_wheel ()->budget = budget;
+}
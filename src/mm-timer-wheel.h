@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#ifndef MM_TIMER_WHEEL_H
+#define MM_TIMER_WHEEL_H
+
+#include <glib.h>
+
+/*
+ * Shared scheduler for the periodic work of all modems.
+ *
+ * Timers are kept in a single timing wheel with one second ticks, and a
+ * single main loop source is armed for the next tick with expired timers,
+ * so that there are no wakeups while nothing is due. Expiration times are
+ * aligned to multiples of a quantum which depends on the interval (at most
+ * a sixth of it, and never more than 10s), so that the checks of different
+ * modems fire together in the same wakeup.
+ *
+ * Timers are grouped by owner (usually the modem); at most 'budget' timers
+ * of the same owner fire in a single wakeup, the rest are delayed to the
+ * next tick so that a single modem doesn't get a burst of commands.
+ *
+ * Callbacks behave like GSourceFunc: return TRUE to run again after the
+ * same interval, FALSE to remove the timer.
+ */
+
+/* Timers of the same owner fired in a single wakeup, by default */
+#define MM_TIMER_WHEEL_DEFAULT_BUDGET 3
+
+guint mm_timer_wheel_add_seconds (gpointer owner,
+                                  guint interval,
+                                  GSourceFunc callback,
+                                  gpointer user_data);
+void  mm_timer_wheel_remove      (guint id);
+
+/* 0 means no limit */
+void  mm_timer_wheel_set_budget  (guint budget);
+
+#endif /* MM_TIMER_WHEEL_H */
@@ -0,0 +1,281 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Micro-benchmark of the unsolicited message dispatching in the AT port.
+ *
+ * A recorded storm of unsolicited messages, interleaved with command
+ * replies, is fed in small chunks both to the AT port and to the previous
+ * implementation, which ran every handler regex over the whole buffer after
+ * each read. The same set of handlers a broadband modem and some vendor
+ * plugins register is used in both cases.
+ *
+ * Usage: bench-at-unsolicited [ITERATIONS] [CHUNK SIZE]
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include "mm-at-serial-port.h"
+#include "mm-modem-helpers.h"
+#include "mm-log.h"
+
+static const gchar *vendor_patterns[] = {
+    "\\r\\n\\^RSSI:(\\d+)\\r\\n",
+    "\\r\\n\\^MODE:(\\d),(\\d)\\r\\n",
+    "\\r\\n\\^BOOT:.+\\r\\n",
+    "\\r\\n\\*CNTI:\\s*(\\d+)\\s*,\\s*(.*)\\r\\n",
+    "\\r\\n_OSSYSI:\\s*(\\d+)\\r\\n",
+    "\\r\\n_OCTI:\\s*(\\d+)\\r\\n",
+    "\\r\\n_OUWCTI:\\s*(\\d+)\\r\\n",
+    "\\r\\n_OSIGQ:\\s*(\\d+),(\\d)\\r\\n",
+    "\\r\\n\\+PACSP0\\r\\n",
+    "\\r\\n\\+CNSMOD:\\s*(\\d)\\r\\n",
+};
+
+static const gchar *storm =
+    "\r\n+CREG: 1,\"0AB3\",\"00D2E1F3\",2\r\n"
+    "\r\n^RSSI:14\r\n"
+    "\r\n+CGREG: 1,\"0AB3\",\"00D2E1F3\",2\r\n"
+    "\r\n^MODE:5,4\r\n"
+    "\r\n+CSQ: 18,99\r\n\r\nOK\r\n"
+    "\r\n^BOOT:12345678,0,0,0,72\r\n"
+    "\r\n+CIEV: signal,3\r\n"
+    "\r\n*CNTI: 0,UMTS\r\n"
+    "\r\n_OSSYSI: 2\r\n"
+    "\r\n+CMTI: \"SM\",3\r\n"
+    "\r\n_OCTI: 3\r\n"
+    "\r\n+COPS: 0,2,\"21403\",2\r\n\r\nOK\r\n"
+    "\r\n_OSIGQ: 20,0\r\n"
+    "\r\n+CUSD: 0,\"Your balance is 10.00\",15\r\n"
+    "\r\n^RSSI:15\r\n"
+    "\r\n+CREG: 5\r\n"
+    "\r\n+CNSMOD: 4\r\n"
+    "\r\n+PACSP0\r\n";
+
+static guint n_callbacks;
+
+static void
+unsolicited_received (MMAtSerialPort *port,
+                      GMatchInfo *match_info,
+                      gpointer user_data)
+{
+    n_callbacks++;
+}
+
+static GPtrArray *
+build_regexes (void)
+{
+    GPtrArray *regexes;
+    GPtrArray *creg;
+    guint i;
+
+    regexes = g_ptr_array_new_with_free_func ((GDestroyNotify) g_regex_unref);
+
+    creg = mm_3gpp_creg_regex_get (FALSE);
+    for (i = 0; i < creg->len; i++)
+        g_ptr_array_add (regexes, g_regex_ref (g_ptr_array_index (creg, i)));
+    mm_3gpp_creg_regex_destroy (creg);
+
+    g_ptr_array_add (regexes, mm_3gpp_ciev_regex_get ());
+    g_ptr_array_add (regexes, mm_3gpp_cmti_regex_get ());
+    g_ptr_array_add (regexes, mm_3gpp_cusd_regex_get ());
+
+    for (i = 0; i < G_N_ELEMENTS (vendor_patterns); i++)
+        g_ptr_array_add (regexes, g_regex_new (vendor_patterns[i],
+                                               G_REGEX_RAW | G_REGEX_OPTIMIZE,
+                                               0, NULL));
+    return regexes;
+}
+
+/*****************************************************************************/
+/* Reference implementation, running every regex over the whole buffer */
+
+static gboolean
+remove_eval_cb (const GMatchInfo *match_info,
+                GString *result,
+                gpointer user_data)
+{
+    int *result_len = (int *) user_data;
+    int start;
+    int end;
+
+    if (g_match_info_fetch_pos  (match_info, 0, &start, &end))
+        *result_len -= (end - start);
+
+    return FALSE;
+}
+
+static void
+regex_parse_unsolicited (GPtrArray *regexes, GByteArray *response)
+{
+    guint i;
+
+    for (i = 0; i < regexes->len; i++) {
+        GRegex *regex = g_ptr_array_index (regexes, i);
+        GMatchInfo *match_info;
+        gboolean matches;
+
+        matches = g_regex_match_full (regex,
+                                      (const char *) response->data,
+                                      response->len,
+                                      0, 0, &match_info, NULL);
+        while (g_match_info_matches (match_info)) {
+            unsolicited_received (NULL, match_info, NULL);
+            g_match_info_next (match_info, NULL);
+        }
+        g_match_info_free (match_info);
+
+        if (matches) {
+            char *str;
+            int result_len = response->len;
+
+            str = g_regex_replace_eval (regex,
+                                        (const char *) response->data,
+                                        response->len,
+                                        0, 0,
+                                        remove_eval_cb, &result_len, NULL);
+
+            g_byte_array_remove_range (response, 0, response->len);
+            g_byte_array_append (response, (const guint8 *) str, result_len);
+            g_free (str);
+        }
+    }
+}
+
+/*****************************************************************************/
+
+typedef void (*ParseUnsolicitedFn) (gpointer data, GByteArray *response);
+typedef void (*ResetFn)            (gpointer data);
+
+static void
+run_regex (gpointer data, GByteArray *response)
+{
+    regex_parse_unsolicited ((GPtrArray *) data, response);
+}
+
+static void
+run_port (gpointer data, GByteArray *response)
+{
+    MM_SERIAL_PORT_GET_CLASS (data)->parse_unsolicited (MM_SERIAL_PORT (data), response);
+}
+
+static void
+reset_port (gpointer data)
+{
+    MM_SERIAL_PORT_GET_CLASS (data)->response_trimmed (MM_SERIAL_PORT (data));
+}
+
+static gdouble
+run_storm (const gchar *name,
+           gpointer data,
+           ParseUnsolicitedFn parse,
+           ResetFn reset,
+           guint iterations,
+           guint chunk_size)
+{
+    GByteArray *response;
+    GTimer *timer;
+    gsize len;
+    guint i;
+    gdouble elapsed;
+
+    n_callbacks = 0;
+    len = strlen (storm);
+    response = g_byte_array_sized_new (len);
+    timer = g_timer_new ();
+
+    for (i = 0; i < iterations; i++) {
+        gsize offset = 0;
+
+        while (offset < len) {
+            gsize n = MIN (chunk_size, len - offset);
+
+            g_byte_array_append (response, (const guint8 *) storm + offset, n);
+            offset += n;
+            parse (data, response);
+        }
+
+        /* Whatever is left are command replies, drop them */
+        g_byte_array_set_size (response, 0);
+        if (reset)
+            reset (data);
+    }
+
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_print ("%-8s %9u messages: %8.3f s (%7.1f ns/byte)\n",
+             name, n_callbacks, elapsed,
+             (elapsed * 1e9) / ((gdouble) len * iterations));
+
+    g_timer_destroy (timer);
+    g_byte_array_unref (response);
+    return elapsed;
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    guint iterations = 5000;
+    guint chunk_size = 16;
+    GPtrArray *regexes;
+    MMAtSerialPort *port;
+    gdouble reference;
+    gdouble current;
+    guint i;
+
+    g_type_init ();
+
+    if (argc > 1)
+        iterations = (guint) atoi (argv[1]);
+    if (argc > 2)
+        chunk_size = MAX (1, atoi (argv[2]));
+
+    regexes = build_regexes ();
+    port = mm_at_serial_port_new ("ttyFAKE0");
+    for (i = 0; i < regexes->len; i++)
+        mm_at_serial_port_add_unsolicited_msg_handler (port,
+                                                       g_ptr_array_index (regexes, i),
+                                                       unsolicited_received,
+                                                       NULL,
+                                                       NULL);
+
+    g_print ("%u iterations over a %u byte storm, %u handlers, %u byte chunks\n",
+             iterations, (guint) strlen (storm), regexes->len, chunk_size);
+
+    reference = run_storm ("regex", regexes, run_regex, NULL, iterations, chunk_size);
+    current = run_storm ("current", port, run_port, reset_port, iterations, chunk_size);
+
+    if (current > 0.0)
+        g_print ("speedup: %.2fx\n", reference / current);
+
+    g_object_unref (port);
+    g_ptr_array_unref (regexes);
+    return 0;
+}
@@ -0,0 +1,211 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Micro-benchmark of the modem charset conversions.
+ *
+ * A corpus of strings like the ones exchanged with modems (operator names,
+ * USSD replies, phonebook entries, SMS texts) is converted to and from the
+ * hex representation of each charset, the way AT commands carry them, and
+ * then appended to a command buffer. The current code is compared against a
+ * reference which opens a new iconv descriptor with g_convert() for every
+ * string and goes through an intermediate binary copy, as it used to.
+ *
+ * Usage: bench-charsets [ITERATIONS]
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "mm-charsets.h"
+#include "mm-utils.h"
+
+static const gchar *corpus[] = {
+    "Vodafone ES",
+    "T-Mobile D",
+    "Orange F",
+    "Movistar",
+    "Telekom.de",
+    "Ihr Guthaben beträgt 12,50 EUR. Gültig bis 31.12.",
+    "Saldo: 5,00 €. Bono de 100 MB activo hasta el día 15.",
+    "Mamá",
+    "Müller, Jürgen",
+    "Åsa Ström",
+    "François",
+    "Hi! Are we still on for dinner tonight? Let me know, I can pick you up at 8.",
+    "Ça va? On se voit à la gare à 18h, n'oublie pas les billets :-)",
+    "Größe: 42, Farbe: grün, Preis: 19,99 €",
+};
+
+typedef struct {
+    MMModemCharset charset;
+    const gchar *name;
+    const gchar *iconv_name;
+} BenchCharset;
+
+static const BenchCharset charsets[] = {
+    { MM_MODEM_CHARSET_UCS2,    "UCS2",    "UCS-2BE" },
+    { MM_MODEM_CHARSET_GSM,     "GSM",     NULL },
+    { MM_MODEM_CHARSET_8859_1,  "8859-1",  "ISO8859-1" },
+    { MM_MODEM_CHARSET_PCCP437, "PCCP437", "CP437" },
+};
+
+/*****************************************************************************/
+/* Reference, one g_convert() per string */
+
+static gchar *
+reference_utf8_to_hex (const gchar *utf8, const BenchCharset *cs)
+{
+    gchar *converted, *hex;
+    gsize len = 0;
+
+    if (!cs->iconv_name) {
+        guint32 gsm_len = 0;
+
+        converted = (gchar *) mm_charset_utf8_to_unpacked_gsm (utf8, &gsm_len);
+        len = gsm_len;
+    } else
+        converted = g_convert (utf8, -1, cs->iconv_name, "UTF-8//TRANSLIT", NULL, &len, NULL);
+    if (!converted)
+        return NULL;
+
+    hex = utils_bin2hexstr ((const guint8 *) converted, len);
+    g_free (converted);
+    return hex;
+}
+
+static gchar *
+reference_hex_to_utf8 (const gchar *hex, const BenchCharset *cs)
+{
+    gchar *bin, *utf8;
+    gsize len = 0;
+
+    bin = utils_hexstr2bin (hex, &len);
+    if (!bin)
+        return NULL;
+
+    if (!cs->iconv_name)
+        utf8 = (gchar *) mm_charset_gsm_unpacked_to_utf8 ((const guint8 *) bin, len);
+    else
+        utf8 = g_convert (bin, len, "UTF-8//TRANSLIT", cs->iconv_name, NULL, NULL, NULL);
+    g_free (bin);
+    return utf8;
+}
+
+static gboolean
+reference_byte_array_append (GByteArray *array, const gchar *utf8, const BenchCharset *cs)
+{
+    gchar *converted, *translit;
+    gsize len = 0;
+
+    if (!cs->iconv_name) {
+        guint32 gsm_len = 0;
+
+        converted = (gchar *) mm_charset_utf8_to_unpacked_gsm (utf8, &gsm_len);
+        len = gsm_len;
+    } else {
+        translit = g_strdup_printf ("%s//TRANSLIT", cs->iconv_name);
+        converted = g_convert (utf8, -1, translit, "UTF-8", NULL, &len, NULL);
+        g_free (translit);
+    }
+    if (!converted)
+        return FALSE;
+
+    g_byte_array_append (array, (const guint8 *) "\"", 1);
+    g_byte_array_append (array, (const guint8 *) converted, len);
+    g_byte_array_append (array, (const guint8 *) "\"", 1);
+    g_free (converted);
+    return TRUE;
+}
+
+/*****************************************************************************/
+
+static gsize
+run_corpus (const BenchCharset *cs, gboolean reference, GByteArray *command)
+{
+    gsize bytes = 0;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (corpus); i++) {
+        gchar *hex, *utf8;
+
+        hex = reference ?
+            reference_utf8_to_hex (corpus[i], cs) :
+            mm_modem_charset_utf8_to_hex (corpus[i], cs->charset);
+        if (!hex)
+            continue;
+        utf8 = reference ?
+            reference_hex_to_utf8 (hex, cs) :
+            mm_modem_charset_hex_to_utf8 (hex, cs->charset);
+        if (utf8) {
+            g_byte_array_set_size (command, 0);
+            if (reference)
+                reference_byte_array_append (command, utf8, cs);
+            else
+                mm_modem_charset_byte_array_append (command, utf8, TRUE, cs->charset);
+            bytes += strlen (utf8);
+        }
+        g_free (hex);
+        g_free (utf8);
+    }
+    return bytes;
+}
+
+static void
+run_charset (const BenchCharset *cs, guint iterations)
+{
+    GByteArray *command;
+    gint pass;
+
+    command = g_byte_array_sized_new (512);
+
+    for (pass = 0; pass < 2; pass++) {
+        gboolean reference = (pass == 1);
+        GTimer *timer;
+        gsize bytes = 0;
+        gdouble elapsed;
+        guint i;
+
+        timer = g_timer_new ();
+        for (i = 0; i < iterations; i++)
+            bytes += run_corpus (cs, reference, command);
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_timer_destroy (timer);
+
+        g_print ("%-8s %-10s %8.0f ns/string %8.1f MiB/s\n",
+                 cs->name,
+                 reference ? "g_convert" : "cached",
+                 elapsed * 1e9 / (iterations * G_N_ELEMENTS (corpus)),
+                 bytes / elapsed / (1024.0 * 1024.0));
+    }
+
+    g_byte_array_free (command, TRUE);
+}
+
+int main (int argc, char **argv)
+{
+    guint iterations = 20000;
+    guint i;
+
+    if (argc > 1)
+        iterations = MAX (1, atoi (argv[1]));
+
+    for (i = 0; i < G_N_ELEMENTS (charsets); i++)
+        run_charset (&charsets[i], iterations);
+
+    return 0;
+}
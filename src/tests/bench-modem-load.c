@@ -0,0 +1,541 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Load generator for the serial port stack, against simulated modems.
+ *
+ * modem-simulator is started with the given number of modems, and the ports
+ * of all of them are then driven at once from a single main loop, the way
+ * the daemon does when modems show up together: each modem is probed (AT
+ * and QCDM), initialized and enabled with the commands sent to a generic
+ * modem, and then polled for signal quality and registration until the end
+ * of the run. The daemon itself only takes ports reported by udev, so the
+ * ports are driven here through the same MMAtSerialPort and MMQcdmSerialPort
+ * objects.
+ *
+ * Reported are the time to probe and to enable the modems, the rate of AT
+ * commands while polling, and the latency of the main loop, measured as how
+ * late a 10 ms timeout gets to run.
+ *
+ * Usage: bench-modem-load [MODEMS] [SECONDS] [-- SIMULATOR OPTIONS]
+ *
+ * The simulator is looked for next to this program, and runs with the
+ * modem-simulator-gsm.sim script unless another one is given in the
+ * simulator options; e.g. '-- --latency 20 --urc-interval 100 --urc-burst 5'
+ * or '-- --fault-rate 1 --faults drop,error,garble'.
+ *
+ * Unless faults are injected, any failed command makes it exit with an error,
+ * and so does a run not over a minute after it should; 'make check' runs it
+ * shortly with a few modems.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include <ModemManager.h>
+#include <mm-errors-types.h>
+
+#include "mm-at-serial-port.h"
+#include "mm-qcdm-serial-port.h"
+#include "mm-serial-parsers.h"
+#include "libqcdm/src/commands.h"
+#include "mm-log.h"
+
+#define LATENCY_TICK_MS 10
+
+/* Time allowed for probing and enabling, on top of the polling time */
+#define WATCHDOG_EXTRA_SECONDS 60
+
+static const gchar *probe_commands[] = {
+    "AT", "+CGMI", "+CGMM", NULL
+};
+
+static const gchar *enable_commands[] = {
+    "Z E0 V1", "+CMEE=1", "X4 &C1", "+GCAP", "+CGMI", "+CGMM", "+CGMR",
+    "+CGSN", "+CPIN?", "+CFUN=1", "+IFC=1,1", "+CSCS=?", "+CSCS=\"UCS2\"",
+    "+CIND=?", "+CMER=3,0,0,1", "+CREG=2", "+CGREG=2", "+CNMI=?", "+CPMS=?",
+    "+CNMI=2,1,2,1,0", "+COPS=3,2;+COPS?", "+CREG?", "+CGREG?", "+CSQ", NULL
+};
+
+static const gchar *poll_commands[] = {
+    "+CSQ", "+CREG?", "+CGREG?", "+COPS=3,2;+COPS?", NULL
+};
+
+typedef enum {
+    PHASE_PROBE,
+    PHASE_ENABLE,
+    PHASE_POLL,
+    PHASE_DONE
+} Phase;
+
+typedef struct {
+    guint index;
+    MMAtSerialPort *at;
+    MMQcdmSerialPort *qcdm;
+    Phase phase;
+    guint step;
+    guint at_retries;
+    gboolean qcdm_pending;
+    gint64 start;
+    gint64 probe_us;
+    gint64 enable_us;
+    guint poll_commands;
+} Modem;
+
+typedef struct {
+    GPtrArray *modems;
+    guint running;
+    gint64 poll_deadline;
+    guint commands;
+    guint errors;
+    guint urcs;
+    GArray *latencies;
+    gint64 last_tick;
+} Context;
+
+static Context ctx;
+
+/*****************************************************************************/
+
+static void modem_next (Modem *modem);
+
+static void
+modem_finish_phase (Modem *modem)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (modem->phase == PHASE_PROBE) {
+        if (modem->qcdm_pending)
+            return;
+        modem->probe_us = now - modem->start;
+    } else if (modem->phase == PHASE_ENABLE)
+        modem->enable_us = now - modem->start - modem->probe_us;
+
+    modem->phase++;
+    modem->step = 0;
+    if (modem->phase == PHASE_DONE) {
+        ctx.running--;
+        return;
+    }
+    modem_next (modem);
+}
+
+static void
+at_response_cb (MMAtSerialPort *port,
+                GString *response,
+                GError *error,
+                Modem *modem)
+{
+    ctx.commands++;
+    if (error) {
+        ctx.errors++;
+        /* Probing retries AT on timeouts, as the port probe does */
+        if (modem->phase == PHASE_PROBE &&
+            modem->step == 0 &&
+            ++modem->at_retries < 3 &&
+            g_error_matches (error, MM_SERIAL_ERROR, MM_SERIAL_ERROR_RESPONSE_TIMEOUT)) {
+            modem_next (modem);
+            return;
+        }
+    }
+
+    /* Only once every modem is polling */
+    if (modem->phase == PHASE_POLL && ctx.poll_deadline != G_MAXINT64)
+        modem->poll_commands++;
+    modem->step++;
+    modem_next (modem);
+}
+
+static void
+qcdm_response_cb (MMQcdmSerialPort *port,
+                  GByteArray *response,
+                  GError *error,
+                  Modem *modem)
+{
+    if (error)
+        ctx.errors++;
+    modem->qcdm_pending = FALSE;
+    if (modem->phase == PHASE_PROBE && !probe_commands[modem->step])
+        modem_finish_phase (modem);
+}
+
+static void
+modem_next (Modem *modem)
+{
+    const gchar *command = NULL;
+
+    switch (modem->phase) {
+    case PHASE_PROBE:
+        command = probe_commands[modem->step];
+        break;
+    case PHASE_ENABLE:
+        command = enable_commands[modem->step];
+        break;
+    case PHASE_POLL:
+        if (g_get_monotonic_time () < ctx.poll_deadline)
+            command = poll_commands[modem->step % (G_N_ELEMENTS (poll_commands) - 1)];
+        break;
+    case PHASE_DONE:
+        return;
+    }
+
+    if (!command) {
+        modem_finish_phase (modem);
+        return;
+    }
+
+    mm_at_serial_port_queue_command (modem->at,
+                                     command,
+                                     3,
+                                     NULL,
+                                     (MMAtSerialResponseFn)at_response_cb,
+                                     modem);
+}
+
+static void
+urc_received (MMAtSerialPort *port,
+              GMatchInfo *match_info,
+              gpointer user_data)
+{
+    ctx.urcs++;
+}
+
+static gboolean
+modem_open_port (MMSerialPort *port)
+{
+    GError *error = NULL;
+
+    if (!mm_serial_port_open (port, &error)) {
+        g_printerr ("error: couldn't open %s: %s\n",
+                    mm_port_get_device (MM_PORT (port)),
+                    error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+modem_start (Modem *modem)
+{
+    modem->start = g_get_monotonic_time ();
+
+    if (modem->qcdm) {
+        GByteArray *verinfo;
+        gint len;
+
+        verinfo = g_byte_array_sized_new (50);
+        len = qcdm_cmd_version_info_new ((char *) verinfo->data, 50);
+        g_assert (len > 0);
+        verinfo->len = len;
+        modem->qcdm_pending = TRUE;
+        mm_qcdm_serial_port_queue_command (modem->qcdm,
+                                           verinfo,
+                                           3,
+                                           NULL,
+                                           (MMQcdmSerialResponseFn)qcdm_response_cb,
+                                           modem);
+    }
+
+    modem_next (modem);
+}
+
+static void
+modem_free (Modem *modem)
+{
+    if (modem->at) {
+        mm_serial_port_close (MM_SERIAL_PORT (modem->at));
+        g_object_unref (modem->at);
+    }
+    if (modem->qcdm) {
+        mm_serial_port_close (MM_SERIAL_PORT (modem->qcdm));
+        g_object_unref (modem->qcdm);
+    }
+    g_slice_free (Modem, modem);
+}
+
+/*****************************************************************************/
+
+static gboolean
+latency_tick (gpointer user_data)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 late;
+
+    late = now - ctx.last_tick - LATENCY_TICK_MS * 1000;
+    g_array_append_val (ctx.latencies, late);
+    ctx.last_tick = now;
+    return TRUE;
+}
+
+static gint
+compare_int64 (const gint64 *a,
+               const gint64 *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+static void
+report_times (const gchar *name,
+              gsize offset)
+{
+    gint64 total = 0, max = 0;
+    guint i;
+
+    for (i = 0; i < ctx.modems->len; i++) {
+        gint64 value = G_STRUCT_MEMBER (gint64, g_ptr_array_index (ctx.modems, i), offset);
+
+        total += value;
+        max = MAX (max, value);
+    }
+    g_print ("%-8s avg %8.1f ms   max %8.1f ms\n",
+             name,
+             total / 1000.0 / ctx.modems->len,
+             max / 1000.0);
+}
+
+static void
+report (gdouble poll_seconds)
+{
+    guint poll_commands = 0;
+    gint64 total = 0;
+    guint i, n;
+
+    report_times ("probe", G_STRUCT_OFFSET (Modem, probe_us));
+    report_times ("enable", G_STRUCT_OFFSET (Modem, enable_us));
+
+    for (i = 0; i < ctx.modems->len; i++)
+        poll_commands += ((Modem *) g_ptr_array_index (ctx.modems, i))->poll_commands;
+    g_print ("polling  %8.0f AT commands/s, %u modems, %u URCs, %u errors in %u commands\n",
+             poll_commands / poll_seconds,
+             ctx.modems->len,
+             ctx.urcs,
+             ctx.errors,
+             ctx.commands);
+
+    n = ctx.latencies->len;
+    if (n == 0)
+        return;
+    g_array_sort (ctx.latencies, (GCompareFunc)compare_int64);
+    for (i = 0; i < n; i++)
+        total += g_array_index (ctx.latencies, gint64, i);
+    g_print ("loop     avg %8.2f ms   p99 %8.2f ms   max %8.2f ms\n",
+             total / 1000.0 / n,
+             g_array_index (ctx.latencies, gint64, (n * 99) / 100) / 1000.0,
+             g_array_index (ctx.latencies, gint64, n - 1) / 1000.0);
+}
+
+/*****************************************************************************/
+
+/* Runs the simulator and reads the ports it created */
+static GPid
+start_simulator (const gchar *program_dir,
+                 guint n_modems,
+                 gchar **extra_args)
+{
+    GPtrArray *argv;
+    GIOChannel *channel;
+    GError *error = NULL;
+    GPid pid;
+    gint out_fd;
+    gboolean has_script = FALSE;
+    gchar *line = NULL;
+    guint i;
+
+    argv = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (argv, g_build_filename (program_dir, "modem-simulator", NULL));
+    g_ptr_array_add (argv, g_strdup_printf ("--modems=%u", n_modems));
+    for (i = 0; extra_args && extra_args[i]; i++) {
+        if (g_str_has_prefix (extra_args[i], "--script") ||
+            g_str_has_prefix (extra_args[i], "--capture"))
+            has_script = TRUE;
+        g_ptr_array_add (argv, g_strdup (extra_args[i]));
+    }
+    if (!has_script)
+        g_ptr_array_add (argv, g_strdup ("--script=" SIMULATOR_SCRIPT));
+    g_ptr_array_add (argv, NULL);
+
+    if (!g_spawn_async_with_pipes (NULL, (gchar **) argv->pdata, NULL, 0, NULL, NULL,
+                                   &pid, NULL, &out_fd, NULL, &error)) {
+        g_printerr ("error: couldn't run the simulator: %s\n", error->message);
+        exit (EXIT_FAILURE);
+    }
+    g_ptr_array_unref (argv);
+
+    channel = g_io_channel_unix_new (out_fd);
+    g_io_channel_set_close_on_unref (channel, TRUE);
+    while (g_io_channel_read_line (channel, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL) {
+        gchar **fields;
+        Modem *modem;
+        guint index;
+
+        g_strstrip (line);
+        if (g_str_equal (line, "READY")) {
+            g_free (line);
+            break;
+        }
+
+        /* INDEX TYPE NAME PATH */
+        fields = g_strsplit (line, " ", 4);
+        g_free (line);
+        if (g_strv_length (fields) != 4 || !g_str_has_prefix (fields[3], "/dev/")) {
+            g_strfreev (fields);
+            continue;
+        }
+
+        index = atoi (fields[0]);
+        while (ctx.modems->len <= index) {
+            modem = g_slice_new0 (Modem);
+            modem->index = ctx.modems->len;
+            g_ptr_array_add (ctx.modems, modem);
+        }
+        modem = g_ptr_array_index (ctx.modems, index);
+
+        /* Ports are opened as /dev/<device> */
+        if (g_str_equal (fields[1], "at") && !modem->at) {
+            GRegex *regex;
+
+            modem->at = mm_at_serial_port_new (fields[3] + strlen ("/dev/"));
+            mm_at_serial_port_set_response_parser (modem->at,
+                                                   mm_serial_parser_v1_parse,
+                                                   mm_serial_parser_v1_new (),
+                                                   mm_serial_parser_v1_destroy);
+            regex = g_regex_new ("\\r\\n\\+CIEV: (\\d+),(\\d+)\\r\\n",
+                                 G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, NULL);
+            mm_at_serial_port_add_unsolicited_msg_handler (modem->at, regex, urc_received, NULL, NULL);
+            g_regex_unref (regex);
+        } else if (g_str_equal (fields[1], "qcdm") && !modem->qcdm)
+            modem->qcdm = mm_qcdm_serial_port_new (fields[3] + strlen ("/dev/"));
+        g_strfreev (fields);
+    }
+    g_io_channel_unref (channel);
+
+    return pid;
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+static gboolean
+watchdog_expired (GPid *pid)
+{
+    g_printerr ("error: run not finished in time, %u modems still running\n",
+                ctx.running);
+    kill (*pid, SIGTERM);
+    exit (EXIT_FAILURE);
+    return FALSE;
+}
+
+int main (int argc, char **argv)
+{
+    gchar **extra_args = NULL;
+    gchar *program_dir;
+    guint n_modems = 10;
+    guint seconds = 10;
+    gboolean faults = FALSE;
+    gint64 poll_start;
+    GPid pid;
+    gint i, j;
+
+    g_type_init ();
+
+    for (i = 1; i < argc; i++) {
+        if (g_str_equal (argv[i], "--")) {
+            extra_args = &argv[i + 1];
+            for (j = 0; extra_args[j]; j++) {
+                if (g_str_has_prefix (extra_args[j], "--fault"))
+                    faults = TRUE;
+            }
+            break;
+        }
+        if (i == 1)
+            n_modems = MAX (1, atoi (argv[i]));
+        else if (i == 2)
+            seconds = MAX (1, atoi (argv[i]));
+    }
+
+    ctx.modems = g_ptr_array_new_with_free_func ((GDestroyNotify)modem_free);
+    ctx.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+    program_dir = g_path_get_dirname (argv[0]);
+    pid = start_simulator (program_dir, n_modems, extra_args);
+    g_free (program_dir);
+
+    for (i = 0; i < ctx.modems->len; i++) {
+        Modem *modem = g_ptr_array_index (ctx.modems, i);
+
+        if (!modem->at || !modem_open_port (MM_SERIAL_PORT (modem->at))) {
+            kill (pid, SIGTERM);
+            return EXIT_FAILURE;
+        }
+        if (modem->qcdm && !modem_open_port (MM_SERIAL_PORT (modem->qcdm))) {
+            g_object_unref (modem->qcdm);
+            modem->qcdm = NULL;
+        }
+    }
+
+    g_print ("%u modems, polling for %u s\n", ctx.modems->len, seconds);
+
+    /* All modems start at once; polling ends at the same time for all */
+    ctx.running = ctx.modems->len;
+    ctx.poll_deadline = G_MAXINT64;
+    ctx.last_tick = g_get_monotonic_time ();
+    g_timeout_add (LATENCY_TICK_MS, latency_tick, NULL);
+    g_timeout_add_seconds (seconds + WATCHDOG_EXTRA_SECONDS, (GSourceFunc)watchdog_expired, &pid);
+    g_ptr_array_foreach (ctx.modems, (GFunc)modem_start, NULL);
+
+    /* Set the deadline once every modem is polling */
+    poll_start = 0;
+    while (ctx.running > 0) {
+        guint polling = 0;
+
+        g_main_context_iteration (NULL, TRUE);
+        if (poll_start)
+            continue;
+        for (i = 0; i < ctx.modems->len; i++)
+            polling += (((Modem *) g_ptr_array_index (ctx.modems, i))->phase >= PHASE_POLL);
+        if (polling == ctx.modems->len) {
+            poll_start = g_get_monotonic_time ();
+            ctx.poll_deadline = poll_start + (gint64) seconds * G_USEC_PER_SEC;
+        }
+    }
+
+    report ((g_get_monotonic_time () - poll_start) / (gdouble) G_USEC_PER_SEC);
+
+    kill (pid, SIGTERM);
+    g_spawn_close_pid (pid);
+    g_ptr_array_unref (ctx.modems);
+    g_array_unref (ctx.latencies);
+
+    if (ctx.errors > 0 && !faults) {
+        g_printerr ("error: %u commands failed without faults injected\n", ctx.errors);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,376 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Micro-benchmark of the AT final response parser.
+ *
+ * A corpus of typical AT replies is fed to the parser in small chunks, the
+ * same way the serial port delivers them, and the parser is run after every
+ * chunk until the final response is recognized. The current parser, both
+ * resuming from where the previous run left and rescanning everything on
+ * each run, is compared against the previous regex cascade based one, which
+ * is kept here as a reference.
+ *
+ * Usage: bench-serial-parsers [ITERATIONS] [CHUNK SIZE]
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include "mm-error-helpers.h"
+#include "mm-serial-parsers.h"
+#include "mm-log.h"
+
+/*****************************************************************************/
+/* Reference regex cascade parser */
+
+typedef struct {
+    GRegex *regex_ok;
+    GRegex *regex_connect;
+    GRegex *regex_cme_error;
+    GRegex *regex_cms_error;
+    GRegex *regex_cme_error_str;
+    GRegex *regex_cms_error_str;
+    GRegex *regex_ezx_error;
+    GRegex *regex_unknown_error;
+    GRegex *regex_connect_failed;
+} RegexParser;
+
+static RegexParser *
+regex_parser_new (void)
+{
+    RegexParser *parser;
+    GRegexCompileFlags flags = G_REGEX_DOLLAR_ENDONLY | G_REGEX_RAW | G_REGEX_OPTIMIZE;
+
+    parser = g_slice_new (RegexParser);
+    parser->regex_ok = g_regex_new ("\\r\\nOK(\\r\\n)+$", flags, 0, NULL);
+    parser->regex_connect = g_regex_new ("\\r\\nCONNECT.*\\r\\n", flags, 0, NULL);
+    parser->regex_cme_error = g_regex_new ("\\r\\n\\+CME ERROR:\\s*(\\d+)\\r\\n$", flags, 0, NULL);
+    parser->regex_cms_error = g_regex_new ("\\r\\n\\+CMS ERROR:\\s*(\\d+)\\r\\n$", flags, 0, NULL);
+    parser->regex_cme_error_str = g_regex_new ("\\r\\n\\+CME ERROR:\\s*([^\\n\\r]+)\\r\\n$", flags, 0, NULL);
+    parser->regex_cms_error_str = g_regex_new ("\\r\\n\\+CMS ERROR:\\s*([^\\n\\r]+)\\r\\n$", flags, 0, NULL);
+    parser->regex_ezx_error = g_regex_new ("\\r\\n\\MODEM ERROR:\\s*(\\d+)\\r\\n$", flags, 0, NULL);
+    parser->regex_unknown_error = g_regex_new ("\\r\\n(ERROR)|(COMMAND NOT SUPPORT)\\r\\n$", flags, 0, NULL);
+    parser->regex_connect_failed = g_regex_new ("\\r\\n(NO CARRIER)|(BUSY)|(NO ANSWER)|(NO DIALTONE)\\r\\n$", flags, 0, NULL);
+    return parser;
+}
+
+static void
+regex_parser_free (RegexParser *parser)
+{
+    g_regex_unref (parser->regex_ok);
+    g_regex_unref (parser->regex_connect);
+    g_regex_unref (parser->regex_cme_error);
+    g_regex_unref (parser->regex_cms_error);
+    g_regex_unref (parser->regex_cme_error_str);
+    g_regex_unref (parser->regex_cms_error_str);
+    g_regex_unref (parser->regex_ezx_error);
+    g_regex_unref (parser->regex_unknown_error);
+    g_regex_unref (parser->regex_connect_failed);
+    g_slice_free (RegexParser, parser);
+}
+
+static gboolean
+remove_eval_cb (const GMatchInfo *match_info,
+                GString *result,
+                gpointer user_data)
+{
+    int *result_len = (int *) user_data;
+    int start;
+    int end;
+
+    if (g_match_info_fetch_pos  (match_info, 0, &start, &end))
+        *result_len -= (end - start);
+
+    return TRUE;
+}
+
+static void
+remove_matches (GRegex *r, GString *string)
+{
+    char *str;
+    int result_len = string->len;
+
+    str = g_regex_replace_eval (r, string->str, string->len, 0, 0,
+                                remove_eval_cb, &result_len, NULL);
+
+    g_string_truncate (string, 0);
+    g_string_append_len (string, str, result_len);
+    g_free (str);
+}
+
+static gboolean
+regex_match_error (GRegex *regex,
+                   GString *response,
+                   GError **error,
+                   GError *(*error_for_code) (gint),
+                   GError *(*error_for_string) (const gchar *),
+                   gint fixed_code)
+{
+    GMatchInfo *match_info = NULL;
+    gboolean found;
+
+    found = g_regex_match_full (regex, response->str, response->len, 0, 0, &match_info, NULL);
+    if (found) {
+        gchar *str;
+
+        str = g_match_info_fetch (match_info, 1);
+        if (error_for_string)
+            *error = error_for_string (str);
+        else if (fixed_code >= 0)
+            *error = error_for_code (fixed_code);
+        else
+            *error = error_for_code (atoi (str));
+        g_free (str);
+    }
+    g_match_info_free (match_info);
+    return found;
+}
+
+static GError *
+me_error_for_code (gint code)
+{
+    return mm_mobile_equipment_error_for_code ((MMMobileEquipmentError) code);
+}
+
+static GError *
+message_error_for_code (gint code)
+{
+    return mm_message_error_for_code ((MMMessageError) code);
+}
+
+static GError *
+connection_error_for_code (gint code)
+{
+    return mm_connection_error_for_code ((MMConnectionError) code);
+}
+
+static gboolean
+regex_parser_parse (RegexParser *parser,
+                    GString *response,
+                    GError **error)
+{
+    while (response->len > 0 && response->str[0] == '\0')
+        g_string_erase (response, 0, 1);
+
+    if (!response->len)
+        return FALSE;
+
+    if (g_regex_match_full (parser->regex_ok, response->str, response->len, 0, 0, NULL, NULL)) {
+        remove_matches (parser->regex_ok, response);
+        return TRUE;
+    }
+    if (g_regex_match_full (parser->regex_connect, response->str, response->len, 0, 0, NULL, NULL))
+        return TRUE;
+
+    return (regex_match_error (parser->regex_cme_error, response, error, me_error_for_code, NULL, -1) ||
+            regex_match_error (parser->regex_cms_error, response, error, message_error_for_code, NULL, -1) ||
+            regex_match_error (parser->regex_cme_error_str, response, error, NULL, mm_mobile_equipment_error_for_string, -1) ||
+            regex_match_error (parser->regex_cms_error_str, response, error, NULL, mm_message_error_for_string, -1) ||
+            regex_match_error (parser->regex_ezx_error, response, error, me_error_for_code, NULL, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN) ||
+            regex_match_error (parser->regex_unknown_error, response, error, me_error_for_code, NULL, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN) ||
+            regex_match_error (parser->regex_connect_failed, response, error, connection_error_for_code, NULL, MM_CONNECTION_ERROR_NO_CARRIER));
+}
+
+/*****************************************************************************/
+/* Corpus of replies, as received from real modems */
+
+static const gchar *corpus[] = {
+    "\r\nOK\r\n",
+    "\r\n+CSQ: 18,99\r\n\r\nOK\r\n",
+    "\r\n+CREG: 2,1,\"0AB3\",\"00D2E1F3\",2\r\n\r\nOK\r\n",
+    "\r\n+COPS: 0,2,\"21403\",2\r\n\r\nOK\r\n",
+    "\r\n+CGMI: Huawei Technologies Co., Ltd.\r\n\r\nOK\r\n",
+    "\r\n+CPIN: READY\r\n\r\nOK\r\n",
+    "\r\n+CME ERROR: 10\r\n",
+    "\r\n+CME ERROR: SIM PIN required\r\n",
+    "\r\n+CMS ERROR: 321\r\n",
+    "\r\nERROR\r\n",
+    "\r\nNO CARRIER\r\n",
+    "\r\nCONNECT 3600000\r\n",
+    "\r\n+CGDCONT: 1,\"IP\",\"internet\",\"0.0.0.0\",0,0\r\n"
+    "+CGDCONT: 2,\"IP\",\"mms\",\"0.0.0.0\",0,0\r\n"
+    "+CGDCONT: 3,\"IPV4V6\",\"ims\",\"0.0.0.0\",0,0\r\n\r\nOK\r\n",
+    "\r\n+CMGL: 0,1,,23\r\n07913366003000F1040B913366611346F20000312170312142800474747A0E\r\n"
+    "+CMGL: 1,1,,23\r\n07913366003000F1040B913366611346F20000312170312142800474747A0E\r\n"
+    "+CMGL: 2,1,,23\r\n07913366003000F1040B913366611346F20000312170312142800474747A0E\r\n"
+    "\r\nOK\r\n",
+};
+
+/* A long reply, like a +CMGL listing with many PDUs, received in small chunks */
+#define LONG_REPLY_ENTRIES 200
+
+static gchar *
+build_long_reply (void)
+{
+    GString *str;
+    guint i;
+
+    str = g_string_new ("\r\n");
+    for (i = 0; i < LONG_REPLY_ENTRIES; i++)
+        g_string_append_printf (str,
+                                "+CMGL: %u,1,,23\r\n"
+                                "07913366003000F1040B913366611346F20000312170312142800474747A0E\r\n",
+                                i);
+    g_string_append (str, "\r\nOK\r\n");
+    return g_string_free (str, FALSE);
+}
+
+typedef gboolean (*ParseFn) (gpointer parser, GByteArray *response, gsize *resume, GError **error);
+
+/* Runs the reference parser the way the AT port used to, copying the
+ * response into a GString and back on every read */
+static gboolean
+run_regex_parser (gpointer parser, GByteArray *response, gsize *resume, GError **error)
+{
+    GString *string;
+    gboolean found;
+
+    string = g_string_sized_new (response->len + 1);
+    g_string_append_len (string, (const gchar *) response->data, response->len);
+    found = regex_parser_parse ((RegexParser *) parser, string, error);
+    g_byte_array_set_size (response, 0);
+    g_byte_array_append (response, (const guint8 *) string->str, string->len);
+    g_string_free (string, TRUE);
+    return found;
+}
+
+/* Runs the current parser always from scratch */
+static gboolean
+run_parser_no_resume (gpointer parser, GByteArray *response, gsize *resume, GError **error)
+{
+    return mm_serial_parser_v1_parse (parser, response, NULL, error);
+}
+
+static gdouble
+run_replies (const gchar *name,
+             const gchar **replies,
+             guint n_replies,
+             gpointer parser,
+             ParseFn parse,
+             guint iterations,
+             guint chunk_size)
+{
+    GByteArray *response;
+    GTimer *timer;
+    guint n_parsed = 0;
+    guint n_calls = 0;
+    guint i;
+    guint j;
+    gdouble elapsed;
+
+    response = g_byte_array_sized_new (1024);
+    timer = g_timer_new ();
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < n_replies; j++) {
+            const gchar *reply = replies[j];
+            gsize len = strlen (reply);
+            gsize offset = 0;
+            gsize resume = 0;
+
+            g_byte_array_set_size (response, 0);
+            while (offset < len) {
+                GError *error = NULL;
+                gsize n = MIN (chunk_size, len - offset);
+
+                g_byte_array_append (response, (const guint8 *) reply + offset, n);
+                offset += n;
+                n_calls++;
+                if (parse (parser, response, &resume, &error)) {
+                    n_parsed++;
+                    g_clear_error (&error);
+                    break;
+                }
+            }
+        }
+    }
+
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_print ("  %-10s %8u replies, %9u parser calls: %8.3f s (%7.1f ns/call)\n",
+             name, n_parsed, n_calls, elapsed,
+             n_calls ? (elapsed * 1e9) / n_calls : 0.0);
+
+    g_timer_destroy (timer);
+    g_byte_array_unref (response);
+    return elapsed;
+}
+
+static void
+run_all (const gchar *title,
+         const gchar **replies,
+         guint n_replies,
+         guint iterations,
+         guint chunk_size)
+{
+    gpointer parser;
+    RegexParser *regex_parser;
+    gdouble current;
+    gdouble reference;
+
+    parser = mm_serial_parser_v1_new ();
+    regex_parser = regex_parser_new ();
+
+    g_print ("%s: %u iterations over %u replies, %u byte chunks\n",
+             title, iterations, n_replies, chunk_size);
+
+    reference = run_replies ("regex", replies, n_replies, regex_parser, run_regex_parser, iterations, chunk_size);
+    run_replies ("no-resume", replies, n_replies, parser, run_parser_no_resume, iterations, chunk_size);
+    current = run_replies ("current", replies, n_replies, parser, mm_serial_parser_v1_parse, iterations, chunk_size);
+
+    if (current > 0.0)
+        g_print ("  speedup: %.2fx\n", reference / current);
+
+    regex_parser_free (regex_parser);
+    mm_serial_parser_v1_destroy (parser);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    guint iterations = 20000;
+    guint chunk_size = 16;
+    gchar *long_reply;
+
+    g_type_init ();
+
+    if (argc > 1)
+        iterations = (guint) atoi (argv[1]);
+    if (argc > 2)
+        chunk_size = MAX (1, atoi (argv[2]));
+
+    run_all ("Common replies", corpus, G_N_ELEMENTS (corpus), iterations, chunk_size);
+
+    long_reply = build_long_reply ();
+    run_all ("Long reply", (const gchar **) &long_reply, 1, MAX (1, iterations / 100), chunk_size);
+    g_free (long_reply);
+
+    return 0;
+}
@@ -0,0 +1,343 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Micro-benchmark of the SMS list bookkeeping.
+ *
+ * A modem storage full of parts is ingested the way MMSmsList does it when
+ * the messages are listed: each part is first checked against the parts
+ * already taken (storage, index), then multipart ones are matched with the
+ * message they belong to (concat reference, sender). Every message is then
+ * looked up by its DBus path, as done when deleting. The lookups are done
+ * through hash indexes like the ones in mm-sms-list.c, and compared with the
+ * linear scans of the message list used before. Note that the scan matches
+ * multipart messages by reference only, so it reports fewer messages: parts
+ * from different senders which happen to use the same reference get merged.
+ *
+ * MMSmsList itself needs the whole daemon, so the messages here are plain
+ * lists of MMSmsPart.
+ *
+ * Usage: bench-sms-list [PARTS] [ITERATIONS]
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include <ModemManager.h>
+
+#include "mm-sms-part.h"
+
+typedef struct {
+    MMSmsStorage storage;
+    guint index;
+} PartKey;
+
+typedef struct {
+    gchar *path;
+    MMSmsStorage storage;
+    gboolean is_multipart;
+    guint reference;
+    gchar *multipart_key;
+    GList *parts;
+} Message;
+
+typedef struct {
+    GList *list;
+    GHashTable *by_path;
+    GHashTable *by_multipart;
+    GHashTable *by_part;
+    guint next_path;
+} List;
+
+static guint
+part_key_hash (const PartKey *key)
+{
+    return (key->index * 31) ^ key->storage;
+}
+
+static gboolean
+part_key_equal (const PartKey *a,
+                const PartKey *b)
+{
+    return (a->index == b->index && a->storage == b->storage);
+}
+
+static gchar *
+build_multipart_key (guint reference,
+                     const gchar *sender)
+{
+    return g_strdup_printf ("%u/%s", reference, sender ? sender : "");
+}
+
+/*****************************************************************************/
+
+static gint
+cmp_part_index (MMSmsPart *part,
+                gpointer user_data)
+{
+    return (GPOINTER_TO_UINT (user_data) - mm_sms_part_get_index (part));
+}
+
+static gint
+cmp_message_by_part (Message *message,
+                     PartKey *key)
+{
+    return !(message->storage == key->storage &&
+             g_list_find_custom (message->parts,
+                                 GUINT_TO_POINTER (key->index),
+                                 (GCompareFunc)cmp_part_index));
+}
+
+static gint
+cmp_message_by_reference (Message *message,
+                          gpointer user_data)
+{
+    if (!message->is_multipart)
+        return -1;
+    return (GPOINTER_TO_UINT (user_data) - message->reference);
+}
+
+static gint
+cmp_message_by_path (Message *message,
+                     const gchar *path)
+{
+    return g_strcmp0 (message->path, path);
+}
+
+static Message *
+list_find_by_part (List *list,
+                   gboolean indexed,
+                   PartKey *key)
+{
+    GList *l;
+
+    if (indexed)
+        return g_hash_table_lookup (list->by_part, key);
+
+    l = g_list_find_custom (list->list, key, (GCompareFunc)cmp_message_by_part);
+    return l ? l->data : NULL;
+}
+
+static Message *
+list_find_multipart (List *list,
+                     gboolean indexed,
+                     MMSmsPart *part,
+                     gchar *key)
+{
+    GList *l;
+
+    if (indexed)
+        return g_hash_table_lookup (list->by_multipart, key);
+
+    l = g_list_find_custom (list->list,
+                            GUINT_TO_POINTER (mm_sms_part_get_concat_reference (part)),
+                            (GCompareFunc)cmp_message_by_reference);
+    return l ? l->data : NULL;
+}
+
+static Message *
+list_find_by_path (List *list,
+                   gboolean indexed,
+                   const gchar *path)
+{
+    GList *l;
+
+    if (indexed)
+        return g_hash_table_lookup (list->by_path, path);
+
+    l = g_list_find_custom (list->list, path, (GCompareFunc)cmp_message_by_path);
+    return l ? l->data : NULL;
+}
+
+static void
+list_take_part (List *list,
+                gboolean indexed,
+                MMSmsPart *part,
+                MMSmsStorage storage)
+{
+    Message *message = NULL;
+    PartKey *key;
+    gchar *multipart_key = NULL;
+
+    key = g_new (PartKey, 1);
+    key->storage = storage;
+    key->index = mm_sms_part_get_index (part);
+    if (list_find_by_part (list, indexed, key)) {
+        g_free (key);
+        mm_sms_part_free (part);
+        return;
+    }
+
+    if (mm_sms_part_should_concat (part)) {
+        multipart_key = build_multipart_key (mm_sms_part_get_concat_reference (part),
+                                             mm_sms_part_get_number (part));
+        message = list_find_multipart (list, indexed, part, multipart_key);
+    }
+
+    if (message)
+        g_free (multipart_key);
+    else {
+        message = g_new0 (Message, 1);
+        message->path = g_strdup_printf (MM_DBUS_SMS_PREFIX "/%u", list->next_path++);
+        message->storage = storage;
+        message->is_multipart = !!multipart_key;
+        message->reference = mm_sms_part_get_concat_reference (part);
+        message->multipart_key = multipart_key;
+        list->list = g_list_prepend (list->list, message);
+        g_hash_table_insert (list->by_path, message->path, message);
+        if (multipart_key)
+            g_hash_table_insert (list->by_multipart, multipart_key, message);
+    }
+
+    message->parts = g_list_prepend (message->parts, part);
+    g_hash_table_insert (list->by_part, key, message);
+}
+
+static void
+message_free (Message *message)
+{
+    g_list_free_full (message->parts, (GDestroyNotify)mm_sms_part_free);
+    g_free (message->multipart_key);
+    g_free (message->path);
+    g_free (message);
+}
+
+/*****************************************************************************/
+
+static GPtrArray *
+build_storage (guint n_parts)
+{
+    GPtrArray *parts;
+    guint index = 0;
+    guint reference = 0;
+
+    parts = g_ptr_array_sized_new (n_parts);
+    while (index < n_parts) {
+        gchar *number;
+        guint max, i;
+
+        /* One in three messages is split in 2 to 4 parts */
+        max = (g_random_int_range (0, 3) == 0) ? g_random_int_range (2, 5) : 1;
+        number = g_strdup_printf ("+3460000%04u", g_random_int_range (0, 200));
+        reference = (reference + 1) & 0xFF;
+
+        for (i = 0; i < max && index < n_parts; i++) {
+            MMSmsPart *part;
+
+            part = mm_sms_part_new (index++);
+            mm_sms_part_set_number (part, number);
+            mm_sms_part_set_text (part, "Lorem ipsum dolor sit amet");
+            if (max > 1) {
+                mm_sms_part_set_concat_reference (part, reference);
+                mm_sms_part_set_concat_max (part, max);
+                mm_sms_part_set_concat_sequence (part, i + 1);
+            }
+            g_ptr_array_add (parts, part);
+        }
+        g_free (number);
+    }
+
+    return parts;
+}
+
+static MMSmsPart *
+copy_part (MMSmsPart *part)
+{
+    MMSmsPart *copy;
+
+    copy = mm_sms_part_new (mm_sms_part_get_index (part));
+    mm_sms_part_set_number (copy, mm_sms_part_get_number (part));
+    mm_sms_part_set_text (copy, mm_sms_part_get_text (part));
+    if (mm_sms_part_should_concat (part)) {
+        mm_sms_part_set_concat_reference (copy, mm_sms_part_get_concat_reference (part));
+        mm_sms_part_set_concat_max (copy, mm_sms_part_get_concat_max (part));
+        mm_sms_part_set_concat_sequence (copy, mm_sms_part_get_concat_sequence (part));
+    }
+    return copy;
+}
+
+static void
+run (GPtrArray *storage,
+     gboolean indexed,
+     guint iterations)
+{
+    GTimer *timer;
+    gdouble ingest = 0, lookup = 0;
+    guint messages = 0;
+    guint i, j;
+
+    for (i = 0; i < iterations; i++) {
+        List list = { 0 };
+        GList *l;
+
+        list.by_path = g_hash_table_new (g_str_hash, g_str_equal);
+        list.by_multipart = g_hash_table_new (g_str_hash, g_str_equal);
+        list.by_part = g_hash_table_new_full ((GHashFunc)part_key_hash,
+                                              (GEqualFunc)part_key_equal,
+                                              g_free,
+                                              NULL);
+
+        timer = g_timer_new ();
+        for (j = 0; j < storage->len; j++)
+            list_take_part (&list,
+                            indexed,
+                            copy_part (g_ptr_array_index (storage, j)),
+                            MM_SMS_STORAGE_ME);
+        ingest += g_timer_elapsed (timer, NULL);
+
+        g_timer_start (timer);
+        for (l = list.list; l; l = g_list_next (l))
+            g_assert (list_find_by_path (&list, indexed, ((Message *)l->data)->path) == l->data);
+        lookup += g_timer_elapsed (timer, NULL);
+        g_timer_destroy (timer);
+
+        messages = g_list_length (list.list);
+        g_hash_table_destroy (list.by_part);
+        g_hash_table_destroy (list.by_multipart);
+        g_hash_table_destroy (list.by_path);
+        g_list_free_full (list.list, (GDestroyNotify)message_free);
+    }
+
+    g_print ("%-8s %6u parts %6u messages %10.0f ns/part %10.0f ns/path lookup\n",
+             indexed ? "indexed" : "scan",
+             storage->len,
+             messages,
+             ingest * 1e9 / (iterations * storage->len),
+             lookup * 1e9 / (iterations * messages));
+}
+
+int main (int argc, char **argv)
+{
+    GPtrArray *storage;
+    guint n_parts = 5000;
+    guint iterations = 5;
+
+    if (argc > 1)
+        n_parts = MAX (1, atoi (argv[1]));
+    if (argc > 2)
+        iterations = MAX (1, atoi (argv[2]));
+
+    g_random_set_seed (1234);
+
+    storage = build_storage (n_parts);
+    run (storage, TRUE, iterations);
+    run (storage, FALSE, iterations);
+
+    g_ptr_array_foreach (storage, (GFunc)mm_sms_part_free, NULL);
+    g_ptr_array_free (storage, TRUE);
+
+    return 0;
+}
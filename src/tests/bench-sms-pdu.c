@@ -0,0 +1,235 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Benchmark of the SMS PDU parser and builder.
+ *
+ * Every PDU of the corpus in sms-pdu-corpus.h is parsed the way messages are
+ * when listed from the modem; the parts with a number and a text are then
+ * built back into SMS-SUBMIT PDUs, the way messages are when sent. The result
+ * of the parser is checked against the one expected for each PDU, so that
+ * the benchmark fails if the corpus and the parser disagree.
+ *
+ * Allocations are counted through g_mem_set_vtable(); with GLib versions
+ * which ignore it, they are reported as n/a.
+ *
+ * Usage: bench-sms-pdu [ITERATIONS]
+ *        bench-sms-pdu --write-corpus DIR
+ *
+ * The second form writes every PDU of the corpus in binary to DIR, to be
+ * used as seed inputs of fuzz-sms-pdu.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "mm-sms-part.h"
+#include "mm-utils.h"
+#include "sms-pdu-corpus.h"
+
+static gulong n_allocs;
+
+static gpointer
+counting_malloc (gsize n_bytes)
+{
+    n_allocs++;
+    return malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem,
+                  gsize n_bytes)
+{
+    n_allocs++;
+    return realloc (mem, n_bytes);
+}
+
+static gpointer
+counting_calloc (gsize n_blocks,
+                 gsize n_block_bytes)
+{
+    n_allocs++;
+    return calloc (n_blocks, n_block_bytes);
+}
+
+static GMemVTable counting_vtable G_GNUC_UNUSED = {
+    counting_malloc,
+    counting_realloc,
+    free,
+    counting_calloc,
+    counting_malloc,
+    counting_realloc
+};
+
+/*****************************************************************************/
+
+static MMSmsPart *
+build_submit_part (MMSmsPart *part)
+{
+    MMSmsPart *submit;
+
+    submit = mm_sms_part_new (0);
+    mm_sms_part_set_smsc (submit, mm_sms_part_get_smsc (part));
+    mm_sms_part_set_number (submit, mm_sms_part_get_number (part));
+    mm_sms_part_set_text (submit, mm_sms_part_get_text (part));
+    if (mm_sms_part_should_concat (part)) {
+        mm_sms_part_set_concat_reference (submit, mm_sms_part_get_concat_reference (part) & 0xFF);
+        mm_sms_part_set_concat_max (submit, mm_sms_part_get_concat_max (part));
+        mm_sms_part_set_concat_sequence (submit, mm_sms_part_get_concat_sequence (part));
+    }
+    return submit;
+}
+
+typedef struct {
+    gdouble elapsed;
+    gulong allocs;
+    guint parts;
+    guint failed;
+} Stats;
+
+static void
+run (guint iterations)
+{
+    Stats decode = { 0 }, encode = { 0 };
+    GTimer *timer;
+    guint i, j;
+
+    timer = g_timer_new ();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < G_N_ELEMENTS (sms_pdu_corpus); j++) {
+            const SmsPduCorpusEntry *entry = &sms_pdu_corpus[j];
+            MMSmsPart *part, *submit;
+            GError *error = NULL;
+            gulong allocs;
+            guint8 *pdu;
+            guint pdu_len = 0, msg_start = 0;
+
+            g_timer_start (timer);
+            allocs = n_allocs;
+            part = mm_sms_part_new_from_pdu (j, entry->hexpdu, &error);
+            decode.elapsed += g_timer_elapsed (timer, NULL);
+            decode.allocs += n_allocs - allocs;
+            decode.parts++;
+
+            if ((part != NULL) != entry->decodes) {
+                g_printerr ("error: PDU '%s' %s: %s\n",
+                            entry->name,
+                            part ? "shouldn't have been parsed" : "couldn't be parsed",
+                            error ? error->message : "no error");
+                exit (EXIT_FAILURE);
+            }
+
+            if (!part) {
+                decode.failed++;
+                g_error_free (error);
+                continue;
+            }
+
+            /* Only messages with a text are sent; note that alphanumeric
+             * senders can't be encoded as destination numbers */
+            if (!mm_sms_part_get_number (part) ||
+                !mm_sms_part_get_text (part) ||
+                !mm_sms_part_get_text (part)[0]) {
+                mm_sms_part_free (part);
+                continue;
+            }
+
+            g_timer_start (timer);
+            allocs = n_allocs;
+            submit = build_submit_part (part);
+            pdu = mm_sms_part_get_submit_pdu (submit, &pdu_len, &msg_start, &error);
+            mm_sms_part_free (submit);
+            g_free (pdu);
+            encode.elapsed += g_timer_elapsed (timer, NULL);
+            encode.allocs += n_allocs - allocs;
+            encode.parts++;
+            if (!pdu) {
+                encode.failed++;
+                g_error_free (error);
+            }
+
+            mm_sms_part_free (part);
+        }
+    }
+    g_timer_destroy (timer);
+
+    for (i = 0; i < 2; i++) {
+        Stats *stats = (i == 0 ? &decode : &encode);
+        gchar *allocs;
+
+        allocs = (n_allocs > 0 ?
+                  g_strdup_printf ("%.1f", (gdouble) stats->allocs / stats->parts) :
+                  g_strdup ("n/a"));
+        g_print ("%-7s %6u parts (%u failed) %10.0f parts/s %8.0f ns/part %6s allocs/part\n",
+                 i == 0 ? "decode" : "encode",
+                 stats->parts / iterations,
+                 stats->failed / iterations,
+                 stats->parts / stats->elapsed,
+                 stats->elapsed * 1e9 / stats->parts,
+                 allocs);
+        g_free (allocs);
+    }
+}
+
+static int
+write_corpus (const gchar *dir)
+{
+    guint i;
+
+    if (g_mkdir_with_parents (dir, 0755) < 0) {
+        g_printerr ("error: couldn't create directory '%s'\n", dir);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (sms_pdu_corpus); i++) {
+        GError *error = NULL;
+        gchar *bin, *path;
+        gsize len = 0;
+
+        bin = utils_hexstr2bin (sms_pdu_corpus[i].hexpdu, &len);
+        path = g_build_filename (dir, sms_pdu_corpus[i].name, NULL);
+        if (!g_file_set_contents (path, bin, len, &error)) {
+            g_printerr ("error: %s\n", error->message);
+            g_error_free (error);
+            g_free (path);
+            g_free (bin);
+            return EXIT_FAILURE;
+        }
+        g_free (path);
+        g_free (bin);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main (int argc, char **argv)
+{
+    guint iterations = 20000;
+
+#if !GLIB_CHECK_VERSION (2, 46, 0)
+    /* Must be done before any other GLib call */
+    g_mem_set_vtable (&counting_vtable);
+#endif
+
+    if (argc > 2 && g_str_equal (argv[1], "--write-corpus"))
+        return write_corpus (argv[2]);
+
+    if (argc > 1)
+        iterations = MAX (1, atoi (argv[1]));
+
+    run (iterations);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Fuzzing target of the SMS PDU parser and builder.
+ *
+ * Each input is a binary PDU, as a modem would report it in hex; it is
+ * parsed, and if that succeeds, built back into an SMS-SUBMIT PDU. GLib
+ * warnings and critical messages are fatal, so that failed checks show up
+ * as crashes too.
+ *
+ * With libFuzzer, build with -DFUZZ_WITH_LIBFUZZER and -fsanitize=fuzzer
+ * in CFLAGS. Otherwise the program runs every file given in the command
+ * line, or its standard input, as one input each, which is what AFL expects
+ * and what reproduces a crash found by either of them. Seed inputs are
+ * written with 'bench-sms-pdu --write-corpus DIR'.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "mm-sms-part.h"
+#include "mm-utils.h"
+
+/* Longest PDU with SMSC listed by +CMGL */
+#define MAX_PDU_LEN 200
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput (const uint8_t *data,
+                        size_t size)
+{
+    MMSmsPart *part, *submit;
+    gchar *hexpdu;
+    guint8 *pdu;
+    guint pdu_len = 0;
+
+    if (size > MAX_PDU_LEN)
+        return 0;
+
+    g_log_set_always_fatal (G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING);
+
+    hexpdu = utils_bin2hexstr (data, size);
+    part = mm_sms_part_new_from_pdu (0, hexpdu, NULL);
+    g_free (hexpdu);
+    if (!part)
+        return 0;
+
+    if (mm_sms_part_get_number (part) &&
+        mm_sms_part_get_text (part) &&
+        mm_sms_part_get_text (part)[0]) {
+        submit = mm_sms_part_new (0);
+        mm_sms_part_set_smsc (submit, mm_sms_part_get_smsc (part));
+        mm_sms_part_set_number (submit, mm_sms_part_get_number (part));
+        mm_sms_part_set_text (submit, mm_sms_part_get_text (part));
+        if (mm_sms_part_should_concat (part)) {
+            mm_sms_part_set_concat_reference (submit, mm_sms_part_get_concat_reference (part) & 0xFF);
+            mm_sms_part_set_concat_max (submit, mm_sms_part_get_concat_max (part));
+            mm_sms_part_set_concat_sequence (submit, mm_sms_part_get_concat_sequence (part));
+        }
+        pdu = mm_sms_part_get_submit_pdu (submit, &pdu_len, NULL, NULL);
+        g_free (pdu);
+        mm_sms_part_free (submit);
+    }
+
+    mm_sms_part_free (part);
+    return 0;
+}
+
+#if !defined FUZZ_WITH_LIBFUZZER
+
+static gboolean
+run_stream (FILE *stream)
+{
+    guint8 data[MAX_PDU_LEN + 1];
+    size_t size;
+
+    size = fread (data, 1, sizeof (data), stream);
+    if (ferror (stream))
+        return FALSE;
+
+    LLVMFuzzerTestOneInput (data, size);
+    return TRUE;
+}
+
+int main (int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2)
+        return run_stream (stdin) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    for (i = 1; i < argc; i++) {
+        FILE *stream;
+        gboolean success;
+
+        stream = fopen (argv[i], "rb");
+        if (!stream) {
+            g_printerr ("error: couldn't open '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        success = run_stream (stream);
+        fclose (stream);
+        if (!success) {
+            g_printerr ("error: couldn't read '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#endif /* FUZZ_WITH_LIBFUZZER */
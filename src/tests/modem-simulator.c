@@ -0,0 +1,1104 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Modem simulator serving AT, QCDM and NMEA ports over pseudo terminals.
+ *
+ * The behaviour of each port comes either from a script or from a capture
+ * file written by the daemon (see mm-serial-capture.h), in which case every
+ * command sent by the daemon is answered with the data it got back when the
+ * capture was taken. Several modems may be simulated at once, all of them
+ * with the same set of ports.
+ *
+ * Script format; blank lines and lines starting with '#' are ignored:
+ *
+ *   [at NAME]                 new AT port; also [qcdm NAME] and [nmea NAME]
+ *   latency MS                delay before every reply
+ *   dribble BYTES MS          write replies BYTES at a time, MS apart
+ *   echo on|off               AT command echo
+ *   urc MS BURST TEXT         every MS, send BURST times the TEXT URC
+ *   fault PERCENT KINDS       make PERCENT of the commands fail; KINDS is a
+ *                             comma separated list of drop (no reply), error,
+ *                             garble (random bytes flipped) and close (the
+ *                             port hangs up)
+ *   nmea MS                   interval between NMEA sentence bursts
+ *   > REQUEST                 AT command line, possibly with '*' wildcards,
+ *                             or QCDM request prefix in hex
+ *   < REPLY                   AT reply line, QCDM reply in hex, or NMEA
+ *                             sentence; several may follow each request
+ *   delay MS                  extra delay before the reply to the last request
+ *
+ * AT command lines with several commands separated by ';' which are not in
+ * the script get the replies of each of the commands, merged. Unknown AT
+ * commands get ERROR, unknown QCDM requests get a bad command reply.
+ *
+ * Once the ports are created, one line is printed per port with the index of
+ * the modem, the type and name of the port, and the path of its pseudo
+ * terminal; then a line with READY.
+ *
+ * Usage: modem-simulator --script FILE [OPTIONS]
+ *        modem-simulator --capture FILE [OPTIONS]
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <glib.h>
+
+#include "mm-serial-capture.h"
+#include "libqcdm/src/utils.h"
+
+#define QCDM_CMD_BAD_CMD 0x13
+#define MAX_FRAME_LEN    4096
+
+/* URCs and NMEA sentences are dropped while nobody reads this much */
+#define MAX_PENDING_OUT  65536
+
+typedef enum {
+    PORT_TYPE_AT,
+    PORT_TYPE_QCDM,
+    PORT_TYPE_NMEA
+} PortType;
+
+static const gchar *port_type_names[] = { "at", "qcdm", "nmea" };
+
+typedef enum {
+    FAULT_DROP   = 1 << 0,
+    FAULT_ERROR  = 1 << 1,
+    FAULT_GARBLE = 1 << 2,
+    FAULT_CLOSE  = 1 << 3
+} FaultKind;
+
+static const gchar *fault_names[] = { "drop", "error", "garble", "close" };
+
+typedef struct {
+    GByteArray *request;  /* AT command line, uppercase; or QCDM request */
+    GByteArray *reply;    /* AT reply, framed; or QCDM reply, unframed */
+    guint delay_ms;
+    gchar *pattern;       /* AT command lines with wildcards */
+} Exchange;
+
+/* Exchanges with the same request, replied to in turns */
+typedef struct {
+    GPtrArray *exchanges;
+    guint next;
+} ExchangeSet;
+
+typedef struct {
+    PortType type;
+    gchar *name;
+    GPtrArray *exchanges;  /* script order */
+    GHashTable *exact;     /* AT command line -> ExchangeSet */
+    guint latency_ms;
+    guint dribble_bytes;
+    guint dribble_ms;
+    gboolean echo;
+    guint urc_ms;
+    guint urc_burst;
+    gchar *urc;
+    gdouble fault_rate;
+    guint faults;
+    guint nmea_ms;
+    GByteArray *nmea;
+} PortScript;
+
+typedef struct {
+    PortScript *script;
+    guint modem;
+    int master;
+    int slave;
+    gchar *path;
+    guint read_id;
+    GByteArray *in;
+    GByteArray *out;
+    guint write_id;
+    GQueue *requests;      /* of GByteArray, waiting to be replied */
+    guint reply_id;
+    guint urc_id;
+    guint nmea_id;
+} SimPort;
+
+/* Command line options */
+static gchar *script_file;
+static gchar *capture_file;
+static gint n_modems = 1;
+static gchar *link_dir;
+static gint latency_ms = -1;
+static gint dribble_bytes = -1;
+static gint dribble_ms = 1;
+static gdouble fault_rate = -1;
+static gchar *faults;
+static gint urc_ms = -1;
+static gint urc_burst = 1;
+static gint seed;
+
+static GOptionEntry entries[] = {
+    { "script", 's', 0, G_OPTION_ARG_FILENAME, &script_file,
+      "Script with the behaviour of the ports", "FILE" },
+    { "capture", 'c', 0, G_OPTION_ARG_FILENAME, &capture_file,
+      "Capture file to replay", "FILE" },
+    { "modems", 'n', 0, G_OPTION_ARG_INT, &n_modems,
+      "Number of modems to simulate", "N" },
+    { "link-dir", 'l', 0, G_OPTION_ARG_FILENAME, &link_dir,
+      "Create links named MODEM-PORT to the pseudo terminals in DIR", "DIR" },
+    { "latency", 0, 0, G_OPTION_ARG_INT, &latency_ms,
+      "Delay before every reply, overriding the script", "MS" },
+    { "dribble", 0, 0, G_OPTION_ARG_INT, &dribble_bytes,
+      "Write replies a few bytes at a time, overriding the script", "BYTES" },
+    { "dribble-interval", 0, 0, G_OPTION_ARG_INT, &dribble_ms,
+      "Time between writes when dribbling", "MS" },
+    { "fault-rate", 0, 0, G_OPTION_ARG_DOUBLE, &fault_rate,
+      "Percentage of commands which fail, overriding the script", "PERCENT" },
+    { "faults", 0, 0, G_OPTION_ARG_STRING, &faults,
+      "Kinds of failure: drop, error, garble, close", "KINDS" },
+    { "urc-interval", 0, 0, G_OPTION_ARG_INT, &urc_ms,
+      "Interval between bursts of URCs in AT ports, overriding the script", "MS" },
+    { "urc-burst", 0, 0, G_OPTION_ARG_INT, &urc_burst,
+      "Number of URCs in every burst", "N" },
+    { "seed", 0, 0, G_OPTION_ARG_INT, &seed,
+      "Seed of the fault injection", "SEED" },
+    { NULL }
+};
+
+/*****************************************************************************/
+/* Scripts */
+
+static void
+exchange_free (Exchange *exchange)
+{
+    g_byte_array_unref (exchange->request);
+    g_byte_array_unref (exchange->reply);
+    g_free (exchange->pattern);
+    g_slice_free (Exchange, exchange);
+}
+
+static void
+exchange_set_free (ExchangeSet *set)
+{
+    g_ptr_array_unref (set->exchanges);
+    g_slice_free (ExchangeSet, set);
+}
+
+static PortScript *
+port_script_new (PortType type,
+                 const gchar *name)
+{
+    PortScript *script;
+
+    script = g_slice_new0 (PortScript);
+    script->type = type;
+    script->name = g_strdup (name);
+    script->exchanges = g_ptr_array_new_with_free_func ((GDestroyNotify)exchange_free);
+    script->exact = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           g_free,
+                                           (GDestroyNotify)exchange_set_free);
+    script->echo = (type == PORT_TYPE_AT);
+    script->urc_burst = 1;
+    script->nmea_ms = 1000;
+    script->nmea = g_byte_array_new ();
+    return script;
+}
+
+static void
+port_script_free (PortScript *script)
+{
+    g_hash_table_destroy (script->exact);
+    g_ptr_array_unref (script->exchanges);
+    g_byte_array_unref (script->nmea);
+    g_free (script->urc);
+    g_free (script->name);
+    g_slice_free (PortScript, script);
+}
+
+static void
+port_script_add_exchange (PortScript *script,
+                          Exchange *exchange)
+{
+    ExchangeSet *set;
+    gchar *key;
+
+    g_ptr_array_add (script->exchanges, exchange);
+    if (script->type != PORT_TYPE_AT || exchange->pattern)
+        return;
+
+    key = g_strndup ((const gchar *)exchange->request->data, exchange->request->len);
+    set = g_hash_table_lookup (script->exact, key);
+    if (!set) {
+        set = g_slice_new0 (ExchangeSet);
+        set->exchanges = g_ptr_array_new ();
+        g_hash_table_insert (script->exact, key, set);
+    } else
+        g_free (key);
+    g_ptr_array_add (set->exchanges, exchange);
+}
+
+static GByteArray *
+hex_to_bytes (const gchar *hex)
+{
+    GByteArray *bytes;
+
+    bytes = g_byte_array_new ();
+    while (*hex) {
+        guint8 byte;
+
+        if (g_ascii_isspace (*hex)) {
+            hex++;
+            continue;
+        }
+        if (!g_ascii_isxdigit (hex[0]) || !g_ascii_isxdigit (hex[1])) {
+            g_byte_array_unref (bytes);
+            return NULL;
+        }
+        byte = (g_ascii_xdigit_value (hex[0]) << 4) | g_ascii_xdigit_value (hex[1]);
+        g_byte_array_append (bytes, &byte, 1);
+        hex += 2;
+    }
+    return bytes;
+}
+
+static guint
+parse_faults (const gchar *str)
+{
+    gchar **kinds;
+    guint mask = 0;
+    guint i, j;
+
+    kinds = g_strsplit (str, ",", -1);
+    for (i = 0; kinds[i]; i++) {
+        g_strstrip (kinds[i]);
+        for (j = 0; j < G_N_ELEMENTS (fault_names); j++) {
+            if (g_str_equal (kinds[i], fault_names[j]))
+                mask |= 1 << j;
+        }
+    }
+    g_strfreev (kinds);
+    return mask;
+}
+
+/* Appends an AT reply line the way modems frame them in verbose mode */
+static void
+append_at_line (GByteArray *reply,
+                const gchar *line)
+{
+    g_byte_array_append (reply, (const guint8 *)"\r\n", 2);
+    g_byte_array_append (reply, (const guint8 *)line, strlen (line));
+    g_byte_array_append (reply, (const guint8 *)"\r\n", 2);
+}
+
+static gboolean
+script_error (GError **error,
+              const gchar *file,
+              guint line,
+              const gchar *message)
+{
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                 "%s:%u: %s", file, line, message);
+    return FALSE;
+}
+
+static gboolean
+load_script (const gchar *file,
+             GPtrArray *scripts,
+             GError **error)
+{
+    gchar *contents;
+    gchar **lines;
+    PortScript *script = NULL;
+    Exchange *exchange = NULL;
+    guint i;
+
+    if (!g_file_get_contents (file, &contents, NULL, error))
+        return FALSE;
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    for (i = 0; lines[i]; i++) {
+        gchar *line = g_strstrip (lines[i]);
+        gchar **words;
+
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        if (line[0] == '[') {
+            gchar *end;
+            guint type;
+
+            end = strchr (line, ']');
+            if (!end)
+                goto invalid;
+            *end = '\0';
+            words = g_strsplit_set (line + 1, " \t", 2);
+            for (type = 0; type < G_N_ELEMENTS (port_type_names); type++) {
+                if (g_str_equal (words[0], port_type_names[type]))
+                    break;
+            }
+            if (type == G_N_ELEMENTS (port_type_names) || !words[1]) {
+                g_strfreev (words);
+                goto invalid;
+            }
+            script = port_script_new (type, g_strstrip (words[1]));
+            g_ptr_array_add (scripts, script);
+            exchange = NULL;
+            g_strfreev (words);
+            continue;
+        }
+
+        if (!script)
+            goto invalid;
+
+        if (line[0] == '>') {
+            line = g_strstrip (line + 1);
+            exchange = g_slice_new0 (Exchange);
+            exchange->reply = g_byte_array_new ();
+            if (script->type == PORT_TYPE_QCDM) {
+                exchange->request = hex_to_bytes (line);
+                if (!exchange->request || exchange->request->len == 0) {
+                    if (exchange->request)
+                        g_byte_array_unref (exchange->request);
+                    g_byte_array_unref (exchange->reply);
+                    g_slice_free (Exchange, exchange);
+                    goto invalid;
+                }
+            } else {
+                gchar *upper;
+
+                upper = g_ascii_strup (line, -1);
+                exchange->request = g_byte_array_new ();
+                g_byte_array_append (exchange->request, (const guint8 *)upper, strlen (upper));
+                if (strchr (upper, '*'))
+                    exchange->pattern = upper;
+                else
+                    g_free (upper);
+            }
+            port_script_add_exchange (script, exchange);
+            continue;
+        }
+
+        if (line[0] == '<') {
+            line = g_strchug (line + 1);
+            if (script->type == PORT_TYPE_NMEA) {
+                g_byte_array_append (script->nmea, (const guint8 *)line, strlen (line));
+                g_byte_array_append (script->nmea, (const guint8 *)"\r\n", 2);
+            } else if (!exchange)
+                goto invalid;
+            else if (script->type == PORT_TYPE_QCDM) {
+                GByteArray *bytes;
+
+                bytes = hex_to_bytes (line);
+                if (!bytes)
+                    goto invalid;
+                g_byte_array_append (exchange->reply, bytes->data, bytes->len);
+                g_byte_array_unref (bytes);
+            } else
+                append_at_line (exchange->reply, line);
+            continue;
+        }
+
+        words = g_strsplit_set (line, " \t", 4);
+        if (g_str_equal (words[0], "latency") && words[1])
+            script->latency_ms = atoi (words[1]);
+        else if (g_str_equal (words[0], "delay") && words[1] && exchange)
+            exchange->delay_ms = atoi (words[1]);
+        else if (g_str_equal (words[0], "dribble") && words[1] && words[2]) {
+            script->dribble_bytes = atoi (words[1]);
+            script->dribble_ms = atoi (words[2]);
+        } else if (g_str_equal (words[0], "echo") && words[1])
+            script->echo = g_str_equal (words[1], "on");
+        else if (g_str_equal (words[0], "urc") && words[1] && words[2] && words[3]) {
+            script->urc_ms = atoi (words[1]);
+            script->urc_burst = MAX (1, atoi (words[2]));
+            g_free (script->urc);
+            script->urc = g_strdup (words[3]);
+        } else if (g_str_equal (words[0], "fault") && words[1] && words[2]) {
+            script->fault_rate = g_ascii_strtod (words[1], NULL);
+            script->faults = parse_faults (words[2]);
+        } else if (g_str_equal (words[0], "nmea") && words[1])
+            script->nmea_ms = MAX (1, atoi (words[1]));
+        else {
+            g_strfreev (words);
+            goto invalid;
+        }
+        g_strfreev (words);
+    }
+
+    g_strfreev (lines);
+    return TRUE;
+
+invalid:
+    script_error (error, file, i + 1, "invalid line");
+    g_strfreev (lines);
+    return FALSE;
+}
+
+/* Every TX record of a port is a request, answered with the RX records
+ * which follow it until the next request */
+static gboolean
+load_capture (const gchar *file,
+              GPtrArray *scripts,
+              GError **error)
+{
+    gchar *contents;
+    gsize len, pos;
+    PortScript *script = NULL;
+    Exchange *exchange = NULL;
+
+    if (!g_file_get_contents (file, &contents, &len, error))
+        return FALSE;
+
+    if (len < MM_SERIAL_CAPTURE_HEADER_SIZE ||
+        memcmp (contents, MM_SERIAL_CAPTURE_MAGIC, 4) != 0 ||
+        contents[4] != MM_SERIAL_CAPTURE_VERSION) {
+        g_free (contents);
+        return script_error (error, file, 0, "not a capture file");
+    }
+
+    for (pos = MM_SERIAL_CAPTURE_HEADER_SIZE; pos + MM_SERIAL_CAPTURE_RECORD_SIZE <= len;) {
+        const guint8 *record = (const guint8 *)&contents[pos];
+        const guint8 *data = record + MM_SERIAL_CAPTURE_RECORD_SIZE;
+        guint16 data_len;
+
+        data_len = record[2] | (record[3] << 8);
+        pos += MM_SERIAL_CAPTURE_RECORD_SIZE + data_len;
+        if (pos > len)
+            break;
+
+        switch (record[0]) {
+        case MM_SERIAL_CAPTURE_RECORD_PORT: {
+            gchar *name;
+
+            /* Ports which turn out to get requests are given a type then */
+            name = g_strndup ((const gchar *)data, data_len);
+            script = port_script_new (PORT_TYPE_NMEA, name);
+            script->echo = FALSE;
+            g_ptr_array_add (scripts, script);
+            exchange = NULL;
+            g_free (name);
+            break;
+        }
+        case MM_SERIAL_CAPTURE_RECORD_TX:
+            if (!script || data_len == 0)
+                break;
+            if (script->exchanges->len == 0)
+                script->type = ((data_len >= 2 && g_ascii_strncasecmp ((const gchar *)data, "AT", 2) == 0) ?
+                                PORT_TYPE_AT : PORT_TYPE_QCDM);
+
+            exchange = g_slice_new0 (Exchange);
+            exchange->reply = g_byte_array_new ();
+            exchange->request = g_byte_array_new ();
+            if (script->type == PORT_TYPE_AT) {
+                gchar *upper;
+
+                upper = g_ascii_strup ((const gchar *)data, data_len);
+                g_strstrip (upper);
+                g_byte_array_append (exchange->request, (const guint8 *)upper, strlen (upper));
+                g_free (upper);
+            } else {
+                gchar frame[MAX_FRAME_LEN];
+                gsize decap_len = 0, used = 0;
+                qcdmbool more = FALSE;
+
+                if (dm_decapsulate_buffer ((const gchar *)data, data_len,
+                                           frame, sizeof (frame),
+                                           &decap_len, &used, &more) && !more)
+                    g_byte_array_append (exchange->request, (const guint8 *)frame, decap_len);
+                else
+                    g_byte_array_append (exchange->request, data, data_len);
+            }
+            port_script_add_exchange (script, exchange);
+            break;
+        case MM_SERIAL_CAPTURE_RECORD_RX:
+            if (!script)
+                break;
+            if (script->type == PORT_TYPE_NMEA)
+                g_byte_array_append (script->nmea, data, data_len);
+            else if (exchange && script->type == PORT_TYPE_AT)
+                g_byte_array_append (exchange->reply, data, data_len);
+            else if (exchange) {
+                gchar frame[MAX_FRAME_LEN];
+                gsize decap_len = 0, used = 0;
+                qcdmbool more = FALSE;
+
+                /* Replies are framed again when sent */
+                if (dm_decapsulate_buffer ((const gchar *)data, data_len,
+                                           frame, sizeof (frame),
+                                           &decap_len, &used, &more) && !more)
+                    g_byte_array_append (exchange->reply, (const guint8 *)frame, decap_len);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    g_free (contents);
+    return TRUE;
+}
+
+/*****************************************************************************/
+/* Ports */
+
+static gboolean port_write_cb (SimPort *port);
+
+static void
+port_flush (SimPort *port)
+{
+    if (!port->write_id && port->out->len > 0)
+        port->write_id = g_idle_add ((GSourceFunc)port_write_cb, port);
+}
+
+static void
+port_close (SimPort *port)
+{
+    if (port->master < 0)
+        return;
+
+    g_printerr ("modem %u: %s port %s closed\n", port->modem, port_type_names[port->script->type], port->script->name);
+
+    if (port->read_id)
+        g_source_remove (port->read_id);
+    if (port->write_id)
+        g_source_remove (port->write_id);
+    if (port->reply_id)
+        g_source_remove (port->reply_id);
+    if (port->urc_id)
+        g_source_remove (port->urc_id);
+    if (port->nmea_id)
+        g_source_remove (port->nmea_id);
+    port->read_id = port->write_id = port->reply_id = port->urc_id = port->nmea_id = 0;
+
+    close (port->master);
+    close (port->slave);
+    port->master = port->slave = -1;
+}
+
+static gboolean
+port_write_cb (SimPort *port)
+{
+    gsize len;
+    gssize written;
+
+    port->write_id = 0;
+
+    len = port->out->len;
+    if (port->script->dribble_bytes > 0)
+        len = MIN (len, port->script->dribble_bytes);
+
+    written = write (port->master, port->out->data, len);
+    if (written < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            port_close (port);
+            return FALSE;
+        }
+        written = 0;
+    }
+    g_byte_array_remove_range (port->out, 0, written);
+
+    if (port->out->len > 0) {
+        guint interval = (port->script->dribble_bytes > 0 ? port->script->dribble_ms : 1);
+
+        port->write_id = g_timeout_add (written > 0 ? interval : 1, (GSourceFunc)port_write_cb, port);
+    }
+    return FALSE;
+}
+
+static const Exchange *
+port_find_exchange (SimPort *port,
+                    const guint8 *request,
+                    gsize request_len)
+{
+    PortScript *script = port->script;
+    guint i;
+
+    if (script->type == PORT_TYPE_AT) {
+        ExchangeSet *set;
+        gchar *key;
+
+        key = g_strndup ((const gchar *)request, request_len);
+        set = g_hash_table_lookup (script->exact, key);
+        if (set) {
+            g_free (key);
+            return g_ptr_array_index (set->exchanges, set->next++ % set->exchanges->len);
+        }
+
+        for (i = 0; i < script->exchanges->len; i++) {
+            const Exchange *exchange = g_ptr_array_index (script->exchanges, i);
+
+            if (exchange->pattern && g_pattern_match_simple (exchange->pattern, key)) {
+                g_free (key);
+                return exchange;
+            }
+        }
+        g_free (key);
+        return NULL;
+    }
+
+    /* QCDM, by prefix */
+    for (i = 0; i < script->exchanges->len; i++) {
+        const Exchange *exchange = g_ptr_array_index (script->exchanges, i);
+
+        if (exchange->request->len <= request_len &&
+            memcmp (exchange->request->data, request, exchange->request->len) == 0)
+            return exchange;
+    }
+    return NULL;
+}
+
+static gboolean
+at_reply_is_ok (GByteArray *reply)
+{
+    return (reply->len >= 6 && memcmp (&reply->data[reply->len - 6], "\r\nOK\r\n", 6) == 0);
+}
+
+/* Builds the reply to an AT command line; lines with several commands not
+ * in the script get the replies of each command, stopping at the first one
+ * which doesn't succeed, with a single OK at the end */
+static GByteArray *
+port_build_at_reply (SimPort *port,
+                     GByteArray *request,
+                     guint *delay_ms)
+{
+    const Exchange *exchange;
+    GByteArray *reply;
+    gchar *line, **commands;
+    guint i;
+
+    reply = g_byte_array_new ();
+    exchange = port_find_exchange (port, request->data, request->len);
+    if (exchange) {
+        g_byte_array_append (reply, exchange->reply->data, exchange->reply->len);
+        *delay_ms = exchange->delay_ms;
+        return reply;
+    }
+
+    line = g_strndup ((const gchar *)request->data, request->len);
+    if (!strchr (line, ';') || !g_str_has_prefix (line, "AT")) {
+        append_at_line (reply, "ERROR");
+        g_free (line);
+        return reply;
+    }
+
+    commands = g_strsplit (line + 2, ";", -1);
+    for (i = 0; commands[i]; i++) {
+        gchar *command;
+
+        command = g_strconcat ("AT", commands[i], NULL);
+        exchange = port_find_exchange (port, (const guint8 *)command, strlen (command));
+        g_free (command);
+
+        if (!exchange || !at_reply_is_ok (exchange->reply)) {
+            if (exchange)
+                g_byte_array_append (reply, exchange->reply->data, exchange->reply->len);
+            else
+                append_at_line (reply, "ERROR");
+            break;
+        }
+
+        g_byte_array_append (reply, exchange->reply->data, exchange->reply->len - 6);
+        *delay_ms = MAX (*delay_ms, exchange->delay_ms);
+        if (!commands[i + 1])
+            append_at_line (reply, "OK");
+    }
+    g_strfreev (commands);
+    g_free (line);
+    return reply;
+}
+
+static GByteArray *
+port_build_qcdm_reply (SimPort *port,
+                       GByteArray *request,
+                       gboolean fail,
+                       guint *delay_ms)
+{
+    const Exchange *exchange;
+    GByteArray *payload, *reply;
+    gsize len;
+
+    exchange = fail ? NULL : port_find_exchange (port, request->data, request->len);
+    payload = g_byte_array_sized_new (request->len + 3);
+    if (exchange) {
+        g_byte_array_append (payload, exchange->reply->data, exchange->reply->len);
+        *delay_ms = exchange->delay_ms;
+    } else {
+        guint8 bad = QCDM_CMD_BAD_CMD;
+
+        g_byte_array_append (payload, &bad, 1);
+        g_byte_array_append (payload, request->data, request->len);
+    }
+
+    /* Room for the CRC, and for escaping every byte */
+    g_byte_array_set_size (payload, payload->len + 2);
+    reply = g_byte_array_sized_new (payload->len * 2 + 1);
+    g_byte_array_set_size (reply, payload->len * 2 + 1);
+    len = dm_encapsulate_buffer ((gchar *)payload->data, payload->len - 2, payload->len,
+                                 (gchar *)reply->data, reply->len);
+    g_byte_array_set_size (reply, len);
+    g_byte_array_unref (payload);
+    return reply;
+}
+
+static gboolean port_reply_cb (SimPort *port);
+
+static void
+port_schedule_reply (SimPort *port)
+{
+    GByteArray *request;
+    GByteArray *reply = NULL;
+    guint fault = 0;
+    guint delay_ms = 0;
+
+    if (port->reply_id || g_queue_is_empty (port->requests))
+        return;
+
+    request = g_queue_peek_head (port->requests);
+
+    if (port->script->fault_rate > 0 &&
+        port->script->faults &&
+        g_random_double_range (0, 100) < port->script->fault_rate) {
+        guint kinds[G_N_ELEMENTS (fault_names)];
+        guint n = 0, i;
+
+        for (i = 0; i < G_N_ELEMENTS (fault_names); i++) {
+            if (port->script->faults & (1 << i))
+                kinds[n++] = 1 << i;
+        }
+        fault = kinds[g_random_int_range (0, n)];
+    }
+
+    if (fault == FAULT_CLOSE) {
+        port_close (port);
+        return;
+    }
+
+    if (fault != FAULT_DROP) {
+        if (port->script->type == PORT_TYPE_QCDM)
+            reply = port_build_qcdm_reply (port, request, fault == FAULT_ERROR, &delay_ms);
+        else if (fault == FAULT_ERROR) {
+            reply = g_byte_array_new ();
+            append_at_line (reply, "ERROR");
+        } else
+            reply = port_build_at_reply (port, request, &delay_ms);
+
+        if (fault == FAULT_GARBLE && reply->len > 0) {
+            guint i;
+
+            for (i = 0; i < 3; i++)
+                reply->data[g_random_int_range (0, reply->len)] ^= (guint8)g_random_int_range (1, 256);
+        }
+    }
+
+    /* The reply replaces the request in the queue until it's sent */
+    g_byte_array_unref (g_queue_pop_head (port->requests));
+    g_queue_push_head (port->requests, reply);
+    port->reply_id = g_timeout_add (port->script->latency_ms + delay_ms,
+                                    (GSourceFunc)port_reply_cb,
+                                    port);
+}
+
+static gboolean
+port_reply_cb (SimPort *port)
+{
+    GByteArray *reply;
+
+    port->reply_id = 0;
+    reply = g_queue_pop_head (port->requests);
+    if (reply) {
+        g_byte_array_append (port->out, reply->data, reply->len);
+        g_byte_array_unref (reply);
+        port_flush (port);
+    }
+    port_schedule_reply (port);
+    return FALSE;
+}
+
+static void
+port_take_request (SimPort *port,
+                   const guint8 *data,
+                   gsize len)
+{
+    GByteArray *request;
+
+    request = g_byte_array_sized_new (len);
+    g_byte_array_append (request, data, len);
+    g_queue_push_tail (port->requests, request);
+    port_schedule_reply (port);
+}
+
+static void
+port_process_input (SimPort *port)
+{
+    if (port->script->type == PORT_TYPE_AT) {
+        guint8 *end;
+
+        while ((end = memchr (port->in->data, '\r', port->in->len)) != NULL) {
+            gsize len = end - port->in->data;
+            gchar *line;
+
+            if (port->script->echo) {
+                g_byte_array_append (port->out, port->in->data, len + 1);
+                port_flush (port);
+            }
+
+            line = g_ascii_strup ((const gchar *)port->in->data, len);
+            g_strstrip (line);
+            if (line[0])
+                port_take_request (port, (const guint8 *)line, strlen (line));
+            g_free (line);
+            g_byte_array_remove_range (port->in, 0, len + 1);
+        }
+        return;
+    }
+
+    if (port->script->type == PORT_TYPE_QCDM) {
+        gchar frame[MAX_FRAME_LEN];
+
+        while (port->in->len > 0) {
+            gsize decap_len = 0, used = 0;
+            qcdmbool more = FALSE;
+            gboolean success;
+
+            success = dm_decapsulate_buffer ((const gchar *)port->in->data, port->in->len,
+                                             frame, sizeof (frame),
+                                             &decap_len, &used, &more);
+            if (more)
+                break;
+            g_byte_array_remove_range (port->in, 0, used > 0 ? used : port->in->len);
+            if (success && decap_len > 0)
+                port_take_request (port, (const guint8 *)frame, decap_len);
+        }
+        return;
+    }
+
+    /* NMEA ports only talk */
+    g_byte_array_set_size (port->in, 0);
+}
+
+static gboolean
+port_read_cb (GIOChannel *channel,
+              GIOCondition condition,
+              SimPort *port)
+{
+    guint8 buf[512];
+    gssize n;
+
+    if (condition & (G_IO_HUP | G_IO_ERR)) {
+        /* No one has the port open; wait for the next user */
+        g_usleep (10000);
+        return TRUE;
+    }
+
+    n = read (port->master, buf, sizeof (buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR || errno == EIO))
+        return TRUE;
+    if (n <= 0) {
+        port->read_id = 0;
+        port_close (port);
+        return FALSE;
+    }
+
+    /* The serial port code opens ports with TIOCEXCL and never clears it;
+     * since the slave stays open here that would outlive the user and keep
+     * non-root processes from opening the port again. */
+    ioctl (port->slave, TIOCNXCL);
+
+    g_byte_array_append (port->in, buf, n);
+    port_process_input (port);
+    return TRUE;
+}
+
+static gboolean
+port_urc_cb (SimPort *port)
+{
+    guint i;
+
+    if (port->out->len > MAX_PENDING_OUT)
+        return TRUE;
+
+    for (i = 0; i < port->script->urc_burst; i++)
+        append_at_line (port->out, port->script->urc);
+    port_flush (port);
+    return TRUE;
+}
+
+static gboolean
+port_nmea_cb (SimPort *port)
+{
+    if (port->out->len > MAX_PENDING_OUT)
+        return TRUE;
+
+    g_byte_array_append (port->out, port->script->nmea->data, port->script->nmea->len);
+    port_flush (port);
+    return TRUE;
+}
+
+static SimPort *
+port_new (PortScript *script,
+          guint modem,
+          GError **error)
+{
+    SimPort *port;
+    struct termios tio;
+    GIOChannel *channel;
+    int master, slave;
+    char path[128];
+
+    if (openpty (&master, &slave, path, NULL, NULL) < 0) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "couldn't create pseudo terminal: %s", g_strerror (errno));
+        return NULL;
+    }
+
+    /* Raw mode, so that data goes through untouched; the slave is kept open
+     * so that the master doesn't see a hangup between users */
+    if (tcgetattr (slave, &tio) == 0) {
+        cfmakeraw (&tio);
+        tcsetattr (slave, TCSANOW, &tio);
+    }
+    fcntl (master, F_SETFL, fcntl (master, F_GETFL) | O_NONBLOCK);
+
+    port = g_slice_new0 (SimPort);
+    port->script = script;
+    port->modem = modem;
+    port->master = master;
+    port->slave = slave;
+    port->path = g_strdup (path);
+    port->in = g_byte_array_new ();
+    port->out = g_byte_array_new ();
+    port->requests = g_queue_new ();
+
+    channel = g_io_channel_unix_new (master);
+    port->read_id = g_io_add_watch (channel,
+                                    G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                    (GIOFunc)port_read_cb,
+                                    port);
+    g_io_channel_unref (channel);
+
+    if (script->type == PORT_TYPE_AT && script->urc && script->urc_ms > 0)
+        port->urc_id = g_timeout_add (script->urc_ms, (GSourceFunc)port_urc_cb, port);
+    if (script->type == PORT_TYPE_NMEA && script->nmea->len > 0)
+        port->nmea_id = g_timeout_add (script->nmea_ms, (GSourceFunc)port_nmea_cb, port);
+
+    return port;
+}
+
+/*****************************************************************************/
+
+static void
+apply_overrides (PortScript *script)
+{
+    if (latency_ms >= 0)
+        script->latency_ms = latency_ms;
+    if (dribble_bytes >= 0) {
+        script->dribble_bytes = dribble_bytes;
+        script->dribble_ms = MAX (1, dribble_ms);
+    }
+    if (fault_rate >= 0)
+        script->fault_rate = fault_rate;
+    if (faults)
+        script->faults = parse_faults (faults);
+    else if (fault_rate > 0 && !script->faults)
+        script->faults = FAULT_DROP | FAULT_ERROR | FAULT_GARBLE;
+    if (urc_ms >= 0 && script->type == PORT_TYPE_AT) {
+        script->urc_ms = urc_ms;
+        script->urc_burst = MAX (1, urc_burst);
+        if (!script->urc)
+            script->urc = g_strdup ("+CIEV: 2,3");
+    }
+}
+
+int main (int argc, char **argv)
+{
+    GOptionContext *context;
+    GPtrArray *scripts;
+    GMainLoop *loop;
+    GError *error = NULL;
+    gint modem;
+    guint i;
+
+    context = g_option_context_new ("- simulate modems over pseudo terminals");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("error: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free (context);
+
+    if (!script_file == !capture_file) {
+        g_printerr ("error: either a script or a capture file is needed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (seed)
+        g_random_set_seed (seed);
+
+    scripts = g_ptr_array_new_with_free_func ((GDestroyNotify)port_script_free);
+    if (!(script_file ?
+          load_script (script_file, scripts, &error) :
+          load_capture (capture_file, scripts, &error))) {
+        g_printerr ("error: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    if (scripts->len == 0) {
+        g_printerr ("error: no ports\n");
+        return EXIT_FAILURE;
+    }
+    g_ptr_array_foreach (scripts, (GFunc)apply_overrides, NULL);
+
+    if (link_dir)
+        g_mkdir_with_parents (link_dir, 0755);
+
+    for (modem = 0; modem < MAX (1, n_modems); modem++) {
+        for (i = 0; i < scripts->len; i++) {
+            PortScript *script = g_ptr_array_index (scripts, i);
+            SimPort *port;
+
+            port = port_new (script, modem, &error);
+            if (!port) {
+                g_printerr ("error: %s\n", error->message);
+                return EXIT_FAILURE;
+            }
+
+            if (link_dir) {
+                gchar *name, *link;
+
+                name = g_strdup_printf ("%d-%s", modem, script->name);
+                link = g_build_filename (link_dir, name, NULL);
+                unlink (link);
+                if (symlink (port->path, link) < 0)
+                    g_printerr ("warning: couldn't create link %s: %s\n", link, g_strerror (errno));
+                g_free (link);
+                g_free (name);
+            }
+
+            g_print ("%d %s %s %s\n", modem, port_type_names[script->type], script->name, port->path);
+        }
+    }
+    g_print ("READY\n");
+    fflush (stdout);
+
+    /* Ports live until the simulator is killed */
+    loop = g_main_loop_new (NULL, FALSE);
+    g_main_loop_run (loop);
+    g_main_loop_unref (loop);
+    g_ptr_array_unref (scripts);
+    return EXIT_SUCCESS;
+}
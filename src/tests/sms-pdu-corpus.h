@@ -0,0 +1,152 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Corpus of SMS PDUs, as listed by +CMGL in PDU mode, shared by the PDU
+ * benchmark and the fuzzing target (as seed inputs).
+ *
+ * It holds SMS-DELIVER PDUs received from several operators, along with
+ * synthetic ones covering every kind of user data handled by the parser:
+ * GSM 7-bit with and without a user data header (so with fill bits before
+ * the text), UCS2, 8-bit data, with and without SMSC. Status reports and
+ * malformed PDUs are included as well; @decodes tells whether the parser is
+ * expected to accept each of them.
+ */
+
+#ifndef SMS_PDU_CORPUS_H
+#define SMS_PDU_CORPUS_H
+
+#include <glib.h>
+
+typedef struct {
+    const gchar *name;
+    gboolean decodes;
+    const gchar *hexpdu;
+} SmsPduCorpusEntry;
+
+static const SmsPduCorpusEntry sms_pdu_corpus[] = {
+    /* Received */
+    { "real-deliver-gsm7", TRUE,
+      "07912104442961F4040B916171957291F800001120821105050A6AC8B2BC7C9A83C220F6"
+      "DB7D2ECB41EDF27C1E3E97411BDE06754FD3D1A0F9BB5D0695F1F4B29B5C2683C6E8B03C"
+      "3CA697E5F34D6AE303D1D1F2F7DD0D4ABB59A0797D8C0685E7A00028EC26832A960B28EC"
+      "2683BE6050780EBA97D96C17" },
+    { "real-deliver-ucs2-alnum", TRUE,
+      "07919730071111F10414D04937BD2C7797E9D3E614000811309291024061080442043504"
+      "410442" },
+    { "real-deliver-dcs-f1", TRUE,
+      "07913306091093F0040485810000F111604231805180A049B7F90D9A1AA5A01668F8769B"
+      "D3E4B29B9E2EB359A03FC85D06A9C3ED707A0EA2CBC3EE79BB4CA7CBCBA05643617DA7C7"
+      "6990FD4D979741EE77DD5E0ED741ED371D442E83E0E1F9BC0CD281E677D9B84C06C1DF75"
+      "39E85C9097E520FB9B2E2F83C6EF369C5E064D8D52D0BC2E07DDEF77D7DC2C7799E5A077"
+      "1D040FCB41F402BB0047BFDD6550B80ECAD966" },
+    { "real-deliver-udhi-16bit", TRUE,
+      "07911356131313F64004850120390011609232239180A006080400100201D7327BFD6EB3"
+      "40E2321BF46E83EA7790F59D1E97DBE1341B442F83C465763D3DA797E56537C81D0ECB41"
+      "AB59CC1693C16031D96C064241E5656838AF03A96230982A269BCD462917C8FA4E8FCBED"
+      "709A0D7ABBE9F6B0FB5C7683D27350984D4FABC9A0B33C4C4FCF5D20EBFB2D079DCB6279"
+      "3DBD06D9C36E50FB2D4E97D9A0B49B5E96BBCB" },
+    /* Synthetic */
+    { "gsm7-short", TRUE,
+      "07914306073011F0040B914306103254F600002101312143654005C8329BFD06" },
+    { "gsm7-160", TRUE,
+      "07914306073011F0040B914306103254F60000210131214365409CCCB7BCDC06A5E1F37A"
+      "1B447EB3DF72D03C4D0785DB653A0B347EBBE7E531BD4CAFCB4161721A9E9E8FD3EE33A8"
+      "CC4ED359A079990C22BF41E5747DDE7E9341F4721BFE9683D2EE719A9C26D7DD74509D0E"
+      "6287C56F791954A683C86FF65B5E06B5C36777181466A7E3F5B00B54A583CAEE741B1426"
+      "83DA6977BA0DB297DDE9709B058AD7D37390FB0D" },
+    { "gsm7-extended", TRUE,
+      "07914306073011F0040B914306103254F60000210131214365401DD3309BFCD6816A2C18"
+      "6C537681846FF71B442E83623018A82904" },
+    { "gsm7-national", TRUE,
+      "07914306073011F004098106103254F600002101312143654011D9775D0E1ABFC965507A"
+      "0EA2DD6231" },
+    { "gsm7-alnum-sender", TRUE,
+      "07914306073011F0040ED0CDB73D3DA787E500002101312143654015C274D96D2FBBD3E4"
+      "37280C6ABEEDE9393D2C07" },
+    { "gsm7-no-smsc", TRUE,
+      "00040B914306103254F600002101312143654013CE3768DA9C0E416937888E4ECF416F77"
+      "19" },
+    { "gsm7-flash", TRUE,
+      "07914306073011F0040B914306103254F6001021013121436540064676788E0E01" },
+    { "gsm7-concat8-1", TRUE,
+      "07914306073011F0440B914306103254F600002101312143654039050003420301A8E8F4"
+      "1C949E83C220F6DB7D06B5CBF379F85C06DDD1E9311A740FCF4173383B4D0789F3203ABA"
+      "0C9A97DD64" },
+    { "gsm7-concat8-2", TRUE,
+      "07914306073011F0440B914306103254F600002101312143654039050003420302CA7250"
+      "DA0DA2A3E5E532081E96D3E72C50393C4683DE66101D5D6E83C661B93C9F769F4161D0F8"
+      "ED1E87E965" },
+    { "gsm7-concat8-3", TRUE,
+      "07914306073011F0440B914306103254F60000210131214365402E050003420303DC617A"
+      "FAED06A1CB6172590EBAA7E96850D80DC2B5C4693A485E3697E565F7B8EC0201" },
+    { "gsm7-concat16-1", TRUE,
+      "07914306073011F0440B914306103254F600002101312143654044060804123402015474"
+      "7A0E4ACF416110FBED3E83DAE5F93C7C2E83EEE8F4180DBA87E7A0399C9DA683C479101D"
+      "5D06CDCB6E72590E4ABB4174B4BC0C" },
+    { "gsm7-concat16-2", TRUE,
+      "07914306073011F0440B914306103254F600002101312143654044060804123402026510"
+      "3C2CA7CF59A072788C06BDCD203ABADC068DC372793EED3E83C2A0F1DB3D0ED3CBEE303D"
+      "FD7683D0E530B92C07DDD37434280C" },
+    { "gsm7-udh-port", TRUE,
+      "07914306073011F0440B914306103254F6000021013121436540160605040B8423F0D0B7"
+      "9C0E0A93C9F2F27C5E2603" },
+    { "ucs2-short", TRUE,
+      "07914306073011F0040B914306103254F60008210131214365400C041F04400438043204"
+      "350442" },
+    { "ucs2-emoji-free", TRUE,
+      "07914306073011F0040B914306103254F60008210131214365401E00C700610020007600"
+      "61003F002065E5672C8A9E306E30C630AD30B930C8" },
+    { "ucs2-concat8-1", TRUE,
+      "07914306073011F0440B914306103254F600082101312143654038050003770201042D04"
+      "42043E00200434043B0438043D043D043E043500200441043E043E043104490435043D04"
+      "380435002C002004400430" },
+    { "ucs2-concat8-2", TRUE,
+      "07914306073011F0440B914306103254F600082101312143654036050003770202043704"
+      "340435043B0451043D043D043E04350020043D0430002004340432043500200447043004"
+      "4104420438002E0020" },
+    { "8bit-data", TRUE,
+      "07914306073011F0040B914306103254F600042101312143654028000102030405060708"
+      "090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F2021222324252627" },
+    { "8bit-wap-push", TRUE,
+      "07914306073011F0440B914306103254F600F521013121436540210605040B8423F00106"
+      "03BEAF84687474703A2F2F6578616D706C652E636F6D2F78" },
+    { "8bit-class0", TRUE,
+      "07914306073011F0040B914306103254F600F42101312143654004DEADBEEF" },
+    /* Status reports, not handled */
+    { "status-report", FALSE,
+      "07914306073011F0062A0B914306103254F6210131214365402101312143654000" },
+    { "status-report-no-smsc", FALSE,
+      "00062A0B914306103254F6210131214365402101312143654000" },
+    /* Malformed; bogus headers or text are ignored, but not truncated PDUs */
+    { "truncated-header", FALSE,
+      "0791" },
+    { "empty-smsc-truncated", FALSE,
+      "00" },
+    { "udl-overflow", FALSE,
+      "07914306073011F0040B914306103254F600002101312143654099C8329BFD06" },
+    { "udhl-overflow", FALSE,
+      "07914306073011F0440B914306103254F600002101312143654005FF0003420301" },
+    { "udh-ie-overflow", TRUE,
+      "07914306073011F0440B914306103254F6000021013121436540080600FF420301A8" },
+    { "udh-short-concat-ie", TRUE,
+      "07914306073011F0440B914306103254F60000210131214365400904000142A8E8F41C01" },
+    { "ucs2-odd-length", TRUE,
+      "07914306073011F0040B914306103254F60008210131214365400304200420" },
+    { "ucs2-lone-surrogate", TRUE,
+      "07914306073011F0040B914306103254F600082101312143654002D83D" },
+};
+
+#endif /* SMS_PDU_CORPUS_H */
@@ -15,9 +15,18 @@
 
 #include <config.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <pty.h>
 #include <glib.h>
 
+#include <ModemManager.h>
+#include <mm-errors-types.h>
+
 #include "mm-at-serial-port.h"
+#include "mm-serial-parsers.h"
+#include "mm-modem-helpers.h"
 #include "mm-log.h"
 
 typedef struct {
@@ -64,6 +73,699 @@ at_serial_echo_removal (void)
     }
 }
 
+/*****************************************************************************/
+
+typedef struct {
+    guint n_creg;
+    guint n_ciev;
+    guint n_owancall;
+    guint n_cmt;
+    gchar *ciev_indicator;
+    gchar *cmt_pdu;
+} UnsolicitedTestContext;
+
+static void
+creg_received (MMAtSerialPort *port,
+               GMatchInfo *match_info,
+               UnsolicitedTestContext *ctx)
+{
+    ctx->n_creg++;
+}
+
+static void
+ciev_received (MMAtSerialPort *port,
+               GMatchInfo *match_info,
+               UnsolicitedTestContext *ctx)
+{
+    ctx->n_ciev++;
+    g_free (ctx->ciev_indicator);
+    ctx->ciev_indicator = g_match_info_fetch (match_info, 1);
+}
+
+static void
+owancall_received (MMAtSerialPort *port,
+                   GMatchInfo *match_info,
+                   UnsolicitedTestContext *ctx)
+{
+    ctx->n_owancall++;
+}
+
+static void
+cmt_received (MMAtSerialPort *port,
+              GMatchInfo *match_info,
+              UnsolicitedTestContext *ctx)
+{
+    ctx->n_cmt++;
+    g_free (ctx->cmt_pdu);
+    ctx->cmt_pdu = g_match_info_fetch (match_info, 2);
+}
+
+static const gchar *unsolicited_input =
+    "\r\n+CREG: 1\r\n"
+    "\r\n+CIEV: signal,3\r\n"
+    "\r\n+CSQ: 20,99\r\n"
+    "_OWANCALL: 1, 1\r\n"
+    "\r\n+CMT: ,23\r\n07913366003000F1040B913366611346F20000312170312142800474747A0E\r\n"
+    "\r\n+CGREG: 5\r\n"
+    "\r\nOK\r\n";
+
+static const gchar *unsolicited_output =
+    "\r\n+CSQ: 20,99\r\n"
+    "\r\nOK\r\n";
+
+static void
+run_unsolicited_test (guint chunk_size)
+{
+    UnsolicitedTestContext ctx = { 0 };
+    MMAtSerialPort *port;
+    GPtrArray *array;
+    GRegex *regex;
+    GByteArray *response;
+    gsize len;
+    gsize offset = 0;
+    guint i;
+
+    port = mm_at_serial_port_new ("ttyFAKE0");
+
+    /* CREG handlers; declaring prefixes through a group of alternatives */
+    array = mm_3gpp_creg_regex_get (FALSE);
+    for (i = 0; i < array->len; i++)
+        mm_at_serial_port_add_unsolicited_msg_handler (port,
+                                                       g_ptr_array_index (array, i),
+                                                       (MMAtSerialUnsolicitedMsgFn) creg_received,
+                                                       &ctx,
+                                                       NULL);
+    mm_3gpp_creg_regex_destroy (array);
+
+    /* CIEV handler, with a simple prefix */
+    regex = mm_3gpp_ciev_regex_get ();
+    mm_at_serial_port_add_unsolicited_msg_handler (port,
+                                                   regex,
+                                                   (MMAtSerialUnsolicitedMsgFn) ciev_received,
+                                                   &ctx,
+                                                   NULL);
+    g_regex_unref (regex);
+
+    /* A handler without a prefix, run over the whole response */
+    regex = g_regex_new ("_OWANCALL: (\\d),\\s*(\\d)\\r\\n", G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, NULL);
+    mm_at_serial_port_add_unsolicited_msg_handler (port,
+                                                   regex,
+                                                   (MMAtSerialUnsolicitedMsgFn) owancall_received,
+                                                   &ctx,
+                                                   NULL);
+    g_regex_unref (regex);
+
+    /* A message spanning several lines */
+    regex = g_regex_new ("\\r\\n\\+CMT: (.*)\\r\\n(.*)\\r\\n", G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, NULL);
+    mm_at_serial_port_add_unsolicited_msg_handler (port,
+                                                   regex,
+                                                   (MMAtSerialUnsolicitedMsgFn) cmt_received,
+                                                   &ctx,
+                                                   NULL);
+    g_regex_unref (regex);
+
+    /* Feed the input in chunks */
+    len = strlen (unsolicited_input);
+    response = g_byte_array_sized_new (len);
+    while (offset < len) {
+        gsize n = MIN (chunk_size, len - offset);
+
+        g_byte_array_append (response, (const guint8 *) unsolicited_input + offset, n);
+        offset += n;
+        MM_SERIAL_PORT_GET_CLASS (port)->parse_unsolicited (MM_SERIAL_PORT (port), response);
+    }
+
+    g_assert_cmpuint (ctx.n_creg, ==, 2);
+    g_assert_cmpuint (ctx.n_ciev, ==, 1);
+    g_assert_cmpstr (ctx.ciev_indicator, ==, "signal");
+    g_assert_cmpuint (ctx.n_owancall, ==, 1);
+    g_assert_cmpuint (ctx.n_cmt, ==, 1);
+    g_assert_cmpstr (ctx.cmt_pdu, ==, "07913366003000F1040B913366611346F20000312170312142800474747A0E");
+
+    g_assert_cmpuint (response->len, ==, strlen (unsolicited_output));
+    g_assert (memcmp (response->data, unsolicited_output, response->len) == 0);
+
+    g_byte_array_unref (response);
+    g_free (ctx.ciev_indicator);
+    g_free (ctx.cmt_pdu);
+    g_object_unref (port);
+}
+
+static void
+at_serial_unsolicited (void)
+{
+    guint chunk_size;
+
+    /* All at once, and in pieces of every size up to a full line */
+    run_unsolicited_test (G_MAXUINT);
+    for (chunk_size = 1; chunk_size <= 20; chunk_size++)
+        run_unsolicited_test (chunk_size);
+}
+
+/*****************************************************************************/
+
+typedef struct {
+    const gchar *commands[4];
+    const gchar *response;
+    /* NULL if the reply can't be split */
+    const gchar *replies[4];
+} PipelineSplitTest;
+
+static const PipelineSplitTest pipeline_split_tests[] = {
+    {
+        { "+CPIN?", "AT+CREG?", "+COPS?", NULL },
+        "+CPIN: READY\r\n\r\n+CREG: 0,1\r\n\r\n+COPS: 0,0,\"Vodafone\",2",
+        { "+CPIN: READY", "+CREG: 0,1", "+COPS: 0,0,\"Vodafone\",2", NULL }
+    },
+    {
+        /* Multi-line and lower case replies */
+        { "+CGDCONT?", "+CMGF?", NULL },
+        "+CGDCONT: 1,\"IP\",\"internet\"\r\n+CGDCONT: 2,\"IP\",\"mms\"\r\n\r\n+cmgf: 0",
+        { "+CGDCONT: 1,\"IP\",\"internet\"\r\n+CGDCONT: 2,\"IP\",\"mms\"", "+cmgf: 0", NULL }
+    },
+    {
+        /* Missing reply */
+        { "+CPIN?", "+CREG?", "+COPS?", NULL },
+        "+CPIN: READY\r\n\r\n+COPS: 0",
+        { NULL }
+    },
+    {
+        /* Unknown leading line */
+        { "+CPIN?", "+CREG?", NULL },
+        "READY\r\n\r\n+CREG: 0,1",
+        { NULL }
+    },
+    {
+        /* Out of order */
+        { "+CPIN?", "+CREG?", NULL },
+        "+CREG: 0,1\r\n\r\n+CPIN: READY",
+        { NULL }
+    },
+    {
+        /* Not a query */
+        { "+CGMI", "+CREG?", NULL },
+        "Manufacturer\r\n\r\n+CREG: 0,1",
+        { NULL }
+    },
+};
+
+static void
+at_serial_pipeline_split (void)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (pipeline_split_tests); i++) {
+        const PipelineSplitTest *test = &pipeline_split_tests[i];
+        gchar **replies;
+        guint j;
+
+        replies = mm_at_serial_port_split_pipelined_response (test->response,
+                                                              (const gchar **) test->commands);
+        if (!test->replies[0]) {
+            g_assert (replies == NULL);
+            continue;
+        }
+
+        g_assert (replies != NULL);
+        for (j = 0; test->replies[j]; j++)
+            g_assert_cmpstr (replies[j], ==, test->replies[j]);
+        g_assert (replies[j] == NULL);
+        g_strfreev (replies);
+    }
+}
+
+/*****************************************************************************/
+
+static const gchar *records_input =
+    "AT+CMGL=\"ALL\"\r"
+    "\r\n+CMGL: 1,\"REC READ\",\"+1234\",,\"12/10/18,10:00:00+08\"\r\nHello\r\n"
+    "+CMGL: 2,\"REC READ\",\"+1234\",,\"12/10/18,10:01:00+08\"\r\nSee +CMGL: 3\r\nand more\r\n"
+    "\r\n+CMGL: 4,\"REC UNREAD\",\"+5678\",,\"12/10/18,10:02:00+08\"\r\nBye\r\n";
+
+static const gchar *records_output[] = {
+    "+CMGL: 1,\"REC READ\",\"+1234\",,\"12/10/18,10:00:00+08\"\r\nHello",
+    "+CMGL: 2,\"REC READ\",\"+1234\",,\"12/10/18,10:01:00+08\"\r\nSee +CMGL: 3\r\nand more",
+    "+CMGL: 4,\"REC UNREAD\",\"+5678\",,\"12/10/18,10:02:00+08\"\r\nBye",
+};
+
+static void
+run_records_test (guint chunk_size)
+{
+    GByteArray *response;
+    gchar *record;
+    gsize len;
+    gsize offset = 0;
+    guint n = 0;
+
+    len = strlen (records_input);
+    response = g_byte_array_sized_new (len);
+    while (offset < len) {
+        gsize chunk = MIN (chunk_size, len - offset);
+
+        g_byte_array_append (response, (const guint8 *) records_input + offset, chunk);
+        offset += chunk;
+
+        /* Records are only complete once the next one starts */
+        while ((record = mm_at_serial_port_take_record (response, "+CMGL:", FALSE)) != NULL) {
+            g_assert_cmpuint (n, <, G_N_ELEMENTS (records_output) - 1);
+            g_assert_cmpstr (record, ==, records_output[n++]);
+            g_free (record);
+        }
+    }
+
+    /* And the last one once the reply is complete */
+    g_assert_cmpuint (n, ==, G_N_ELEMENTS (records_output) - 1);
+    record = mm_at_serial_port_take_record (response, "+CMGL:", TRUE);
+    g_assert_cmpstr (record, ==, records_output[n]);
+    g_free (record);
+    g_assert_cmpuint (response->len, ==, 0);
+
+    g_byte_array_unref (response);
+}
+
+static void
+at_serial_records (void)
+{
+    guint chunk_size;
+
+    run_records_test (G_MAXUINT);
+    for (chunk_size = 1; chunk_size <= 20; chunk_size++)
+        run_records_test (chunk_size);
+}
+
+/*****************************************************************************/
+
+/* Requests the fake modem knows about, and what it replies to them */
+typedef struct {
+    const gchar *request;
+    const gchar *reply;
+    /* How long the modem takes to reply */
+    guint delay_ms;
+} PipelineExchange;
+
+typedef struct {
+    const gchar *query;
+    /* The information response expected, or NULL if an error is expected */
+    const gchar *reply;
+    GQuark error_domain;
+} PipelineQuery;
+
+typedef struct {
+    GMainLoop *loop;
+    int master;
+    int slave;
+    guint watch_id;
+    GString *input;
+    const PipelineExchange *exchanges;
+    GPtrArray *requests;
+    guint n_pending;
+} PipelineTestContext;
+
+typedef struct {
+    PipelineTestContext *ctx;
+    const PipelineQuery *query;
+} PipelineQueryContext;
+
+typedef struct {
+    PipelineTestContext *ctx;
+    const gchar *reply;
+} PipelineDelayedReply;
+
+static void
+pipeline_modem_reply (PipelineTestContext *ctx,
+                      const gchar *reply)
+{
+    g_assert_cmpint (write (ctx->master, reply, strlen (reply)), ==, strlen (reply));
+}
+
+static gboolean
+pipeline_modem_delayed_reply_cb (PipelineDelayedReply *delayed)
+{
+    pipeline_modem_reply (delayed->ctx, delayed->reply);
+    g_free (delayed);
+    return FALSE;
+}
+
+static gboolean
+pipeline_modem_input_cb (GIOChannel *channel,
+                         GIOCondition condition,
+                         PipelineTestContext *ctx)
+{
+    gchar buf[256];
+    gssize len;
+    gchar *eol;
+
+    len = read (ctx->master, buf, sizeof (buf));
+    if (len > 0)
+        g_string_append_len (ctx->input, buf, len);
+
+    while ((eol = strchr (ctx->input->str, '\r')) != NULL) {
+        gchar *request;
+        guint i;
+
+        request = g_strndup (ctx->input->str, eol - ctx->input->str);
+        g_string_erase (ctx->input, 0, eol - ctx->input->str + 1);
+
+        for (i = 0; ctx->exchanges[i].request; i++) {
+            if (g_str_equal (ctx->exchanges[i].request, request)) {
+                PipelineDelayedReply *delayed;
+
+                if (!ctx->exchanges[i].delay_ms) {
+                    pipeline_modem_reply (ctx, ctx->exchanges[i].reply);
+                    break;
+                }
+
+                delayed = g_new0 (PipelineDelayedReply, 1);
+                delayed->ctx = ctx;
+                delayed->reply = ctx->exchanges[i].reply;
+                g_timeout_add (ctx->exchanges[i].delay_ms,
+                               (GSourceFunc) pipeline_modem_delayed_reply_cb,
+                               delayed);
+                break;
+            }
+        }
+        g_assert (ctx->exchanges[i].request != NULL);
+        g_ptr_array_add (ctx->requests, request);
+    }
+
+    return TRUE;
+}
+
+static void
+pipeline_query_ready (MMAtSerialPort *port,
+                      GString *response,
+                      GError *error,
+                      PipelineQueryContext *qctx)
+{
+    if (qctx->query->reply) {
+        gchar *reply;
+
+        g_assert_no_error (error);
+        reply = g_strstrip (g_strdup (response->str));
+        g_assert_cmpstr (reply, ==, qctx->query->reply);
+        g_free (reply);
+    } else {
+        g_assert (error != NULL);
+        g_assert (error->domain == qctx->query->error_domain);
+    }
+
+    if (--qctx->ctx->n_pending == 0)
+        g_main_loop_quit (qctx->ctx->loop);
+    g_free (qctx);
+}
+
+static gboolean
+pipeline_timeout_cb (PipelineTestContext *ctx)
+{
+    g_assert_not_reached ();
+    return FALSE;
+}
+
+/* Opens an AT port on a pty, with a fake modem on the other side replying
+ * to the given exchanges */
+static MMAtSerialPort *
+fake_modem_setup (PipelineTestContext *ctx,
+                  const PipelineExchange *exchanges)
+{
+    MMAtSerialPort *port;
+    GIOChannel *channel;
+    struct termios stbuf;
+    GError *error = NULL;
+
+    g_assert (openpty (&ctx->master, &ctx->slave, NULL, NULL, NULL) == 0);
+    memset (&stbuf, 0, sizeof (stbuf));
+    tcgetattr (ctx->slave, &stbuf);
+    cfmakeraw (&stbuf);
+    tcsetattr (ctx->slave, TCSANOW, &stbuf);
+    fcntl (ctx->slave, F_SETFL, O_NONBLOCK);
+    fcntl (ctx->master, F_SETFL, O_NONBLOCK);
+
+    ctx->loop = g_main_loop_new (NULL, FALSE);
+    ctx->input = g_string_new ("");
+    ctx->exchanges = exchanges;
+    ctx->requests = g_ptr_array_new_with_free_func (g_free);
+
+    channel = g_io_channel_unix_new (ctx->master);
+    ctx->watch_id = g_io_add_watch (channel, G_IO_IN, (GIOFunc) pipeline_modem_input_cb, ctx);
+    g_io_channel_unref (channel);
+
+    port = MM_AT_SERIAL_PORT (g_object_new (MM_TYPE_AT_SERIAL_PORT,
+                                            MM_PORT_DEVICE, "ttyFAKE0",
+                                            MM_PORT_SUBSYS, MM_PORT_SUBSYS_TTY,
+                                            MM_PORT_TYPE, MM_PORT_TYPE_AT,
+                                            MM_SERIAL_PORT_FD, ctx->slave,
+                                            MM_SERIAL_PORT_SEND_DELAY, (guint64) 0,
+                                            MM_AT_SERIAL_PORT_PIPELINE, TRUE,
+                                            NULL));
+    mm_at_serial_port_set_response_parser (port,
+                                           mm_serial_parser_v1_parse,
+                                           mm_serial_parser_v1_new (),
+                                           mm_serial_parser_v1_destroy);
+    g_assert (mm_serial_port_open (MM_SERIAL_PORT (port), &error));
+    g_assert_no_error (error);
+
+    return port;
+}
+
+static void
+fake_modem_teardown (PipelineTestContext *ctx,
+                     MMAtSerialPort *port)
+{
+    mm_serial_port_close (MM_SERIAL_PORT (port));
+    g_object_unref (port);
+    g_source_remove (ctx->watch_id);
+    g_ptr_array_unref (ctx->requests);
+    g_string_free (ctx->input, TRUE);
+    g_main_loop_unref (ctx->loop);
+    close (ctx->master);
+    close (ctx->slave);
+}
+
+static void
+run_pipeline_test (const PipelineQuery *queries,
+                   guint timeout,
+                   const PipelineExchange *exchanges,
+                   const gchar **expected_requests)
+{
+    PipelineTestContext ctx = { 0 };
+    MMAtSerialPort *port;
+    guint timeout_id;
+    guint i;
+
+    port = fake_modem_setup (&ctx, exchanges);
+
+    /* All queued in the same main loop iteration */
+    for (i = 0; queries[i].query; i++) {
+        PipelineQueryContext *qctx;
+
+        qctx = g_new0 (PipelineQueryContext, 1);
+        qctx->ctx = &ctx;
+        qctx->query = &queries[i];
+        ctx.n_pending++;
+        mm_at_serial_port_queue_command (port,
+                                         queries[i].query,
+                                         timeout,
+                                         NULL,
+                                         (MMAtSerialResponseFn) pipeline_query_ready,
+                                         qctx);
+    }
+
+    timeout_id = g_timeout_add_seconds (10, (GSourceFunc) pipeline_timeout_cb, &ctx);
+    g_main_loop_run (ctx.loop);
+    g_source_remove (timeout_id);
+
+    for (i = 0; expected_requests[i]; i++) {
+        g_assert_cmpuint (i, <, ctx.requests->len);
+        g_assert_cmpstr (g_ptr_array_index (ctx.requests, i), ==, expected_requests[i]);
+    }
+    g_assert_cmpuint (i, ==, ctx.requests->len);
+
+    fake_modem_teardown (&ctx, port);
+}
+
+static void
+at_serial_pipeline (void)
+{
+    static const PipelineQuery queries[] = {
+        { "+CPIN?", "+CPIN: READY" },
+        { "+CREG?", "+CREG: 0,1" },
+        { "+CMGF?", "+CMGF: 0" },
+        { NULL }
+    };
+    static const PipelineExchange exchanges[] = {
+        { "AT+CPIN?;+CREG?;+CMGF?",
+          "\r\n+CPIN: READY\r\n\r\n+CREG: 0,1\r\n\r\n+CMGF: 0\r\n\r\nOK\r\n" },
+        { NULL }
+    };
+    static const gchar *expected_requests[] = {
+        "AT+CPIN?;+CREG?;+CMGF?",
+        NULL
+    };
+
+    run_pipeline_test (queries, 3, exchanges, expected_requests);
+}
+
+static void
+at_serial_pipeline_slow (void)
+{
+    static const PipelineQuery queries[] = {
+        { "+CPIN?", "+CPIN: READY" },
+        { "+CREG?", "+CREG: 0,1" },
+        { "+CMGF?", "+CMGF: 0" },
+        { NULL }
+    };
+    static const PipelineExchange exchanges[] = {
+        /* Each query takes the modem 0.7s, so the whole line takes longer
+         * than the timeout of any single query */
+        { "AT+CPIN?;+CREG?;+CMGF?",
+          "\r\n+CPIN: READY\r\n\r\n+CREG: 0,1\r\n\r\n+CMGF: 0\r\n\r\nOK\r\n",
+          2100 },
+        { NULL }
+    };
+    static const gchar *expected_requests[] = {
+        "AT+CPIN?;+CREG?;+CMGF?",
+        NULL
+    };
+
+    run_pipeline_test (queries, 1, exchanges, expected_requests);
+}
+
+static void
+at_serial_pipeline_error (void)
+{
+    static const PipelineQuery queries[] = {
+        { "+CPIN?", "+CPIN: READY" },
+        { "+CMGF?", NULL, 0 },
+        { NULL }
+    };
+    static const PipelineExchange exchanges[] = {
+        /* A +CMS ERROR aborts the whole line; queries get resent one by one */
+        { "AT+CPIN?;+CMGF?", "\r\n+CMS ERROR: 302\r\n" },
+        { "AT+CPIN?",        "\r\n+CPIN: READY\r\n\r\nOK\r\n" },
+        { "AT+CMGF?",        "\r\n+CMS ERROR: 302\r\n" },
+        { NULL }
+    };
+    static const gchar *expected_requests[] = {
+        "AT+CPIN?;+CMGF?",
+        "AT+CPIN?",
+        "AT+CMGF?",
+        NULL
+    };
+    PipelineQuery *copy;
+
+    /* Error domains are not constant expressions */
+    copy = g_memdup (queries, sizeof (queries));
+    copy[1].error_domain = MM_MESSAGE_ERROR;
+    run_pipeline_test (copy, 3, exchanges, expected_requests);
+    g_free (copy);
+}
+
+/*****************************************************************************/
+
+typedef struct {
+    PipelineTestContext *ctx;
+    MMAtSerialPort *port;
+    guint n_records;
+    gboolean cpin_done;
+    gboolean done;
+} StreamedTestContext;
+
+static void
+streamed_cpin_ready (MMAtSerialPort *port,
+                     GString *response,
+                     GError *error,
+                     StreamedTestContext *sctx)
+{
+    g_assert_no_error (error);
+    sctx->cpin_done = TRUE;
+    if (sctx->done)
+        g_main_loop_quit (sctx->ctx->loop);
+}
+
+static void
+streamed_record (MMAtSerialPort *port,
+                 const gchar *record,
+                 StreamedTestContext *sctx)
+{
+    static const gchar *expected[] = {
+        "+CMGL: 1,1,,23\r\n0791947106004034040C9194",
+        "+CMGL: 2,1,,23\r\n0791947106004034040C9195",
+        "+CMGL: 3,1,,23\r\n0791947106004034040C9196",
+    };
+
+    /* Never given while the port is reading and parsing its input */
+    g_assert (g_main_current_source () != NULL);
+    g_assert (g_main_current_source ()->source_funcs != &g_io_watch_funcs);
+    g_assert (!sctx->done);
+    g_assert_cmpuint (sctx->n_records, <, G_N_ELEMENTS (expected));
+    g_assert_cmpstr (record, ==, expected[sctx->n_records++]);
+
+    /* Callbacks may queue other commands */
+    if (sctx->n_records == 1)
+        mm_at_serial_port_queue_command (port,
+                                         "+CPIN?",
+                                         3,
+                                         NULL,
+                                         (MMAtSerialResponseFn) streamed_cpin_ready,
+                                         sctx);
+}
+
+static void
+streamed_ready (MMAtSerialPort *port,
+                GString *response,
+                GError *error,
+                StreamedTestContext *sctx)
+{
+    g_assert_no_error (error);
+    /* All records were given before the final reply */
+    g_assert_cmpuint (sctx->n_records, ==, 3);
+    g_assert (strstr (response->str, "+CMGL") == NULL);
+    sctx->done = TRUE;
+    if (sctx->cpin_done)
+        g_main_loop_quit (sctx->ctx->loop);
+}
+
+static void
+at_serial_streamed (void)
+{
+    static const PipelineExchange exchanges[] = {
+        { "AT+CMGL=4",
+          "\r\n+CMGL: 1,1,,23\r\n0791947106004034040C9194\r\n"
+          "+CMGL: 2,1,,23\r\n0791947106004034040C9195\r\n"
+          "+CMGL: 3,1,,23\r\n0791947106004034040C9196\r\n"
+          "\r\nOK\r\n" },
+        { "AT+CPIN?", "\r\n+CPIN: READY\r\n\r\nOK\r\n" },
+        { NULL }
+    };
+    PipelineTestContext ctx = { 0 };
+    StreamedTestContext sctx = { 0 };
+    MMAtSerialPort *port;
+    guint timeout_id;
+
+    port = fake_modem_setup (&ctx, exchanges);
+    sctx.ctx = &ctx;
+    sctx.port = port;
+
+    mm_at_serial_port_queue_command_streamed (port,
+                                              "+CMGL=4",
+                                              "+CMGL:",
+                                              3,
+                                              NULL,
+                                              (MMAtSerialRecordFn) streamed_record,
+                                              (MMAtSerialResponseFn) streamed_ready,
+                                              &sctx);
+
+    timeout_id = g_timeout_add_seconds (10, (GSourceFunc) pipeline_timeout_cb, &ctx);
+    g_main_loop_run (ctx.loop);
+    g_source_remove (timeout_id);
+
+    g_assert (sctx.cpin_done);
+    fake_modem_teardown (&ctx, port);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
 void
 _mm_log (const char *loc,
          const char *func,
@@ -80,6 +782,13 @@ int main (int argc, char **argv)
     g_test_init (&argc, &argv, NULL);
 
     g_test_add_func ("/ModemManager/AT-serial/echo-removal", at_serial_echo_removal);
+    g_test_add_func ("/ModemManager/AT-serial/unsolicited", at_serial_unsolicited);
+    g_test_add_func ("/ModemManager/AT-serial/pipeline-split", at_serial_pipeline_split);
+    g_test_add_func ("/ModemManager/AT-serial/pipeline", at_serial_pipeline);
+    g_test_add_func ("/ModemManager/AT-serial/pipeline-slow", at_serial_pipeline_slow);
+    g_test_add_func ("/ModemManager/AT-serial/pipeline-error", at_serial_pipeline_error);
+    g_test_add_func ("/ModemManager/AT-serial/records", at_serial_records);
+    g_test_add_func ("/ModemManager/AT-serial/streamed", at_serial_streamed);
 
     return g_test_run ();
 }
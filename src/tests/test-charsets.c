@@ -327,6 +327,276 @@ test_pack_gsm7_7_chars_offset (void *f, gpointer d)
 }
 
 
+static void
+test_gsm_all_unichars (void *f, gpointer d)
+{
+    gunichar c;
+    guint supported = 0;
+
+    /* Every char in the GSM charset must go to GSM and back unchanged, and
+     * every other one must be skipped */
+    for (c = 1; c < 0x10000; c++) {
+        char s[7];
+        guint8 *gsm, *utf8;
+        guint32 len = 0;
+        guint clen = 0, unsupported = 0;
+
+        if (c >= 0xD800 && c <= 0xDFFF)
+            continue;
+        s[g_unichar_to_utf8 (c, s)] = '\0';
+
+        gsm = mm_charset_utf8_to_unpacked_gsm (s, &len);
+        g_assert (gsm);
+        clen = mm_charset_get_encoded_len (s, MM_MODEM_CHARSET_GSM, &unsupported);
+        if (len == 0) {
+            g_assert_cmpint (unsupported, ==, 1);
+            g_free (gsm);
+            continue;
+        }
+
+        supported++;
+        g_assert_cmpint (unsupported, ==, 0);
+        g_assert_cmpint (clen, ==, len);
+        g_assert (len == 1 || (len == 2 && gsm[0] == 0x1B));
+
+        utf8 = mm_charset_gsm_unpacked_to_utf8 (gsm, len);
+        g_assert_cmpstr ((const char *) utf8, ==, s);
+
+        g_free (gsm);
+        g_free (utf8);
+    }
+
+    /* 128 default chars but the escape code, and 10 extended ones */
+    g_assert_cmpint (supported, ==, 127 + 10);
+}
+
+static void
+test_gsm_unpacked_invalid (void *f, gpointer d)
+{
+    static const guint8 gsm[] = { 0x41, 0x1B, 0x42, 0x1B, 0x65, 0x1B };
+    guint8 *utf8;
+
+    /* Unknown extended chars, and a trailing escape, are replaced */
+    utf8 = mm_charset_gsm_unpacked_to_utf8 (gsm, sizeof (gsm));
+    g_assert_cmpstr ((const char *) utf8, ==, "A?B€?");
+    g_free (utf8);
+}
+
+static void
+pack_septets_slow (const guint8 *src, guint32 len, guint8 start_offset, guint8 *packed)
+{
+    guint32 i, bit;
+    int j;
+
+    for (i = 0, bit = start_offset; i < len; i++) {
+        for (j = 0; j < 7; j++, bit++) {
+            if (src[i] & (1 << j))
+                packed[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+}
+
+static void
+test_pack_unpack_random (void *f, gpointer d)
+{
+    guint8 unpacked[200], expected[200];
+    guint32 len, packed_len, unpacked_len, i;
+    guint8 offset, *packed, *result;
+
+    for (len = 0; len < 180; len++) {
+        for (offset = 0; offset < 8; offset++) {
+            for (i = 0; i < len; i++)
+                unpacked[i] = g_test_rand_int_range (0, 128);
+
+            memset (expected, 0, sizeof (expected));
+            pack_septets_slow (unpacked, len, offset, expected);
+
+            packed = gsm_pack (unpacked, len, offset, &packed_len);
+            g_assert_cmpint (packed_len, ==, (len * 7 + offset + 7) / 8);
+            if (packed_len)
+                g_assert_cmpint (memcmp (packed, expected, packed_len), ==, 0);
+
+            result = gsm_unpack (packed ? packed : expected, len, offset, &unpacked_len);
+            g_assert_cmpint (unpacked_len, ==, len);
+            g_assert_cmpint (memcmp (result, unpacked, len), ==, 0);
+
+            g_free (packed);
+            g_free (result);
+        }
+    }
+}
+
+static void
+test_ucs2_roundtrip (void *f, gpointer d)
+{
+    static const char *strings[] = {
+        "",
+        "Hello, world",
+        "ΑΒΓΔ αβγδ ΩΠΨΣ",
+        "日本語のテキスト",
+        "mixed: 1 € = ¥ ✓ \xef\xbf\xbd \xef\xbf\xbf",
+        NULL
+    };
+    guint i;
+
+    for (i = 0; strings[i]; i++) {
+        guint8 *ucs2;
+        gchar *iconv, *utf8;
+        gsize len = 0, iconv_len = 0;
+
+        ucs2 = mm_charset_utf8_to_ucs2be (strings[i], &len);
+        g_assert (ucs2);
+        g_assert_cmpint (len, ==, g_utf8_strlen (strings[i], -1) * 2);
+
+        /* Same as iconv gives */
+        iconv = g_convert (strings[i], -1, "UCS-2BE", "UTF-8", NULL, &iconv_len, NULL);
+        g_assert (iconv);
+        g_assert_cmpint (len, ==, iconv_len);
+        g_assert_cmpint (memcmp (ucs2, iconv, len), ==, 0);
+
+        utf8 = mm_charset_ucs2be_to_utf8 (ucs2, len);
+        g_assert_cmpstr (utf8, ==, strings[i]);
+
+        g_free (ucs2);
+        g_free (iconv);
+        g_free (utf8);
+    }
+}
+
+static void
+test_ucs2_hex (void *f, gpointer d)
+{
+    gchar *hex, *utf8;
+
+    hex = mm_modem_charset_utf8_to_hex ("Aé€", MM_MODEM_CHARSET_UCS2);
+    g_assert_cmpstr (hex, ==, "004100E920AC");
+    utf8 = mm_modem_charset_hex_to_utf8 (hex, MM_MODEM_CHARSET_UCS2);
+    g_assert_cmpstr (utf8, ==, "Aé€");
+    g_free (hex);
+    g_free (utf8);
+
+    /* Lone surrogates can't be converted */
+    utf8 = mm_modem_charset_hex_to_utf8 ("0041D800", MM_MODEM_CHARSET_UCS2);
+    g_assert (utf8 == NULL);
+}
+
+static void
+test_charset_conversions (void *f, gpointer d)
+{
+    static const char *strings[] = {
+        "",
+        "Vodafone ES",
+        "Ça coûte 5 £, ½ prix",
+        "Größe über Maß",
+        "日本語",
+        NULL
+    };
+    static const struct {
+        MMModemCharset charset;
+        const char *iconv_name;
+    } charsets[] = {
+        { MM_MODEM_CHARSET_UCS2,    "UCS-2BE" },
+        { MM_MODEM_CHARSET_8859_1,  "ISO8859-1" },
+        { MM_MODEM_CHARSET_PCCP437, "CP437" },
+        { MM_MODEM_CHARSET_PCDN,    "CP850" },
+        { MM_MODEM_CHARSET_IRA,     "ASCII" },
+    };
+    guint i, j, n;
+
+    /* Run everything twice, as converters are reused */
+    for (n = 0; n < 2; n++) {
+        for (i = 0; i < G_N_ELEMENTS (charsets); i++) {
+            for (j = 0; strings[j]; j++) {
+                GByteArray *array;
+                gchar *expected, *translit, *hex, *utf8;
+                gsize expected_len = 0, translit_len = 0;
+
+                /* Same output as g_convert() */
+                translit = g_strdup_printf ("%s//TRANSLIT", charsets[i].iconv_name);
+                expected = g_convert (strings[j], -1, translit, "UTF-8", NULL, &translit_len, NULL);
+                g_free (translit);
+                if (!expected)
+                    continue;
+
+                array = g_byte_array_new ();
+                g_byte_array_append (array, (const guint8 *) "AT", 2);
+                g_assert (mm_modem_charset_byte_array_append (array, strings[j], TRUE, charsets[i].charset));
+                g_assert_cmpint (array->len, ==, translit_len + 4);
+                g_assert_cmpint (memcmp (array->data, "AT\"", 3), ==, 0);
+                g_assert_cmpint (memcmp (&array->data[3], expected, translit_len), ==, 0);
+                g_assert_cmpint (array->data[array->len - 1], ==, '"');
+                g_byte_array_free (array, TRUE);
+                g_free (expected);
+
+                /* Strict conversions fail if any char can't be converted */
+                expected = g_convert (strings[j], -1, charsets[i].iconv_name, "UTF-8", NULL, &expected_len, NULL);
+                hex = mm_modem_charset_utf8_to_hex (strings[j], charsets[i].charset);
+                if (charsets[i].charset == MM_MODEM_CHARSET_IRA) {
+                    /* Not converted at all */
+                    g_assert_cmpstr (hex, ==, strings[j]);
+                    g_free (hex);
+                    g_free (expected);
+                    continue;
+                }
+                if (!expected) {
+                    g_assert (hex == NULL);
+                    continue;
+                }
+                g_assert_cmpint (strlen (hex), ==, expected_len * 2);
+
+                utf8 = mm_modem_charset_hex_to_utf8 (hex, charsets[i].charset);
+                g_assert_cmpstr (utf8, ==, strings[j]);
+
+                g_free (expected);
+                g_free (hex);
+                g_free (utf8);
+            }
+        }
+    }
+}
+
+static void
+test_charset_conversions_gsm (void *f, gpointer d)
+{
+    GByteArray *array;
+    gchar *hex, *utf8;
+
+    array = g_byte_array_new ();
+    g_assert (mm_modem_charset_byte_array_append (array, "a@{€", FALSE, MM_MODEM_CHARSET_GSM));
+    g_assert_cmpint (array->len, ==, 6);
+    g_assert_cmpint (memcmp (array->data, "\x61\x00\x1b\x28\x1b\x65", 6), ==, 0);
+    g_byte_array_free (array, TRUE);
+
+    hex = mm_modem_charset_utf8_to_hex ("Hi {ÄÖ}", MM_MODEM_CHARSET_GSM);
+    g_assert_cmpstr (hex, ==, "4869201B285B5C1B29");
+    utf8 = mm_modem_charset_hex_to_utf8 (hex, MM_MODEM_CHARSET_GSM);
+    g_assert_cmpstr (utf8, ==, "Hi {ÄÖ}");
+    g_free (hex);
+    g_free (utf8);
+}
+
+static void
+test_charset_conversions_gsm_unsupported (void *f, gpointer d)
+{
+    GByteArray *array;
+    gchar *hex, *encoded;
+
+    /* Strict conversions fail instead of dropping the chars with no GSM
+     * equivalent ... */
+    hex = mm_modem_charset_utf8_to_hex ("a一b", MM_MODEM_CHARSET_GSM);
+    g_assert (hex == NULL);
+    encoded = mm_utf8_take_and_convert_to_charset (g_strdup ("a一b"),
+                                                   MM_MODEM_CHARSET_GSM);
+    g_assert (encoded == NULL);
+
+    /* ... while transliterating ones skip them */
+    array = g_byte_array_new ();
+    g_assert (mm_modem_charset_byte_array_append (array, "a一b", FALSE, MM_MODEM_CHARSET_GSM));
+    g_assert_cmpint (array->len, ==, 2);
+    g_assert_cmpint (memcmp (array->data, "ab", 2), ==, 0);
+    g_byte_array_free (array, TRUE);
+}
+
 #if GLIB_CHECK_VERSION(2,25,12)
 typedef GTestFixtureFunc TCFunc;
 #else
@@ -347,6 +617,8 @@ int main (int argc, char **argv)
     g_test_suite_add (suite, TESTCASE (test_def_chars, NULL));
     g_test_suite_add (suite, TESTCASE (test_esc_chars, NULL));
     g_test_suite_add (suite, TESTCASE (test_mixed_chars, NULL));
+    g_test_suite_add (suite, TESTCASE (test_gsm_all_unichars, NULL));
+    g_test_suite_add (suite, TESTCASE (test_gsm_unpacked_invalid, NULL));
 
     g_test_suite_add (suite, TESTCASE (test_unpack_gsm7, NULL));
     g_test_suite_add (suite, TESTCASE (test_unpack_gsm7_7_chars, NULL));
@@ -359,6 +631,13 @@ int main (int argc, char **argv)
     g_test_suite_add (suite, TESTCASE (test_pack_gsm7_last_septet_alone, NULL));
 
     g_test_suite_add (suite, TESTCASE (test_pack_gsm7_7_chars_offset, NULL));
+    g_test_suite_add (suite, TESTCASE (test_pack_unpack_random, NULL));
+
+    g_test_suite_add (suite, TESTCASE (test_ucs2_roundtrip, NULL));
+    g_test_suite_add (suite, TESTCASE (test_ucs2_hex, NULL));
+    g_test_suite_add (suite, TESTCASE (test_charset_conversions, NULL));
+    g_test_suite_add (suite, TESTCASE (test_charset_conversions_gsm, NULL));
+    g_test_suite_add (suite, TESTCASE (test_charset_conversions_gsm_unsupported, NULL));
 
     result = g_test_run ();
 
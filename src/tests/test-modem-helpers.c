@@ -1408,6 +1408,9 @@ test_cnum_response_generic_multiple_numbers (void *f, gpointer d)
 
 /*****************************************************************************/
 
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
 void
 _mm_log (const char *loc,
          const char *func,
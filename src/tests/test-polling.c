@@ -0,0 +1,181 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <glib.h>
+
+#include "mm-polling.h"
+#include "mm-log.h"
+
+typedef struct {
+    guint polls;
+    GMainLoop *loop;
+} PollCounter;
+
+static void
+count_poll (PollCounter *counter)
+{
+    counter->polls++;
+    if (counter->loop)
+        g_main_loop_quit (counter->loop);
+}
+
+static void
+test_backoff (void)
+{
+    PollCounter counter = { 0 };
+    MMPolling *polling;
+
+    polling = mm_polling_new (10, 80, (MMPollingFunc)count_poll, &counter);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 10);
+
+    mm_polling_start (polling, TRUE);
+    g_assert_cmpuint (counter.polls, ==, 1);
+
+    /* Doubles while the value doesn't change, up to the maximum */
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 20);
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 40);
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 80);
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 80);
+
+    /* Polls are only launched when their timer fires */
+    g_assert_cmpuint (counter.polls, ==, 1);
+
+    mm_polling_free (polling);
+}
+
+static void
+test_reset (void)
+{
+    PollCounter counter = { 0 };
+    MMPolling *polling;
+
+    polling = mm_polling_new (10, 80, (MMPollingFunc)count_poll, &counter);
+    mm_polling_start (polling, TRUE);
+    mm_polling_done (polling, FALSE);
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 40);
+
+    /* A change brings the interval back to the minimum */
+    mm_polling_done (polling, TRUE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 10);
+
+    /* And so does restarting */
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 20);
+    mm_polling_start (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 10);
+    g_assert_cmpuint (counter.polls, ==, 1);
+
+    /* Restarting right away polls again */
+    mm_polling_start (polling, TRUE);
+    g_assert_cmpuint (counter.polls, ==, 2);
+
+    /* But not while a poll is ongoing */
+    mm_polling_start (polling, TRUE);
+    g_assert_cmpuint (counter.polls, ==, 2);
+
+    mm_polling_free (polling);
+}
+
+static void
+test_indication (void)
+{
+    PollCounter counter = { 0 };
+    MMPolling *polling;
+
+    polling = mm_polling_new (10, 80, (MMPollingFunc)count_poll, &counter);
+    mm_polling_start (polling, FALSE);
+
+    /* Unsolicited values postpone polling to the maximum interval */
+    mm_polling_indication (polling);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 80);
+
+    /* A change found by a poll brings it back */
+    mm_polling_start (polling, TRUE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 10);
+
+    /* Indications during a poll are left to the poll outcome */
+    mm_polling_indication (polling);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 10);
+    mm_polling_done (polling, FALSE);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 20);
+
+    mm_polling_free (polling);
+}
+
+static gboolean
+poll_timed_out (gpointer unused)
+{
+    g_assert_not_reached ();
+    return FALSE;
+}
+
+static void
+test_scheduled (void)
+{
+    PollCounter counter = { 0 };
+    MMPolling *polling;
+    guint timeout_id;
+
+    counter.loop = g_main_loop_new (NULL, FALSE);
+    polling = mm_polling_new (1, 4, (MMPollingFunc)count_poll, &counter);
+
+    /* Not right away, but once the interval elapses */
+    mm_polling_start (polling, FALSE);
+    g_assert_cmpuint (counter.polls, ==, 0);
+
+    timeout_id = g_timeout_add_seconds (10, poll_timed_out, NULL);
+    g_main_loop_run (counter.loop);
+    g_assert_cmpuint (counter.polls, ==, 1);
+
+    /* The next one is only scheduled when the poll is done */
+    mm_polling_done (polling, FALSE);
+    g_main_loop_run (counter.loop);
+    g_assert_cmpuint (counter.polls, ==, 2);
+    g_assert_cmpuint (mm_polling_get_interval (polling), ==, 2);
+
+    g_source_remove (timeout_id);
+    mm_polling_free (polling);
+    g_main_loop_unref (counter.loop);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/polling/backoff", test_backoff);
+    g_test_add_func ("/ModemManager/polling/reset", test_reset);
+    g_test_add_func ("/ModemManager/polling/indication", test_indication);
+    g_test_add_func ("/ModemManager/polling/scheduled", test_scheduled);
+
+    return g_test_run ();
+}
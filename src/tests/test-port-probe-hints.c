@@ -0,0 +1,256 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <glib.h>
+
+#include "mm-port-probe-hints.h"
+#include "mm-log.h"
+
+static gchar *
+build_key (const gchar *ifnum,
+           const gchar *driver)
+{
+    return mm_port_probe_hints_build_key (0x12d1, 0x1001,
+                                          "0123456789", "11.608", "E1550", "huawei",
+                                          ifnum, driver);
+}
+
+static void
+assert_hint (GKeyFile *store,
+             const gchar *key,
+             MMPortType expected_type,
+             const gchar *expected_vendor,
+             const gchar *expected_product)
+{
+    MMPortType type = MM_PORT_TYPE_UNKNOWN;
+    gchar *vendor = NULL;
+    gchar *product = NULL;
+
+    g_assert (mm_port_probe_hints_lookup (store, key, &type, &vendor, &product));
+    g_assert_cmpint (type, ==, expected_type);
+    g_assert_cmpstr (vendor, ==, expected_vendor);
+    g_assert_cmpstr (product, ==, expected_product);
+    g_free (vendor);
+    g_free (product);
+}
+
+static void
+assert_no_hint (GKeyFile *store,
+                const gchar *key)
+{
+    MMPortType type = MM_PORT_TYPE_UNKNOWN;
+    gchar *vendor = NULL;
+    gchar *product = NULL;
+
+    g_assert (!mm_port_probe_hints_lookup (store, key, &type, &vendor, &product));
+    g_assert (vendor == NULL);
+    g_assert (product == NULL);
+}
+
+static void
+test_key (void)
+{
+    gchar *key;
+    gchar *other;
+
+    /* Same device, interface and driver: same key */
+    key = build_key ("00", "option1");
+    other = build_key ("00", "option1");
+    g_assert_cmpstr (key, ==, other);
+    g_free (other);
+
+    /* Another interface or driver of the same device: another key */
+    other = build_key ("01", "option1");
+    g_assert_cmpstr (key, !=, other);
+    g_free (other);
+    other = build_key ("00", "qcserial");
+    g_assert_cmpstr (key, !=, other);
+    g_free (other);
+    other = build_key (NULL, NULL);
+    g_assert_cmpstr (key, !=, other);
+    g_free (other);
+
+    g_free (key);
+}
+
+static void
+test_hit (void)
+{
+    GKeyFile *store;
+    gchar *at_key;
+    gchar *qcdm_key;
+
+    store = g_key_file_new ();
+    at_key = build_key ("00", "option1");
+    qcdm_key = build_key ("01", "option1");
+
+    mm_port_probe_hints_update (store, at_key, MM_PORT_TYPE_AT,
+                                TRUE, "huawei", TRUE, "e1550");
+    mm_port_probe_hints_update (store, qcdm_key, MM_PORT_TYPE_QCDM,
+                                FALSE, NULL, FALSE, NULL);
+
+    assert_hint (store, at_key, MM_PORT_TYPE_AT, "huawei", "e1550");
+    assert_hint (store, qcdm_key, MM_PORT_TYPE_QCDM, NULL, NULL);
+
+    /* Results survive saving and loading the store */
+    {
+        GKeyFile *loaded;
+        gchar *data;
+        gsize len;
+
+        data = g_key_file_to_data (store, &len, NULL);
+        loaded = g_key_file_new ();
+        g_assert (g_key_file_load_from_data (loaded, data, len, G_KEY_FILE_NONE, NULL));
+        assert_hint (loaded, at_key, MM_PORT_TYPE_AT, "huawei", "e1550");
+        assert_hint (loaded, qcdm_key, MM_PORT_TYPE_QCDM, NULL, NULL);
+        g_key_file_free (loaded);
+        g_free (data);
+    }
+
+    g_free (at_key);
+    g_free (qcdm_key);
+    g_key_file_free (store);
+}
+
+static void
+test_miss (void)
+{
+    GKeyFile *store;
+    gchar *key;
+    gchar *other;
+
+    store = g_key_file_new ();
+    key = build_key ("00", "option1");
+
+    /* Empty store, or no store at all */
+    assert_no_hint (store, key);
+    assert_no_hint (NULL, key);
+
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_AT,
+                                TRUE, "huawei", TRUE, "e1550");
+
+    /* Another port of the same device */
+    other = build_key ("02", "option1");
+    assert_no_hint (store, other);
+    g_free (other);
+
+    /* Same interface, bound to another driver */
+    other = build_key ("00", "qcserial");
+    assert_no_hint (store, other);
+    g_free (other);
+
+    /* Unknown types stored by someone else are ignored */
+    g_key_file_set_string (store, key, "type", "gps");
+    assert_no_hint (store, key);
+
+    g_free (key);
+    g_key_file_free (store);
+}
+
+static void
+test_invalidation (void)
+{
+    GKeyFile *store;
+    gchar *key;
+
+    store = g_key_file_new ();
+    key = build_key ("00", "option1");
+
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_AT,
+                                TRUE, "huawei", TRUE, "e1550");
+
+    /* Confirmed without probing vendor and product again: kept */
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_AT,
+                                FALSE, NULL, FALSE, NULL);
+    assert_hint (store, key, MM_PORT_TYPE_AT, "huawei", "e1550");
+
+    /* Probed again: updated, or removed when not reported */
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_AT,
+                                TRUE, "zte", TRUE, NULL);
+    assert_hint (store, key, MM_PORT_TYPE_AT, "zte", NULL);
+
+    /* Found to be QCDM now: the AT results are dropped */
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_QCDM,
+                                FALSE, NULL, FALSE, NULL);
+    assert_hint (store, key, MM_PORT_TYPE_QCDM, NULL, NULL);
+    g_assert (!g_key_file_has_key (store, key, "vendor", NULL));
+
+    /* And AT again: nothing of the old AT results comes back */
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_AT,
+                                FALSE, NULL, FALSE, NULL);
+    assert_hint (store, key, MM_PORT_TYPE_AT, NULL, NULL);
+
+    /* Neither AT nor QCDM: nothing kept */
+    mm_port_probe_hints_update (store, key, MM_PORT_TYPE_UNKNOWN,
+                                FALSE, NULL, FALSE, NULL);
+    assert_no_hint (store, key);
+    g_assert (!g_key_file_has_group (store, key));
+
+    g_free (key);
+    g_key_file_free (store);
+}
+
+static void
+test_fallback (void)
+{
+    /* AT hint: confirmed first */
+    g_assert_cmpint (mm_port_probe_hints_at_step (MM_PORT_TYPE_AT, TRUE, FALSE),
+                     ==, MM_PORT_PROBE_HINTS_AT_STEP_CONFIRM);
+
+    /* The "AT" confirmation failed and cleared the hint: full probing */
+    g_assert_cmpint (mm_port_probe_hints_at_step (MM_PORT_TYPE_UNKNOWN, TRUE, FALSE),
+                     ==, MM_PORT_PROBE_HINTS_AT_STEP_FULL);
+
+    /* Or it succeeded, AT is already probed */
+    g_assert_cmpint (mm_port_probe_hints_at_step (MM_PORT_TYPE_AT, TRUE, TRUE),
+                     ==, MM_PORT_PROBE_HINTS_AT_STEP_NONE);
+
+    /* QCDM hint: AT isn't confirmed, it was QCDM last time; if the QCDM
+     * confirmation fails, the hint is cleared and AT is fully probed */
+    g_assert_cmpint (mm_port_probe_hints_at_step (MM_PORT_TYPE_QCDM, TRUE, FALSE),
+                     ==, MM_PORT_PROBE_HINTS_AT_STEP_FULL);
+    g_assert_cmpint (mm_port_probe_hints_at_step (MM_PORT_TYPE_UNKNOWN, TRUE, FALSE),
+                     ==, MM_PORT_PROBE_HINTS_AT_STEP_FULL);
+
+    /* Nothing to do if AT isn't requested */
+    g_assert_cmpint (mm_port_probe_hints_at_step (MM_PORT_TYPE_AT, FALSE, FALSE),
+                     ==, MM_PORT_PROBE_HINTS_AT_STEP_NONE);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/port-probe-hints/key", test_key);
+    g_test_add_func ("/ModemManager/port-probe-hints/hit", test_hit);
+    g_test_add_func ("/ModemManager/port-probe-hints/miss", test_miss);
+    g_test_add_func ("/ModemManager/port-probe-hints/invalidation", test_invalidation);
+    g_test_add_func ("/ModemManager/port-probe-hints/fallback", test_fallback);
+
+    return g_test_run ();
+}
@@ -0,0 +1,452 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <glib.h>
+
+#include "mm-probe-plan.h"
+#include "mm-log.h"
+
+/* Same values as MMPortProbeFlag */
+#define PROBE_AT         (1 << 0)
+#define PROBE_AT_VENDOR  (1 << 1)
+#define PROBE_AT_PRODUCT (1 << 2)
+#define PROBE_QCDM       (1 << 3)
+
+#define DEFAULT_SEND_DELAY 100000
+
+static const MMPortProbeAtCommand custom_init[] = {
+    { "ATE1 E0", 3, NULL },
+    { NULL }
+};
+
+static const MMPortProbeAtCommand other_custom_init[] = {
+    { "AT+CFUN=1", 3, NULL },
+    { NULL }
+};
+
+static void
+test_flags (void)
+{
+    MMProbePlan plan;
+
+    mm_probe_plan_init (&plan);
+    g_assert (!mm_probe_plan_is_valid (&plan));
+
+    /* Generic */
+    mm_probe_plan_add (&plan, PROBE_AT | PROBE_QCDM,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    /* Filtering by vendor string */
+    mm_probe_plan_add (&plan, PROBE_AT | PROBE_AT_VENDOR,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    /* Filtering by product string */
+    mm_probe_plan_add (&plan, PROBE_AT | PROBE_AT_VENDOR | PROBE_AT_PRODUCT,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+
+    g_assert (mm_probe_plan_is_valid (&plan));
+    g_assert_cmpuint (plan.flags, ==, PROBE_AT | PROBE_AT_VENDOR | PROBE_AT_PRODUCT | PROBE_QCDM);
+    g_assert_cmpuint (plan.n_plugins, ==, 3);
+    g_assert_cmpuint (plan.send_delay, ==, DEFAULT_SEND_DELAY);
+    g_assert (plan.custom_init == NULL);
+
+    /* Nothing to probe */
+    mm_probe_plan_init (&plan);
+    mm_probe_plan_add (&plan, 0, MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    g_assert (!mm_probe_plan_is_valid (&plan));
+}
+
+static void
+test_most_specific (void)
+{
+    MMProbePlan plan;
+
+    /* The vendor plugin comes first, then the generic one */
+    mm_probe_plan_init (&plan);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_VENDOR_ID, 0, custom_init);
+    mm_probe_plan_add (&plan, PROBE_AT | PROBE_QCDM,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    g_assert (mm_probe_plan_is_valid (&plan));
+    g_assert_cmpuint (plan.flags, ==, PROBE_AT | PROBE_QCDM);
+    g_assert_cmpuint (plan.send_delay, ==, 0);
+    g_assert (plan.custom_init == custom_init);
+
+    /* Order doesn't matter */
+    mm_probe_plan_init (&plan);
+    mm_probe_plan_add (&plan, PROBE_AT | PROBE_QCDM,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_DRIVER, DEFAULT_SEND_DELAY, other_custom_init);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_PRODUCT_ID, 0, custom_init);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_UDEV_TAG, DEFAULT_SEND_DELAY, NULL);
+    g_assert (mm_probe_plan_is_valid (&plan));
+    g_assert_cmpint (plan.match, ==, MM_PROBE_PLAN_MATCH_PRODUCT_ID);
+    g_assert_cmpuint (plan.send_delay, ==, 0);
+    g_assert (plan.custom_init == custom_init);
+}
+
+static void
+test_conflict (void)
+{
+    MMProbePlan plan;
+
+    /* Two plugins matching the same way, wanting different init commands */
+    mm_probe_plan_init (&plan);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_VENDOR_ID, DEFAULT_SEND_DELAY, custom_init);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_VENDOR_ID, DEFAULT_SEND_DELAY, other_custom_init);
+    g_assert (plan.conflict);
+    g_assert (!mm_probe_plan_is_valid (&plan));
+
+    /* Less specific plugins don't change that */
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    g_assert (!mm_probe_plan_is_valid (&plan));
+
+    /* A more specific one decides */
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_PRODUCT_ID, DEFAULT_SEND_DELAY, other_custom_init);
+    g_assert (mm_probe_plan_is_valid (&plan));
+    g_assert (plan.custom_init == other_custom_init);
+
+    /* Just a different send delay is a conflict as well */
+    mm_probe_plan_init (&plan);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_ANY, DEFAULT_SEND_DELAY, NULL);
+    mm_probe_plan_add (&plan, PROBE_AT,
+                       MM_PROBE_PLAN_MATCH_ANY, 0, NULL);
+    g_assert (!mm_probe_plan_is_valid (&plan));
+}
+
+/*****************************************************************************/
+
+typedef struct _QueuedPlan QueuedPlan;
+struct _QueuedPlan {
+    const gchar *name;
+    gboolean waiting;
+    gboolean started;
+    /* Pending plan dropped when this one finishes */
+    QueuedPlan *drops;
+};
+
+static GList *started_plans;
+static MMProbePlanQueue *finishing_queue;
+
+static gboolean
+queued_plan_is_ready (QueuedPlan *plan)
+{
+    return !plan->waiting;
+}
+
+static void
+queued_plan_start (QueuedPlan *plan)
+{
+    g_assert (!plan->started);
+    plan->started = TRUE;
+    started_plans = g_list_append (started_plans, plan);
+}
+
+/* Finishes right away, e.g. when the port was already probed */
+static void
+queued_plan_start_and_finish (QueuedPlan *plan)
+{
+    queued_plan_start (plan);
+    mm_probe_plan_queue_remove (finishing_queue, plan);
+    if (plan->drops)
+        mm_probe_plan_queue_remove (finishing_queue, plan->drops);
+}
+
+static void
+assert_started (const gchar *names)
+{
+    GString *str;
+    GList *l;
+
+    str = g_string_new ("");
+    for (l = started_plans; l; l = g_list_next (l))
+        g_string_append_printf (str, "%s%s", str->len ? " " : "", ((QueuedPlan *)l->data)->name);
+    g_assert_cmpstr (str->str, ==, names);
+    g_string_free (str, TRUE);
+
+    g_list_free (started_plans);
+    started_plans = NULL;
+}
+
+static void
+test_queue_limit (void)
+{
+    MMProbePlanQueue queue = MM_PROBE_PLAN_QUEUE_INIT;
+    QueuedPlan plans[] = {
+        { "usb0" }, { "usb1" }, { "usb2" }, { "usb3" }, { "usb4" }
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (plans); i++)
+        mm_probe_plan_queue_push (&queue, &plans[i]);
+
+    /* Started in order up to the limit */
+    g_assert_cmpuint (mm_probe_plan_queue_start_pending (&queue, 2,
+                                                         (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                                         (MMProbePlanStartFunc)queued_plan_start), ==, 2);
+    assert_started ("usb0 usb1");
+    g_assert_cmpuint (g_list_length (queue.running), ==, 2);
+    g_assert_cmpuint (g_queue_get_length (&queue.pending), ==, 3);
+
+    /* Nothing else while both run */
+    g_assert_cmpuint (mm_probe_plan_queue_start_pending (&queue, 2,
+                                                         (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                                         (MMProbePlanStartFunc)queued_plan_start), ==, 0);
+
+    /* One finishes, the next one goes on */
+    mm_probe_plan_queue_remove (&queue, &plans[0]);
+    mm_probe_plan_queue_start_pending (&queue, 2,
+                                       (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                       (MMProbePlanStartFunc)queued_plan_start);
+    assert_started ("usb2");
+
+    /* Plans not ready are skipped, without blocking those after them */
+    plans[3].waiting = TRUE;
+    mm_probe_plan_queue_remove (&queue, &plans[1]);
+    mm_probe_plan_queue_start_pending (&queue, 2,
+                                       (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                       (MMProbePlanStartFunc)queued_plan_start);
+    assert_started ("usb4");
+    g_assert_cmpuint (g_queue_get_length (&queue.pending), ==, 1);
+
+    /* Once ready it goes on as soon as there's room */
+    plans[3].waiting = FALSE;
+    mm_probe_plan_queue_start_pending (&queue, 2,
+                                       (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                       (MMProbePlanStartFunc)queued_plan_start);
+    assert_started ("");
+    mm_probe_plan_queue_remove (&queue, &plans[2]);
+    mm_probe_plan_queue_start_pending (&queue, 2,
+                                       (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                       (MMProbePlanStartFunc)queued_plan_start);
+    assert_started ("usb3");
+
+    /* Removing pending plans works as well */
+    mm_probe_plan_queue_remove (&queue, &plans[3]);
+    mm_probe_plan_queue_remove (&queue, &plans[4]);
+    g_assert (queue.running == NULL);
+    g_assert (g_queue_is_empty (&queue.pending));
+}
+
+static void
+test_queue_no_limit (void)
+{
+    MMProbePlanQueue queue = MM_PROBE_PLAN_QUEUE_INIT;
+    QueuedPlan plans[] = {
+        { "usb0" }, { "usb1" }, { "usb2" }
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (plans); i++)
+        mm_probe_plan_queue_push (&queue, &plans[i]);
+
+    g_assert_cmpuint (mm_probe_plan_queue_start_pending (&queue, 0, NULL,
+                                                         (MMProbePlanStartFunc)queued_plan_start), ==, 3);
+    assert_started ("usb0 usb1 usb2");
+    g_assert (g_queue_is_empty (&queue.pending));
+
+    for (i = 0; i < G_N_ELEMENTS (plans); i++)
+        mm_probe_plan_queue_remove (&queue, &plans[i]);
+    g_assert (queue.running == NULL);
+}
+
+static void
+test_queue_finish_on_start (void)
+{
+    MMProbePlanQueue queue = MM_PROBE_PLAN_QUEUE_INIT;
+    QueuedPlan plans[] = {
+        { "usb0" }, { "usb1" }, { "usb2" }
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (plans); i++)
+        mm_probe_plan_queue_push (&queue, &plans[i]);
+    finishing_queue = &queue;
+
+    /* The first one finishes as soon as it starts, dropping the next one;
+     * that leaves room for the last one */
+    plans[0].drops = &plans[1];
+    g_assert_cmpuint (mm_probe_plan_queue_start_pending (&queue, 1,
+                                                         (MMProbePlanReadyFunc)queued_plan_is_ready,
+                                                         (MMProbePlanStartFunc)queued_plan_start_and_finish), ==, 2);
+    assert_started ("usb0 usb2");
+    g_assert (queue.running == NULL);
+    g_assert (g_queue_is_empty (&queue.pending));
+
+    finishing_queue = NULL;
+}
+
+static void
+test_open_retry_delay (void)
+{
+    /* Doubles from the minimum up to the maximum */
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (1, 125, 1000), ==, 125);
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (2, 125, 1000), ==, 250);
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (3, 125, 1000), ==, 500);
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (4, 125, 1000), ==, 1000);
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (5, 125, 1000), ==, 1000);
+
+    /* Never beyond the maximum, however many retries */
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (40, 125, 1000), ==, 1000);
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (G_MAXUINT, 125, 1000), ==, 1000);
+    g_assert_cmpuint (mm_probe_plan_open_retry_delay (3, 125, 300), ==, 300);
+}
+
+/*****************************************************************************/
+
+typedef struct {
+    const gchar *name;
+    guint runs;
+    gint64 run_time;
+} DeferredCheck;
+
+static GMainLoop *loop;
+static guint pending;
+
+static gboolean
+deferred_check_run (DeferredCheck *check)
+{
+    check->runs++;
+    check->run_time = g_get_monotonic_time ();
+    if (--pending == 0)
+        g_main_loop_quit (loop);
+    /* Ignored */
+    return TRUE;
+}
+
+static gboolean
+test_timed_out (gpointer unused)
+{
+    g_assert_not_reached ();
+    return FALSE;
+}
+
+static void
+test_deferrals_retry (void)
+{
+    MMProbePlanDeferrals *deferrals;
+    DeferredCheck first = { "ttyUSB0" };
+    DeferredCheck second = { "ttyUSB1" };
+    DeferredCheck other_device = { "ttyACM0" };
+    gint64 start;
+    guint timeout_id;
+
+    loop = g_main_loop_new (NULL, FALSE);
+    deferrals = mm_probe_plan_deferrals_new ();
+
+    mm_probe_plan_deferrals_add (deferrals, "/devices/usb1", 30,
+                                 (GSourceFunc)deferred_check_run, &first);
+    mm_probe_plan_deferrals_add (deferrals, "/devices/usb1", 30,
+                                 (GSourceFunc)deferred_check_run, &second);
+    mm_probe_plan_deferrals_add (deferrals, "/devices/usb2", 30,
+                                 (GSourceFunc)deferred_check_run, &other_device);
+
+    /* Another port of the first device finished: only its deferred checks go
+     * on, without waiting for the timeout */
+    start = g_get_monotonic_time ();
+    g_assert_cmpuint (mm_probe_plan_deferrals_retry (deferrals, "/devices/usb1"), ==, 2);
+    /* Retrying again before they run doesn't run them twice */
+    g_assert_cmpuint (mm_probe_plan_deferrals_retry (deferrals, "/devices/usb1"), ==, 0);
+    g_assert_cmpuint (mm_probe_plan_deferrals_retry (deferrals, "/devices/usb3"), ==, 0);
+
+    pending = 2;
+    timeout_id = g_timeout_add_seconds (10, test_timed_out, NULL);
+    g_main_loop_run (loop);
+    g_source_remove (timeout_id);
+
+    g_assert_cmpuint (first.runs, ==, 1);
+    g_assert_cmpuint (second.runs, ==, 1);
+    g_assert_cmpint (first.run_time - start, <, G_USEC_PER_SEC);
+    g_assert_cmpuint (other_device.runs, ==, 0);
+
+    /* Once run, they are gone */
+    g_assert_cmpuint (mm_probe_plan_deferrals_retry (deferrals, "/devices/usb1"), ==, 0);
+
+    /* The one in the other device is still waiting */
+    g_assert_cmpuint (mm_probe_plan_deferrals_retry (deferrals, "/devices/usb2"), ==, 1);
+    pending = 1;
+    timeout_id = g_timeout_add_seconds (10, test_timed_out, NULL);
+    g_main_loop_run (loop);
+    g_source_remove (timeout_id);
+    g_assert_cmpuint (other_device.runs, ==, 1);
+    g_assert_cmpuint (first.runs, ==, 1);
+
+    mm_probe_plan_deferrals_free (deferrals);
+    g_main_loop_unref (loop);
+}
+
+static void
+test_deferrals_timeout (void)
+{
+    MMProbePlanDeferrals *deferrals;
+    DeferredCheck check = { "ttyUSB0" };
+    gint64 start;
+    guint timeout_id;
+
+    loop = g_main_loop_new (NULL, FALSE);
+    deferrals = mm_probe_plan_deferrals_new ();
+
+    /* Without any retry, checks run after the timeout */
+    start = g_get_monotonic_time ();
+    mm_probe_plan_deferrals_add (deferrals, "/devices/usb1", 1,
+                                 (GSourceFunc)deferred_check_run, &check);
+
+    pending = 1;
+    timeout_id = g_timeout_add_seconds (10, test_timed_out, NULL);
+    g_main_loop_run (loop);
+    g_source_remove (timeout_id);
+
+    g_assert_cmpuint (check.runs, ==, 1);
+    g_assert_cmpint (check.run_time - start, >=, G_USEC_PER_SEC / 2);
+
+    mm_probe_plan_deferrals_free (deferrals);
+    g_main_loop_unref (loop);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/probe-plan/flags", test_flags);
+    g_test_add_func ("/ModemManager/probe-plan/most-specific", test_most_specific);
+    g_test_add_func ("/ModemManager/probe-plan/conflict", test_conflict);
+    g_test_add_func ("/ModemManager/probe-plan/queue-limit", test_queue_limit);
+    g_test_add_func ("/ModemManager/probe-plan/queue-no-limit", test_queue_no_limit);
+    g_test_add_func ("/ModemManager/probe-plan/queue-finish-on-start", test_queue_finish_on_start);
+    g_test_add_func ("/ModemManager/probe-plan/open-retry-delay", test_open_retry_delay);
+    g_test_add_func ("/ModemManager/probe-plan/deferrals-retry", test_deferrals_retry);
+    g_test_add_func ("/ModemManager/probe-plan/deferrals-timeout", test_deferrals_timeout);
+
+    return g_test_run ();
+}
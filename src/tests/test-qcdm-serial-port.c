@@ -396,6 +396,240 @@ test_leading_frame_markers (void *f)
     g_assert (wait_for_child (d, 3));
 }
 
+/* Test that a reply much larger than the serial read size, followed by
+ * another frame in the same write, is given to the child in one piece.
+ */
+static void
+test_large_frame (void *f)
+{
+    TestData *d = f;
+    char req[512];
+    gsize req_len;
+    pid_t cpid;
+    char frame[3000];
+    char rsp[sizeof (frame) * 2 + 20];
+    gsize rsp_len;
+    char extra[10] = { 0x13, 0x00 };
+    gsize i;
+
+    /* Version Info reply padded with data that needs escaping */
+    frame[0] = 0x00;
+    for (i = 1; i < sizeof (frame) - 2; i++)
+        frame[i] = (i % 2) ? 0x7D : 0x7E;
+    rsp_len = dm_encapsulate_buffer (frame, sizeof (frame) - 2, sizeof (frame),
+                                     rsp, sizeof (rsp));
+    g_assert (rsp_len > 0);
+    rsp_len += dm_encapsulate_buffer (extra, 2, sizeof (extra),
+                                      &rsp[rsp_len], sizeof (rsp) - rsp_len);
+
+    signal (SIGCHLD, SIG_DFL);
+    cpid = fork ();
+    g_assert (cpid >= 0);
+
+    if (cpid == 0) {
+        /* In the child */
+        qcdm_test_child (d->slave, qcdm_verinfo_expect_success_cb);
+        exit (0);
+    }
+    /* Parent */
+    d->child = cpid;
+
+    req_len = server_wait_request (d->master, req, sizeof (req));
+    g_assert (req_len == 1);
+    g_assert_cmpint (req[0], ==, 0x00);
+
+    /* All at once, so that the child reads several chunks in a row */
+    i = 0;
+    while (i < rsp_len) {
+        ssize_t written;
+
+        written = write (d->master, &rsp[i], rsp_len - i);
+        g_assert (written > 0);
+        i += written;
+    }
+
+    /* We expect the child to exit normally */
+    g_assert (wait_for_child (d, 3));
+}
+
+typedef struct {
+    GMainLoop *loop;
+    gboolean got_reply;
+    guint n_records;
+} LogTestCtx;
+
+static void
+log_test_check_done (LogTestCtx *ctx)
+{
+    if (ctx->got_reply && ctx->n_records == 2)
+        g_main_loop_quit (ctx->loop);
+}
+
+static void
+log_test_verinfo_cb (MMQcdmSerialPort *port,
+                     GByteArray *response,
+                     GError *error,
+                     gpointer user_data)
+{
+    LogTestCtx *ctx = user_data;
+
+    g_assert_no_error (error);
+    g_assert (response->len > 0);
+    g_assert_cmpint (response->data[0], ==, 0x00);
+    ctx->got_reply = TRUE;
+    log_test_check_done (ctx);
+}
+
+static void
+log_test_records_cb (MMQcdmSerialPort *port,
+                     const MMQcdmLogRecord *records,
+                     guint n_records,
+                     guint n_dropped,
+                     gpointer user_data)
+{
+    LogTestCtx *ctx = user_data;
+    guint i;
+
+    g_assert_cmpuint (n_dropped, ==, 0);
+    for (i = 0; i < n_records; i++) {
+        u_int32_t cell_id = 0;
+
+        g_assert_cmpint (records[i].type, ==, MM_QCDM_LOG_RECORD_TYPE_LOG);
+        g_assert_cmpuint (records[i].code, ==, 0x4127);
+        g_assert_cmpint (qcdm_result_get_u32 (records[i].result,
+                                              QCDM_CMD_LOG_ITEM_WCDMA_CELL_ID,
+                                              &cell_id), ==, 0);
+        g_assert_cmpuint (cell_id, ==, 0x12345678 + ctx->n_records);
+        ctx->n_records++;
+    }
+    log_test_check_done (ctx);
+}
+
+static void
+qcdm_log_test_child (int fd)
+{
+    MMQcdmSerialPort *port;
+    LogTestCtx ctx = { NULL, FALSE, 0 };
+    const guint16 log_codes[] = { 0x4127, 0 };
+    gboolean success;
+    GError *error = NULL;
+    GByteArray *verinfo;
+    guint id;
+
+    g_type_init ();
+
+    ctx.loop = g_main_loop_new (NULL, FALSE);
+
+    port = mm_qcdm_serial_port_new_fd (fd);
+    g_assert (port);
+
+    success = mm_serial_port_open (MM_SERIAL_PORT (port), &error);
+    g_assert_no_error (error);
+    g_assert (success);
+
+    id = mm_qcdm_serial_port_add_log_listener (port, log_codes, FALSE, log_test_records_cb, &ctx);
+    g_assert (id > 0);
+
+    verinfo = g_byte_array_sized_new (50);
+    verinfo->len = qcdm_cmd_version_info_new ((char *) verinfo->data, 50);
+    g_assert (verinfo->len > 0);
+    mm_qcdm_serial_port_queue_command (port, verinfo, 3, NULL, log_test_verinfo_cb, &ctx);
+
+    g_main_loop_run (ctx.loop);
+
+    mm_qcdm_serial_port_remove_log_listener (port, id);
+    mm_serial_port_close (MM_SERIAL_PORT (port));
+    g_object_unref (port);
+}
+
+static gsize
+build_cell_id_log (char *buf, gsize len, guint32 cell_id)
+{
+    char log[40] = {
+        0x10, 0x00, 0x1c, 0x00, 0x1c, 0x00, 0x27, 0x41,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    };
+
+    log[24] = cell_id & 0xFF;
+    log[25] = (cell_id >> 8) & 0xFF;
+    log[26] = (cell_id >> 16) & 0xFF;
+    log[27] = (cell_id >> 24) & 0xFF;
+    return dm_encapsulate_buffer (log, 32, sizeof (log), buf, len);
+}
+
+/* Test that log packets and event reports received around the reply to a
+ * command are given to the log listeners, and not taken as the reply.
+ */
+static void
+test_log_frames (void *f)
+{
+    TestData *d = f;
+    char req[512];
+    gsize req_len;
+    pid_t cpid;
+    char rsp[512];
+    gsize rsp_len = 0;
+    char log_config_rsp[16] = { 0x73, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+                                0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00 };
+    char config_rsp[40];
+    gsize config_rsp_len;
+    char event[10] = { 0x60, 0x06, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00 };
+    const char verinfo[] = {
+        0x00, 0x41, 0x75, 0x67, 0x20, 0x31, 0x39, 0x20, 0x32, 0x30, 0x30, 0x38,
+        0x32, 0x30, 0x3a, 0x34, 0x38, 0x3a, 0x34, 0x37, 0x4f, 0x63, 0x74, 0x20,
+        0x32, 0x39, 0x20, 0x32, 0x30, 0x30, 0x37, 0x31, 0x39, 0x3a, 0x30, 0x30,
+        0x3a, 0x30, 0x30, 0x53, 0x43, 0x4e, 0x52, 0x5a, 0x2e, 0x2e, 0x2e, 0x2a,
+        0x06, 0x04, 0xb9, 0x0b, 0x02, 0x00, 0xb2, 0x19, 0xc4, 0x7e
+    };
+    gsize i;
+
+    /* Log, reply, event nobody asked for, log */
+    rsp_len += build_cell_id_log (&rsp[rsp_len], sizeof (rsp) - rsp_len, 0x12345678);
+    memcpy (&rsp[rsp_len], verinfo, sizeof (verinfo));
+    rsp_len += sizeof (verinfo);
+    rsp_len += dm_encapsulate_buffer (event, 8, sizeof (event), &rsp[rsp_len], sizeof (rsp) - rsp_len);
+    rsp_len += build_cell_id_log (&rsp[rsp_len], sizeof (rsp) - rsp_len, 0x12345679);
+
+    config_rsp_len = dm_encapsulate_buffer (log_config_rsp, sizeof (log_config_rsp), sizeof (log_config_rsp) + 2,
+                                            config_rsp, sizeof (config_rsp));
+    g_assert (config_rsp_len > 0);
+
+    signal (SIGCHLD, SIG_DFL);
+    cpid = fork ();
+    g_assert (cpid >= 0);
+
+    if (cpid == 0) {
+        /* In the child */
+        qcdm_log_test_child (d->slave);
+        exit (0);
+    }
+    /* Parent */
+    d->child = cpid;
+
+    /* Log mask for equipment ID 4 first */
+    req_len = server_wait_request (d->master, req, sizeof (req));
+    g_assert (req_len > 1);
+    g_assert_cmpint (req[0], ==, 0x73);
+    server_send_response (d->master, config_rsp, config_rsp_len);
+
+    req_len = server_wait_request (d->master, req, sizeof (req));
+    g_assert (req_len == 1);
+    g_assert_cmpint (req[0], ==, 0x00);
+
+    i = 0;
+    while (i < rsp_len) {
+        ssize_t written;
+
+        written = write (d->master, &rsp[i], rsp_len - i);
+        g_assert (written > 0);
+        i += written;
+    }
+
+    /* We expect the child to exit normally */
+    g_assert (wait_for_child (d, 3));
+}
+
 static void
 test_pty_create (gpointer user_data)
 {
@@ -448,6 +682,9 @@ typedef void (*TCFunc)(void);
 #define TESTCASE(t, d) g_test_create_case (#t, 0, d, NULL, (TCFunc) t, NULL)
 #define TESTCASE_PTY(t, d) g_test_create_case (#t, sizeof (*d), d, (TCFunc) test_pty_create, (TCFunc) t, (TCFunc) test_pty_cleanup)
 
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
 void
 _mm_log (const char *loc,
          const char *func,
@@ -472,6 +709,8 @@ int main (int argc, char **argv)
     g_test_suite_add (suite, TESTCASE_PTY (test_sierra_cns_rejected, data));
     g_test_suite_add (suite, TESTCASE_PTY (test_random_data_rejected, data));
     g_test_suite_add (suite, TESTCASE_PTY (test_leading_frame_markers, data));
+    g_test_suite_add (suite, TESTCASE_PTY (test_large_frame, data));
+    g_test_suite_add (suite, TESTCASE_PTY (test_log_frames, data));
 
     result = g_test_run ();
 
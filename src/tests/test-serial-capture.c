@@ -0,0 +1,260 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "mm-serial-capture.h"
+#include "mm-log.h"
+
+typedef struct {
+    guint8 type;
+    guint8 flags;
+    guint16 len;
+    guint64 timestamp;
+    const guint8 *data;
+} Record;
+
+/* Splits a dump into its records, checking they fill it exactly */
+static GArray *
+parse_dump (GByteArray *dump)
+{
+    GArray *records;
+    gsize pos = 0;
+
+    records = g_array_new (FALSE, FALSE, sizeof (Record));
+    while (pos < dump->len) {
+        const guint8 *p = &dump->data[pos];
+        Record record;
+        guint i;
+
+        g_assert_cmpuint (dump->len - pos, >=, MM_SERIAL_CAPTURE_RECORD_SIZE);
+        record.type = p[0];
+        record.flags = p[1];
+        record.len = p[2] | (p[3] << 8);
+        record.timestamp = 0;
+        for (i = 0; i < 8; i++)
+            record.timestamp |= ((guint64) p[4 + i]) << (8 * i);
+        record.data = p + MM_SERIAL_CAPTURE_RECORD_SIZE;
+
+        pos += MM_SERIAL_CAPTURE_RECORD_SIZE + record.len;
+        g_assert_cmpuint (pos, <=, dump->len);
+        g_array_append_val (records, record);
+    }
+    return records;
+}
+
+static void
+test_basic (void)
+{
+    MMSerialCapture *capture;
+    GByteArray *dump;
+    GArray *records;
+    Record *r;
+
+    capture = mm_serial_capture_new ("ttyUSB0", 1024);
+    mm_serial_capture_add (capture, MM_SERIAL_CAPTURE_RECORD_TX, (const guint8 *) "AT\r", 3);
+    mm_serial_capture_add (capture, MM_SERIAL_CAPTURE_RECORD_RX, (const guint8 *) "\r\nOK\r\n", 6);
+
+    dump = g_byte_array_new ();
+    mm_serial_capture_dump (capture, dump);
+    records = parse_dump (dump);
+    g_assert_cmpuint (records->len, ==, 3);
+
+    r = &g_array_index (records, Record, 0);
+    g_assert_cmpuint (r->type, ==, MM_SERIAL_CAPTURE_RECORD_PORT);
+    g_assert_cmpuint (r->len, ==, strlen ("ttyUSB0"));
+    g_assert (memcmp (r->data, "ttyUSB0", r->len) == 0);
+
+    r = &g_array_index (records, Record, 1);
+    g_assert_cmpuint (r->type, ==, MM_SERIAL_CAPTURE_RECORD_TX);
+    g_assert_cmpuint (r->flags, ==, 0);
+    g_assert_cmpuint (r->len, ==, 3);
+    g_assert (memcmp (r->data, "AT\r", 3) == 0);
+
+    r = &g_array_index (records, Record, 2);
+    g_assert_cmpuint (r->type, ==, MM_SERIAL_CAPTURE_RECORD_RX);
+    g_assert_cmpuint (r->len, ==, 6);
+    g_assert (memcmp (r->data, "\r\nOK\r\n", 6) == 0);
+    g_assert_cmpuint (r->timestamp, >=, g_array_index (records, Record, 1).timestamp);
+
+    g_array_unref (records);
+    g_byte_array_unref (dump);
+    mm_serial_capture_free (capture);
+}
+
+static void
+test_wrap (void)
+{
+    MMSerialCapture *capture;
+    GByteArray *dump;
+    GArray *records;
+    guint i;
+    guint first;
+
+    /* Records of different sizes, so that they wrap at different offsets */
+    capture = mm_serial_capture_new ("ttyUSB1", 256);
+    for (i = 0; i < 500; i++) {
+        gchar *str;
+
+        str = g_strdup_printf ("%u:%.*s", i, i % 17, "xxxxxxxxxxxxxxxxxxxx");
+        mm_serial_capture_add (capture,
+                               (i % 2) ? MM_SERIAL_CAPTURE_RECORD_RX : MM_SERIAL_CAPTURE_RECORD_TX,
+                               (const guint8 *) str,
+                               strlen (str));
+        g_free (str);
+    }
+
+    dump = g_byte_array_new ();
+    mm_serial_capture_dump (capture, dump);
+    records = parse_dump (dump);
+    g_assert_cmpuint (records->len, >, 2);
+    g_assert_cmpuint (dump->len - MM_SERIAL_CAPTURE_RECORD_SIZE - strlen ("ttyUSB1"), <=, 256);
+
+    /* The newest records are kept, in order */
+    first = 500 - (records->len - 1);
+    for (i = 1; i < records->len; i++) {
+        Record *r = &g_array_index (records, Record, i);
+        guint n = first + i - 1;
+        gchar *str;
+
+        str = g_strdup_printf ("%u:%.*s", n, n % 17, "xxxxxxxxxxxxxxxxxxxx");
+        g_assert_cmpuint (r->type, ==, (n % 2) ? MM_SERIAL_CAPTURE_RECORD_RX : MM_SERIAL_CAPTURE_RECORD_TX);
+        g_assert_cmpuint (r->len, ==, strlen (str));
+        g_assert (memcmp (r->data, str, r->len) == 0);
+        g_free (str);
+    }
+
+    g_array_unref (records);
+    g_byte_array_unref (dump);
+    mm_serial_capture_free (capture);
+}
+
+static void
+test_truncated (void)
+{
+    MMSerialCapture *capture;
+    GByteArray *dump;
+    GArray *records;
+    guint8 data[1000];
+    Record *r;
+    guint i;
+
+    for (i = 0; i < sizeof (data); i++)
+        data[i] = i & 0xFF;
+
+    capture = mm_serial_capture_new ("ttyUSB2", 256);
+    mm_serial_capture_add (capture, MM_SERIAL_CAPTURE_RECORD_RX, (const guint8 *) "OK", 2);
+    mm_serial_capture_add (capture, MM_SERIAL_CAPTURE_RECORD_RX, data, sizeof (data));
+
+    dump = g_byte_array_new ();
+    mm_serial_capture_dump (capture, dump);
+    records = parse_dump (dump);
+    g_assert_cmpuint (records->len, ==, 2);
+
+    /* Only the end of the chunk is kept */
+    r = &g_array_index (records, Record, 1);
+    g_assert_cmpuint (r->flags, ==, MM_SERIAL_CAPTURE_FLAG_TRUNCATED);
+    g_assert_cmpuint (r->len, ==, 256 - MM_SERIAL_CAPTURE_RECORD_SIZE);
+    g_assert (memcmp (r->data, data + sizeof (data) - r->len, r->len) == 0);
+
+    g_array_unref (records);
+    g_byte_array_unref (dump);
+    mm_serial_capture_free (capture);
+}
+
+static void
+test_redacted (void)
+{
+    static const struct {
+        const gchar *command;
+        const gchar *stored;
+    } tests[] = {
+        { "AT+CPIN=\"1234\"\r",              "AT+CPIN=" },
+        { "AT+cpin2=\"12345678\",\"1234\"\r", "AT+cpin2=" },
+        { "AT+CLCK=\"SC\",0,\"1234\"\r",      "AT+CLCK=" },
+        { "AT+CPWD=\"SC\",\"1234\",\"4321\"\r", "AT+CPWD=" },
+        { "AT+CMGS=23\r0011000B91\x1a",      "AT+CMGS=" },
+        { "AT+CMEE=1;+CMGW=\"123\"\rhi\x1a",  "AT+CMEE=1;+CMGW=" },
+        /* Not sensitive */
+        { "AT+CPIN?\r",                      "AT+CPIN?\r" },
+        { "AT+CPIN?;+CSQ=1\r",               "AT+CPIN?;+CSQ=1\r" },
+        { "AT+CPMS=\"SM\"\r",                "AT+CPMS=\"SM\"\r" },
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+        MMSerialCapture *capture;
+        GByteArray *dump;
+        GArray *records;
+        Record *r;
+        gboolean redacted;
+
+        capture = mm_serial_capture_new ("ttyUSB3", 1024);
+        mm_serial_capture_add (capture,
+                               MM_SERIAL_CAPTURE_RECORD_TX,
+                               (const guint8 *) tests[i].command,
+                               strlen (tests[i].command));
+        /* Responses are kept as-is */
+        mm_serial_capture_add (capture,
+                               MM_SERIAL_CAPTURE_RECORD_RX,
+                               (const guint8 *) "+CPIN: SIM PIN",
+                               strlen ("+CPIN: SIM PIN"));
+
+        dump = g_byte_array_new ();
+        mm_serial_capture_dump (capture, dump);
+        records = parse_dump (dump);
+        g_assert_cmpuint (records->len, ==, 3);
+
+        redacted = strcmp (tests[i].command, tests[i].stored) != 0;
+        r = &g_array_index (records, Record, 1);
+        g_assert_cmpuint (r->flags, ==, redacted ? MM_SERIAL_CAPTURE_FLAG_REDACTED : 0);
+        g_assert_cmpuint (r->len, ==, strlen (tests[i].stored));
+        g_assert (memcmp (r->data, tests[i].stored, r->len) == 0);
+
+        r = &g_array_index (records, Record, 2);
+        g_assert_cmpuint (r->flags, ==, 0);
+        g_assert_cmpuint (r->len, ==, strlen ("+CPIN: SIM PIN"));
+
+        g_array_unref (records);
+        g_byte_array_unref (dump);
+        mm_serial_capture_free (capture);
+    }
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/serial-capture/basic", test_basic);
+    g_test_add_func ("/ModemManager/serial-capture/wrap", test_wrap);
+    g_test_add_func ("/ModemManager/serial-capture/truncated", test_truncated);
+    g_test_add_func ("/ModemManager/serial-capture/redacted", test_redacted);
+
+    return g_test_run ();
+}
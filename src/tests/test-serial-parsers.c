@@ -0,0 +1,302 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include "mm-error-helpers.h"
+#include "mm-serial-parsers.h"
+#include "mm-log.h"
+
+typedef struct {
+    const gchar *response;
+    /* Whether the parser should consider the response complete */
+    gboolean found;
+    /* Response left after parsing, if found */
+    const gchar *cleaned;
+    /* Expected error, if any */
+    GQuark (*error_domain) (void);
+    gint error_code;
+} ParserTest;
+
+static const ParserTest parser_tests[] = {
+    /* Incomplete responses */
+    { "\r\n", FALSE, NULL, NULL, 0 },
+    { "\r\nOK", FALSE, NULL, NULL, 0 },
+    { "\r\n+CSQ: 20,99\r\n", FALSE, NULL, NULL, 0 },
+    { "\r\n+CSQ: 20,99\r\n\r\nOK\r", FALSE, NULL, NULL, 0 },
+    { "\r\nOKAY\r\n", FALSE, NULL, NULL, 0 },
+    { "\r\nOK\r\n\r\n+CSQ: 20,99\r\n", FALSE, NULL, NULL, 0 },
+    { "\r\n+CME ERROR: 10", FALSE, NULL, NULL, 0 },
+
+    /* Successful responses */
+    { "\r\nOK\r\n", TRUE, "", NULL, 0 },
+    { "\r\nOK\r\n\r\n", TRUE, "", NULL, 0 },
+    { "\r\n+CSQ: 20,99\r\n\r\nOK\r\n", TRUE, "+CSQ: 20,99", NULL, 0 },
+    { "\r\n+CGMI: FOO\r\n+CGMM: BAR\r\n\r\nOK\r\n", TRUE, "+CGMI: FOO\r\n+CGMM: BAR", NULL, 0 },
+    { "\r\nCONNECT\r\n", TRUE, "CONNECT", NULL, 0 },
+    { "\r\nCONNECT 115200\r\n", TRUE, "CONNECT 115200", NULL, 0 },
+
+    /* Errors */
+    { "\r\nERROR\r\n", TRUE, "ERROR", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN },
+    { "\r\nCOMMAND NOT SUPPORT\r\n", TRUE, "COMMAND NOT SUPPORT", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN },
+    { "\r\n+CME ERROR: 11\r\n", TRUE, "+CME ERROR: 11", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_SIM_PIN },
+    { "\r\n+CME ERROR:11\r\n", TRUE, "+CME ERROR:11", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_SIM_PIN },
+    { "\r\n+CME ERROR: SIM PIN required\r\n", TRUE, "+CME ERROR: SIM PIN required", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_SIM_PIN },
+    { "\r\n+CME ERROR: \r\n", TRUE, "+CME ERROR: ", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN },
+    { "\r\n+CMS ERROR: 311\r\n", TRUE, "+CMS ERROR: 311", mm_message_error_quark, MM_MESSAGE_ERROR_SIM_PIN },
+    { "\r\n+CMS ERROR: SIM PIN required\r\n", TRUE, "+CMS ERROR: SIM PIN required", mm_message_error_quark, MM_MESSAGE_ERROR_SIM_PIN },
+    { "\r\nMODEM ERROR: 3\r\n", TRUE, "MODEM ERROR: 3", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN },
+    { "\r\n+CSQ: 20,99\r\n\r\nERROR\r\n", TRUE, "+CSQ: 20,99\r\n\r\nERROR", mm_mobile_equipment_error_quark, MM_MOBILE_EQUIPMENT_ERROR_UNKNOWN },
+
+    /* Connection failures */
+    { "\r\nNO CARRIER\r\n", TRUE, "NO CARRIER", mm_connection_error_quark, MM_CONNECTION_ERROR_NO_CARRIER },
+    { "\r\nBUSY\r\n", TRUE, "BUSY", mm_connection_error_quark, MM_CONNECTION_ERROR_BUSY },
+    { "\r\nNO ANSWER\r\n", TRUE, "NO ANSWER", mm_connection_error_quark, MM_CONNECTION_ERROR_NO_ANSWER },
+    { "\r\nNO DIALTONE\r\n", TRUE, "NO DIALTONE", mm_connection_error_quark, MM_CONNECTION_ERROR_NO_DIALTONE },
+};
+
+static GByteArray *
+byte_array_new_from_string (const gchar *str)
+{
+    GByteArray *array;
+
+    array = g_byte_array_sized_new (strlen (str));
+    g_byte_array_append (array, (const guint8 *) str, strlen (str));
+    return array;
+}
+
+static void
+assert_response (GByteArray *response,
+                 const gchar *expected)
+{
+    gchar *str;
+
+    str = g_strndup ((const gchar *) response->data, response->len);
+    g_assert_cmpstr (str, ==, expected);
+    g_free (str);
+}
+
+static void
+run_parser_test (gpointer parser,
+                 const ParserTest *test)
+{
+    GByteArray *response;
+    GError *error = NULL;
+    gboolean found;
+
+    response = byte_array_new_from_string (test->response);
+    found = mm_serial_parser_v1_parse (parser, response, NULL, &error);
+
+    g_assert_cmpint (found, ==, test->found);
+    if (found)
+        assert_response (response, test->cleaned);
+    else
+        assert_response (response, test->response);
+
+    if (test->error_domain) {
+        g_assert_error (error, test->error_domain (), test->error_code);
+        g_error_free (error);
+    } else
+        g_assert_no_error (error);
+
+    g_byte_array_unref (response);
+}
+
+static void
+test_parse_final_responses (void)
+{
+    gpointer parser;
+    guint i;
+
+    parser = mm_serial_parser_v1_new ();
+    for (i = 0; i < G_N_ELEMENTS (parser_tests); i++)
+        run_parser_test (parser, &parser_tests[i]);
+    mm_serial_parser_v1_destroy (parser);
+}
+
+static void
+run_chunked_parser_test (gpointer parser,
+                         const gchar *str,
+                         guint chunk_size)
+{
+    GByteArray *response;
+    gsize resume = 0;
+    gsize len;
+    gsize offset = 0;
+
+    /* Feed the response in chunks, resuming the parsing each time, and
+     * compare each result with the one of parsing everything from scratch */
+    len = strlen (str);
+    response = g_byte_array_sized_new (len);
+    while (offset < len) {
+        GByteArray *reference;
+        GError *error = NULL;
+        GError *reference_error = NULL;
+        gboolean found;
+        gboolean reference_found;
+        gsize n = MIN (chunk_size, len - offset);
+
+        g_byte_array_append (response, (const guint8 *) str + offset, n);
+        offset += n;
+
+        reference = g_byte_array_sized_new (response->len);
+        g_byte_array_append (reference, response->data, response->len);
+
+        found = mm_serial_parser_v1_parse (parser, response, &resume, &error);
+        reference_found = mm_serial_parser_v1_parse (parser, reference, NULL, &reference_error);
+
+        g_assert_cmpint (found, ==, reference_found);
+        g_assert_cmpuint (resume, <=, response->len);
+        g_assert_cmpuint (response->len, ==, reference->len);
+        g_assert (memcmp (response->data, reference->data, response->len) == 0);
+        if (reference_error) {
+            g_assert_error (error, reference_error->domain, reference_error->code);
+            g_error_free (reference_error);
+            g_error_free (error);
+        } else
+            g_assert_no_error (error);
+
+        g_byte_array_unref (reference);
+
+        if (found)
+            break;
+    }
+
+    g_byte_array_unref (response);
+}
+
+static void
+test_parse_chunked (void)
+{
+    gpointer parser;
+    guint chunk_size;
+    guint i;
+
+    parser = mm_serial_parser_v1_new ();
+    for (chunk_size = 1; chunk_size <= 8; chunk_size++) {
+        for (i = 0; i < G_N_ELEMENTS (parser_tests); i++)
+            run_chunked_parser_test (parser, parser_tests[i].response, chunk_size);
+    }
+    mm_serial_parser_v1_destroy (parser);
+}
+
+static void
+test_parse_leading_nul (void)
+{
+    static const gchar with_nul[] = "\0\0\r\n+CSQ: 20,99\r\n\r\nOK\r\n";
+    gpointer parser;
+    GByteArray *response;
+    GError *error = NULL;
+
+    parser = mm_serial_parser_v1_new ();
+
+    response = g_byte_array_sized_new (sizeof (with_nul));
+    g_byte_array_append (response, (const guint8 *) with_nul, sizeof (with_nul) - 1);
+    g_assert (mm_serial_parser_v1_parse (parser, response, NULL, &error));
+    g_assert_no_error (error);
+    assert_response (response, "+CSQ: 20,99");
+    g_byte_array_unref (response);
+
+    mm_serial_parser_v1_destroy (parser);
+}
+
+static void
+test_parse_connect_data (void)
+{
+    gpointer parser;
+    GByteArray *response;
+    GError *error = NULL;
+
+    parser = mm_serial_parser_v1_new ();
+
+    /* Data may already follow CONNECT in the same read */
+    response = byte_array_new_from_string ("\r\nCONNECT 115200\r\n\x7e\xff\x7d\x23");
+    g_assert (mm_serial_parser_v1_parse (parser, response, NULL, &error));
+    g_assert_no_error (error);
+    assert_response (response, "CONNECT 115200\r\n\x7e\xff\x7d\x23");
+    g_byte_array_unref (response);
+
+    mm_serial_parser_v1_destroy (parser);
+}
+
+static void
+test_parse_custom_regex (void)
+{
+    gpointer parser;
+    GRegex *successful;
+    GRegex *error_regex;
+    GByteArray *response;
+    GError *error = NULL;
+
+    successful = g_regex_new ("\\r\\n\\+WIND: 4\\r\\n$", G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, NULL);
+    error_regex = g_regex_new ("\\r\\n\\+CUSTOM ERROR: (\\d+)\\r\\n$", G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, NULL);
+
+    parser = mm_serial_parser_v1_new ();
+    mm_serial_parser_v1_set_custom_regex (parser, successful, error_regex);
+    g_regex_unref (successful);
+    g_regex_unref (error_regex);
+
+    /* Custom successful reply */
+    response = byte_array_new_from_string ("\r\n+WIND: 4\r\n");
+    g_assert (mm_serial_parser_v1_parse (parser, response, NULL, &error));
+    g_assert_no_error (error);
+    assert_response (response, "+WIND: 4");
+    g_byte_array_unref (response);
+
+    /* Custom error reply */
+    response = byte_array_new_from_string ("\r\n+CUSTOM ERROR: 10\r\n");
+    g_assert (mm_serial_parser_v1_parse (parser, response, NULL, &error));
+    g_assert_error (error, MM_MOBILE_EQUIPMENT_ERROR, MM_MOBILE_EQUIPMENT_ERROR_SIM_NOT_INSERTED);
+    g_clear_error (&error);
+    g_byte_array_unref (response);
+
+    /* Builtin replies still work */
+    response = byte_array_new_from_string ("\r\nOK\r\n");
+    g_assert (mm_serial_parser_v1_parse (parser, response, NULL, &error));
+    g_assert_no_error (error);
+    g_byte_array_unref (response);
+
+    mm_serial_parser_v1_destroy (parser);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_type_init ();
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/serial-parsers/final-responses", test_parse_final_responses);
+    g_test_add_func ("/ModemManager/serial-parsers/leading-nul", test_parse_leading_nul);
+    g_test_add_func ("/ModemManager/serial-parsers/chunked", test_parse_chunked);
+    g_test_add_func ("/ModemManager/serial-parsers/connect-data", test_parse_connect_data);
+    g_test_add_func ("/ModemManager/serial-parsers/custom-regex", test_parse_custom_regex);
+
+    return g_test_run ();
+}
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "mm-sms-part.h"
+#include "mm-charsets.h"
 #include "mm-utils.h"
 
 /* If defined will print debugging traces */
@@ -352,6 +353,22 @@ test_pdu_insufficient_data (void)
     g_free (hexpdu);
 }
 
+static void
+test_pdu_udhi_overflow (void)
+{
+    GError *error = NULL;
+    MMSmsPart *part;
+
+    /* User data header claiming to be longer than the user data */
+    part = mm_sms_part_new_from_pdu (
+        0,
+        "07914306073011F0440B914306103254F600002101312143654005FF0003420301",
+        &error);
+    g_assert (part == NULL);
+    g_assert (error != NULL);
+    g_error_free (error);
+}
+
 
 static void
 test_pdu_udhi (void)
@@ -429,6 +446,32 @@ test_address_encode_unknown (void)
 
 /********************* PDU CREATOR TESTS *********************/
 
+static void
+common_test_check_submit_pdu (MMSmsPart *part,
+                              const guint8 *expected,
+                              gsize expected_size,
+                              guint expected_msgstart)
+{
+    guint8 *pdu;
+    guint len = 0, msgstart = 0;
+    GError *error = NULL;
+
+    pdu = mm_sms_part_get_submit_pdu (part,
+                                      &len,
+                                      &msgstart,
+                                      &error);
+
+    trace_pdu (pdu, len);
+
+    g_assert_no_error (error);
+    g_assert (pdu != NULL);
+    g_assert_cmpuint (len, ==, expected_size);
+    g_assert_cmpint (memcmp (pdu, expected, len), ==, 0);
+    g_assert_cmpint (msgstart, ==, expected_msgstart);
+
+    g_free (pdu);
+}
+
 static void
 common_test_create_pdu (const gchar *smsc,
                         const gchar *number,
@@ -440,9 +483,6 @@ common_test_create_pdu (const gchar *smsc,
                         guint expected_msgstart)
 {
     MMSmsPart *part;
-    guint8 *pdu;
-    guint len = 0, msgstart = 0;
-    GError *error = NULL;
 
     part = mm_sms_part_new (0);
     if (smsc)
@@ -456,20 +496,8 @@ common_test_create_pdu (const gchar *smsc,
     if (class > 0)
         mm_sms_part_set_class (part, class);
 
-    pdu = mm_sms_part_get_submit_pdu (part,
-                                      &len,
-                                      &msgstart,
-                                      &error);
-
-    trace_pdu (pdu, len);
-
-    g_assert_no_error (error);
-    g_assert (pdu != NULL);
-    g_assert_cmpuint (len, ==, expected_size);
-    g_assert_cmpint (memcmp (pdu, expected, len), ==, 0);
-    g_assert_cmpint (msgstart, ==, expected_msgstart);
-
-    g_free (pdu);
+    common_test_check_submit_pdu (part, expected, expected_size, expected_msgstart);
+    mm_sms_part_free (part);
 }
 
 static void
@@ -621,6 +649,118 @@ test_create_pdu_gsm_no_validity (void)
                             1); /* expected_msgstart */
 }
 
+static void
+common_test_create_concat_pdu (const gchar *text,
+                               guint sequence,
+                               const guint8 *expected,
+                               gsize expected_size)
+{
+    MMSmsPart *part;
+
+    part = mm_sms_part_new (SMS_PART_INVALID_INDEX);
+    mm_sms_part_set_number (part, "+15556661234");
+    mm_sms_part_set_text (part, text);
+    mm_sms_part_set_concat_reference (part, 0x42);
+    mm_sms_part_set_concat_max (part, 2);
+    mm_sms_part_set_concat_sequence (part, sequence);
+
+    common_test_check_submit_pdu (part, expected, expected_size, 1);
+    mm_sms_part_free (part);
+}
+
+static void
+test_create_pdu_gsm_concat (void)
+{
+    static const guint8 expected[] = {
+        0x00, 0x41, 0x00, 0x0B, 0x91, 0x51, 0x55, 0x66, 0x16, 0x32, 0xF4, 0x00,
+        0x00, 0x0C, 0x05, 0x00, 0x03, 0x42, 0x02, 0x01, 0x90, 0x65, 0x36, 0xFB,
+        0x0D
+    };
+
+    /* TP-UDHI set, UDL counts the 7 septets taken by the header, and the
+     * text starts after a fill bit */
+    common_test_create_concat_pdu ("Hello", 1, expected, sizeof (expected));
+}
+
+static void
+test_create_pdu_ucs2_concat (void)
+{
+    static const guint8 expected[] = {
+        0x00, 0x41, 0x00, 0x0B, 0x91, 0x51, 0x55, 0x66, 0x16, 0x32, 0xF4, 0x00,
+        0x08, 0x0A, 0x05, 0x00, 0x03, 0x42, 0x02, 0x02, 0x04, 0x14, 0x04, 0x30
+    };
+
+    common_test_create_concat_pdu ("Да", 2, expected, sizeof (expected));
+}
+
+static void
+common_test_split_text (const gchar *text,
+                        guint expected_chunks,
+                        MMModemCharset charset,
+                        guint expected_first_len)
+{
+    gchar **chunks;
+    GString *joined;
+    guint i;
+
+    chunks = mm_sms_part_util_split_text (text);
+    g_assert_cmpuint (g_strv_length (chunks), ==, expected_chunks);
+    g_assert_cmpuint (mm_charset_get_encoded_len (chunks[0], charset, NULL), ==, expected_first_len);
+
+    /* Nothing lost, every chunk fits in a PDU */
+    joined = g_string_new (NULL);
+    for (i = 0; chunks[i]; i++) {
+        MMSmsPart *part;
+        guint8 *pdu;
+        GError *error = NULL;
+
+        g_string_append (joined, chunks[i]);
+
+        part = mm_sms_part_new (SMS_PART_INVALID_INDEX);
+        mm_sms_part_set_number (part, "+15556661234");
+        mm_sms_part_set_text (part, chunks[i]);
+        if (expected_chunks > 1) {
+            mm_sms_part_set_concat_reference (part, 1);
+            mm_sms_part_set_concat_max (part, expected_chunks);
+            mm_sms_part_set_concat_sequence (part, i + 1);
+        }
+        pdu = mm_sms_part_get_submit_pdu (part, NULL, NULL, &error);
+        g_assert_no_error (error);
+        g_assert (pdu != NULL);
+        g_free (pdu);
+        mm_sms_part_free (part);
+    }
+    g_assert_cmpstr (joined->str, ==, text);
+
+    g_string_free (joined, TRUE);
+    g_strfreev (chunks);
+}
+
+static void
+test_split_text (void)
+{
+    gchar *text;
+
+    /* Fits in a single part */
+    text = g_strnfill (160, 'a');
+    common_test_split_text (text, 1, MM_MODEM_CHARSET_GSM, 160);
+    g_free (text);
+
+    /* 153 septets per part once split */
+    text = g_strnfill (161, 'a');
+    common_test_split_text (text, 2, MM_MODEM_CHARSET_GSM, 153);
+    g_free (text);
+
+    /* Extension characters take 2 septets, and are never split */
+    text = g_strdup_printf ("%s%s", "a", "€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€€");
+    common_test_split_text (text, 2, MM_MODEM_CHARSET_GSM, 153);
+    g_free (text);
+
+    /* UCS2, 67 characters per part once split */
+    common_test_split_text ("Да здравствует король, детка! Да здравствует король, детка! Да здравствует король, детка!",
+                            2, MM_MODEM_CHARSET_UCS2, 134);
+}
+
 int main (int argc, char **argv)
 {
     g_type_init ();
@@ -637,6 +777,7 @@ int main (int argc, char **argv)
     g_test_add_func ("/MM/SMS/PDU-Parser/pdu-dcsf-8bit", test_pdu_dcsf_8bit);
     g_test_add_func ("/MM/SMS/PDU-Parser/pdu-insufficient-data", test_pdu_insufficient_data);
     g_test_add_func ("/MM/SMS/PDU-Parser/pdu-udhi", test_pdu_udhi);
+    g_test_add_func ("/MM/SMS/PDU-Parser/pdu-udhi-overflow", test_pdu_udhi_overflow);
 
     g_test_add_func ("/MM/SMS/Address-Encoder/smsc-intl", test_address_encode_smsc_intl);
     g_test_add_func ("/MM/SMS/Address-Encoder/smsc-unknown", test_address_encode_smsc_unknown);
@@ -649,6 +790,9 @@ int main (int argc, char **argv)
     g_test_add_func ("/MM/SMS/PDU-Creator/GSM-no-smsc", test_create_pdu_gsm_no_smsc);
     g_test_add_func ("/MM/SMS/PDU-Creator/GSM-3", test_create_pdu_gsm_3);
     g_test_add_func ("/MM/SMS/PDU-Creator/GSM-no-validity", test_create_pdu_gsm_no_validity);
+    g_test_add_func ("/MM/SMS/PDU-Creator/GSM-concat", test_create_pdu_gsm_concat);
+    g_test_add_func ("/MM/SMS/PDU-Creator/UCS2-concat", test_create_pdu_ucs2_concat);
+    g_test_add_func ("/MM/SMS/PDU-Creator/split-text", test_split_text);
 
     return g_test_run ();
 }
@@ -0,0 +1,290 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Built together with the send queue, with a short maximum wait
+ * (MAX_WAIT_USEC, 200 ms) so that starvation shows up quickly. The queue
+ * sends its commands through the stub modem below, which records them.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "mm-sms-send-queue.h"
+#include "mm-base-modem-at.h"
+#include "mm-log.h"
+
+/* Replies to the slow command take longer than the maximum wait */
+#define SLOW_REPLY_MS 500
+
+typedef struct {
+    GMainLoop *loop;
+    /* Commands sent, in order */
+    GPtrArray *sent;
+    /* Replied to after SLOW_REPLY_MS; everything else right away */
+    const gchar *slow_command;
+    guint n_replies_pending;
+    guint n_messages_pending;
+} SendQueueTest;
+
+static SendQueueTest *test;
+
+static void
+check_done (void)
+{
+    if (!test->n_replies_pending && !test->n_messages_pending)
+        g_main_loop_quit (test->loop);
+}
+
+/*****************************************************************************/
+/* Stub modem */
+
+GType
+mm_base_modem_get_type (void)
+{
+    /* The queue only needs an object to send commands through */
+    return G_TYPE_OBJECT;
+}
+
+const gchar *
+mm_base_modem_get_device (MMBaseModem *self)
+{
+    return "stub";
+}
+
+static gboolean
+reply_cb (GSimpleAsyncResult *result)
+{
+    g_simple_async_result_complete (result);
+    g_object_unref (result);
+
+    test->n_replies_pending--;
+    check_done ();
+    return FALSE;
+}
+
+void
+mm_base_modem_at_command (MMBaseModem *self,
+                          const gchar *command,
+                          guint timeout,
+                          gboolean allow_cached,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+    GSimpleAsyncResult *result;
+
+    g_ptr_array_add (test->sent, g_strdup (command));
+
+    result = g_simple_async_result_new (G_OBJECT (self),
+                                        callback,
+                                        user_data,
+                                        mm_base_modem_at_command);
+    test->n_replies_pending++;
+    if (test->slow_command && g_str_equal (command, test->slow_command))
+        g_timeout_add (SLOW_REPLY_MS, (GSourceFunc) reply_cb, result);
+    else
+        g_idle_add ((GSourceFunc) reply_cb, result);
+}
+
+const gchar *
+mm_base_modem_at_command_finish (MMBaseModem *self,
+                                 GAsyncResult *res,
+                                 GError **error)
+{
+    if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error))
+        return NULL;
+    return "";
+}
+
+/*****************************************************************************/
+
+static void
+submit_ready (MMSmsSendQueue *queue,
+              GAsyncResult *res)
+{
+    GError *error = NULL;
+
+    g_assert (mm_sms_send_queue_submit_finish (queue, res, &error));
+    g_assert_no_error (error);
+
+    test->n_messages_pending--;
+    check_done ();
+}
+
+static void
+submit (MMSmsSendQueue *queue,
+        MMSmsSendPriority priority,
+        const gchar *first_part,
+        ...)
+{
+    GPtrArray *commands;
+    const gchar *part;
+    va_list args;
+
+    commands = g_ptr_array_new_with_free_func (g_free);
+    va_start (args, first_part);
+    for (part = first_part; part; part = va_arg (args, const gchar *))
+        g_ptr_array_add (commands, g_strdup (part));
+    va_end (args);
+
+    test->n_messages_pending++;
+    mm_sms_send_queue_submit (queue,
+                              priority,
+                              commands,
+                              (GAsyncReadyCallback) submit_ready,
+                              NULL);
+}
+
+static MMSmsSendQueue *
+send_queue_test_setup (SendQueueTest *ctx)
+{
+    MMBaseModem *modem;
+    MMSmsSendQueue *queue;
+
+    memset (ctx, 0, sizeof (*ctx));
+    ctx->loop = g_main_loop_new (NULL, FALSE);
+    ctx->sent = g_ptr_array_new_with_free_func (g_free);
+    test = ctx;
+
+    modem = g_object_new (G_TYPE_OBJECT, NULL);
+    queue = mm_sms_send_queue_new (modem);
+    g_object_unref (modem);
+    return queue;
+}
+
+static void
+send_queue_test_run (MMSmsSendQueue *queue,
+                     const gchar **expected)
+{
+    guint i;
+
+    g_main_loop_run (test->loop);
+
+    for (i = 0; expected[i]; i++) {
+        g_assert_cmpuint (i, <, test->sent->len);
+        g_assert_cmpstr (g_ptr_array_index (test->sent, i), ==, expected[i]);
+    }
+    g_assert_cmpuint (i, ==, test->sent->len);
+
+    g_object_unref (queue);
+    g_ptr_array_unref (test->sent);
+    g_main_loop_unref (test->loop);
+    test = NULL;
+}
+
+static void
+send_queue_priority (void)
+{
+    static const gchar *expected[] = {
+        /* Alone in the queue when submitted */
+        "N0",
+        /* The rest go by class, with the relay link kept open among them */
+        "+CMMS=2",
+        "H1",
+        "N1",
+        "B1/1",
+        "B1/2",
+        /* And released once the queue is empty */
+        "+CMMS=0",
+        NULL
+    };
+    SendQueueTest ctx;
+    MMSmsSendQueue *queue;
+
+    queue = send_queue_test_setup (&ctx);
+    submit (queue, MM_SMS_SEND_PRIORITY_NORMAL, "N0", NULL);
+    submit (queue, MM_SMS_SEND_PRIORITY_BULK, "B1/1", "B1/2", NULL);
+    submit (queue, MM_SMS_SEND_PRIORITY_NORMAL, "N1", NULL);
+    submit (queue, MM_SMS_SEND_PRIORITY_HIGH, "H1", NULL);
+    send_queue_test_run (queue, expected);
+}
+
+static gboolean
+submit_high_cb (MMSmsSendQueue *queue)
+{
+    submit (queue, MM_SMS_SEND_PRIORITY_HIGH, "H1", NULL);
+    return FALSE;
+}
+
+static void
+send_queue_starvation (void)
+{
+    static const gchar *expected[] = {
+        "N0",
+        /* Waited longer than the maximum while N0 was being sent, so it
+         * goes before the high priority message submitted meanwhile */
+        "+CMMS=2",
+        "B1",
+        "H1",
+        "+CMMS=0",
+        NULL
+    };
+    SendQueueTest ctx;
+    MMSmsSendQueue *queue;
+
+    queue = send_queue_test_setup (&ctx);
+    ctx.slow_command = "N0";
+    submit (queue, MM_SMS_SEND_PRIORITY_NORMAL, "N0", NULL);
+    submit (queue, MM_SMS_SEND_PRIORITY_BULK, "B1", NULL);
+    /* Well after the maximum wait, but before N0 is sent */
+    g_timeout_add (SLOW_REPLY_MS - 100, (GSourceFunc) submit_high_cb, queue);
+    send_queue_test_run (queue, expected);
+}
+
+static void
+send_queue_cmms_multipart (void)
+{
+    static const gchar *expected[] = {
+        "+CMMS=2",
+        "B1/1",
+        "B1/2",
+        "B1/3",
+        "+CMMS=0",
+        NULL
+    };
+    SendQueueTest ctx;
+    MMSmsSendQueue *queue;
+
+    queue = send_queue_test_setup (&ctx);
+    submit (queue, MM_SMS_SEND_PRIORITY_BULK, "B1/1", "B1/2", "B1/3", NULL);
+    send_queue_test_run (queue, expected);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_type_init ();
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/SMS-send-queue/priority", send_queue_priority);
+    g_test_add_func ("/ModemManager/SMS-send-queue/starvation", send_queue_starvation);
+    g_test_add_func ("/ModemManager/SMS-send-queue/cmms-multipart", send_queue_cmms_multipart);
+
+    return g_test_run ();
+}
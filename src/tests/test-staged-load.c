@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+#include <glib.h>
+
+#include "mm-staged-load.h"
+#include "mm-log.h"
+
+static void
+test_single (void)
+{
+    MMStagedLoad load = { 0 };
+
+    /* Initialization done: the deferred stage starts */
+    g_assert (mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (load.running);
+
+    /* And finishes */
+    g_assert (!mm_staged_load_deferred_done (&load, TRUE));
+    g_assert (!load.running);
+
+    /* Initialized again later on: runs again */
+    g_assert (mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (!mm_staged_load_deferred_done (&load, TRUE));
+}
+
+static void
+test_reinit_while_running (void)
+{
+    MMStagedLoad load = { 0 };
+
+    g_assert (mm_staged_load_request_deferred (&load, TRUE));
+
+    /* Initialized again, e.g. after unlocking the SIM, while still loading:
+     * no other loading starts */
+    g_assert (!mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (!mm_staged_load_request_deferred (&load, TRUE));
+
+    /* But it runs once more when done, and only once */
+    g_assert (mm_staged_load_deferred_done (&load, TRUE));
+    g_assert (load.running);
+    g_assert (!mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (mm_staged_load_deferred_done (&load, TRUE));
+    g_assert (!mm_staged_load_deferred_done (&load, TRUE));
+    g_assert (!load.running);
+}
+
+static void
+test_failed (void)
+{
+    MMStagedLoad load = { 0 };
+
+    /* Failed modems don't load anything else */
+    g_assert (!mm_staged_load_request_deferred (&load, FALSE));
+    g_assert (!load.running);
+
+    /* Neither once more, if they fail while loading */
+    g_assert (mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (!mm_staged_load_request_deferred (&load, FALSE));
+    g_assert (!mm_staged_load_deferred_done (&load, TRUE));
+
+    g_assert (mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (!mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (!mm_staged_load_deferred_done (&load, FALSE));
+    g_assert (!load.running);
+
+    /* Cancelled or failed loading can be requested again */
+    g_assert (mm_staged_load_request_deferred (&load, TRUE));
+    g_assert (!mm_staged_load_deferred_done (&load, TRUE));
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/staged-load/single", test_single);
+    g_test_add_func ("/ModemManager/staged-load/reinit-while-running", test_reinit_while_running);
+    g_test_add_func ("/ModemManager/staged-load/failed", test_failed);
+
+    return g_test_run ();
+}
@@ -0,0 +1,186 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ *
+ * Copyright (C) 2012 Google, Inc.
+ */
+
+/*
+ * Built together with a wheel of only WHEEL_SLOTS (4) slots, so that timers
+ * wrap around it within a few seconds.
+ */
+
+#include <glib.h>
+
+#include "mm-timer-wheel.h"
+#include "mm-log.h"
+
+/* Timers fire between 'interval' and 'interval + 1' seconds after being
+ * added, and exactly 'interval' seconds after the previous run when re-armed;
+ * allow some scheduling latency on top */
+#define LATENCY_USEC (G_USEC_PER_SEC / 4)
+
+typedef struct {
+    const gchar *name;
+    guint interval;
+    /* Times to run, the timer is re-armed until then */
+    guint runs;
+    guint fired;
+    gint64 armed;
+} TestTimer;
+
+static GMainLoop *loop;
+static guint pending;
+
+static void
+check_elapsed (TestTimer *timer)
+{
+    gint64 elapsed;
+
+    elapsed = g_get_monotonic_time () - timer->armed;
+    if (!timer->fired) {
+        g_assert_cmpint (elapsed, >=, (gint64) timer->interval * G_USEC_PER_SEC);
+        g_assert_cmpint (elapsed, <, (gint64) (timer->interval + 1) * G_USEC_PER_SEC + LATENCY_USEC);
+    } else {
+        g_assert_cmpint (elapsed, >, (gint64) timer->interval * G_USEC_PER_SEC - LATENCY_USEC);
+        g_assert_cmpint (elapsed, <, (gint64) timer->interval * G_USEC_PER_SEC + LATENCY_USEC);
+    }
+}
+
+static gboolean
+timer_cb (TestTimer *timer)
+{
+    check_elapsed (timer);
+
+    timer->armed = g_get_monotonic_time ();
+    timer->fired++;
+    if (timer->fired < timer->runs)
+        return TRUE;
+
+    if (--pending == 0)
+        g_main_loop_quit (loop);
+    return FALSE;
+}
+
+static gboolean
+cancelled_cb (TestTimer *timer)
+{
+    g_assert_not_reached ();
+    return FALSE;
+}
+
+static gboolean
+test_timed_out (gpointer unused)
+{
+    g_assert_not_reached ();
+    return FALSE;
+}
+
+static guint
+timer_add (TestTimer *timer,
+           GSourceFunc callback)
+{
+    timer->armed = g_get_monotonic_time ();
+    return mm_timer_wheel_add_seconds (NULL, timer->interval, callback, timer);
+}
+
+static void
+test_wrap (void)
+{
+    /* Longer than a revolution, must not fire in the first one */
+    TestTimer longer = { "longer", 6, 1 };
+    /* Re-armed across several revolutions */
+    TestTimer rearmed = { "rearmed", 1, 6 };
+    /* Removed before firing, in the same slot as the others */
+    TestTimer cancelled = { "cancelled", 2, 1 };
+    guint cancelled_id;
+    guint timeout_id;
+
+    loop = g_main_loop_new (NULL, FALSE);
+    mm_timer_wheel_set_budget (0);
+
+    timer_add (&longer, (GSourceFunc)timer_cb);
+    timer_add (&rearmed, (GSourceFunc)timer_cb);
+    cancelled_id = timer_add (&cancelled, (GSourceFunc)cancelled_cb);
+    pending = 2;
+
+    mm_timer_wheel_remove (cancelled_id);
+    /* Removing twice is harmless */
+    mm_timer_wheel_remove (cancelled_id);
+
+    timeout_id = g_timeout_add_seconds (30, test_timed_out, NULL);
+    g_main_loop_run (loop);
+    g_source_remove (timeout_id);
+
+    g_assert_cmpuint (longer.fired, ==, 1);
+    g_assert_cmpuint (rearmed.fired, ==, 6);
+
+    g_main_loop_unref (loop);
+}
+
+static gboolean
+quit_cb (gpointer unused)
+{
+    g_main_loop_quit (loop);
+    return FALSE;
+}
+
+static gboolean
+remove_other_cb (guint *other_id)
+{
+    /* Removing a timer expired in the same tick must not run it */
+    mm_timer_wheel_remove (*other_id);
+    g_main_loop_quit (loop);
+    return FALSE;
+}
+
+static void
+test_remove_in_callback (void)
+{
+    guint ids[2];
+
+    loop = g_main_loop_new (NULL, FALSE);
+
+    /* Same interval, same tick; the first one added runs first */
+    ids[0] = mm_timer_wheel_add_seconds (NULL, 1, (GSourceFunc)remove_other_cb, &ids[1]);
+    ids[1] = mm_timer_wheel_add_seconds (NULL, 1, (GSourceFunc)cancelled_cb, NULL);
+
+    g_main_loop_run (loop);
+
+    /* Let a few more ticks pass */
+    g_timeout_add_seconds (2, quit_cb, NULL);
+    g_main_loop_run (loop);
+
+    g_main_loop_unref (loop);
+}
+
+/* Nothing to log */
+guint32 mm_log_level = 0;
+
+void
+_mm_log (const char *loc,
+         const char *func,
+         guint32 level,
+         const char *fmt,
+         ...)
+{
+    /* Dummy log function */
+}
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/ModemManager/timer-wheel/wrap", test_wrap);
+    g_test_add_func ("/ModemManager/timer-wheel/remove-in-callback", test_remove_in_callback);
+
+    return g_test_run ();
+}